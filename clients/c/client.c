@@ -5,6 +5,8 @@
 #include <time.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/un.h>
 #include <jansson.h>
 #include "client.h"
@@ -64,7 +66,7 @@ void client_destroy(Client* client) {
 
 unsigned client_configure(Client* client, int argc, char* argv[]) {
   int opt = 0;
-  while ((opt = getopt(argc, argv, "h:p:u:UCHOsqv")) != -1) {
+  while ((opt = getopt(argc, argv, "h:p:u:b:UCHOsqv")) != -1) {
     switch (opt) {
       case 'h':
         client->options.host = optarg;
@@ -75,6 +77,10 @@ unsigned client_configure(Client* client, int argc, char* argv[]) {
       case 'u':
         client->options.unix = optarg;
         break;
+      case 'b':
+        client->options.batch = atoi(optarg);
+        if (client->options.batch > MELIAN_MAX_MULTI_KEYS) client->options.batch = MELIAN_MAX_MULTI_KEYS;
+        break;
       case MELIAN_ACTION_QUERY_TABLE1_BY_ID:
         client->options.fetches[action_to_index(opt)] = 1;
         break;
@@ -148,6 +154,8 @@ static void create_socket(Client* client) {
       sin.sin_port = htons(client->options.port);
       inet_pton(AF_INET, client->options.host, &sin.sin_addr);
       if (connect(client->fd, (struct sockaddr*)&sin, sizeof(sin)) < 0) terminate("connect", 1);
+      int one = 1;
+      setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
       if (client->options.verbose) printf("Connected on TCP socket to host %s port %u\n", client->options.host, client->options.port);
       break;
     }
@@ -240,6 +248,44 @@ static int cmp_ulong(const void *lv, const void *rv) {
   return *lu - *ru;
 }
 
+static unsigned make_key(struct FetchBinding* binding, unsigned id, uint8_t* key) {
+  switch (binding->key_mode) {
+    case KEY_MODE_NUMERIC_ID:
+      memcpy(key, &id, sizeof(unsigned));
+      return sizeof(unsigned);
+    case KEY_MODE_HOSTNAME:
+      return snprintf((char*)key, MAX_HOST_LEN, "host-%05u", id);
+    default:
+      return 0;
+  }
+}
+
+// Fetch keys in batches with FETCH_MULTI; return the number of non-empty frames.
+static unsigned client_fetch_multi(Client* client, struct FetchBinding* binding, unsigned first, unsigned count) {
+  static uint8_t payload[MELIAN_MAX_MULTI_KEYS * (4 + MAX_HOST_LEN)];
+  unsigned len = 0;
+  for (unsigned id = first; id < first + count; ++id) {
+    unsigned key_len = make_key(binding, id, payload + len + 4);
+    uint32_t l = htonl(key_len);
+    memcpy(payload + len, &l, sizeof(l));
+    len += sizeof(l) + key_len;
+  }
+  client_send_request(client, MELIAN_ACTION_FETCH_MULTI,
+                      binding->table_id, binding->index_id, payload, len);
+  if (client_read_response(client) <= 0) return 0;
+
+  unsigned found = 0;
+  unsigned pos = 0;
+  for (unsigned f = 0; f < count && pos + 4 <= client->rlen; ++f) {
+    uint32_t l = 0;
+    memcpy(&l, client->rbuf + pos, sizeof(l));
+    l = ntohl(l);
+    if (l) ++found;
+    pos += sizeof(l) + l;
+  }
+  return found;
+}
+
 static void client_fetch(Client* client, struct FetchBinding* binding) {
   if (!binding->resolved) {
     fprintf(stderr, "Skipping action %c: unresolved binding for %s.%s\n",
@@ -254,7 +300,28 @@ static void client_fetch(Client* client, struct FetchBinding* binding) {
   double sum2 = 0;
   unsigned long* dbuf = calloc(1, count * sizeof(unsigned long));
   unsigned dpos = 0;
-  for (unsigned id = 1; id <= count; ++id) {
+  unsigned batch = client->options.batch;
+  if (batch > 1) {
+    // Latency is reported per key, spreading each batch evenly over its keys.
+    for (unsigned id = 1; id <= count; id += batch) {
+      unsigned n = count - id + 1 < batch ? count - id + 1 : batch;
+      double t0 = now_sec();
+      unsigned found = client_fetch_multi(client, binding, id, n);
+      double t1 = now_sec();
+      double elapsed_us = (t1 - t0) * US_IN_ONE_SECOND / n;
+      for (unsigned k = 0; k < n; ++k) {
+        if (k >= found) {
+          ++bad;
+          continue;
+        }
+        ++good;
+        dbuf[dpos++] = elapsed_us;
+        sum += elapsed_us;
+        sum2 += elapsed_us * elapsed_us;
+      }
+    }
+  }
+  for (unsigned id = 1; batch <= 1 && id <= count; ++id) {
     unsigned long elapsed_us = 0;
     unsigned bytes = 0;
     switch (binding->key_mode) {
@@ -5,7 +5,7 @@
 
 // TODO: make these limits dynamic? Arena?
 enum {
-  MAX_RESPONSE_LEN = 10240,
+  MAX_RESPONSE_LEN = 1024*1024,
 };
 
 // Options available when running a client.
@@ -14,6 +14,7 @@ struct Options {
   unsigned port;
   const char *unix;
   unsigned fetches[26*2+10]; // lowercase, uppercase, digits
+  unsigned batch;
   unsigned stats;
   unsigned quit;
   unsigned verbose;
@@ -3,12 +3,13 @@
 
 static void show_usage(const char* progname) {
   fprintf(stderr, "A test client for the blazing parrot server\n");
-  fprintf(stderr, "Usage with TCP socket: %s [-UCHq] [-v] [-h host] -p port\n", progname);
-  fprintf(stderr, "Usage with UNIX socket: %s [-UCHq] [-v] -u unix_path\n", progname);
+  fprintf(stderr, "Usage with TCP socket: %s [-UCHq] [-v] [-b batch] [-h host] -p port\n", progname);
+  fprintf(stderr, "Usage with UNIX socket: %s [-UCHq] [-v] [-b batch] -u unix_path\n", progname);
   fprintf(stderr, "Options:\n");
   fprintf(stderr, "  -U    query table1 by id\n");
   fprintf(stderr, "  -C    query table2 by id\n");
   fprintf(stderr, "  -H    query table2 by hostname\n");
+  fprintf(stderr, "  -b N  fetch N keys per request using FETCH_MULTI\n");
   fprintf(stderr, "  -q    send QUIT message at the end\n");
   fprintf(stderr, "  -v    print verbose logging\n");
 }
@@ -15,7 +15,12 @@
 #define MELIAN_DEFAULT_LISTENERS        "unix:///tmp/melian.sock,tcp://127.0.0.1:0"
 #define MELIAN_DEFAULT_TABLE_PERIOD     "60"
 #define MELIAN_DEFAULT_TABLE_STRIP_NULL "false"
+#define MELIAN_DEFAULT_TABLE_DENSE_FACTOR "2"
+#define MELIAN_DEFAULT_TABLE_HUGE_PAGES "false"
+#define MELIAN_DEFAULT_TABLE_RELEASE_STANDBY "false"
 #define MELIAN_DEFAULT_TABLE_TABLES     "table1#0|60|id:int,table2#1|60|id:int;hostname:string"
+#define MELIAN_DEFAULT_SERVER_WORKERS   "1"
+#define MELIAN_DEFAULT_SERVER_LOADERS   "1"
 
 typedef union MelianRequestHeader {
   uint8_t bytes[8];
@@ -49,11 +54,67 @@ enum DataTable {
 // All possible actions for a request.
 enum MelianAction {
   MELIAN_ACTION_FETCH               = 'F',
+  MELIAN_ACTION_FETCH_MULTI         = 'M',
+  MELIAN_ACTION_FETCH_RANGE         = 'R',
+  MELIAN_ACTION_FETCH_PREFIX        = 'P',
+  MELIAN_ACTION_FILTER              = 'W',
   MELIAN_ACTION_DESCRIBE_SCHEMA     = 'D',
   MELIAN_ACTION_GET_STATISTICS      = 's',
   MELIAN_ACTION_QUIT                = 'q',
 };
 
+// A FETCH_MULTI request carries N keys for one table / index, each as a
+// 4-byte BE length followed by the key bytes.  The response is a single
+// 4-byte BE length followed by N frames in request order, each one being a
+// 4-byte BE length plus the value; a missing key yields an empty frame.
+enum {
+  MELIAN_MAX_MULTI_KEYS = 1024,
+};
+
+// A FETCH on a postings (non-unique) index returns every row with that key: the
+// response is a 4-byte BE length, followed by a 4-byte BE count of rows and the
+// frames in row order.  A missing key yields an empty response, as for other
+// indexes.  FETCH_MULTI on a postings index returns the first row of each key.
+
+// A FETCH_RANGE request asks an ordered index for the rows whose keys lie in
+// [from, to], in key order.  Its payload is a 4-byte BE limit followed by the
+// two bounds, each as a 4-byte BE length followed by the key bytes; an empty
+// bound leaves that end open, and a limit of 0 means MELIAN_MAX_RANGE_ROWS.
+// The response is a 4-byte BE length, followed by a 4-byte BE count of frames,
+// the cursor as a 4-byte BE length plus the key bytes, and the frames.  When
+// more rows match, the cursor is the key to send as from in the next request;
+// otherwise it is empty.
+//
+// A FETCH_PREFIX request asks an ordered string index for the rows whose keys
+// start with a prefix, in key order.  Its payload is a 4-byte BE limit, the
+// prefix and a from key, each as a 4-byte BE length followed by the bytes;
+// from is empty for the first page, and the cursor of the previous response
+// for the following ones.  The response has the same format as FETCH_RANGE.
+enum {
+  MELIAN_MAX_RANGE_ROWS = 1024,
+};
+
+// A FILTER request selects rows of a table using its bitmap indexes; the
+// index_id in the header is ignored.  Its payload is a 4-byte BE offset and a
+// 4-byte BE limit, followed by a program in reverse Polish notation: a term
+// MELIAN_FILTER_EQ, a 1-byte index id, and a key as a 4-byte BE length plus
+// the bytes, pushes the rows with that key; MELIAN_FILTER_AND and _OR pop two
+// sets of rows and push their intersection / union.  The program must leave
+// exactly one set.  The response is a 4-byte BE length, followed by a 4-byte
+// BE count of all matching rows, a 4-byte BE count of frames, and the frames
+// of the matching rows in load order, skipping the first offset ones.  Up to
+// limit frames are returned, capped at MELIAN_MAX_RANGE_ROWS; a limit of 0
+// returns just the counts.  An invalid program yields an empty response.
+enum MelianFilterOp {
+  MELIAN_FILTER_EQ                  = '=',
+  MELIAN_FILTER_AND                 = '&',
+  MELIAN_FILTER_OR                  = '|',
+};
+
+enum {
+  MELIAN_MAX_FILTER_TERMS = 32,
+};
+
 // Legacy action aliases (deprecated).
 #define MELIAN_ACTION_QUERY_TABLE1_BY_ID   'U'
 #define MELIAN_ACTION_QUERY_TABLE2_BY_ID   'C'
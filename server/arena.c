@@ -1,9 +1,80 @@
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "util.h"
 #include "log.h"
 #include "arena.h"
 
+enum {
+  ARENA_CHUNK = 2 * 1024 * 1024,  // bytes made usable at a time in a reserved arena
+};
+
+// Largest arena whose values all get an unsigned index, in whole chunks.
+#if SIZE_MAX > 0xFFFFFFFFu
+#define ARENA_RESERVE ((size_t) 0xFFFFFFFFu * ARENA_ALIGN / ARENA_CHUNK * ARENA_CHUNK)
+#else
+#define ARENA_RESERVE ((size_t) 0xFFFFFFFFu / ARENA_CHUNK * ARENA_CHUNK)
+#endif
+
+static size_t arena_round(unsigned long long len) {
+  unsigned long long rounded = (len + ARENA_CHUNK - 1) / ARENA_CHUNK * ARENA_CHUNK;
+  return rounded > ARENA_RESERVE ? ARENA_RESERVE : (size_t) rounded;
+}
+
+// Map len bytes aligned to a chunk, so that each chunk can be a huge page.
+static void* arena_map_aligned(size_t len, int prot, int flags) {
+#if defined(MAP_ANONYMOUS)
+  size_t span = len + ARENA_CHUNK;
+  uint8_t* raw = mmap(0, span, prot, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+  if (raw == MAP_FAILED) return 0;
+  uint8_t* beg = (uint8_t*) (((uintptr_t) raw + ARENA_CHUNK - 1) & ~(uintptr_t) (ARENA_CHUNK - 1));
+  if (beg > raw) munmap(raw, beg - raw);
+  if (raw + span > beg + len) munmap(beg + len, raw + span - (beg + len));
+  return beg;
+#else
+  (void) len;
+  (void) prot;
+  (void) flags;
+  return 0;
+#endif
+}
+
+// Tell the kernel that a range of an arena is worth backing by huge pages;
+// this has to be repeated whenever the range is mapped again.
+static void arena_advise(const Arena* arena, void* beg, size_t len) {
+#if defined(MADV_HUGEPAGE)
+  if (arena->huge && len) madvise(beg, len, MADV_HUGEPAGE);
+#else
+  (void) arena;
+  (void) beg;
+  (void) len;
+#endif
+}
+
+// Reserve the address space of an arena without using any memory for it yet.
+static unsigned arena_map(Arena* arena, unsigned capacity) {
+#if defined(MAP_ANONYMOUS) && defined(MAP_NORESERVE)
+  void* buffer = arena_map_aligned(ARENA_RESERVE, PROT_NONE, MAP_NORESERVE);
+  if (!buffer) return 0;
+  size_t usable = arena_round(capacity ? capacity : 1);
+  if (mprotect(buffer, usable, PROT_READ | PROT_WRITE) != 0) {
+    munmap(buffer, ARENA_RESERVE);
+    return 0;
+  }
+  arena->buffer = buffer;
+  arena->capacity = usable;
+  arena->reserved = ARENA_RESERVE;
+  return 1;
+#else
+  (void) arena;
+  (void) capacity;
+  return 0;
+#endif
+}
+
 Arena* arena_build(unsigned capacity) {
   Arena* arena = 0;
   unsigned bad = 0;
@@ -13,8 +84,10 @@ Arena* arena_build(unsigned capacity) {
       LOG_WARN("Could not allocate Arena object");
       break;
     }
-    arena->capacity = capacity;
+    if (arena_map(arena, capacity)) break;
+    LOG_DEBUG("Could not reserve address space for arena, allocating %u bytes", capacity);
 
+    arena->capacity = capacity;
     arena->buffer = malloc(capacity);
     if (!arena->buffer) {
       LOG_WARN("Could not allocate Arena buffer");
@@ -31,7 +104,11 @@ Arena* arena_build(unsigned capacity) {
 
 void arena_destroy(Arena* arena) {
   if (!arena) return;
-  if (arena->buffer) free(arena->buffer);
+  if (arena->reserved) {
+    munmap(arena->buffer, arena->reserved);
+  } else if (arena->buffer) {
+    free(arena->buffer);
+  }
   free(arena);
 }
 
@@ -39,37 +116,233 @@ void arena_reset(Arena* arena) {
   arena->used = 0;
 }
 
-static void arena_check_and_grow(Arena* arena, unsigned extra) {
-  unsigned total = arena->used + extra;
+// Make a reserved arena usable up to capacity, optionally faulting in its
+// pages now rather than as they are first written.
+static unsigned arena_commit(Arena* arena, size_t capacity, unsigned populate) {
+  uint8_t* beg = arena->buffer + arena->capacity;
+  size_t len = capacity - arena->capacity;
+#if defined(MAP_POPULATE)
+  // A huge arena is populated after the advice, or it would get small pages.
+  if (populate && !arena->huge) {
+    if (mmap(beg, len, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_POPULATE, -1, 0) == MAP_FAILED) return 0;
+    arena->capacity = capacity;
+    return 1;
+  }
+#endif
+  if (mprotect(beg, len, PROT_READ | PROT_WRITE) != 0) return 0;
+  arena->capacity = capacity;
+  if (populate && arena->huge) {
+#if defined(MADV_POPULATE_WRITE)
+    if (madvise(beg, len, MADV_POPULATE_WRITE) == 0) return 1;
+#endif
+    for (size_t pos = 0; pos < len; pos += 4096) ((volatile uint8_t*) beg)[pos] = 0;
+  }
+  return 1;
+}
+
+unsigned arena_presize(Arena* arena, size_t len) {
+  if (len <= arena->capacity) return 1;
+  if (arena->reserved) {
+    size_t capacity = arena_round(len);
+    if (!arena_commit(arena, capacity, 1)) {
+      LOG_WARN("Could not presize arena to %zu bytes", capacity);
+      return 0;
+    }
+    return 1;
+  }
+  if (len > ARENA_RESERVE) return 0;
+  uint8_t* buffer = realloc(arena->buffer, len);
+  if (!buffer) {
+    LOG_WARN("Could not presize arena to %zu bytes", len);
+    return 0;
+  }
+  arena->buffer = buffer;
+  arena->capacity = len;
+  return 1;
+}
+
+void arena_trim(Arena* arena) {
+  if (arena->reserved) {
+    size_t keep = arena_round(arena->used ? arena->used : 1);
+    if (keep >= arena->capacity) return;
+    // The pages go back to the system, and the range is reserved again.
+    if (mmap(arena->buffer + keep, arena->capacity - keep, PROT_NONE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED) {
+      LOG_WARN("Could not trim arena from %zu to %zu bytes", arena->capacity, keep);
+      return;
+    }
+    arena_advise(arena, arena->buffer + keep, arena->capacity - keep);
+    arena->capacity = keep;
+    return;
+  }
+  if (!arena->used || arena->used >= arena->capacity) return;
+  uint8_t* buffer = realloc(arena->buffer, arena->used);
+  if (!buffer) return;
+  arena->buffer = buffer;
+  arena->capacity = arena->used;
+}
+
+unsigned arena_use_huge_pages(Arena* arena) {
+#if defined(MADV_HUGEPAGE)
+  if (!arena->reserved) return 0;
+  arena->huge = 1;
+  arena_advise(arena, arena->buffer, arena->reserved);
+  return 1;
+#else
+  (void) arena;
+  return 0;
+#endif
+}
+
+void* arena_table_alloc(const Arena* arena, size_t len, size_t* mapped) {
+  *mapped = 0;
+  if (arena->huge && len >= ARENA_CHUNK) {
+    size_t span = (len + ARENA_CHUNK - 1) / ARENA_CHUNK * ARENA_CHUNK;
+    void* table = arena_map_aligned(span, PROT_READ | PROT_WRITE, 0);
+    if (table) {
+      arena_advise(arena, table, span);
+      *mapped = span;
+      return table;
+    }
+  }
+  return calloc(1, len);
+}
+
+void arena_table_free(void* table, size_t mapped) {
+  if (!table) return;
+  if (mapped) {
+    munmap(table, mapped);
+  } else {
+    free(table);
+  }
+}
+
+unsigned long long arena_huge_bytes(const void* beg, size_t len) {
+  FILE* smaps = fopen("/proc/self/smaps", "r");
+  if (!smaps) return 0;
+  uintptr_t lo = (uintptr_t) beg;
+  uintptr_t hi = lo + len;
+  unsigned inside = 0;
+  unsigned long long total = 0;
+  char line[512];
+  while (fgets(line, sizeof(line), smaps)) {
+    unsigned long long from = 0;
+    unsigned long long to = 0;
+    unsigned long long kb = 0;
+    // Mappings start with their address range, followed by their counters;
+    // only those starting in the range are counted, as a table that was not
+    // mapped on its own lives in the middle of the heap.
+    if (sscanf(line, "%llx-%llx ", &from, &to) == 2) {
+      inside = from >= lo && from < hi;
+    } else if (inside && sscanf(line, "AnonHugePages: %llu kB", &kb) == 1) {
+      total += kb * 1024;
+    }
+  }
+  fclose(smaps);
+  return total;
+}
+
+void arena_release(Arena* arena) {
+  arena->used = 0;
+  if (arena->reserved) {
+    if (!arena->capacity) return;
+    if (mmap(arena->buffer, arena->capacity, PROT_NONE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED) {
+      LOG_WARN("Could not release arena of %zu bytes", arena->capacity);
+      return;
+    }
+    arena_advise(arena, arena->buffer, arena->capacity);
+    arena->capacity = 0;
+    return;
+  }
+  uint8_t* buffer = realloc(arena->buffer, 1);
+  if (!buffer) return;
+  arena->buffer = buffer;
+  arena->capacity = 1;
+}
+
+unsigned long long arena_resident_bytes(const void* beg, size_t len) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  uintptr_t at = (uintptr_t) beg & ~(uintptr_t) (page - 1);
+  uintptr_t end = (uintptr_t) beg + len;
+  unsigned char resident[4096];
+  unsigned long long total = 0;
+  while (at < end) {
+    size_t span = end - at;
+    if (span > sizeof(resident) * page) span = sizeof(resident) * page;
+    if (mincore((void*) at, span, resident) != 0) break;
+    size_t pages = (span + page - 1) / page;
+    for (size_t p = 0; p < pages; ++p) {
+      if (resident[p] & 1) total += page;
+    }
+    at += pages * page;
+  }
+  return total;
+}
+
+static void arena_check_and_grow(Arena* arena, size_t extra) {
+  unsigned long long total = (unsigned long long) arena->used + extra;
   if (total <= arena->capacity) return;
 
-  unsigned capacity = next_power_of_two(total, arena->capacity);
+  if (arena->reserved) {
+    // Make the next chunks usable; memory only gets used as it is written.
+    size_t capacity = arena_round(total);
+    if (capacity < total || !arena_commit(arena, capacity, 0)) {
+      LOG_WARN("Could not grow arena to %llu bytes", total);
+    }
+    return;
+  }
+
+  if (total > ARENA_RESERVE) {
+    LOG_WARN("Could not grow arena to %llu bytes", total);
+    return;
+  }
+  size_t capacity = arena->capacity ? arena->capacity : 1;
+  while (capacity < total) capacity *= 2;
+  if (capacity > ARENA_RESERVE) capacity = ARENA_RESERVE;
   uint8_t *buffer = realloc(arena->buffer, capacity);
-  LOG_DEBUG("Arena need %u grow %p %u => %p %u", total, (void*)arena->buffer, arena->capacity, (void*)buffer, capacity);
+  LOG_DEBUG("Arena need %llu grow %p %zu => %p %zu", total, (void*)arena->buffer, arena->capacity, (void*)buffer, capacity);
+  if (!buffer) {
+    LOG_WARN("Could not grow arena to %zu bytes", capacity);
+    return;
+  }
   arena->buffer = buffer;
   arena->capacity = capacity;
 }
 
-unsigned arena_store(Arena* arena, const uint8_t *src, unsigned len) {
-  arena_check_and_grow(arena, len);
-  unsigned index = arena->used;
-  uint8_t *ptr = arena->buffer + index;
-  memcpy(ptr, src, len);
+unsigned arena_begin(Arena* arena, size_t len) {
+  size_t start = (arena->used + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+  if (!arena_reserve(arena, start - arena->used + len)) return -1;
+  // The padding is left as it is; nothing reads it.
+  arena->used = start;
+  return (unsigned) (start / ARENA_ALIGN);
+}
+
+unsigned arena_store(Arena* arena, const uint8_t *src, size_t len) {
+  unsigned index = arena_begin(arena, len);
+  if (index == (unsigned)-1) return -1;
+  memcpy(arena->buffer + arena->used, src, len);
   arena->used += len;
   return index;
 }
 
 unsigned arena_store_framed(Arena* arena, const uint8_t *src, unsigned len) {
   // Store preframed value in arena
-  uint8_t hdr[sizeof(unsigned)] = {
-    (uint8_t)((len >> 24) & 0xFF),
-    (uint8_t)((len >> 16) & 0xFF),
-    (uint8_t)((len >> 8)  & 0xFF),
-    (uint8_t)( len        & 0xFF)
-  };
-  unsigned vstore = arena_store(arena, hdr, sizeof(unsigned));
-  if (vstore == (unsigned)-1) return -1;
-  unsigned  fstore = arena_store(arena, src, len);
-  if (fstore == (unsigned)-1) return -1;
-  return vstore;
+  unsigned index = arena_begin(arena, sizeof(unsigned) + len);
+  if (index == (unsigned)-1) return -1;
+  uint8_t *hdr = arena->buffer + arena->used;
+  hdr[0] = (uint8_t)((len >> 24) & 0xFF);
+  hdr[1] = (uint8_t)((len >> 16) & 0xFF);
+  hdr[2] = (uint8_t)((len >> 8)  & 0xFF);
+  hdr[3] = (uint8_t)( len        & 0xFF);
+  memcpy(hdr + sizeof(unsigned), src, len);
+  arena->used += sizeof(unsigned) + len;
+  return index;
+}
+
+uint8_t* arena_reserve(Arena* arena, size_t len) {
+  arena_check_and_grow(arena, len);
+  if (arena->capacity - arena->used < len) return 0;
+  return arena->buffer + arena->used;
 }
@@ -4,25 +4,74 @@
 // Allocating means incrementing the used bytes.
 // There is no piece-wise deallocation.
 // The arena can be reset in a single intruction by setting used to zero.
-// When allocating, we grow the arena to twice its current size until the needed bytes fit.
+// The arena reserves address space for the largest size indexes can reach, and
+// makes it usable a chunk at a time, so growing never moves or copies it; where
+// that is not possible, it is a malloc'ed buffer that doubles on growth.
+// The reserved space is aligned to 2 MB, so it can be backed by huge pages.
 // When allocating, return indexes rather than pointers, so that the values don't change on growth.
+// Values start at a multiple of ARENA_ALIGN bytes, and indexes count in those
+// units, so that an unsigned index reaches 32 GB.
 
+#include <stddef.h>
 #include <stdint.h>
 
-#define arena_get_ptr(arena, index) ((index) == (unsigned)-1 ? 0 : (arena)->buffer + (index))
+enum {
+  ARENA_ALIGN = 8,    // bytes per unit of an index
+};
+
+#define arena_get_ptr(arena, index) ((index) == (unsigned)-1 ? 0 : (arena)->buffer + (size_t)(index) * ARENA_ALIGN)
 
 typedef struct Arena {
   uint8_t *buffer;    // contiguous storage
-  unsigned capacity;  // total capacity
-  unsigned used;      // currently used
+  size_t capacity;    // total capacity
+  size_t used;        // currently used
+  size_t reserved;    // address space reserved for buffer, or 0 if it is malloc'ed
+  unsigned huge;      // whether buffer and the tables allocated for it prefer huge pages
 } Arena;
 
 Arena* arena_build(unsigned capacity);
 void arena_destroy(Arena* arena);
 void arena_reset(Arena* arena);
+// Make room for len bytes in all, with their pages already in memory, before
+// they are written; return 0 if the arena could not grow.
+unsigned arena_presize(Arena* arena, size_t len);
+// Give back the memory past what is used, once the arena is fully loaded.
+void arena_trim(Arena* arena);
+// Empty the arena and give back all of its memory, keeping its address space.
+void arena_release(Arena* arena);
+// Ask for the arena, and the tables allocated for it from now on, to be backed
+// by huge pages; return 0 if the arena cannot be.
+unsigned arena_use_huge_pages(Arena* arena);
+
+// Allocate zeroed memory for a table indexing the arena, with huge pages if the
+// arena uses them; mapped is set to the bytes mapped for it, or 0 if it was
+// calloc'ed, and must be passed to arena_table_free.
+void* arena_table_alloc(const Arena* arena, size_t len, size_t* mapped);
+void arena_table_free(void* table, size_t mapped);
+
+// Number of bytes in [beg, beg+len) currently backed by huge pages.
+unsigned long long arena_huge_bytes(const void* beg, size_t len);
+// Number of bytes in the pages of [beg, beg+len) currently in memory.
+unsigned long long arena_resident_bytes(const void* beg, size_t len);
 
 // Store pointer into arena, return index
-unsigned arena_store(Arena* arena, const uint8_t *src, unsigned len);
+unsigned arena_store(Arena* arena, const uint8_t *src, size_t len);
 
 // Store length + value into arena, return index.
 unsigned arena_store_framed(Arena* arena, const uint8_t *src, unsigned len);
+
+// Start the next value, making room for len bytes; return its index, or
+// (unsigned)-1 if the arena could not grow.  The value is written from
+// arena_get_ptr, and the caller then adds what it wrote to used.
+unsigned arena_begin(Arena* arena, size_t len);
+
+// Make room for at least len more bytes and return a pointer to them, or 0 if
+// the arena could not grow; the caller then adds what it wrote to used.
+// The pointer is only valid until the arena grows again, unless it is reserved.
+uint8_t* arena_reserve(Arena* arena, size_t len);
+
+// Get the total length (4 + value_len) of a value stored with arena_store_framed.
+static inline unsigned arena_get_frame_len(const Arena* arena, unsigned index) {
+  const uint8_t *hdr = arena->buffer + (size_t)index * ARENA_ALIGN;
+  return sizeof(unsigned) + ((unsigned)hdr[0] << 24 | (unsigned)hdr[1] << 16 | (unsigned)hdr[2] << 8 | hdr[3]);
+}
@@ -0,0 +1,138 @@
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "arena.h"
+#include "roaring.h"
+#include "bitmap.h"
+
+enum {
+  BITMAP_INITIAL_KEYS = 16,     // initial capacity of the key table, grown as needed
+};
+
+Bitmap* bitmap_build(unsigned rows, struct Arena* arena) {
+  Bitmap* bitmap = 0;
+  unsigned bad = 0;
+  do {
+    if (!arena) {
+      LOG_WARN("Cannot create a Bitmap object without a valid Arena");
+      break;
+    }
+
+    bitmap = calloc(1, sizeof(Bitmap));
+    if (!bitmap) {
+      LOG_WARN("Could not allocate a Bitmap object");
+      break;
+    }
+
+    bitmap->keys = hash_build(BITMAP_INITIAL_KEYS, arena);
+    bitmap->staged_cap = rows ? rows : 1;
+    bitmap->staged = malloc(bitmap->staged_cap * sizeof(BitmapEntry));
+    if (!bitmap->keys || !bitmap->staged) {
+      LOG_WARN("Could not allocate Bitmap staging area for %u rows", bitmap->staged_cap);
+      ++bad;
+      break;
+    }
+    bitmap->arena = arena;
+  } while (0);
+  if (bad) {
+    bitmap_destroy(bitmap);
+    bitmap = 0;
+  }
+  return bitmap;
+}
+
+void bitmap_destroy(Bitmap* bitmap) {
+  if (!bitmap) return;
+  if (bitmap->keys) hash_destroy(bitmap->keys);
+  if (bitmap->maps) {
+    for (unsigned j = 0; j < bitmap->count; ++j) {
+      roaring_destroy(bitmap->maps[j]);
+    }
+    free(bitmap->maps);
+  }
+  if (bitmap->staged) free(bitmap->staged);
+  free(bitmap);
+}
+
+unsigned bitmap_insert(Bitmap* bitmap, const void *key, uint32_t key_len, unsigned frame) {
+  if (bitmap->staged_used >= bitmap->staged_cap) {
+    unsigned cap = bitmap->staged_cap * 2;
+    BitmapEntry* staged = realloc(bitmap->staged, cap * sizeof(BitmapEntry));
+    if (!staged) {
+      LOG_WARN("Could not grow Bitmap staging area to %u rows", cap);
+      return 0;
+    }
+    bitmap->staged = staged;
+    bitmap->staged_cap = cap;
+  }
+
+  Hash* keys = bitmap->keys;
+  const Bucket* bucket = hash_get(keys, key, key_len);
+  unsigned map = 0;
+  if (bucket) {
+    map = bucket->frame_idx;
+  } else {
+    if (bitmap->count >= bitmap->cap) {
+      unsigned cap = bitmap->cap ? 2 * bitmap->cap : BITMAP_INITIAL_KEYS;
+      struct Roaring** maps = realloc(bitmap->maps, cap * sizeof(struct Roaring*));
+      if (!maps) {
+        LOG_WARN("Could not grow Bitmap to %u keys", cap);
+        return 0;
+      }
+      bitmap->maps = maps;
+      bitmap->cap = cap;
+    }
+    if (2 * (keys->used + 1) > keys->cap && !hash_resize(keys, keys->cap * 2)) return 0;
+    map = bitmap->count;
+    bitmap->maps[map] = roaring_build();
+    if (!bitmap->maps[map]) return 0;
+    ++bitmap->count;
+    if (!hash_insert(keys, key, key_len, map)) return 0;
+  }
+
+  BitmapEntry* entry = &bitmap->staged[bitmap->staged_used++];
+  entry->map = map;
+  entry->frame_idx = frame;
+  return 1;
+}
+
+unsigned bitmap_finalize(Bitmap* bitmap, const unsigned* rows, unsigned row_count) {
+  // Frames are stored in row order, so rows is sorted and each frame can be
+  // found with a binary search; and since staged rows are also in load order,
+  // row numbers are added to each bitmap in increasing order.
+  unsigned bad = 0;
+  for (unsigned j = 0; j < bitmap->staged_used; ++j) {
+    const BitmapEntry* entry = &bitmap->staged[j];
+    unsigned lo = 0;
+    unsigned hi = row_count;
+    while (lo < hi) {
+      unsigned mid = (lo + hi) / 2;
+      if (rows[mid] < entry->frame_idx) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    if (lo >= row_count || rows[lo] != entry->frame_idx) {
+      ++bad;
+      continue;
+    }
+    if (!roaring_add(bitmap->maps[entry->map], lo)) return 0;
+  }
+  if (bad) {
+    LOG_WARN("Could not find %u frames among the %u rows of the slot", bad, row_count);
+  }
+
+  // Lookups done while staging should not count as queries.
+  memset(&bitmap->keys->stats, 0, sizeof(bitmap->keys->stats));
+  free(bitmap->staged);
+  bitmap->staged = 0;
+  bitmap->staged_used = bitmap->staged_cap = 0;
+  return 1;
+}
+
+const struct Roaring* bitmap_get(Bitmap* bitmap, const void *key, uint32_t key_len) {
+  const Bucket* bucket = hash_get(bitmap->keys, key, key_len);
+  if (!bucket) return 0;
+  return bitmap->maps[bucket->frame_idx];
+}
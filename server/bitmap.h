@@ -0,0 +1,43 @@
+#pragma once
+
+// A Bitmap keeps an index for low-cardinality columns: each distinct key maps to
+// a compressed bitmap (see roaring.h) of the numbers of the rows with that key,
+// where rows are numbered in load order across the whole table slot.  Since all
+// bitmap indexes of a table share that numbering, they can be combined with AND
+// and OR to filter rows on several columns at once.
+//
+// Row numbers are only known once the whole slot is loaded, so rows are staged by
+// bitmap_insert and the bitmaps are only built by bitmap_finalize.
+
+#include <stdint.h>
+#include "hash.h"
+
+struct Roaring;
+
+typedef struct BitmapEntry {
+  unsigned map;           // number of the bitmap for the key of this row
+  unsigned frame_idx;     // index into arena memory for preframed value
+} BitmapEntry;
+
+typedef struct Bitmap {
+  struct Hash* keys;      // distinct keys, mapped to their bitmap number
+  unsigned count;         // number of distinct keys
+  unsigned cap;           // allocated bitmaps
+  struct Roaring** maps;  // rows for each key
+  BitmapEntry *staged;    // rows inserted but not yet finalized
+  unsigned staged_used;
+  unsigned staged_cap;
+  struct Arena* arena;    // pointer to common arena
+} Bitmap;
+
+// Build an empty index, with room to stage the given number of rows.
+Bitmap* bitmap_build(unsigned rows, struct Arena* arena);
+void bitmap_destroy(Bitmap* bitmap);
+unsigned bitmap_insert(Bitmap* bitmap, const void *key, uint32_t key_len, unsigned frame);
+
+// Build the bitmaps; rows holds the arena index of the preframed value of
+// every row in the slot, in load order, so it gives each frame its row number.
+unsigned bitmap_finalize(Bitmap* bitmap, const unsigned* rows, unsigned row_count);
+
+// Return the bitmap of rows for a key, or NULL if no row has that key.
+const struct Roaring* bitmap_get(Bitmap* bitmap, const void *key, uint32_t key_len);
@@ -21,8 +21,12 @@ static ConfigSocket* parse_socket_from_uri(const char* uri);
 static char* trim(char* s);
 static unsigned parse_table_specs(Config* config, const char* raw);
 static ConfigIndexType parse_index_type(const char* value);
+static ConfigIndexEngine parse_index_engine(const char* value);
 static ConfigDbDriver parse_db_driver(const char* value);
-static void apply_select_overrides(Config* config);
+static void apply_statement_overrides(Config* config, const char* var, unsigned probe);
+static void apply_partition_overrides(Config* config);
+static void apply_watermark_overrides(Config* config);
+static void apply_reuse_overrides(Config* config);
 static ConfigTableSpec* find_table_spec(Config* config, const char* name);
 static unsigned load_config_file(Config* config);
 static char* read_entire_file(const char* path, size_t* len);
@@ -50,6 +54,8 @@ struct ConfigFileOverrides {
   ConfigArray* listeners;
   char* sqlite_filename;
   char* table_tables;
+  char* server_workers;
+  char* server_loaders;
 };
 struct ConfigCliOverrides {
   char* listeners;
@@ -123,8 +129,14 @@ Config* config_build(void) {
     }
     config->listeners.sockets = make_sockets_from_config_array(listeners);
 
+    config->server.workers = get_config_number("MELIAN_SERVER_WORKERS", MELIAN_DEFAULT_SERVER_WORKERS);
+    config->server.loaders = get_config_number("MELIAN_SERVER_LOADERS", MELIAN_DEFAULT_SERVER_LOADERS);
+
     config->table.period = get_config_number("MELIAN_TABLE_PERIOD", MELIAN_DEFAULT_TABLE_PERIOD);
     config->table.strip_null = get_config_bool("MELIAN_TABLE_STRIP_NULL", MELIAN_DEFAULT_TABLE_STRIP_NULL);
+    config->table.dense_factor = get_config_number("MELIAN_TABLE_DENSE_FACTOR", MELIAN_DEFAULT_TABLE_DENSE_FACTOR);
+    config->table.huge_pages = get_config_bool("MELIAN_TABLE_HUGE_PAGES", MELIAN_DEFAULT_TABLE_HUGE_PAGES);
+    config->table.release_standby = get_config_bool("MELIAN_TABLE_RELEASE_STANDBY", MELIAN_DEFAULT_TABLE_RELEASE_STANDBY);
     const char* table_raw = get_config_string("MELIAN_TABLE_TABLES", MELIAN_DEFAULT_TABLE_TABLES);
     config->table.schema = strdup(table_raw);
     if (!config->table.schema) {
@@ -132,7 +144,11 @@ Config* config_build(void) {
       break;
     }
     parse_table_specs(config, config->table.schema);
-    apply_select_overrides(config);
+    apply_statement_overrides(config, "MELIAN_TABLE_SELECTS", 0);
+    apply_statement_overrides(config, "MELIAN_TABLE_PROBES", 1);
+    apply_partition_overrides(config);
+    apply_watermark_overrides(config);
+    apply_reuse_overrides(config);
   } while (0);
 
   return config;
@@ -147,10 +163,19 @@ void config_show_usage(void) {
 	printf("  MELIAN_DB_USER         : database user name (default: %s)\n", MELIAN_DEFAULT_DB_USER);
 	printf("  MELIAN_DB_PASSWORD     : database user password (default: %s)\n", MELIAN_DEFAULT_DB_PASSWORD);
     printf("  MELIAN_LISTENERS       : the listeners that melian will listen on, tcp, unix socket, or both (default: %s)\n", MELIAN_DEFAULT_LISTENERS);
+	printf("  MELIAN_SERVER_WORKERS  : number of threads serving requests, 0 for one per CPU (default: %s)\n", MELIAN_DEFAULT_SERVER_WORKERS);
+	printf("  MELIAN_SERVER_LOADERS  : number of threads loading tables, each with its own DB connection (default: %s)\n", MELIAN_DEFAULT_SERVER_LOADERS);
 	printf("  MELIAN_SQLITE_FILENAME : SQLite database filename (default: %s)\n", MELIAN_DEFAULT_SQLITE_FILENAME);
+	printf("  MELIAN_TABLE_DENSE_FACTOR: use an array for int indexes whose key range is at most this many times the rows, 0 to disable (default: %s)\n", MELIAN_DEFAULT_TABLE_DENSE_FACTOR);
+	printf("  MELIAN_TABLE_HUGE_PAGES: whether to back table arenas and hash tables with 2 MB transparent huge pages (default: %s)\n", MELIAN_DEFAULT_TABLE_HUGE_PAGES);
+	printf("  MELIAN_TABLE_PARTITIONS: semicolon-separated list of table=count[:range|:modulo], to load tables over several connections\n");
 	printf("  MELIAN_TABLE_PERIOD    : how often (seconds) to refresh the data by default (default: %s)\n", MELIAN_DEFAULT_TABLE_PERIOD);
+	printf("  MELIAN_TABLE_PROBES    : semicolon-separated list of table=SELECT ... change checks, run before each reload, which is skipped if their result did not change\n");
+	printf("  MELIAN_TABLE_RELEASE_STANDBY: whether to free the copy of each table not being served while it is not reloading (default: %s)\n", MELIAN_DEFAULT_TABLE_RELEASE_STANDBY);
+	printf("  MELIAN_TABLE_REUSE_ROWS: semicolon-separated list of tables whose rows are fingerprinted, so that a reload copies the rows that did not change\n");
 	printf("  MELIAN_TABLE_SELECTS   : semicolon-separated list of table=SELECT ... overrides\n");
 	printf("  MELIAN_TABLE_STRIP_NULL: whether to strip null values in returned payloads (default: %s)\n", MELIAN_DEFAULT_TABLE_STRIP_NULL);
+	printf("  MELIAN_TABLE_WATERMARKS: semicolon-separated list of table=column[:count], to reload only rows whose column grew, with a full reload every count loads (default: %u)\n", MELIAN_DEFAULT_FULL_EVERY);
 	printf("  MELIAN_TABLE_TABLES    : schema spec (default: %s); format per entry:\n", MELIAN_DEFAULT_TABLE_TABLES);
 	printf("      name[#id][|period][|column#idx[:type];column#idx[:type]...]\n");
 	printf("    Example: users#1|60|id:int;email:string,hosts#2|30|id:int;hostname:string\n");
@@ -238,7 +263,8 @@ static ConfigSocket* parse_socket_from_uri(const char* uri) {
 }
 
 static ConfigSocket** make_sockets_from_config_array(ConfigArray* array) {
-  ConfigSocket** sockets = calloc(array->length, sizeof(ConfigSocket*));
+  // NULL-terminated
+  ConfigSocket** sockets = calloc(array->length + 1, sizeof(ConfigSocket*));
   size_t n = 0;
   for (size_t i = 0; i < array->length; i++) {
     ConfigSocket* socket = parse_socket_from_uri(array->elems[i]);
@@ -321,6 +347,10 @@ static unsigned parse_table_specs(Config* config, const char* raw) {
     ConfigTableSpec* spec = &config->table.tables[config->table.table_count];
     memset(spec, 0, sizeof(*spec));
     spec->period = config->table.period;
+    spec->dense_factor = config->table.dense_factor;
+    spec->huge_pages = config->table.huge_pages;
+    spec->release_standby = config->table.release_standby;
+    spec->partitions = 1;
     unsigned char used_index_ids[256] = {0};
 
     char* section_ctx = 0;
@@ -401,6 +431,13 @@ static unsigned parse_table_specs(Config* config, const char* raw) {
             used_index_ids[column_id] = 0;
             continue;
           }
+          char* engine_sep = type_sep ? strchr(type_sep + 1, ':') : 0;
+          if (engine_sep) {
+            *engine_sep = '\0';
+            ispec->engine = parse_index_engine(engine_sep + 1);
+          } else {
+            ispec->engine = CONFIG_INDEX_ENGINE_HASH;
+          }
           if (type_val) {
             ispec->type = parse_index_type(type_val);
           } else {
@@ -451,6 +488,24 @@ static ConfigIndexType parse_index_type(const char* value) {
   return CONFIG_INDEX_TYPE_INT;
 }
 
+static ConfigIndexEngine parse_index_engine(const char* value) {
+  if (!value) return CONFIG_INDEX_ENGINE_HASH;
+  char lower[16];
+  snprintf(lower, sizeof(lower), "%s", value);
+  for (char* p = lower; *p; ++p) {
+    if (*p >= 'A' && *p <= 'Z') *p = *p - 'A' + 'a';
+  }
+  if (strcmp(lower, "swiss") == 0) return CONFIG_INDEX_ENGINE_SWISS;
+  if (strcmp(lower, "mph") == 0) return CONFIG_INDEX_ENGINE_MPH;
+  if (strcmp(lower, "ordered") == 0) return CONFIG_INDEX_ENGINE_ORDERED;
+  if (strcmp(lower, "postings") == 0) return CONFIG_INDEX_ENGINE_POSTINGS;
+  if (strcmp(lower, "bitmap") == 0) return CONFIG_INDEX_ENGINE_BITMAP;
+  if (strcmp(lower, "hash") != 0) {
+    LOG_WARN("Unknown index engine %s, defaulting to hash", lower);
+  }
+  return CONFIG_INDEX_ENGINE_HASH;
+}
+
 static ConfigDbDriver parse_db_driver(const char* value) {
   char tmp[64];
   if (value && value[0]) {
@@ -485,12 +540,13 @@ static ConfigTableSpec* find_table_spec(Config* config, const char* name) {
   return NULL;
 }
 
-static void apply_select_overrides(Config* config) {
-  const char* raw = getenv("MELIAN_TABLE_SELECTS");
+// Set the SELECT, or the change probe, of tables from a list of table=statement.
+static void apply_statement_overrides(Config* config, const char* var, unsigned probe) {
+  const char* raw = getenv(var);
   if (!raw || !raw[0]) return;
   char* copy = strdup(raw);
   if (!copy) {
-    LOG_WARN("Could not duplicate MELIAN_TABLE_SELECTS");
+    LOG_WARN("Could not duplicate %s", var);
     return;
   }
   char* ctx = 0;
@@ -499,22 +555,147 @@ static void apply_select_overrides(Config* config) {
     if (!trimmed[0]) continue;
     char* eq = strchr(trimmed, '=');
     if (!eq) {
-      LOG_WARN("Invalid select override [%s], missing '='", trimmed);
+      LOG_WARN("Invalid entry [%s] in %s, missing '='", trimmed, var);
       continue;
     }
     *eq = '\0';
     char* name = trim(trimmed);
     char* stmt = trim(eq + 1);
     if (!name[0] || !stmt[0]) {
-      LOG_WARN("Invalid select override entry [%s]", entry);
+      LOG_WARN("Invalid entry [%s] in %s", entry, var);
+      continue;
+    }
+    ConfigTableSpec* spec = find_table_spec(config, name);
+    if (!spec) {
+      LOG_WARN("Entry in %s references unknown table %s", var, name);
+      continue;
+    }
+    if (probe) {
+      snprintf(spec->probe_stmt, sizeof(spec->probe_stmt), "%s", stmt);
+    } else {
+      snprintf(spec->select_stmt, sizeof(spec->select_stmt), "%s", stmt);
+    }
+  }
+  free(copy);
+}
+
+static void apply_partition_overrides(Config* config) {
+  const char* raw = getenv("MELIAN_TABLE_PARTITIONS");
+  if (!raw || !raw[0]) return;
+  char* copy = strdup(raw);
+  if (!copy) {
+    LOG_WARN("Could not duplicate MELIAN_TABLE_PARTITIONS");
+    return;
+  }
+  char* ctx = 0;
+  for (char* entry = strtok_r(copy, ";", &ctx); entry; entry = strtok_r(NULL, ";", &ctx)) {
+    char* trimmed = trim(entry);
+    if (!trimmed[0]) continue;
+    char* eq = strchr(trimmed, '=');
+    if (!eq) {
+      LOG_WARN("Invalid partition override [%s], missing '='", trimmed);
+      continue;
+    }
+    *eq = '\0';
+    char* name = trim(trimmed);
+    char* value = trim(eq + 1);
+    ConfigPartitionMode mode = CONFIG_PARTITION_RANGE;
+    char* colon = strchr(value, ':');
+    if (colon) {
+      *colon = '\0';
+      char* mode_name = trim(colon + 1);
+      if (strcasecmp(mode_name, "modulo") == 0) {
+        mode = CONFIG_PARTITION_MODULO;
+      } else if (strcasecmp(mode_name, "range") != 0) {
+        LOG_WARN("Invalid partition mode [%s] for table %s", mode_name, name);
+        continue;
+      }
+      value = trim(value);
+    }
+    char* end = 0;
+    long count = strtol(value, &end, 10);
+    if (!name[0] || !value[0] || *end || count < 1 || count > MELIAN_MAX_PARTITIONS) {
+      LOG_WARN("Invalid partition override for table [%s], need a count between 1 and %u", name, MELIAN_MAX_PARTITIONS);
+      continue;
+    }
+    ConfigTableSpec* spec = find_table_spec(config, name);
+    if (!spec) {
+      LOG_WARN("Partition override references unknown table %s", name);
+      continue;
+    }
+    spec->partitions = (unsigned)count;
+    spec->partition_mode = mode;
+  }
+  free(copy);
+}
+
+static void apply_watermark_overrides(Config* config) {
+  const char* raw = getenv("MELIAN_TABLE_WATERMARKS");
+  if (!raw || !raw[0]) return;
+  char* copy = strdup(raw);
+  if (!copy) {
+    LOG_WARN("Could not duplicate MELIAN_TABLE_WATERMARKS");
+    return;
+  }
+  char* ctx = 0;
+  for (char* entry = strtok_r(copy, ";", &ctx); entry; entry = strtok_r(NULL, ";", &ctx)) {
+    char* trimmed = trim(entry);
+    if (!trimmed[0]) continue;
+    char* eq = strchr(trimmed, '=');
+    if (!eq) {
+      LOG_WARN("Invalid watermark override [%s], missing '='", trimmed);
+      continue;
+    }
+    *eq = '\0';
+    char* name = trim(trimmed);
+    char* column = trim(eq + 1);
+    long count = MELIAN_DEFAULT_FULL_EVERY;
+    char* colon = strchr(column, ':');
+    if (colon) {
+      *colon = '\0';
+      char* value = trim(colon + 1);
+      char* end = 0;
+      count = strtol(value, &end, 10);
+      if (!value[0] || *end || count < 1) {
+        LOG_WARN("Invalid full reload count [%s] for table %s", value, name);
+        continue;
+      }
+      column = trim(column);
+    }
+    if (!name[0] || !column[0]) {
+      LOG_WARN("Invalid watermark override for table [%s], need a column", name);
       continue;
     }
     ConfigTableSpec* spec = find_table_spec(config, name);
     if (!spec) {
-      LOG_WARN("Select override references unknown table %s", name);
+      LOG_WARN("Watermark override references unknown table %s", name);
       continue;
     }
-    snprintf(spec->select_stmt, sizeof(spec->select_stmt), "%s", stmt);
+    snprintf(spec->watermark, sizeof(spec->watermark), "%s", column);
+    spec->full_every = (unsigned)count;
+  }
+  free(copy);
+}
+
+// Mark the tables, from a list of table names, whose rows are fingerprinted.
+static void apply_reuse_overrides(Config* config) {
+  const char* raw = getenv("MELIAN_TABLE_REUSE_ROWS");
+  if (!raw || !raw[0]) return;
+  char* copy = strdup(raw);
+  if (!copy) {
+    LOG_WARN("Could not duplicate MELIAN_TABLE_REUSE_ROWS");
+    return;
+  }
+  char* ctx = 0;
+  for (char* entry = strtok_r(copy, ";", &ctx); entry; entry = strtok_r(NULL, ";", &ctx)) {
+    char* name = trim(entry);
+    if (!name[0]) continue;
+    ConfigTableSpec* spec = find_table_spec(config, name);
+    if (!spec) {
+      LOG_WARN("Row reuse override references unknown table %s", name);
+      continue;
+    }
+    spec->reuse_rows = 1;
   }
   free(copy);
 }
@@ -662,6 +843,22 @@ static unsigned parse_config_file_defaults(const char* json) {
     }
   }
 
+  json_t* server = json_object_get(root, "server");
+  if (json_is_object(server)) {
+    json_t* workers = json_object_get(server, "workers");
+    if (json_is_integer(workers)) {
+      char tmp[32];
+      snprintf(tmp, sizeof(tmp), "%lld", (long long)json_integer_value(workers));
+      set_override_string(&config_file_overrides.server_workers, tmp);
+    }
+    json_t* loaders = json_object_get(server, "loaders");
+    if (json_is_integer(loaders)) {
+      char tmp[32];
+      snprintf(tmp, sizeof(tmp), "%lld", (long long)json_integer_value(loaders));
+      set_override_string(&config_file_overrides.server_loaders, tmp);
+    }
+  }
+
   json_t* tables = json_object_get(root, "tables");
   if (json_is_array(tables) && json_array_size(tables) > 0) {
     char* spec = build_tables_override(tables);
@@ -683,6 +880,8 @@ static void clear_config_file_overrides(void) {
   set_override_owned(&config_file_overrides.db_password, NULL);
   set_override_owned(&config_file_overrides.sqlite_filename, NULL);
   set_override_owned(&config_file_overrides.table_tables, NULL);
+  set_override_owned(&config_file_overrides.server_workers, NULL);
+  set_override_owned(&config_file_overrides.server_loaders, NULL);
   set_override_owned_array(&config_file_overrides.listeners, NULL);
 }
 
@@ -698,6 +897,8 @@ static const char* config_file_default_for(const char* name) {
   }
   if (strcmp(name, "MELIAN_SQLITE_FILENAME") == 0) return config_file_overrides.sqlite_filename;
   if (strcmp(name, "MELIAN_TABLE_TABLES") == 0) return config_file_overrides.table_tables;
+  if (strcmp(name, "MELIAN_SERVER_WORKERS") == 0) return config_file_overrides.server_workers;
+  if (strcmp(name, "MELIAN_SERVER_LOADERS") == 0) return config_file_overrides.server_loaders;
   return NULL;
 }
 
@@ -827,6 +1028,10 @@ static char* build_tables_override(json_t* tables) {
         type = type_buf;
       }
       if (!sb_append(&buf, &len, &cap, ":%s", type)) goto fail;
+      json_t* engine_val = json_object_get(idx, "engine");
+      if (json_is_string(engine_val) && json_string_value(engine_val)[0]) {
+        if (!sb_append(&buf, &len, &cap, ":%s", json_string_value(engine_val))) goto fail;
+      }
       wrote_index = 1;
     }
     if (!wrote_index) {
@@ -35,39 +35,77 @@ typedef struct ConfigListeners {
 
 #define MELIAN_MAX_TABLES 64
 #define MELIAN_MAX_INDEXES 16
+#define MELIAN_MAX_PARTITIONS 32
 #define MELIAN_MAX_NAME_LEN 256
 #define MELIAN_MAX_SELECT_LEN 4096
+#define MELIAN_MAX_PROBE_LEN 256
+#define MELIAN_DEFAULT_FULL_EVERY 10   // loads of a watermarked table between full reloads
 
 typedef enum ConfigIndexType {
   CONFIG_INDEX_TYPE_INT,
   CONFIG_INDEX_TYPE_STRING,
 } ConfigIndexType;
 
+// Engine used to look up keys in an index.
+typedef enum ConfigIndexEngine {
+  CONFIG_INDEX_ENGINE_HASH,     // linear probing over 24-byte buckets
+  CONFIG_INDEX_ENGINE_SWISS,    // control bytes checked 16 slots at a time
+  CONFIG_INDEX_ENGINE_MPH,      // minimal perfect hash, built once all keys are loaded
+  CONFIG_INDEX_ENGINE_DENSE,    // direct-addressed array, chosen automatically for dense int keys
+  CONFIG_INDEX_ENGINE_ORDERED,  // sorted array, also answers range scans
+  CONFIG_INDEX_ENGINE_POSTINGS, // non-unique keys, each mapped to all its rows
+  CONFIG_INDEX_ENGINE_BITMAP,   // few distinct keys, each mapped to a bitmap of rows
+} ConfigIndexEngine;
+
+// How a partitioned table is split between its load queries, on its first index.
+typedef enum ConfigPartitionMode {
+  CONFIG_PARTITION_RANGE,       // key ranges, from the keys of the previous load
+  CONFIG_PARTITION_MODULO,      // key modulo the number of partitions
+} ConfigPartitionMode;
+
 typedef struct ConfigIndexSpec {
   unsigned id;
   char column[MELIAN_MAX_NAME_LEN];
   ConfigIndexType type;
+  ConfigIndexEngine engine;
 } ConfigIndexSpec;
 
 typedef struct ConfigTableSpec {
   unsigned id;
   char name[MELIAN_MAX_NAME_LEN];
   unsigned period;
+  unsigned dense_factor;
+  unsigned huge_pages;
+  unsigned release_standby;
+  unsigned partitions;
+  ConfigPartitionMode partition_mode;
   unsigned index_count;
   char select_stmt[MELIAN_MAX_SELECT_LEN];
+  char probe_stmt[MELIAN_MAX_SELECT_LEN];
+  char watermark[MELIAN_MAX_NAME_LEN];  // column to read only changed rows by, if any
+  unsigned full_every;
+  unsigned reuse_rows;    // whether to fingerprint rows, to copy the unchanged ones on reloads
   ConfigIndexSpec indexes[MELIAN_MAX_INDEXES];
 } ConfigTableSpec;
 
 typedef struct ConfigTable {
   unsigned period;
   unsigned strip_null;
+  unsigned dense_factor;  // max key range per row for direct-addressed int indexes; 0 disables them
+  unsigned huge_pages;    // whether to back arenas and hash tables with huge pages
+  unsigned release_standby;  // whether to free the slot not being served between reloads
   char* schema;
   unsigned table_count;
   ConfigTableSpec tables[MELIAN_MAX_TABLES];
 } ConfigTable;
 
+#define MELIAN_MAX_WORKERS 256
+#define MELIAN_MAX_LOADERS 64
+
 typedef struct ConfigServer {
   unsigned show_msgs;
+  unsigned workers;       // event loop threads; 0 means one per online CPU
+  unsigned loaders;       // threads loading tables, each with its own DB connection
 } ConfigServer;
 
 typedef struct ConfigFileData {
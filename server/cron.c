@@ -8,7 +8,9 @@
 #include <unistd.h>
 #include "util.h"
 #include "log.h"
+#include "config.h"
 #include "data.h"
+#include "db.h"
 #include "server.h"
 #include "cron.h"
 
@@ -24,9 +26,12 @@ enum ThreadMessage {
 static void poke_thread(Cron* cron, uint8_t message);
 static void on_tick(evutil_socket_t fd, short what, void *arg);
 static void* loader_main(void *arg);
+static void* loader_once(void *arg);
+static void* loader_once_thread(void *arg);
 
 Cron* cron_build(struct Server* server) {
   Cron* cron = 0;
+  unsigned bad = 0;
   do {
     cron = calloc(1, sizeof(Cron));
     if (!cron) {
@@ -34,7 +39,37 @@ Cron* cron_build(struct Server* server) {
       break;
     }
     cron->server = server;
+
+    unsigned num_loaders = server->config->server.loaders;
+    if (!num_loaders) num_loaders = 1;
+    if (num_loaders > MELIAN_MAX_LOADERS) {
+      LOG_WARN("Limiting %u requested loaders to %u", num_loaders, MELIAN_MAX_LOADERS);
+      num_loaders = MELIAN_MAX_LOADERS;
+    }
+    cron->loaders = calloc(num_loaders, sizeof(CronLoader));
+    if (!cron->loaders) {
+      LOG_WARN("Could not allocate %u Cron loaders", num_loaders);
+      ++bad;
+      break;
+    }
+    for (unsigned l = 0; l < num_loaders; ++l) {
+      CronLoader* loader = &cron->loaders[l];
+      loader->cron = cron;
+      loader->id = l;
+      loader->db = l ? db_build(server->config) : server->db;
+      if (!loader->db) {
+        ++bad;
+        break;
+      }
+      ++cron->num_loaders;
+    }
+    if (bad) break;
+    LOG_INFO("Loading tables with %u loader(s)", cron->num_loaders);
   } while (0);
+  if (bad) {
+    cron_destroy(cron);
+    cron = 0;
+  }
   return cron;
 }
 
@@ -43,9 +78,38 @@ void cron_destroy(Cron* cron) {
   cron_stop(cron);
 
   if (cron->tick) event_free(cron->tick);
+  if (cron->loaders) {
+    for (unsigned l = 1; l < cron->num_loaders; ++l) {
+      db_destroy(cron->loaders[l].db);
+    }
+    free(cron->loaders);
+  }
   free(cron);
 }
 
+unsigned cron_load_all(Cron* cron) {
+  // The calling thread works as loader 0.
+  for (unsigned l = 1; l < cron->num_loaders; ++l) {
+    CronLoader* loader = &cron->loaders[l];
+    if (pthread_create(&loader->thread, 0, loader_once_thread, loader) != 0) {
+      LOG_WARN("Could not start thread for loader %u", l);
+      continue;
+    }
+    loader->started = 1;
+  }
+  loader_once(&cron->loaders[0]);
+
+  unsigned rows = cron->loaders[0].rows;
+  for (unsigned l = 1; l < cron->num_loaders; ++l) {
+    CronLoader* loader = &cron->loaders[l];
+    if (!loader->started) continue;
+    pthread_join(loader->thread, 0);
+    loader->started = 0;
+    rows += loader->rows;
+  }
+  return rows;
+}
+
 unsigned cron_run(Cron* cron) {
   do {
     if (cron->running) break;
@@ -57,14 +121,22 @@ unsigned cron_run(Cron* cron) {
     // evutil_make_socket_nonblocking(cron->pair[0]);
     // evutil_make_socket_nonblocking(cron->pair[1]);
 
+    // Never block the event loop on a tick: if the pipe is full, the loaders are
+    // busy and will find due tables the next time they wake up anyway.
+    evutil_make_socket_nonblocking(cron->pair[1]);
+
     struct timeval wait = { CRON_TICK_PERIOD, 0 };
     cron->tick = event_new(cron->server->base, -1, EV_PERSIST, on_tick, cron);
     event_add(cron->tick, &wait);
 
-    pthread_t thread;
-    pthread_create(&thread, 0, loader_main, cron);
-    pthread_detach(thread);
-    cron->thread = (void*) thread;
+    for (unsigned l = 0; l < cron->num_loaders; ++l) {
+      CronLoader* loader = &cron->loaders[l];
+      if (pthread_create(&loader->thread, 0, loader_main, loader) != 0) {
+        LOG_WARN("Could not start thread for loader %u", l);
+        continue;
+      }
+      loader->started = 1;
+    }
   } while (0);
   return 1;
 }
@@ -74,14 +146,19 @@ unsigned cron_stop(Cron* cron) {
     if (!cron->running) break;
     cron->running = 0;
 
-    if (!cron->thread) break;
-    poke_thread(cron, THREAD_MESSAGE_QUIT);
+    // Loaders also quit on any message once the cron is not running.
+    for (unsigned l = 0; l < cron->num_loaders; ++l) {
+      poke_thread(cron, THREAD_MESSAGE_QUIT);
+    }
     sleep(1); // TODO: needed?
-    LOG_DEBUG("Poked thread to quit");
-    pthread_t thread = (pthread_t) cron->thread;
-    pthread_join(thread, 0);
-    LOG_DEBUG("Joined thread");
-    cron->thread = 0;
+    LOG_DEBUG("Poked threads to quit");
+    for (unsigned l = 0; l < cron->num_loaders; ++l) {
+      CronLoader* loader = &cron->loaders[l];
+      if (!loader->started) continue;
+      pthread_join(loader->thread, 0);
+      LOG_DEBUG("Joined thread for loader %u", l);
+      loader->started = 0;
+    }
   } while (0);
   return 1;
 }
@@ -92,7 +169,9 @@ static void poke_thread(Cron* cron, uint8_t message) {
     wrote = write(cron->pair[1], &message, 1);
   } while (wrote < 0 && errno == EINTR);
 
-  if (wrote < 0) {
+  if (wrote < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    LOG_DEBUG("Cron threads busy, skipping message %c", message);
+  } else if (wrote < 0) {
     LOG_ERROR("Failed to poke cron thread: %s", strerror(errno));
   } else if (wrote != 1) {
     LOG_ERROR("Failed to deliver cron message, wrote %zd bytes", wrote);
@@ -104,24 +183,41 @@ static void on_tick(evutil_socket_t fd, short what, void *arg) {
   UNUSED(what);
   Cron* cron = arg;
   LOG_DEBUG("Tick for cron %p", (void*)cron);
-  poke_thread(cron, THREAD_MESSAGE_WAKEUP);
+  for (unsigned l = 0; l < cron->num_loaders; ++l) {
+    poke_thread(cron, THREAD_MESSAGE_WAKEUP);
+  }
 }
 
 static void* loader_main(void *arg) {
-  Cron* cron = arg;
-  LOG_INFO("THREAD: running loader, cron: %p", (void*)cron);
+  CronLoader* loader = arg;
+  Cron* cron = loader->cron;
+  LOG_INFO("THREAD: running loader %u, cron: %p", loader->id, (void*)cron);
   while (1) {
     uint8_t b;
     int nread = read(cron->pair[0], &b, 1);
     LOG_DEBUG("THREAD: read %u bytes: %c", nread, b);
     if (nread != 1) break;
-    if (b == THREAD_MESSAGE_QUIT) {
+    if (b == THREAD_MESSAGE_QUIT || !cron->running) {
       LOG_DEBUG("THREAD: got a quit message");
       break;
     }
     LOG_DEBUG("THREAD: woke up");
-    data_load_all_tables_from_db(cron->server->data, cron->server->db);
+    data_load_all_tables_from_db(cron->server->data, loader->db);
   }
-  LOG_INFO("THREAD: stopping, cron: %p", (void*)cron);
+  LOG_INFO("THREAD: stopping loader %u, cron: %p", loader->id, (void*)cron);
+  db_thread_end();
+  return 0;
+}
+
+static void* loader_once(void *arg) {
+  CronLoader* loader = arg;
+  loader->rows = data_load_all_tables_from_db(loader->cron->server->data, loader->db);
+  return 0;
+}
+
+// loader_once run in a thread of its own, rather than by the calling thread.
+static void* loader_once_thread(void *arg) {
+  loader_once(arg);
+  db_thread_end();
   return 0;
 }
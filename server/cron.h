@@ -1,18 +1,37 @@
 #pragma once
 
-// A Cron has an ongoing clock tick which periodically wakes up a thread.
-// This thread performs the work of reloading data from MySQL.
+// A Cron has an ongoing clock tick which periodically wakes up a pool of loader
+// threads.  These threads perform the work of reloading data from the database:
+// each one has its own DB connection, and they pick due tables one at a time, so
+// a large table being loaded does not delay the others.
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+struct DB;
+
+typedef struct CronLoader {
+  struct Cron* cron;
+  unsigned id;
+  struct DB* db;          // loader 0 uses the server DB
+  pthread_t thread;
+  unsigned started;       // whether thread is running
+  unsigned rows;          // rows loaded by the last cron_load_all
+} CronLoader;
 
 typedef struct Cron {
   struct event_base *base;
   struct event *tick;
   int pair[2];
   struct Server* server;
-  void* thread;
-  unsigned running;
+  CronLoader* loaders;
+  unsigned num_loaders;
+  atomic_uint running;
 } Cron;
 
 Cron* cron_build(struct Server* server);
 void cron_destroy(Cron* cron);
+// Load all tables with every loader, waiting for them; return the total rows loaded.
+unsigned cron_load_all(Cron* cron);
 unsigned cron_run(Cron* cron);
 unsigned cron_stop(Cron* cron);
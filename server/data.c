@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -8,6 +9,8 @@
 #include "log.h"
 #include "arena.h"
 #include "hash.h"
+#include "index.h"
+#include "roaring.h"
 #include "config.h"
 #include "db.h"
 #include "data.h"
@@ -15,9 +18,44 @@
 enum {
   DATA_REFRESH_PERIOD = 20,
   ARENA_INITIAL_CAPACITY = 1024,
+  ROWS_INITIAL_CAPACITY = 1024,
+  STAGE_INITIAL_CAPACITY = 1024,
+  STAGE_KEY_BYTES = 8,          // expected average key length, to size the stage
+  ARENA_HEADROOM = 8,           // a load is expected to need up to 1/8 more than the previous one
+  STANDBY_GRACE = 30,           // seconds after a swap before the slot not being served may be freed
+  FILTER_SELECT_CHUNK = 256,    // row numbers resolved at a time by table_filter
 };
 
+// A part of a partitioned table, loaded by its own thread and connection.
+typedef struct TablePart {
+  Table* table;
+  DB* db;                 // connection the part is read over, kept by the loader
+  TableStage stage;
+  unsigned failed;        // set if the part could not be read
+  unsigned rows;
+  unsigned changed;       // rows past the watermark, for a delta reload
+  unsigned parts;         // parts the table was read in
+  unsigned min_id;
+  unsigned max_id;
+  pthread_t thread;
+  unsigned started;
+} TablePart;
+
 static void data_refresh_schema(Data* data);
+static unsigned table_load_full(Table* table, DB* db, struct TableSlot* slot, TablePart* loaded);
+static unsigned table_load_delta(Table* table, DB* db, struct TableSlot* slot, TablePart* loaded);
+static void* table_load_part(void* arg);
+static void* table_load_part_thread(void* arg);
+static unsigned table_stage_init(Table* table, TableStage* stage, unsigned rows);
+static unsigned table_stage_merge(TableStage* stage, const TableStage* part);
+static unsigned table_stage_drop_unkeyed(TableStage* stage);
+static void table_stage_release(TableStage* stage);
+static void table_stage_keep(struct TableSlot* slot, TableStage* stage);
+static size_t table_arena_estimate(Table* table, unsigned parts);
+static unsigned long long table_huge_bytes(Table* table, struct TableSlot* slot);
+static void table_release_standby(Table* table, unsigned now);
+static unsigned table_pinned(struct TableSlot* slot, struct TableSlot** pin, unsigned keep);
+static unsigned table_build_indexes(Table* table, struct TableSlot* slot, const TableStage* stage);
 static json_t* schema_table_json(Table* table);
 static const char* index_type_name(ConfigIndexType type);
 
@@ -25,23 +63,59 @@ Table* table_build(const ConfigTableSpec* spec, unsigned arena_cap) {
   Table* table = 0;
   unsigned bad = 0;
   do {
-    table = calloc(1, sizeof(Table));
+    // The pins of each slot are on a cache line of their own.
+    table = aligned_alloc(_Alignof(Table), sizeof(Table));
     if (!table) {
       LOG_WARN("Could not allocate Table object id %u", spec->id);
       break;
     }
+    memset(table, 0, sizeof(Table));
 
     table->table_id = spec->id;
     snprintf(table->name, sizeof(table->name), "%s", spec->name);
     table->period = spec->period ? spec->period : DATA_REFRESH_PERIOD;
-    snprintf(table->select_stmt, sizeof(table->select_stmt), "%s", spec->select_stmt);
+    table->dense_factor = spec->dense_factor;
+    table->huge_pages = spec->huge_pages;
+    table->release_standby = spec->release_standby;
+    if (spec->select_stmt[0]) {
+      snprintf(table->select_stmt, sizeof(table->select_stmt), "%s", spec->select_stmt);
+    } else {
+      snprintf(table->select_stmt, sizeof(table->select_stmt), "SELECT * FROM %s", spec->name);
+    }
+    snprintf(table->probe_stmt, sizeof(table->probe_stmt), "%s", spec->probe_stmt);
+    snprintf(table->watermark, sizeof(table->watermark), "%s", spec->watermark);
+    table->full_every = spec->full_every ? spec->full_every : MELIAN_DEFAULT_FULL_EVERY;
     table->index_count = spec->index_count;
+    table->partitions = spec->partitions ? spec->partitions : 1;
+    table->partition_mode = spec->partition_mode;
+    if (table->partitions > 1 && (!spec->index_count || spec->indexes[0].type != CONFIG_INDEX_TYPE_INT)) {
+      LOG_WARN("Table %s can only be partitioned on an int first index, loading it in one part", spec->name);
+      table->partitions = 1;
+    }
+    if (table->watermark[0] && !spec->index_count) {
+      LOG_WARN("Table %s needs an index to be reloaded by watermark, always reading it in full", spec->name);
+      table->watermark[0] = '\0';
+    }
+    // Rows of a watermarked table are copied from one slot to the next in load order.
+    if (table->watermark[0]) table->keep_rows = 1;
     for (unsigned idx = 0; idx < spec->index_count; ++idx) {
+      // Bitmap indexes number rows in load order, so keep the frame of every row.
+      if (spec->indexes[idx].engine == CONFIG_INDEX_ENGINE_BITMAP) table->keep_rows = 1;
       table->indexes[idx].id = spec->indexes[idx].id;
       table->indexes[idx].type = spec->indexes[idx].type;
+      table->indexes[idx].engine = spec->indexes[idx].engine;
       snprintf(table->indexes[idx].column, sizeof(table->indexes[idx].column),
                "%s", spec->indexes[idx].column);
     }
+    // Rows can only be matched to those of the previous load by a unique key.
+    if (spec->reuse_rows) {
+      if (table->index_count && table->indexes[0].engine != CONFIG_INDEX_ENGINE_POSTINGS &&
+          table->indexes[0].engine != CONFIG_INDEX_ENGINE_BITMAP) {
+        table->fingerprint = 1;
+      } else {
+        LOG_WARN("Table %s needs a unique first index to reuse rows", table->name);
+      }
+    }
 
     for (unsigned b = 0; b < 2; ++b) {
       struct TableSlot* slot = &table->slots[b];
@@ -49,8 +123,10 @@ Table* table_build(const ConfigTableSpec* spec, unsigned arena_cap) {
       if (!slot->arena) {
         LOG_WARN("Could not allocate arena %u for Table id %u", b, spec->id);
         ++bad;
+      } else if (table->huge_pages && !arena_use_huge_pages(slot->arena)) {
+        LOG_WARN("Could not use huge pages for arena %u of Table id %u", b, spec->id);
       }
-      slot->indexes = calloc(table->index_count, sizeof(struct Hash*));
+      slot->indexes = calloc(table->index_count, sizeof(struct Index*));
       if (!slot->indexes) {
         LOG_WARN("Could not allocate index array %u for Table id %u", b, spec->id);
         ++bad;
@@ -60,8 +136,8 @@ Table* table_build(const ConfigTableSpec* spec, unsigned arena_cap) {
       break;
     }
 
-    LOG_DEBUG("Built table id %u name %s period %u indexes %u",
-              table->table_id, table->name, table->period, table->index_count);
+    LOG_DEBUG("Built table id %u name %s period %u indexes %u partitions %u",
+              table->table_id, table->name, table->period, table->index_count, table->partitions);
   } while (0);
   if (bad) {
     table_destroy(table);
@@ -78,10 +154,15 @@ void table_destroy(Table* table) {
     struct TableSlot* slot = &table->slots[b];
     if (slot->indexes) {
       for (unsigned i = 0; i < table->index_count; ++i) {
-        if (slot->indexes[i]) hash_destroy(slot->indexes[i]);
+        if (slot->indexes[i]) index_destroy(slot->indexes[i]);
       }
       free(slot->indexes);
     }
+    if (slot->rows) free(slot->rows);
+    if (slot->snapshot) {
+      table_stage_release(slot->snapshot);
+      free(slot->snapshot);
+    }
     if (slot->arena) arena_destroy(slot->arena);
   }
   free(table);
@@ -102,29 +183,102 @@ unsigned table_load_from_db(Table* table, struct DB* db, unsigned now, unsigned
 
   if (!load) return 1;
 
+  // Responses still being sent may point into the slot to be loaded; the
+  // table stays due, so it is tried again on the next tick.
+  unsigned pins = table->slots[1 - table->current_slot].pins;
+  if (pins) {
+    LOG_INFO("Delaying reload of table %s, %u responses still use its previous data", table->name, pins);
+    return 0;
+  }
+
+  // A table with a change probe is only read again when its result moves.
+  char probe[MELIAN_MAX_PROBE_LEN];
+  unsigned probed = db_probe(db, table, probe, sizeof(probe));
+  if (probed && table->stats.last_loaded && strcmp(probe, table->probe_value) == 0) {
+    LOG_DEBUG("Table %s did not change, skipping reload", table->name);
+    table->stats.last_loaded = now;
+    ++table->stats.skipped;
+    return 0;
+  }
+
+  // A table with a watermark only reads the rows past the one seen by the
+  // previous load, except every full_every loads; the watermark is read
+  // before the rows, so that rows written meanwhile are read again next time.
+  char mark[MELIAN_MAX_PROBE_LEN];
+  unsigned marked = db_watermark(db, table, mark, sizeof(mark)) && mark[0];
+  unsigned delta = marked && table->watermark_value[0] && table->stats.last_loaded &&
+                   table->since_full + 1 < table->full_every;
+
   unsigned pos = 1 - table->current_slot;
   struct TableSlot* slot = &table->slots[pos];
   arena_reset(slot->arena);
+  slot->row_count = 0;
+  table->standby_released = 0;
+  // The arena is made as large as the previous load needed, and its pages are
+  // faulted in now, so that neither happens while rows are being read.
+  arena_presize(slot->arena, table_arena_estimate(table, 1));
 
-  unsigned size = db_get_table_size(db, table);
-  unsigned hash_cap = 2 * next_power_of_two(size, 1);
-  LOG_DEBUG("Building hash tables for %s, size %u, capacity %u", table->name, size, hash_cap);
-
-  for (unsigned idx = 0; idx < table->index_count; ++idx) {
-    if (slot->indexes[idx]) hash_destroy(slot->indexes[idx]);
-    slot->indexes[idx] = hash_build(hash_cap, slot->arena);
+  TablePart loaded;
+  memset(&loaded, 0, sizeof(loaded));
+  if (delta && !table_load_delta(table, db, slot, &loaded)) {
+    LOG_DEBUG("Could not reload changed rows of table %s, reading it in full", table->name);
+    table_stage_release(&loaded.stage);
+    arena_reset(slot->arena);
+    delta = 0;
   }
+  unsigned failed = delta ? 0 : table_load_full(table, db, slot, &loaded);
 
-  unsigned min_id = (unsigned) -1;
-  unsigned max_id = 0;
-  unsigned rows = db_query_into_hash(db, table, slot, &min_id, &max_id);
-  LOG_INFO("Loaded %u rows for table %s at slot %u", rows, table->name, pos);
+  TableStage* stage = &loaded.stage;
+  unsigned indexed = 0;
+  if (!failed) {
+    indexed = table_build_indexes(table, slot, stage);
+    // Keys stored by the indexes were the last thing written to the arena.
+    arena_trim(slot->arena);
+    slot->huge_bytes = table_huge_bytes(table, slot);
+  }
+  unsigned reused = stage->reused;
+  slot->rows = stage->rows;
+  slot->row_count = stage->row_count;
+  slot->row_cap = stage->row_cap;
+  stage->rows = 0;
+  if (indexed && table->watermark[0]) {
+    table_stage_keep(slot, stage);
+  } else {
+    table_stage_release(stage);
+  }
+  // In either case the table stays due, so it is tried again on the next tick.
+  if (failed) {
+    LOG_WARN("Could not load %u parts of table %s, keeping its current data", failed, table->name);
+    return 0;
+  }
+  if (!indexed) {
+    LOG_WARN("Could not build the indexes of table %s, keeping its current data", table->name);
+    return 0;
+  }
+  unsigned rows = loaded.rows;
+  if (delta) {
+    LOG_INFO("Reloaded %u rows for table %s at slot %u, %u of them past watermark %s",
+             rows, table->name, pos, loaded.changed, table->watermark_value);
+  } else {
+    LOG_INFO("Loaded %u rows for table %s at slot %u in %u parts, reusing %u of them",
+             rows, table->name, pos, loaded.parts, reused);
+  }
 
+  // If the probe failed, the next one cannot match, and the table is read again.
+  snprintf(table->probe_value, sizeof(table->probe_value), "%s", probed ? probe : "");
+  snprintf(table->watermark_value, sizeof(table->watermark_value), "%s", marked ? mark : "");
+  if (delta) {
+    ++table->since_full;
+    ++table->stats.deltas;
+  } else {
+    table->since_full = 0;
+  }
   table->stats.last_loaded = now;
   table->stats.rows = rows;
+  table->stats.reused = reused;
   if (table->index_count && table->indexes[0].type == CONFIG_INDEX_TYPE_INT) {
-    table->stats.min_id = min_id == (unsigned)-1 ? 0 : min_id;
-    table->stats.max_id = max_id;
+    table->stats.min_id = loaded.min_id == (unsigned)-1 ? 0 : loaded.min_id;
+    table->stats.max_id = loaded.max_id;
   } else {
     table->stats.min_id = 0;
     table->stats.max_id = 0;
@@ -133,19 +287,695 @@ unsigned table_load_from_db(Table* table, struct DB* db, unsigned now, unsigned
   return rows;
 }
 
-const Bucket* table_fetch(Table* table, unsigned index_id, const void *key, unsigned len) {
+// Read all the rows of a table into a slot, leaving in loaded the stage with
+// all of them, and return the number of parts that could not be read.
+static unsigned table_load_full(Table* table, DB* db, struct TableSlot* slot, TablePart* loaded) {
+  // The first part is read into the slot arena by the calling thread, and any
+  // others into arenas of their own, each by a thread with its own connection.
+  unsigned parts = table->partitions;
+  TablePart part[MELIAN_MAX_PARTITIONS];
+  memset(part, 0, parts * sizeof(TablePart));
+  part[0].stage.arena = slot->arena;
+  for (unsigned p = 1; p < parts; ++p) {
+    part[p].stage.arena = arena_build(ARENA_INITIAL_CAPACITY);
+    if (part[p].stage.arena) {
+      arena_presize(part[p].stage.arena, table_arena_estimate(table, parts));
+      continue;
+    }
+    LOG_WARN("Could not allocate arena for part %u of table %s, loading it in one part", p, table->name);
+    for (unsigned q = 1; q < p; ++q) arena_destroy(part[q].stage.arena);
+    parts = 1;
+  }
+
+  // The previous load gives a good estimate of the number of rows; the
+  // indexes themselves are only built once the actual number is known.
+  // Rows that did not change since then are copied from the live slot.
+  struct TableSlot* cur = &table->slots[table->current_slot];
+  unsigned reuse = table->fingerprint && table->stats.last_loaded && cur->indexes[0];
+  for (unsigned p = 0; p < parts; ++p) {
+    TableStage* stage = &part[p].stage;
+    table_stage_init(table, stage, table->stats.rows / parts);
+    stage->keep_rows = table->keep_rows;
+    stage->partition = p;
+    stage->partitions = parts;
+    stage->fingerprint = table->fingerprint;
+    stage->reuse_index = reuse ? cur->indexes[0] : 0;
+    stage->reuse_arena = cur->arena;
+    part[p].table = table;
+    part[p].db = db_part(db, p);
+  }
+  // The slot keeps its row array from one load to the next.
+  part[0].stage.rows = slot->rows;
+  part[0].stage.row_cap = slot->row_cap;
+  slot->rows = 0;
+  slot->row_cap = 0;
+
+  for (unsigned p = 1; p < parts; ++p) {
+    if (pthread_create(&part[p].thread, 0, table_load_part_thread, &part[p]) == 0) {
+      part[p].started = 1;
+      continue;
+    }
+    LOG_WARN("Could not start thread for part %u of table %s, loading it inline", p, table->name);
+    table_load_part(&part[p]);
+  }
+  part[0].rows = db_query_into_hash(db, table, &part[0].stage, &part[0].min_id, &part[0].max_id);
+  if (part[0].rows == (unsigned)-1) part[0].failed = 1;
+
+  TableStage* stage = &part[0].stage;
+  unsigned failed = part[0].failed;
+  for (unsigned p = 1; p < parts; ++p) {
+    if (part[p].started) pthread_join(part[p].thread, 0);
+    // Once a part is missing the load is abandoned, so the others are not merged.
+    if (!part[p].failed && !failed && !table_stage_merge(stage, &part[p].stage)) {
+      LOG_WARN("Could not merge part %u of table %s", p, table->name);
+      part[p].failed = 1;
+    }
+    if (part[p].failed) {
+      ++failed;
+    } else if (!failed) {
+      part[0].rows += part[p].rows;
+      stage->reused += part[p].stage.reused;
+      if (part[p].rows && part[0].min_id > part[p].min_id) part[0].min_id = part[p].min_id;
+      if (part[p].rows && part[0].max_id < part[p].max_id) part[0].max_id = part[p].max_id;
+    }
+    arena_destroy(part[p].stage.arena);
+    table_stage_release(&part[p].stage);
+  }
+  *loaded = part[0];
+  loaded->parts = parts;
+  return failed;
+}
+
+// Read the rows of a table past its watermark, and write into a slot a copy of
+// the current one, with these rows replacing those with the same first key.
+// Return 0 if no rows could be read, so that the table is read in full.
+static unsigned table_load_delta(Table* table, DB* db, struct TableSlot* slot, TablePart* loaded) {
+  struct TableSlot* cur = &table->slots[table->current_slot];
+  const TableStage* old = cur->snapshot;
+  if (!old) return 0;
+
+  TableStage delta;
+  memset(&delta, 0, sizeof(delta));
+  delta.arena = arena_build(ARENA_INITIAL_CAPACITY);
+  if (!delta.arena || !table_stage_init(table, &delta, 0)) {
+    LOG_WARN("Could not allocate stage for changed rows of table %s", table->name);
+    if (delta.arena) arena_destroy(delta.arena);
+    return 0;
+  }
+  delta.keep_rows = table->keep_rows;
+  delta.fingerprint = table->fingerprint;
+  delta.partitions = 1;
+  delta.watermark = table->watermark_value;
+  unsigned min_id = 0;
+  unsigned max_id = 0;
+  unsigned changed = db_query_into_hash(db, table, &delta, &min_id, &max_id);
+
+  Arena* scratch = 0;
+  Index* seen = 0;
+  unsigned ok = 0;
+  do {
+    // Rows at the watermark are always read again, so none means an error.
+    if (!changed || changed == (unsigned)-1) break;
+
+    // Rows without a first key cannot replace the row they were read from,
+    // and would be added again by every delta: only full reloads read them.
+    unsigned keys = table_stage_drop_unkeyed(&delta);
+    changed = keys;
+    // The keys of the set all point to an empty frame of its own arena.
+    scratch = arena_build(ARENA_INITIAL_CAPACITY);
+    unsigned none = scratch ? arena_store_framed(scratch, (const uint8_t*) "", 0) : (unsigned)-1;
+    if (none != (unsigned)-1) seen = index_build(CONFIG_INDEX_ENGINE_HASH, table->indexes[0].type, keys, scratch);
+    if (!seen) {
+      LOG_WARN("Could not allocate key set for changed rows of table %s", table->name);
+      break;
+    }
+    unsigned bad = 0;
+    for (unsigned j = 0; j < delta.used && !bad; ++j) {
+      const TableStageEntry* entry = &delta.entries[j];
+      if (entry->index != 0) continue;
+      if (!index_insert(seen, delta.keys + entry->key_off, entry->key_len, none, 0)) ++bad;
+    }
+
+    TableStage* stage = &loaded->stage;
+    stage->arena = slot->arena;
+    if (bad || !table_stage_init(table, stage, table->stats.rows + changed)) break;
+    stage->keep_rows = table->keep_rows;
+    stage->rows = slot->rows;
+    stage->row_cap = slot->row_cap;
+    slot->rows = 0;
+    slot->row_cap = 0;
+
+    // The keys of each row of the current slot were staged together, in the
+    // order of its rows, and are staged again for the copy of the row.
+    loaded->min_id = (unsigned)-1;
+    loaded->max_id = 0;
+    unsigned kept = 0;
+    unsigned e = 0;
+    for (unsigned r = 0; r < cur->row_count && !bad; ++r) {
+      unsigned frame = cur->rows[r];
+      unsigned beg = e;
+      unsigned replaced = 0;
+      for (; e < old->used && old->entries[e].frame == frame; ++e) {
+        const TableStageEntry* entry = &old->entries[e];
+        uint32_t frame_len = 0;
+        if (entry->index == 0 &&
+            index_get(seen, old->keys + entry->key_off, entry->key_len, &frame_len) != (unsigned)-1) {
+          replaced = 1;
+        }
+      }
+      if (replaced) continue;
+
+      // The fingerprint of the row, if any, comes right before it.
+      unsigned skip = table->fingerprint ? sizeof(uint64_t) : 0;
+      unsigned copy = arena_store(slot->arena, arena_get_ptr(cur->arena, frame) - skip,
+                                  skip + arena_get_frame_len(cur->arena, frame));
+      if (copy == (unsigned)-1 || !table_stage_row(stage, copy + skip / ARENA_ALIGN)) {
+        ++bad;
+        break;
+      }
+      copy += skip / ARENA_ALIGN;
+      for (unsigned k = beg; k < e && !bad; ++k) {
+        const TableStageEntry* entry = &old->entries[k];
+        const uint8_t* key = old->keys + entry->key_off;
+        if (!table_stage_key(stage, entry->index, key, entry->key_len, copy)) ++bad;
+        if (entry->index != 0 || table->indexes[0].type != CONFIG_INDEX_TYPE_INT) continue;
+        unsigned key_int = 0;
+        memcpy(&key_int, key, sizeof(unsigned));
+        if (loaded->min_id > key_int) loaded->min_id = key_int;
+        if (loaded->max_id < key_int) loaded->max_id = key_int;
+      }
+      ++kept;
+    }
+    if (bad || !table_stage_merge(stage, &delta)) {
+      LOG_WARN("Could not merge changed rows of table %s", table->name);
+      break;
+    }
+    if (loaded->min_id > min_id) loaded->min_id = min_id;
+    if (loaded->max_id < max_id) loaded->max_id = max_id;
+    loaded->rows = kept + changed;
+    loaded->changed = changed;
+    stage->reused = kept;
+    ok = 1;
+  } while (0);
+
+  if (seen) index_destroy(seen);
+  if (scratch) arena_destroy(scratch);
+  arena_destroy(delta.arena);
+  table_stage_release(&delta);
+  return ok;
+}
+
+// Bytes each of parts arenas is expected to need for the next load of a table,
+// from what the live slot used; 0 before the first load.
+static size_t table_arena_estimate(Table* table, unsigned parts) {
+  size_t used = table->slots[table->current_slot].arena->used / parts;
+  return used + used / ARENA_HEADROOM;
+}
+
+// How much of the arena and hash tables of a slot is backed by huge pages.
+// Reading it means going through /proc/self/smaps, so it is done once per load,
+// by the loader, and not by every status request.
+static unsigned long long table_huge_bytes(Table* table, struct TableSlot* slot) {
+  if (!slot->arena->huge) return 0;
+  unsigned long long huge = arena_huge_bytes(slot->arena->buffer, slot->arena->capacity);
+  for (unsigned idx = 0; idx < table->index_count; ++idx) {
+    Index* index = slot->indexes[idx];
+    if (!index || index->engine != CONFIG_INDEX_ENGINE_HASH) continue;
+    if (!index->u.hash->mapped) continue;
+    huge += arena_huge_bytes(index->u.hash->tab, index->u.hash->mapped);
+  }
+  return huge;
+}
+
+// Free the arena, indexes and rows of the slot not being served, a while after
+// the swap and once no response points into it, unless the next load is close.
+static void table_release_standby(Table* table, unsigned now) {
+  if (!table->release_standby || table->standby_released || !table->stats.last_loaded) return;
+  unsigned elapsed = now - table->stats.last_loaded;
+  if (elapsed < STANDBY_GRACE || elapsed + STANDBY_GRACE >= table->period) return;
+  unsigned idle = 0;
+  if (!atomic_compare_exchange_strong(&table->loading, &idle, 1)) return;
+
+  struct TableSlot* slot = &table->slots[1 - table->current_slot];
+  if (slot->pins) {
+    atomic_store(&table->loading, 0);
+    return;
+  }
+  for (unsigned idx = 0; idx < table->index_count; ++idx) {
+    if (slot->indexes[idx]) index_destroy(slot->indexes[idx]);
+    slot->indexes[idx] = 0;
+  }
+  if (slot->rows) free(slot->rows);
+  slot->rows = 0;
+  slot->row_count = 0;
+  slot->row_cap = 0;
+  if (slot->snapshot) {
+    table_stage_release(slot->snapshot);
+    free(slot->snapshot);
+    slot->snapshot = 0;
+  }
+  arena_release(slot->arena);
+  table->standby_released = 1;
+  LOG_DEBUG("Released standby slot %u of table %s", 1 - table->current_slot, table->name);
+  atomic_store(&table->loading, 0);
+}
+
+// Read one part of a partitioned table over a connection of its own.
+static void* table_load_part(void* arg) {
+  TablePart* part = (TablePart*) arg;
+  Table* table = part->table;
+  unsigned p = part->stage.partition;
+  // The loader keeps the connection, and its prepared statements, for the next load.
+  if (!db_ensure_connected(part->db)) {
+    LOG_WARN("No connection to load part %u of table %s", p, table->name);
+    part->failed = 1;
+    return 0;
+  }
+  part->rows = db_query_into_hash(part->db, table, &part->stage, &part->min_id, &part->max_id);
+  if (part->rows == (unsigned)-1) part->failed = 1;
+  return 0;
+}
+
+static void* table_load_part_thread(void* arg) {
+  table_load_part(arg);
+  db_thread_end();
+  return 0;
+}
+
+unsigned table_stage_row(TableStage* stage, unsigned frame) {
+  if (!stage->keep_rows) return 1;
+  if (stage->row_count >= stage->row_cap) {
+    unsigned cap = stage->row_cap ? 2 * stage->row_cap : ROWS_INITIAL_CAPACITY;
+    unsigned* rows = realloc(stage->rows, cap * sizeof(unsigned));
+    if (!rows) {
+      LOG_WARN("Could not grow row array to %u rows", cap);
+      return 0;
+    }
+    stage->rows = rows;
+    stage->row_cap = cap;
+  }
+  stage->rows[stage->row_count++] = frame;
+  return 1;
+}
+
+unsigned table_stage_key(TableStage* stage, unsigned index, const void *key, uint32_t key_len, unsigned frame) {
+  if (stage->used >= stage->cap) {
+    unsigned cap = stage->cap ? 2 * stage->cap : STAGE_INITIAL_CAPACITY;
+    TableStageEntry* entries = realloc(stage->entries, cap * sizeof(TableStageEntry));
+    if (!entries) {
+      LOG_WARN("Could not grow key stage to %u keys", cap);
+      return 0;
+    }
+    stage->entries = entries;
+    stage->cap = cap;
+  }
+  if (stage->keys_used + key_len > stage->keys_cap) {
+    unsigned cap = stage->keys_cap ? stage->keys_cap : STAGE_INITIAL_CAPACITY * STAGE_KEY_BYTES;
+    while (stage->keys_used + key_len > cap) cap *= 2;
+    uint8_t* keys = realloc(stage->keys, cap);
+    if (!keys) {
+      LOG_WARN("Could not grow key stage to %u bytes", cap);
+      return 0;
+    }
+    stage->keys = keys;
+    stage->keys_cap = cap;
+  }
+
+  TableStageEntry* entry = &stage->entries[stage->used++];
+  entry->index = index;
+  entry->key_len = key_len;
+  entry->key_off = stage->keys_used;
+  entry->frame = frame;
+  memcpy(stage->keys + stage->keys_used, key, key_len);
+  stage->keys_used += key_len;
+  return 1;
+}
+
+unsigned table_stage_fingerprint(TableStage* stage, uint64_t fingerprint) {
+  if (!stage->fingerprint) return 1;
+  // It fills whole units of the arena, so the row starts right after it.
+  return arena_store(stage->arena, (const uint8_t*) &fingerprint, sizeof(uint64_t)) != (unsigned)-1;
+}
+
+unsigned table_stage_reuse(TableStage* stage, const void *key, uint32_t key_len, uint64_t fingerprint) {
+  if (!stage->reuse_index) return (unsigned)-1;
+  uint32_t frame_len = 0;
+  unsigned frame = index_peek(stage->reuse_index, key, key_len, &frame_len);
+  if (frame == (unsigned)-1) return frame;
+
+  const Arena* live = stage->reuse_arena;
+  const uint8_t* row = arena_get_ptr(live, frame) - sizeof(uint64_t);
+  uint64_t previous = 0;
+  memcpy(&previous, row, sizeof(uint64_t));
+  if (previous != fingerprint) return (unsigned)-1;
+  unsigned copy = arena_store(stage->arena, row, sizeof(uint64_t) + arena_get_frame_len(live, frame));
+  if (copy == (unsigned)-1) return 0;
+  ++stage->reused;
+  return copy + sizeof(uint64_t) / ARENA_ALIGN;
+}
+
+static unsigned table_stage_init(Table* table, TableStage* stage, unsigned rows) {
+  unsigned cap = rows * table->index_count;
+  if (cap < STAGE_INITIAL_CAPACITY) cap = STAGE_INITIAL_CAPACITY;
+  stage->entries = malloc(cap * sizeof(TableStageEntry));
+  stage->keys = malloc(cap * STAGE_KEY_BYTES);
+  if (!stage->entries || !stage->keys) {
+    LOG_WARN("Could not allocate key stage for table %s with %u keys", table->name, cap);
+    free(stage->entries);
+    free(stage->keys);
+    stage->entries = 0;
+    stage->keys = 0;
+    return 0;
+  }
+  stage->cap = cap;
+  stage->keys_cap = cap * STAGE_KEY_BYTES;
+  return 1;
+}
+
+// Drop the rows of a stage without a key in the first index, keeping the
+// others in order; their values stay in the arena.  Return the rows left.
+static unsigned table_stage_drop_unkeyed(TableStage* stage) {
+  unsigned used = 0;
+  unsigned rows = 0;
+  for (unsigned beg = 0, end = 0; beg < stage->used; beg = end) {
+    unsigned keyed = 0;
+    for (end = beg; end < stage->used && stage->entries[end].frame == stage->entries[beg].frame; ++end) {
+      if (stage->entries[end].index == 0) keyed = 1;
+    }
+    if (!keyed) continue;
+    memmove(stage->entries + used, stage->entries + beg, (end - beg) * sizeof(TableStageEntry));
+    used += end - beg;
+    ++rows;
+  }
+  stage->used = used;
+  if (!stage->keep_rows) return rows;
+
+  // Keys are staged in the order of their rows.
+  unsigned kept = 0;
+  for (unsigned r = 0, e = 0; r < stage->row_count; ++r) {
+    if (e >= used || stage->entries[e].frame != stage->rows[r]) continue;
+    while (e < used && stage->entries[e].frame == stage->rows[r]) ++e;
+    stage->rows[kept++] = stage->rows[r];
+  }
+  stage->row_count = kept;
+  return rows;
+}
+
+// Append the rows and keys of a part to a stage, after copying the arena of
+// the part at the end of the stage arena.
+static unsigned table_stage_merge(TableStage* stage, const TableStage* part) {
+  unsigned base = arena_store(stage->arena, part->arena->buffer, part->arena->used);
+  if (base == (unsigned)-1) return 0;
+  for (unsigned j = 0; j < part->used; ++j) {
+    const TableStageEntry* entry = &part->entries[j];
+    if (!table_stage_key(stage, entry->index, part->keys + entry->key_off, entry->key_len, base + entry->frame)) return 0;
+  }
+  for (unsigned j = 0; j < part->row_count; ++j) {
+    if (!table_stage_row(stage, base + part->rows[j])) return 0;
+  }
+  return 1;
+}
+
+static void table_stage_release(TableStage* stage) {
+  if (stage->entries) free(stage->entries);
+  if (stage->keys) free(stage->keys);
+  if (stage->rows) free(stage->rows);
+  memset(stage, 0, sizeof(TableStage));
+}
+
+// Keep the staged keys of a slot until it is loaded again.
+static void table_stage_keep(struct TableSlot* slot, TableStage* stage) {
+  if (!slot->snapshot) slot->snapshot = calloc(1, sizeof(TableStage));
+  if (!slot->snapshot) {
+    LOG_WARN("Could not allocate key snapshot, the next reload will be a full one");
+    table_stage_release(stage);
+    return;
+  }
+  table_stage_release(slot->snapshot);
+  *slot->snapshot = *stage;
+  memset(stage, 0, sizeof(TableStage));
+}
+
+// Build every index of a slot from the staged keys, sized for the number of
+// keys each one actually got, and inserting them in row order.
+static unsigned table_build_indexes(Table* table, struct TableSlot* slot, const TableStage* stage) {
+  unsigned keys[MELIAN_MAX_INDEXES] = {0};
+  for (unsigned j = 0; j < stage->used; ++j) {
+    ++keys[stage->entries[j].index];
+  }
+
+  unsigned bad = 0;
+  for (unsigned idx = 0; idx < table->index_count; ++idx) {
+    if (slot->indexes[idx]) index_destroy(slot->indexes[idx]);
+    LOG_DEBUG("Building index %s for %s, size %u", table->indexes[idx].column, table->name, keys[idx]);
+    slot->indexes[idx] = index_build(table->indexes[idx].engine, table->indexes[idx].type, keys[idx], slot->arena);
+    if (!slot->indexes[idx]) ++bad;
+  }
+
+  for (unsigned j = 0; j < stage->used; ++j) {
+    const TableStageEntry* entry = &stage->entries[j];
+    Index* index = slot->indexes[entry->index];
+    if (!index) continue;
+    uint32_t frame_len = arena_get_frame_len(slot->arena, entry->frame);
+    if (!index_insert(index, stage->keys + entry->key_off, entry->key_len, entry->frame, frame_len)) {
+      LOG_WARN("Could not insert key for table %s index %s",
+               table->name, table->indexes[entry->index].column);
+      ++bad;
+      break;
+    }
+  }
+
+  for (unsigned idx = 0; idx < table->index_count; ++idx) {
+    Index* index = slot->indexes[idx];
+    if (!index) continue;
+    if (!index_finalize(index, stage->rows, stage->row_count)) {
+      LOG_WARN("Could not finalize index %s for table %s", table->indexes[idx].column, table->name);
+      ++bad;
+      continue;
+    }
+    if (table->indexes[idx].type == CONFIG_INDEX_TYPE_INT && index_densify(index, table->dense_factor)) {
+      LOG_DEBUG("Using dense array for index %s of table %s", table->indexes[idx].column, table->name);
+    }
+  }
+  return bad == 0;
+}
+
+// Pin the current slot of a table, checking that it is still current once
+// pinned: a loader that has not seen the pin cannot be loading it then.
+struct TableSlot* table_pin(Table* table) {
+  while (1) {
+    unsigned current = table->current_slot;
+    struct TableSlot* slot = &table->slots[current];
+    atomic_fetch_add(&slot->pins, 1);
+    if (table->current_slot == current) return slot;
+    atomic_fetch_sub(&slot->pins, 1);
+  }
+}
+
+// Hand the pin on a slot to the caller if keep is set, else drop it.
+static unsigned table_pinned(struct TableSlot* slot, struct TableSlot** pin, unsigned keep) {
+  if (keep) {
+    *pin = slot;
+  } else {
+    atomic_fetch_sub(&slot->pins, 1);
+  }
+  return keep;
+}
+
+void data_unpin(struct TableSlot* slot) {
+  if (slot) atomic_fetch_sub(&slot->pins, 1);
+}
+
+const uint8_t* table_fetch(Table* table, unsigned index_id, const void *key, unsigned len, unsigned* frame_len,
+                           struct TableSlot** pin) {
+  *pin = 0;
   if (index_id >= table->index_count) {
     LOG_WARN("Invalid index %u for table %s", index_id, table->name);
     return NULL;
   }
-  unsigned current_slot = table->current_slot;
-  struct TableSlot* slot = &table->slots[current_slot];
-  Hash* hash = slot->indexes[index_id];
-  if (!hash) {
-    LOG_FATAL("Unexpected null hash for table %s index %u current %u",
+  // Pin the current slot once, so that the hash and the arena always match.
+  struct TableSlot* slot = table_pin(table);
+  unsigned current_slot = slot - table->slots;
+  Index* index = slot->indexes[index_id];
+  if (!index) {
+    LOG_FATAL("Unexpected null index for table %s index %u current %u",
+              table->name, index_id, current_slot);
+  }
+  unsigned frame = index_get(index, key, len, frame_len);
+  return table_pinned(slot, pin, frame != (unsigned)-1) ? arena_get_ptr(slot->arena, frame) : NULL;
+}
+
+unsigned table_fetch_batch(Table* table, unsigned index_id, unsigned count,
+                           const void* const* keys, const uint32_t* key_lens,
+                           const uint8_t** frames, unsigned* frame_lens, struct TableSlot** pin) {
+  *pin = 0;
+  if (index_id >= table->index_count) {
+    LOG_WARN("Invalid index %u for table %s", index_id, table->name);
+    for (unsigned j = 0; j < count; ++j) {
+      frames[j] = NULL;
+      frame_lens[j] = 0;
+    }
+    return 0;
+  }
+  struct TableSlot* slot = table_pin(table);
+  unsigned current_slot = slot - table->slots;
+  Index* index = slot->indexes[index_id];
+  if (!index) {
+    LOG_FATAL("Unexpected null index for table %s index %u current %u",
+              table->name, index_id, current_slot);
+  }
+  unsigned idxs[HASH_BATCH_GROUP];
+  unsigned found = 0;
+  for (unsigned beg = 0; beg < count; beg += HASH_BATCH_GROUP) {
+    unsigned n = count - beg < HASH_BATCH_GROUP ? count - beg : HASH_BATCH_GROUP;
+    index_get_batch(index, n, keys + beg, key_lens + beg, idxs, frame_lens + beg);
+    for (unsigned j = 0; j < n; ++j) {
+      frames[beg + j] = arena_get_ptr(slot->arena, idxs[j]);
+      found += frames[beg + j] != NULL;
+    }
+  }
+  table_pinned(slot, pin, found);
+  return found;
+}
+
+unsigned table_fetch_all(Table* table, unsigned index_id, const void *key, unsigned len,
+                         const struct Arena** arena, const unsigned** frames, unsigned* bytes,
+                         struct TableSlot** pin) {
+  *pin = 0;
+  if (index_id >= table->index_count) {
+    LOG_WARN("Invalid index %u for table %s", index_id, table->name);
+    return (unsigned)-1;
+  }
+  struct TableSlot* slot = table_pin(table);
+  unsigned current_slot = slot - table->slots;
+  Index* index = slot->indexes[index_id];
+  if (!index) {
+    LOG_FATAL("Unexpected null index for table %s index %u current %u",
               table->name, index_id, current_slot);
   }
-  return hash_get(hash, key, len);
+  *arena = slot->arena;
+  unsigned count = index_get_all(index, key, len, frames, bytes);
+  table_pinned(slot, pin, count != (unsigned)-1 && count);
+  return count;
+}
+
+unsigned table_range(Table* table, unsigned index_id, const void *from, unsigned from_len,
+                     const void *to, unsigned to_len, unsigned limit,
+                     const uint8_t** frames, unsigned* frame_lens,
+                     const void** next, unsigned* next_len, struct TableSlot** pin) {
+  *pin = 0;
+  if (index_id >= table->index_count) {
+    LOG_WARN("Invalid index %u for table %s", index_id, table->name);
+    return (unsigned)-1;
+  }
+  struct TableSlot* slot = table_pin(table);
+  unsigned current_slot = slot - table->slots;
+  Index* index = slot->indexes[index_id];
+  if (!index) {
+    LOG_FATAL("Unexpected null index for table %s index %u current %u",
+              table->name, index_id, current_slot);
+  }
+  unsigned count = index_range(index, from, from_len, to, to_len, limit, frames, frame_lens, next, next_len);
+  table_pinned(slot, pin, count != (unsigned)-1 && count);
+  return count;
+}
+
+unsigned table_prefix(Table* table, unsigned index_id, const void *prefix, unsigned prefix_len,
+                      const void *from, unsigned from_len, unsigned limit,
+                      const uint8_t** frames, unsigned* frame_lens,
+                      const void** next, unsigned* next_len, struct TableSlot** pin) {
+  *pin = 0;
+  if (index_id >= table->index_count) {
+    LOG_WARN("Invalid index %u for table %s", index_id, table->name);
+    return (unsigned)-1;
+  }
+  struct TableSlot* slot = table_pin(table);
+  unsigned current_slot = slot - table->slots;
+  Index* index = slot->indexes[index_id];
+  if (!index) {
+    LOG_FATAL("Unexpected null index for table %s index %u current %u",
+              table->name, index_id, current_slot);
+  }
+  unsigned count = index_prefix(index, prefix, prefix_len, from, from_len, limit, frames, frame_lens, next, next_len);
+  table_pinned(slot, pin, count != (unsigned)-1 && count);
+  return count;
+}
+
+unsigned table_filter(Table* table, const DataFilterTerm* terms, unsigned count,
+                      unsigned offset, unsigned limit,
+                      const uint8_t** frames, unsigned* frame_lens, unsigned* total,
+                      struct TableSlot** pin) {
+  static const Roaring none;    // the rows for a key missing from an index
+  *pin = 0;
+  struct TableSlot* slot = table_pin(table);
+  const Roaring* stack[MELIAN_MAX_FILTER_TERMS];
+  Roaring* owned[MELIAN_MAX_FILTER_TERMS];
+  unsigned depth = 0;
+  unsigned bad = 0;
+  *total = 0;
+  for (unsigned j = 0; j < count && !bad; ++j) {
+    const DataFilterTerm* term = &terms[j];
+    switch (term->op) {
+      case MELIAN_FILTER_EQ: {
+        const Roaring* map = 0;
+        if (depth >= MELIAN_MAX_FILTER_TERMS || term->index_id >= table->index_count ||
+            !slot->indexes[term->index_id] ||
+            !index_get_bitmap(slot->indexes[term->index_id], term->key, term->key_len, &map)) {
+          ++bad;
+          break;
+        }
+        stack[depth] = map ? map : &none;
+        owned[depth] = 0;
+        ++depth;
+        break;
+      }
+      case MELIAN_FILTER_AND:
+      case MELIAN_FILTER_OR: {
+        if (depth < 2) {
+          ++bad;
+          break;
+        }
+        Roaring* map = term->op == MELIAN_FILTER_AND ? roaring_and(stack[depth - 2], stack[depth - 1])
+                                                     : roaring_or(stack[depth - 2], stack[depth - 1]);
+        roaring_destroy(owned[depth - 1]);
+        roaring_destroy(owned[depth - 2]);
+        depth -= 2;
+        if (!map) {
+          ++bad;
+          break;
+        }
+        stack[depth] = owned[depth] = map;
+        ++depth;
+        break;
+      }
+      default:
+        ++bad;
+        break;
+    }
+  }
+
+  unsigned n = (unsigned)-1;
+  if (!bad && depth == 1) {
+    *total = roaring_cardinality(stack[0]);
+    n = 0;
+    while (n < limit) {
+      uint32_t rows[FILTER_SELECT_CHUNK];
+      unsigned want = limit - n < FILTER_SELECT_CHUNK ? limit - n : FILTER_SELECT_CHUNK;
+      unsigned got = roaring_select(stack[0], offset + n, want, rows);
+      for (unsigned k = 0; k < got; ++k) {
+        unsigned frame = slot->rows[rows[k]];
+        frames[n + k] = arena_get_ptr(slot->arena, frame);
+        frame_lens[n + k] = arena_get_frame_len(slot->arena, frame);
+      }
+      n += got;
+      if (got < want) break;
+    }
+  }
+  for (unsigned j = 0; j < depth; ++j) {
+    roaring_destroy(owned[j]);
+  }
+  table_pinned(slot, pin, n != (unsigned)-1 && n);
+  return n;
 }
 
 Data* data_build(Config* config) {
@@ -200,38 +1030,111 @@ void data_destroy(Data* data) {
 
 unsigned data_load_all_tables_from_db(Data* data, struct DB* db) {
   unsigned rows = 0;
-  unsigned now = time(0);
-  do {
-    unsigned tables = 0;
-    for (unsigned t = 0; t < data->table_count; ++t) {
-      Table* table = data->tables[t];
-      if (!table) continue;
-      tables += table_load_from_db(table, db, now, 0);
-    }
-    if (!tables) {
-      LOG_DEBUG("No tables to refresh");
-      break;
+  unsigned tables = 0;
+  for (unsigned t = 0; t < data->table_count; ++t) {
+    Table* table = data->tables[t];
+    if (!table) continue;
+    if (!table_load_from_db(table, db, time(0), 0)) {
+      table_release_standby(table, time(0));
+      continue;
     }
-
-    LOG_DEBUG("Refreshing %u tables", tables);
-    rows = 0;
-    db_connect(db);
-    for (unsigned t = 0; t < data->table_count; ++t) {
-      Table* table = data->tables[t];
-      if (!table) continue;
-      rows += table_load_from_db(table, db, now, 1);
+    unsigned idle = 0;
+    if (!atomic_compare_exchange_strong(&table->loading, &idle, 1)) {
+      LOG_DEBUG("Table %s is already being refreshed", table->name);
+      continue;
     }
-    db_disconnect(db);
-  } while (0);
 
+    // The connection stays open between loads; it is only checked here.
+    if (!tables && !db_ensure_connected(db)) {
+      atomic_store(&table->loading, 0);
+      break;
+    }
+    ++tables;
+    // This checks again that the table is due, since another thread may have
+    // loaded it between the first check and the claim.
+    rows += table_load_from_db(table, db, time(0), 1);
+    atomic_store(&table->loading, 0);
+  }
+  if (tables) {
+    LOG_DEBUG("Refreshed %u tables", tables);
+  } else {
+    LOG_DEBUG("No tables to refresh");
+  }
   return rows;
 }
 
-const Bucket* data_fetch(Data* data, unsigned table_id, unsigned index_id, const void *key, unsigned len) {
+const uint8_t* data_fetch(Data* data, unsigned table_id, unsigned index_id, const void *key, unsigned len, unsigned* frame_len,
+                          struct TableSlot** pin) {
+  *pin = 0;
   if (table_id >= ALEN(data->lookup)) return NULL;
   Table* table = data->lookup[table_id];
   if (!table) return NULL;
-  return table_fetch(table, index_id, key, len);
+  return table_fetch(table, index_id, key, len, frame_len, pin);
+}
+
+unsigned data_fetch_batch(Data* data, unsigned table_id, unsigned index_id, unsigned count,
+                          const void* const* keys, const uint32_t* key_lens,
+                          const uint8_t** frames, unsigned* frame_lens, struct TableSlot** pin) {
+  *pin = 0;
+  Table* table = table_id < ALEN(data->lookup) ? data->lookup[table_id] : NULL;
+  if (!table) {
+    for (unsigned j = 0; j < count; ++j) {
+      frames[j] = NULL;
+      frame_lens[j] = 0;
+    }
+    return 0;
+  }
+  return table_fetch_batch(table, index_id, count, keys, key_lens, frames, frame_lens, pin);
+}
+
+unsigned data_fetch_all(Data* data, unsigned table_id, unsigned index_id, const void *key, unsigned len,
+                        const struct Arena** arena, const unsigned** frames, unsigned* bytes,
+                        struct TableSlot** pin) {
+  *pin = 0;
+  if (table_id >= ALEN(data->lookup)) return (unsigned)-1;
+  Table* table = data->lookup[table_id];
+  if (!table) return (unsigned)-1;
+  return table_fetch_all(table, index_id, key, len, arena, frames, bytes, pin);
+}
+
+unsigned data_index_unique(Data* data, unsigned table_id, unsigned index_id) {
+  Table* table = table_id < ALEN(data->lookup) ? data->lookup[table_id] : NULL;
+  if (!table || index_id >= table->index_count) return 1;
+  return table->indexes[index_id].engine != CONFIG_INDEX_ENGINE_POSTINGS;
+}
+
+unsigned data_range(Data* data, unsigned table_id, unsigned index_id, const void *from, unsigned from_len,
+                    const void *to, unsigned to_len, unsigned limit,
+                    const uint8_t** frames, unsigned* frame_lens,
+                    const void** next, unsigned* next_len, struct TableSlot** pin) {
+  *pin = 0;
+  if (table_id >= ALEN(data->lookup)) return (unsigned)-1;
+  Table* table = data->lookup[table_id];
+  if (!table) return (unsigned)-1;
+  return table_range(table, index_id, from, from_len, to, to_len, limit, frames, frame_lens, next, next_len, pin);
+}
+
+unsigned data_prefix(Data* data, unsigned table_id, unsigned index_id, const void *prefix, unsigned prefix_len,
+                     const void *from, unsigned from_len, unsigned limit,
+                     const uint8_t** frames, unsigned* frame_lens,
+                     const void** next, unsigned* next_len, struct TableSlot** pin) {
+  *pin = 0;
+  if (table_id >= ALEN(data->lookup)) return (unsigned)-1;
+  Table* table = data->lookup[table_id];
+  if (!table) return (unsigned)-1;
+  return table_prefix(table, index_id, prefix, prefix_len, from, from_len, limit, frames, frame_lens, next, next_len, pin);
+}
+
+unsigned data_filter(Data* data, unsigned table_id, const DataFilterTerm* terms, unsigned count,
+                     unsigned offset, unsigned limit,
+                     const uint8_t** frames, unsigned* frame_lens, unsigned* total,
+                     struct TableSlot** pin) {
+  *total = 0;
+  *pin = 0;
+  if (table_id >= ALEN(data->lookup)) return (unsigned)-1;
+  Table* table = data->lookup[table_id];
+  if (!table) return (unsigned)-1;
+  return table_filter(table, terms, count, offset, limit, frames, frame_lens, total, pin);
 }
 
 void data_show_usage(void) {
@@ -2,13 +2,12 @@
 
 // Data stores the indexed data for all configured tables.
 // Each table has a period, indicating how often to refresh the data.
-// Each table has an arena for the actual data, and up to two hashes as indexes.
+// Each table has an arena for the actual data, and one Index per configured index.
 // Each table stores two slots of data, to allow lock-free data refreshes.
 
 #include <stdatomic.h>
 #include "protocol.h"
 
-struct Bucket;
 struct Config;
 struct DB;
 
@@ -17,29 +16,100 @@ struct TableStats {
   unsigned rows;
   unsigned min_id;
   unsigned max_id;
+  unsigned skipped;       // reloads skipped because the probe did not change
+  unsigned deltas;        // reloads that only read the rows past the watermark
+  unsigned reused;        // rows of the last load copied from the previous one
 };
 
 #include "config.h"
 
 struct TableSlot {
   struct Arena* arena;
-  struct Hash** indexes;
+  struct Index** indexes;
+  unsigned* rows;         // arena index of each row's preframed value, in load order;
+  unsigned row_count;     // only kept for tables with bitmap indexes
+  unsigned row_cap;
+  struct TableStage* snapshot;  // keys of every row, for tables reloaded by watermark
+  unsigned long long huge_bytes;  // of the arena and hash tables, counted once loaded
+  _Alignas(64) atomic_uint pins;  // responses being sent from this slot
 };
 
+// One step of a FILTER program, in reverse Polish notation: either push the rows
+// whose key in a bitmap index equals key, or pop two sets and push their AND / OR.
+typedef struct DataFilterTerm {
+  uint8_t op;             // one of enum MelianFilterOp
+  uint8_t index_id;
+  uint32_t key_len;
+  const void* key;
+} DataFilterTerm;
+
+// Keys read by the loader are staged with the frame of their row, and only
+// inserted once all rows are in the arena, into indexes sized for them.
+// A partitioned table is read by several queries at once, each one staging
+// its rows into an arena of its own; these are then merged into the slot.
+// A table with a watermark keeps the stage of each slot, so that a reload
+// can copy the rows that did not change along with their keys.
+// A table with a unique first index stores each row after a fingerprint of
+// its values; a row read again with the same fingerprint as the row with the
+// same key in the live slot is copied from it instead of being encoded.
+typedef struct TableStageEntry {
+  unsigned index;         // position of the index in the table
+  uint32_t key_len;       // length of key in bytes
+  unsigned key_off;       // offset of the key bytes in the stage
+  unsigned frame;         // index into arena memory for preframed value
+} TableStageEntry;
+
+typedef struct TableStage {
+  struct Arena* arena;    // where rows are stored
+  TableStageEntry* entries;
+  unsigned used;
+  unsigned cap;
+  uint8_t* keys;          // bytes of all staged keys
+  unsigned keys_used;
+  unsigned keys_cap;
+  unsigned* rows;         // frame of each row, if keep_rows is set
+  unsigned row_count;
+  unsigned row_cap;
+  unsigned keep_rows;
+  unsigned partition;     // part of the table read by the query, out of partitions
+  unsigned partitions;
+  const char* watermark;  // if set, only rows whose watermark column is not below it
+  unsigned fingerprint;   // whether each row is stored after the fingerprint of its values
+  struct Index* reuse_index;          // first index of the live slot, to find rows to reuse
+  const struct Arena* reuse_arena;
+  unsigned reused;        // rows copied from the live slot
+} TableStage;
+
 typedef struct TableIndex {
   unsigned id;
   char column[MELIAN_MAX_NAME_LEN];
   ConfigIndexType type;
+  ConfigIndexEngine engine;
 } TableIndex;
 
 typedef struct Table {
   unsigned table_id;
   char name[MELIAN_MAX_NAME_LEN];
   char select_stmt[MELIAN_MAX_SELECT_LEN];
+  char probe_stmt[MELIAN_MAX_SELECT_LEN];   // optional change probe, run before each reload
+  char probe_value[MELIAN_MAX_PROBE_LEN];   // what the probe returned before the last reload
+  char watermark[MELIAN_MAX_NAME_LEN];      // column that grows when a row changes, if any
+  char watermark_value[MELIAN_MAX_PROBE_LEN];  // its highest value before the last reload
+  unsigned full_every;    // loads between full reloads, which also drop deleted rows
+  unsigned since_full;    // loads since the last full reload
   unsigned period;
+  unsigned dense_factor;
+  unsigned huge_pages;    // whether slot arenas and their hash tables use huge pages
+  unsigned release_standby;  // whether the slot not being served is freed between reloads
+  unsigned standby_released; // whether it currently is
+  unsigned partitions;    // queries used to load the table, over as many connections
+  ConfigPartitionMode partition_mode;
+  unsigned keep_rows;     // whether slots record the frame of every row, for bitmap indexes
+  unsigned fingerprint;   // whether rows are stored after a fingerprint of their values
   unsigned index_count;
   TableIndex indexes[MELIAN_MAX_INDEXES];
   struct TableStats stats;
+  atomic_uint loading;    // set while a loader thread owns the table
   atomic_uint current_slot;
   struct TableSlot slots[2];
 } Table;
@@ -60,11 +130,83 @@ Table* table_build(const ConfigTableSpec* spec, unsigned arena_cap);
 void table_destroy(Table* table);
 const char* table_name(Table* table);
 unsigned table_load_from_db(Table* table, struct DB* db, unsigned now, unsigned load);
-const struct Bucket* table_fetch(Table* table, unsigned index_id, const void *key, unsigned len);
+// Record the preframed value of the next row stored in the arena of a stage.
+unsigned table_stage_row(TableStage* stage, unsigned frame);
+// Stage a key for an index of the table, pointing to the preframed value of its row.
+unsigned table_stage_key(TableStage* stage, unsigned index, const void *key, uint32_t key_len, unsigned frame);
+// Store the fingerprint of the values of the next row, if the stage keeps them.
+unsigned table_stage_fingerprint(TableStage* stage, uint64_t fingerprint);
+// Copy into a stage the row of the live slot with the same first key, if its
+// values have the same fingerprint; return its frame, (unsigned)-1 if there is
+// no such row, or 0 if it could not be copied.
+unsigned table_stage_reuse(TableStage* stage, const void *key, uint32_t key_len, uint64_t fingerprint);
+// Lookups return values from the current slot, and pin it if they return any:
+// the slot is not loaded again until the pin is dropped with data_unpin, once
+// the values have been sent.  Lookups that return nothing set pin to 0.
+void data_unpin(struct TableSlot* slot);
+// Pin the current slot of a table, to read its arena and indexes outside of a
+// lookup; drop the pin with data_unpin.
+struct TableSlot* table_pin(Table* table);
+// Return the preframed value for a key in the current slot, or NULL.
+const uint8_t* table_fetch(Table* table, unsigned index_id, const void *key, unsigned len, unsigned* frame_len,
+                           struct TableSlot** pin);
+// Same as table_fetch, for many keys at once; misses get a NULL frame.
+// Return the number of keys found.
+unsigned table_fetch_batch(Table* table, unsigned index_id, unsigned count,
+                           const void* const* keys, const uint32_t* key_lens,
+                           const uint8_t** frames, unsigned* frame_lens, struct TableSlot** pin);
+// Return the number of rows for a key of a postings index, pointing frames to the
+// indexes of their preframed values in arena; see index_get_all.
+unsigned table_fetch_all(Table* table, unsigned index_id, const void *key, unsigned len,
+                         const struct Arena** arena, const unsigned** frames, unsigned* bytes,
+                         struct TableSlot** pin);
+// Return the preframed values whose keys lie in [from, to], up to limit, in key order,
+// and the key to continue from in next, if more values match; see index_range.
+unsigned table_range(Table* table, unsigned index_id, const void *from, unsigned from_len,
+                     const void *to, unsigned to_len, unsigned limit,
+                     const uint8_t** frames, unsigned* frame_lens,
+                     const void** next, unsigned* next_len, struct TableSlot** pin);
+// Same as table_range, for the keys of a string index starting with prefix,
+// from the first one not less than from; see index_prefix.
+unsigned table_prefix(Table* table, unsigned index_id, const void *prefix, unsigned prefix_len,
+                      const void *from, unsigned from_len, unsigned limit,
+                      const uint8_t** frames, unsigned* frame_lens,
+                      const void** next, unsigned* next_len, struct TableSlot** pin);
+// Run a FILTER program over the bitmap indexes of a table, setting total to the
+// number of matching rows and returning the preframed values of up to limit of
+// them, in load order, after skipping the first offset ones.  Return (unsigned)-1
+// if the program is invalid or uses an index that is not a bitmap index.
+unsigned table_filter(Table* table, const DataFilterTerm* terms, unsigned count,
+                      unsigned offset, unsigned limit,
+                      const uint8_t** frames, unsigned* frame_lens, unsigned* total,
+                      struct TableSlot** pin);
 
 Data* data_build(struct Config* config);
 void data_destroy(Data* data);
+// Load the tables that are due, skipping those being loaded by another thread;
+// this can run in several threads at once, each with its own DB.
 unsigned data_load_all_tables_from_db(Data* data, struct DB* db);
-const struct Bucket* data_fetch(Data* data, unsigned table_id, unsigned index_id, const void *key, unsigned len);
+const uint8_t* data_fetch(Data* data, unsigned table_id, unsigned index_id, const void *key, unsigned len, unsigned* frame_len,
+                          struct TableSlot** pin);
+unsigned data_fetch_batch(Data* data, unsigned table_id, unsigned index_id, unsigned count,
+                          const void* const* keys, const uint32_t* key_lens,
+                          const uint8_t** frames, unsigned* frame_lens, struct TableSlot** pin);
+unsigned data_fetch_all(Data* data, unsigned table_id, unsigned index_id, const void *key, unsigned len,
+                        const struct Arena** arena, const unsigned** frames, unsigned* bytes,
+                        struct TableSlot** pin);
+// Return 0 if an index may map a key to several rows, 1 otherwise.
+unsigned data_index_unique(Data* data, unsigned table_id, unsigned index_id);
+unsigned data_range(Data* data, unsigned table_id, unsigned index_id, const void *from, unsigned from_len,
+                    const void *to, unsigned to_len, unsigned limit,
+                    const uint8_t** frames, unsigned* frame_lens,
+                    const void** next, unsigned* next_len, struct TableSlot** pin);
+unsigned data_prefix(Data* data, unsigned table_id, unsigned index_id, const void *prefix, unsigned prefix_len,
+                     const void *from, unsigned from_len, unsigned limit,
+                     const uint8_t** frames, unsigned* frame_lens,
+                     const void** next, unsigned* next_len, struct TableSlot** pin);
+unsigned data_filter(Data* data, unsigned table_id, const DataFilterTerm* terms, unsigned count,
+                     unsigned offset, unsigned limit,
+                     const uint8_t** frames, unsigned* frame_lens, unsigned* total,
+                     struct TableSlot** pin);
 void data_show_usage(void);
 const char* data_schema_json(Data* data, unsigned* len);
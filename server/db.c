@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #ifdef HAVE_MYSQL
 #include <mysql/mysql.h>
 #endif
@@ -14,7 +15,8 @@
 #include "util.h"
 #include "log.h"
 #include "arena.h"
-#include "hash.h"
+#include "encoder.h"
+#include "xxhash.h"
 #include "config.h"
 #include "db.h"
 #include "data.h"
@@ -22,50 +24,156 @@
 // TODO: make these limits dynamic? Arena?
 enum {
   MAX_FIELDS = 99,
-  MAX_FIELD_NAME_LEN = 100,
-  MAX_JSON_LEN = 10240,
   MAX_SQL_LEN = 1024,
+  BACKOFF_MIN = 1,              // seconds to wait after a first failure to connect
+  BACKOFF_MAX = 60,             // longest wait between attempts to connect
+  STATEMENTS_INITIAL_CAPACITY = 8,
+  MYSQL_VALUE_INITIAL = 64,     // bytes first allocated for each column fetched from MySQL
+  FINGERPRINT_NULL = 0x100,     // fingerprint tag of a NULL value, apart from any value tag
+  PROBE_PARTITION = MELIAN_MAX_PARTITIONS,  // statement slot used by the change probe of a table
+  DELTA_PARTITION,              // statement slot used to read the rows past the watermark
+  WATERMARK_PARTITION,          // statement slot used to read the highest watermark
 };
 
-static const char* table_select_sql(Table* table) {
-  if (!table) return "";
-  if (!table->select_stmt[0] && table->name[0]) {
-    snprintf(table->select_stmt, sizeof(table->select_stmt), "SELECT * FROM %s", table->name);
+// Write a value as an SQL literal: a number as it is, so that it compares as
+// one whatever the type of the column, and anything else as a quoted string,
+// doubling quotes, and backslashes for MySQL, which reads them as escapes.
+// PostgreSQL gives a quoted literal the type of the column it is compared to,
+// and would refuse a number next to a text column, so it always gets quotes.
+static void sql_literal(const DB* db, const char* value, char* out, unsigned len) {
+  ConfigDbDriver driver = db->config->db.driver;
+  const char* p = value;
+  if (*p == '-') ++p;
+  unsigned digits = 0;
+  unsigned dots = 0;
+  for (; *p; ++p) {
+    if (*p >= '0' && *p <= '9') {
+      ++digits;
+    } else if (*p != '.' || dots++) {
+      break;
+    }
+  }
+  if (!*p && digits && p[-1] != '.' && driver != CONFIG_DB_DRIVER_POSTGRESQL) {
+    snprintf(out, len, "%s", value);
+    return;
+  }
+
+  unsigned backslash = driver == CONFIG_DB_DRIVER_MYSQL;
+  unsigned pos = 0;
+  if (len < 3) return;
+  out[pos++] = '\'';
+  for (p = value; *p && pos + 3 < len; ++p) {
+    if (*p == '\'' || (backslash && *p == '\\')) out[pos++] = *p;
+    out[pos++] = *p;
   }
-  return table->select_stmt;
+  out[pos++] = '\'';
+  out[pos] = '\0';
+}
+
+// The query for the part of a table read into a stage.  Rows past a watermark
+// also include those at it, since more of them may have been written since.
+// A partitioned table is split on its first index: in ranges of the keys seen
+// by the previous load, with keys outside of them going to the first or last
+// part, or else by modulo.
+static const char* table_select_sql(const DB* db, Table* table, const TableStage* stage, char* sql, unsigned len) {
+  if (stage->watermark) {
+    char mark[2 * MELIAN_MAX_PROBE_LEN + 3];
+    sql_literal(db, stage->watermark, mark, sizeof(mark));
+    snprintf(sql, len, "SELECT * FROM (%s) AS melian_delta WHERE %s >= %s",
+             table->select_stmt, table->watermark, mark);
+    return sql;
+  }
+  if (stage->partitions <= 1) return table->select_stmt;
+
+  const char* column = table->indexes[0].column;
+  unsigned part = stage->partition;
+  unsigned last = stage->partitions - 1;
+  unsigned long long lo = table->stats.min_id;
+  unsigned long long hi = table->stats.max_id;
+  char cond[MAX_SQL_LEN];
+  if (table->partition_mode == CONFIG_PARTITION_RANGE && hi > lo) {
+    unsigned long long step = (hi - lo) / stage->partitions + 1;
+    unsigned long long beg = lo + part * step;
+    unsigned long long end = beg + step;
+    if (part == 0) {
+      snprintf(cond, sizeof(cond), "%s < %llu OR %s IS NULL", column, end, column);
+    } else if (part == last) {
+      snprintf(cond, sizeof(cond), "%s >= %llu", column, beg);
+    } else {
+      snprintf(cond, sizeof(cond), "%s >= %llu AND %s < %llu", column, beg, column, end);
+    }
+  } else if (part == 0) {
+    snprintf(cond, sizeof(cond), "ABS(%s %% %u) = 0 OR %s IS NULL", column, stage->partitions, column);
+  } else {
+    snprintf(cond, sizeof(cond), "ABS(%s %% %u) = %u", column, stage->partitions, part);
+  }
+  snprintf(sql, len, "SELECT * FROM (%s) AS melian_part WHERE %s", table->select_stmt, cond);
+  return sql;
 }
 
 #ifdef HAVE_MYSQL
 static void mysql_refresh_versions(DB* db);
 static void db_mysql_connect(DB* db);
 static void db_mysql_disconnect(DB* db);
-static unsigned db_mysql_get_table_size(DB* db, Table* table);
-static unsigned db_mysql_query_into_hash(DB* db, Table* table, struct TableSlot* slot,
+static EncoderType mysql_encoder_type(enum enum_field_types type);
+static unsigned db_mysql_query_into_hash(DB* db, Table* table, TableStage* stage,
                             unsigned* min_id, unsigned* max_id);
+static unsigned db_mysql_probe(DB* db, Table* table, unsigned partition, const char* sql,
+                               char* value, unsigned len);
+static MYSQL_STMT* db_mysql_prepare(DB* db, Table* table, unsigned partition, const char* sql);
+static atomic_uint mysql_users;   // DBs built for MySQL, which all share the client library
+
+// The columns of a row of a MySQL statement, all fetched as text.
+typedef __typeof__(*((MYSQL_BIND*) 0)->is_null) MySQLFlag;   // bool or my_bool, by client library
+typedef struct MySQLRow {
+  unsigned count;
+  MYSQL_BIND binds[MAX_FIELDS];
+  char* buffers[MAX_FIELDS];
+  unsigned long caps[MAX_FIELDS];     // bytes each buffer holds, besides a NUL
+  unsigned long lengths[MAX_FIELDS];
+  MySQLFlag nulls[MAX_FIELDS];
+  char* values[MAX_FIELDS];           // buffers of the current row, 0 for NULL values
+} MySQLRow;
+static unsigned mysql_row_bind(MYSQL_STMT* stmt, MySQLRow* row, unsigned count);
+static int mysql_row_fetch(MYSQL_STMT* stmt, MySQLRow* row);
+static void mysql_row_free(MySQLRow* row);
 #endif
 
 #ifdef HAVE_SQLITE3
 static void sqlite_refresh_versions(DB* db);
 static void db_sqlite_connect(DB* db);
 static void db_sqlite_disconnect(DB* db);
-static unsigned db_sqlite_get_table_size(DB* db, Table* table);
-static unsigned db_sqlite_query_into_hash(DB* db, Table* table, struct TableSlot* slot,
+static unsigned db_sqlite_query_into_hash(DB* db, Table* table, TableStage* stage,
                             unsigned* min_id, unsigned* max_id);
+static unsigned db_sqlite_probe(DB* db, Table* table, unsigned partition, const char* sql,
+                                char* value, unsigned len);
 #endif
 
 #ifdef HAVE_POSTGRESQL
 static void postgres_refresh_versions(DB* db);
 static void db_postgresql_connect(DB* db);
 static void db_postgresql_disconnect(DB* db);
-static unsigned db_postgresql_get_table_size(DB* db, Table* table);
-static unsigned db_postgresql_query_into_hash(DB* db, Table* table, struct TableSlot* slot,
+static EncoderType postgres_encoder_type(Oid type);
+static unsigned db_postgresql_query_into_hash(DB* db, Table* table, TableStage* stage,
                             unsigned* min_id, unsigned* max_id);
+static unsigned db_postgresql_probe(DB* db, Table* table, unsigned partition, const char* sql,
+                                    char* value, unsigned len);
+static void postgres_statement_name(const DBStatement* statement, char* name, unsigned len);
 #endif
 
 #if !defined(HAVE_MYSQL) || !defined(HAVE_SQLITE3) || !defined(HAVE_POSTGRESQL)
 static void driver_not_supported(ConfigDbDriver driver);
 #endif
 
+static unsigned db_is_connected(DB* db);
+static unsigned db_is_alive(DB* db);
+static DBStatement* db_statement(DB* db, Table* table, unsigned partition, const char* sql);
+static void db_statement_release(DB* db, DBStatement* statement, unsigned connected);
+static unsigned probe_append(char* value, unsigned len, unsigned pos, unsigned col, const char* text);
+static unsigned reuse_row(Table* table, TableStage* stage, const char* key, unsigned key_len, uint64_t fingerprint);
+static unsigned db_run_probe(DB* db, Table* table, unsigned partition, const char* sql,
+                             char* value, unsigned len);
+
 DB* db_build(Config* config) {
   DB* db = 0;
   do {
@@ -77,15 +185,17 @@ DB* db_build(Config* config) {
     db->config = config;
     db->client_version[0] = '\0';
     db->server_version[0] = '\0';
+    db->stats = &db->own_stats;
 
     switch (config->db.driver) {
       case CONFIG_DB_DRIVER_MYSQL:
 #ifdef HAVE_MYSQL
-        if (mysql_library_init(0, 0, 0) != 0) {
+        // The client library is set up by the first DB and torn down with the
+        // last one; the server DB lives as long as any other.
+        if (atomic_fetch_add(&mysql_users, 1) == 0 && mysql_library_init(0, 0, 0) != 0) {
           LOG_WARN("mysql_library_init failed");
-        } else {
-          db->mysql_initialized = 1;
         }
+        db->mysql_initialized = 1;
         mysql_refresh_versions(db);
         break;
 #else
@@ -116,12 +226,35 @@ DB* db_build(Config* config) {
   return db;
 }
 
+DB* db_clone(DB* db) {
+  DB* clone = db_build(db->config);
+  if (clone) clone->stats = db->stats;
+  return clone;
+}
+
+void db_thread_end(void) {
+#ifdef HAVE_MYSQL
+  mysql_thread_end();
+#endif
+}
+
+DB* db_part(DB* db, unsigned part) {
+  if (part >= MELIAN_MAX_PARTITIONS) return 0;
+  if (!part) return db;
+  if (!db->parts[part]) db->parts[part] = db_clone(db);
+  return db->parts[part];
+}
+
 void db_destroy(DB* db) {
   if (!db) return;
+  for (unsigned p = 1; p < MELIAN_MAX_PARTITIONS; ++p) {
+    if (db->parts[p]) db_destroy(db->parts[p]);
+  }
   db_disconnect(db);
+  if (db->statements) free(db->statements);
 #ifdef HAVE_MYSQL
   if (db->mysql_initialized) {
-    mysql_library_end();
+    if (atomic_fetch_sub(&mysql_users, 1) == 1) mysql_library_end();
     db->mysql_initialized = 0;
   }
 #endif
@@ -130,6 +263,7 @@ void db_destroy(DB* db) {
 
 void db_connect(DB* db) {
   if (!db) return;
+  double t0 = now_sec();
   switch (db->config->db.driver) {
     case CONFIG_DB_DRIVER_MYSQL:
 #ifdef HAVE_MYSQL
@@ -159,10 +293,24 @@ void db_connect(DB* db) {
       LOG_FATAL("Unknown database driver id %d", db->config->db.driver);
       break;
   }
+  if (!db_is_connected(db)) {
+    atomic_fetch_add(&db->stats->failures, 1);
+    return;
+  }
+  unsigned elapsed = (now_sec() - t0) * 1000000;
+  atomic_fetch_add(&db->stats->connects, 1);
+  atomic_fetch_add(&db->stats->connect_us, elapsed);
+  atomic_store(&db->stats->last_connect_us, elapsed);
+  LOG_DEBUG("Connected to database in %u us", elapsed);
 }
 
 void db_disconnect(DB* db) {
   if (!db) return;
+  // Statements belong to the connection.
+  for (unsigned j = 0; j < db->statement_count; ++j) {
+    db_statement_release(db, &db->statements[j], 0);
+  }
+  db->statement_count = 0;
   switch (db->config->db.driver) {
     case CONFIG_DB_DRIVER_MYSQL:
 #ifdef HAVE_MYSQL
@@ -190,62 +338,238 @@ void db_disconnect(DB* db) {
   }
 }
 
-unsigned db_get_table_size(DB* db, Table* table) {
+unsigned db_ensure_connected(DB* db) {
   if (!db) return 0;
+  if (db_is_connected(db)) {
+    if (db_is_alive(db)) return 1;
+    LOG_WARN("Lost connection to database, connecting again");
+    atomic_fetch_add(&db->stats->lost, 1);
+    db_disconnect(db);
+  }
+
+  unsigned now = time(0);
+  if (now < db->retry_at) {
+    LOG_DEBUG("Not connecting to database for %u more seconds", db->retry_at - now);
+    return 0;
+  }
+  db_connect(db);
+  if (db_is_connected(db)) {
+    db->backoff = 0;
+    db->retry_at = 0;
+    return 1;
+  }
+  db->backoff = db->backoff ? 2 * db->backoff : BACKOFF_MIN;
+  if (db->backoff > BACKOFF_MAX) db->backoff = BACKOFF_MAX;
+  db->retry_at = now + db->backoff;
+  LOG_WARN("Could not connect to database, trying again in %u seconds", db->backoff);
+  return 0;
+}
+
+static unsigned db_is_connected(DB* db) {
   switch (db->config->db.driver) {
-    case CONFIG_DB_DRIVER_MYSQL:
 #ifdef HAVE_MYSQL
-      return db_mysql_get_table_size(db, table);
-#else
-      driver_not_supported(db->config->db.driver);
-      return 0;
+    case CONFIG_DB_DRIVER_MYSQL:
+      return db->mysql != 0;
 #endif
+#ifdef HAVE_SQLITE3
     case CONFIG_DB_DRIVER_SQLITE:
+      return db->sqlite != 0;
+#endif
+#ifdef HAVE_POSTGRESQL
+    case CONFIG_DB_DRIVER_POSTGRESQL:
+      return db->postgres != 0;
+#endif
+    default:
+      return 0;
+  }
+}
+
+static unsigned db_is_alive(DB* db) {
+  switch (db->config->db.driver) {
+#ifdef HAVE_MYSQL
+    case CONFIG_DB_DRIVER_MYSQL:
+      return mysql_ping((MYSQL*) db->mysql) == 0;
+#endif
 #ifdef HAVE_SQLITE3
-      return db_sqlite_get_table_size(db, table);
-#else
-      driver_not_supported(db->config->db.driver);
+    case CONFIG_DB_DRIVER_SQLITE:
+      return 1;
+#endif
+#ifdef HAVE_POSTGRESQL
+    case CONFIG_DB_DRIVER_POSTGRESQL:
+      return PQstatus(db->postgres) == CONNECTION_OK;
+#endif
+    default:
       return 0;
+  }
+}
+
+// The statement for a part of a table, or for its probe; it needs to be
+// prepared if it is new, or if its SQL changed since it was last prepared.
+static DBStatement* db_statement(DB* db, Table* table, unsigned partition, const char* sql) {
+  DBStatement* statement = 0;
+  for (unsigned j = 0; j < db->statement_count; ++j) {
+    if (db->statements[j].table_id != table->table_id) continue;
+    if (db->statements[j].partition != partition) continue;
+    statement = &db->statements[j];
+    break;
+  }
+  if (statement) {
+    if (strcmp(statement->sql, sql) == 0) return statement;
+    db_statement_release(db, statement, 1);
+  } else {
+    if (db->statement_count >= db->statement_cap) {
+      unsigned cap = db->statement_cap ? 2 * db->statement_cap : STATEMENTS_INITIAL_CAPACITY;
+      DBStatement* statements = realloc(db->statements, cap * sizeof(DBStatement));
+      if (!statements) {
+        LOG_WARN("Could not grow statement array to %u statements", cap);
+        return 0;
+      }
+      db->statements = statements;
+      db->statement_cap = cap;
+    }
+    statement = &db->statements[db->statement_count++];
+    memset(statement, 0, sizeof(DBStatement));
+    statement->table_id = table->table_id;
+    statement->partition = partition;
+  }
+  statement->sql = strdup(sql);
+  if (!statement->sql) {
+    LOG_WARN("Could not copy statement for table %s", table_name(table));
+    *statement = db->statements[--db->statement_count];
+    return 0;
+  }
+  return statement;
+}
+
+// Free a statement; if the connection is still in use, also drop it there.
+static void db_statement_release(DB* db, DBStatement* statement, unsigned connected) {
+  switch (db->config->db.driver) {
+#ifdef HAVE_MYSQL
+    case CONFIG_DB_DRIVER_MYSQL:
+      if (statement->handle) mysql_stmt_close((MYSQL_STMT*) statement->handle);
+      break;
 #endif
+#ifdef HAVE_SQLITE3
+    case CONFIG_DB_DRIVER_SQLITE:
+      if (statement->handle) sqlite3_finalize((sqlite3_stmt*) statement->handle);
+      break;
+#endif
+#ifdef HAVE_POSTGRESQL
     case CONFIG_DB_DRIVER_POSTGRESQL:
+      if (connected && statement->prepared && db->postgres) {
+        char name[MAX_SQL_LEN];
+        char sql[2 * MAX_SQL_LEN];
+        postgres_statement_name(statement, name, sizeof(name));
+        snprintf(sql, sizeof(sql), "DEALLOCATE %s", name);
+        PQclear(PQexec(db->postgres, sql));
+      }
+      break;
+#endif
+    default:
+      (void) connected;
+      break;
+  }
+  if (statement->sql) free(statement->sql);
+  statement->sql = 0;
+  statement->handle = 0;
+  statement->prepared = 0;
+}
+
+// Chain the fingerprint of the values of a row with its next column; the tag
+// tells apart values that are encoded differently, and NULL from empty values.
+static inline uint64_t fingerprint_add(uint64_t fingerprint, unsigned tag, const char* value, unsigned len) {
+  if (!value) return XXH3_64bits("", 0, fingerprint + FINGERPRINT_NULL);
+  return XXH3_64bits(value, len, fingerprint + tag);
+}
+
+// Copy the row with the same first key from the live slot, if it has the same
+// fingerprint, or else store the fingerprint of the row about to be encoded.
+// Return the frame of the copy, (unsigned)-1 to encode the row, or 0 on error.
+static unsigned reuse_row(Table* table, TableStage* stage, const char* key, unsigned key_len, uint64_t fingerprint) {
+  unsigned frame = (unsigned)-1;
+  if (key && key_len) {
+    if (table->indexes[0].type == CONFIG_INDEX_TYPE_INT) {
+      unsigned key_int = (unsigned) strtoll(key, 0, 10);
+      frame = table_stage_reuse(stage, &key_int, sizeof(unsigned), fingerprint);
+    } else {
+      frame = table_stage_reuse(stage, key, key_len, fingerprint);
+    }
+  }
+  if (frame == (unsigned)-1 && !table_stage_fingerprint(stage, fingerprint)) {
+    LOG_WARN("Could not store row fingerprint for table %s", table_name(table));
+    return 0;
+  }
+  return frame;
+}
+
+// Append a column of the first row returned by a probe to its value.
+static unsigned probe_append(char* value, unsigned len, unsigned pos, unsigned col, const char* text) {
+  if (pos >= len) return pos;
+  int wrote = snprintf(value + pos, len - pos, "%s%s", col ? "|" : "", text ? text : "");
+  return wrote < 0 ? pos : pos + wrote;
+}
+
+// Run a statement and store the first row it returns in value.
+static unsigned db_run_probe(DB* db, Table* table, unsigned partition, const char* sql,
+                             char* value, unsigned len) {
+  value[0] = '\0';
+  switch (db->config->db.driver) {
+#ifdef HAVE_MYSQL
+    case CONFIG_DB_DRIVER_MYSQL:
+      return db_mysql_probe(db, table, partition, sql, value, len);
+#endif
+#ifdef HAVE_SQLITE3
+    case CONFIG_DB_DRIVER_SQLITE:
+      return db_sqlite_probe(db, table, partition, sql, value, len);
+#endif
 #ifdef HAVE_POSTGRESQL
-      return db_postgresql_get_table_size(db, table);
-#else
-      driver_not_supported(db->config->db.driver);
-      return 0;
+    case CONFIG_DB_DRIVER_POSTGRESQL:
+      return db_postgresql_probe(db, table, partition, sql, value, len);
 #endif
     default:
       return 0;
   }
 }
 
-unsigned db_query_into_hash(DB* db, Table* table, struct TableSlot* slot,
+unsigned db_probe(DB* db, Table* table, char* value, unsigned len) {
+  if (!db || !table->probe_stmt[0] || !len) return 0;
+  return db_run_probe(db, table, PROBE_PARTITION, table->probe_stmt, value, len);
+}
+
+unsigned db_watermark(DB* db, Table* table, char* value, unsigned len) {
+  if (!db || !table->watermark[0] || !len) return 0;
+  char sql[MELIAN_MAX_SELECT_LEN + MAX_SQL_LEN];
+  snprintf(sql, sizeof(sql), "SELECT MAX(%s) FROM (%s) AS melian_mark", table->watermark, table->select_stmt);
+  return db_run_probe(db, table, WATERMARK_PARTITION, sql, value, len);
+}
+
+unsigned db_query_into_hash(DB* db, Table* table, TableStage* stage,
                             unsigned* min_id, unsigned* max_id) {
-  if (!db) return 0;
+  if (!db) return (unsigned)-1;
   switch (db->config->db.driver) {
     case CONFIG_DB_DRIVER_MYSQL:
 #ifdef HAVE_MYSQL
-      return db_mysql_query_into_hash(db, table, slot, min_id, max_id);
+      return db_mysql_query_into_hash(db, table, stage, min_id, max_id);
 #else
       driver_not_supported(db->config->db.driver);
-      return 0;
+      return (unsigned)-1;
 #endif
     case CONFIG_DB_DRIVER_SQLITE:
 #ifdef HAVE_SQLITE3
-      return db_sqlite_query_into_hash(db, table, slot, min_id, max_id);
+      return db_sqlite_query_into_hash(db, table, stage, min_id, max_id);
 #else
       driver_not_supported(db->config->db.driver);
-      return 0;
+      return (unsigned)-1;
 #endif
     case CONFIG_DB_DRIVER_POSTGRESQL:
 #ifdef HAVE_POSTGRESQL
-      return db_postgresql_query_into_hash(db, table, slot, min_id, max_id);
+      return db_postgresql_query_into_hash(db, table, stage, min_id, max_id);
 #else
       driver_not_supported(db->config->db.driver);
-      return 0;
+      return (unsigned)-1;
 #endif
     default:
-      return 0;
+      return (unsigned)-1;
   }
 }
 
@@ -301,61 +625,118 @@ static void db_mysql_disconnect(DB* db) {
   LOG_INFO("Disconnected from MySQL server at %s:%u", cfg->host, cfg->port);
 }
 
-static unsigned db_mysql_get_table_size(DB* db, Table* table) {
-  unsigned rows = 0;
-  unsigned count = 0;
-  MYSQL_RES *result = 0;
-  do {
-    if (!db->mysql) {
-      LOG_WARN("Cannot get table size for %s, invalid MySQL connection", table_name(table));
-      break;
-    }
+// Columns of these types are encoded as strings, all others as numbers.
+static EncoderType mysql_encoder_type(enum enum_field_types type) {
+  switch (type) {
+    case MYSQL_TYPE_TIMESTAMP:
+    case MYSQL_TYPE_DATE:
+    case MYSQL_TYPE_TIME:
+    case MYSQL_TYPE_DATETIME:
+    case MYSQL_TYPE_VARCHAR:
+    case MYSQL_TYPE_TIMESTAMP2:
+    case MYSQL_TYPE_DATETIME2:
+    case MYSQL_TYPE_TIME2:
+    case MYSQL_TYPE_JSON:
+    case MYSQL_TYPE_ENUM:
+    case MYSQL_TYPE_SET:
+    case MYSQL_TYPE_TINY_BLOB:
+    case MYSQL_TYPE_MEDIUM_BLOB:
+    case MYSQL_TYPE_LONG_BLOB:
+    case MYSQL_TYPE_BLOB:
+    case MYSQL_TYPE_VAR_STRING:
+    case MYSQL_TYPE_STRING:
+    case MYSQL_TYPE_GEOMETRY:
+      return ENCODER_TYPE_STRING;
+    default:
+      return ENCODER_TYPE_NUMBER;
+  }
+}
 
-    const char* select_sql = table_select_sql(table);
-    LOG_DEBUG("Counting rows from table %s", table_name(table));
-    char sql[MAX_SQL_LEN];
-    snprintf(sql, MAX_SQL_LEN, "SELECT COUNT(*) FROM (%s) AS melian_sub", select_sql);
-    if (mysql_query((MYSQL*) db->mysql, sql)) {
-      LOG_WARN("Cannot run query [%s] for table %s", sql, table_name(table));
-      break;
+// The statement for a part of a table, or for its probe, prepared on the
+// connection if it was not yet; it is closed along with the connection.
+static MYSQL_STMT* db_mysql_prepare(DB* db, Table* table, unsigned partition, const char* sql) {
+  DBStatement* statement = db_statement(db, table, partition, sql);
+  if (!statement) return 0;
+  if (!statement->prepared) {
+    MYSQL_STMT* handle = mysql_stmt_init((MYSQL*) db->mysql);
+    if (!handle) {
+      LOG_WARN("Could not allocate MySQL statement for table %s", table_name(table));
+      return 0;
     }
-
-    result = mysql_store_result((MYSQL*) db->mysql);
-    if (!result) {
-      LOG_WARN("Cannot store MySQL result for COUNT query for table %s", table_name(table));
-      break;
+    if (mysql_stmt_prepare(handle, sql, strlen(sql))) {
+      LOG_WARN("Cannot prepare [%s] for table %s: %s", sql, table_name(table), mysql_stmt_error(handle));
+      mysql_stmt_close(handle);
+      return 0;
     }
+    statement->handle = handle;
+    statement->prepared = 1;
+  }
+  return (MYSQL_STMT*) statement->handle;
+}
 
-    unsigned num_fields = mysql_num_fields(result);
-    if (num_fields != 1) {
-      LOG_WARN("Expected %u number of fields for COUNT query for table %s, got %u",
-               1, table_name(table), num_fields);
-      break;
-    }
+// Fetch every column of a statement as text, as the text protocol returns it,
+// into buffers that grow to fit the longest value read.
+static unsigned mysql_row_bind(MYSQL_STMT* stmt, MySQLRow* row, unsigned count) {
+  for (unsigned col = 0; col < count; ++col) {
+    row->buffers[col] = malloc(MYSQL_VALUE_INITIAL + 1);
+    if (!row->buffers[col]) return 0;
+    row->count = col + 1;
+    row->caps[col] = MYSQL_VALUE_INITIAL;
+    MYSQL_BIND* bind = &row->binds[col];
+    memset(bind, 0, sizeof(MYSQL_BIND));
+    bind->buffer_type = MYSQL_TYPE_STRING;
+    bind->buffer = row->buffers[col];
+    bind->buffer_length = row->caps[col];
+    bind->length = &row->lengths[col];
+    bind->is_null = &row->nulls[col];
+  }
+  return mysql_stmt_bind_result(stmt, row->binds) == 0;
+}
 
-    MYSQL_ROW row;
-    while ((row = mysql_fetch_row(result))) {
-      for (unsigned col = 0; col < num_fields; col++) {
-        count = atoi(row[col]);
-      }
-      ++rows;
+// Fetch the next row, pointing values to its NUL-terminated columns, or to 0
+// for NULL ones; return 1 if there was a row, 0 at the end, -1 on error.
+static int mysql_row_fetch(MYSQL_STMT* stmt, MySQLRow* row) {
+  int rc = mysql_stmt_fetch(stmt);
+  if (rc == MYSQL_NO_DATA) return 0;
+  if (rc != 0 && rc != MYSQL_DATA_TRUNCATED) return -1;
+  unsigned grown = 0;
+  for (unsigned col = 0; col < row->count; ++col) {
+    if (row->nulls[col]) {
+      row->values[col] = 0;
+      continue;
     }
-    if (rows != 1) {
-      LOG_WARN("Expected %u rows for COUNT query for table %s, got %u",
-               1, table_name(table), rows);
-      break;
+    if (row->lengths[col] > row->caps[col]) {
+      // Read the whole value again, into a buffer that fits it.
+      unsigned long cap = row->lengths[col];
+      char* buffer = realloc(row->buffers[col], cap + 1);
+      if (!buffer) return -1;
+      row->buffers[col] = buffer;
+      row->caps[col] = cap;
+      row->binds[col].buffer = buffer;
+      row->binds[col].buffer_length = cap;
+      if (mysql_stmt_fetch_column(stmt, &row->binds[col], col, 0)) return -1;
+      grown = 1;
     }
-  } while (0);
+    row->buffers[col][row->lengths[col]] = '\0';
+    row->values[col] = row->buffers[col];
+  }
+  if (grown && mysql_stmt_bind_result(stmt, row->binds)) return -1;
+  return 1;
+}
 
-  if (result) mysql_free_result(result);
-  LOG_DEBUG("Counted %u rows from table %s", count, table_name(table));
-  return count;
+static void mysql_row_free(MySQLRow* row) {
+  for (unsigned col = 0; col < row->count; ++col) free(row->buffers[col]);
+  row->count = 0;
 }
 
-static unsigned db_mysql_query_into_hash(DB* db, Table* table, struct TableSlot* slot,
+static unsigned db_mysql_query_into_hash(DB* db, Table* table, TableStage* stage,
                                          unsigned* min_id, unsigned* max_id) {
   unsigned rows = 0;
+  unsigned ok = 0;
+  MYSQL_STMT* stmt = 0;
   MYSQL_RES *result = 0;
+  MySQLRow bound = {0};
+  Encoder* encoder = 0;
   do {
     if (!db->mysql) {
       LOG_WARN("Cannot query table data for %s, invalid MySQL connection", table_name(table));
@@ -364,15 +745,19 @@ static unsigned db_mysql_query_into_hash(DB* db, Table* table, struct TableSlot*
 
     double t0 = now_sec();
     LOG_DEBUG("Fetching from table %s", table_name(table));
-    const char* query = table_select_sql(table);
-    if (mysql_query((MYSQL*) db->mysql, query)) {
-      LOG_WARN("Cannot run query [%s] for table %s", query, table_name(table));
+    char sql[MELIAN_MAX_SELECT_LEN + 2 * MAX_SQL_LEN];
+    const char* query = table_select_sql(db, table, stage, sql, sizeof(sql));
+    stmt = db_mysql_prepare(db, table, stage->watermark ? DELTA_PARTITION : stage->partition, query);
+    if (!stmt) break;
+    // Rows are fetched from the server as they are read, since the result is
+    // not stored in the client library first.
+    if (mysql_stmt_execute(stmt)) {
+      LOG_WARN("Cannot run query [%s] for table %s: %s", query, table_name(table), mysql_stmt_error(stmt));
       break;
     }
-
-    result = mysql_store_result((MYSQL*) db->mysql);
+    result = mysql_stmt_result_metadata(stmt);
     if (!result) {
-      LOG_WARN("Cannot store MySQL result for SELECT query for table %s", table_name(table));
+      LOG_WARN("Cannot get MySQL result columns for SELECT query for table %s", table_name(table));
       break;
     }
 
@@ -383,7 +768,9 @@ static unsigned db_mysql_query_into_hash(DB* db, Table* table, struct TableSlot*
       break;
     }
 
-    char names[MAX_FIELDS][MAX_FIELD_NAME_LEN];
+    encoder = encoder_build(num_fields, db->config->table.strip_null);
+    if (!encoder) break;
+
     enum enum_field_types types[MAX_FIELDS];
     int index_pos[MELIAN_MAX_INDEXES];
     for (unsigned idx = 0; idx < MELIAN_MAX_INDEXES; ++idx) index_pos[idx] = -1;
@@ -399,7 +786,10 @@ static unsigned db_mysql_query_into_hash(DB* db, Table* table, struct TableSlot*
 
       types[col] = field->type;
       LOG_DEBUG("Column %u type %u", col, (unsigned) field->type);
-      snprintf(names[col], MAX_FIELD_NAME_LEN, "%s", field->name);
+      if (!encoder_add_column(encoder, field->name, mysql_encoder_type(field->type))) {
+        ++bad;
+        break;
+      }
       for (unsigned idx = 0; idx < table->index_count; ++idx) {
         if (strcmp(field->name, table->indexes[idx].column) == 0) {
           index_pos[idx] = col;
@@ -407,60 +797,54 @@ static unsigned db_mysql_query_into_hash(DB* db, Table* table, struct TableSlot*
       }
     }
     if (bad) break;
+    if (!mysql_row_bind(stmt, &bound, num_fields)) {
+      LOG_WARN("Cannot bind MySQL result columns for SELECT query for table %s", table_name(table));
+      break;
+    }
 
     *min_id = (unsigned) -1;
     *max_id = 0;
-    MYSQL_ROW row;
-    while ((row = mysql_fetch_row(result))) {
-      char jbuf[MAX_JSON_LEN];
-      unsigned jpos = 0;
-      jpos += snprintf(jbuf + jpos, MAX_JSON_LEN - jpos, "{");
-      unsigned cols = 0;
-      for (unsigned col = 0; col < num_fields; col++) {
-        unsigned col_is_null = !row[col] || types[col] == MYSQL_TYPE_NULL;
-        if (db->config->table.strip_null && col_is_null) continue;
-
-        if (cols > 0) jpos += snprintf(jbuf + jpos, MAX_JSON_LEN - jpos, ",");
-        jpos += snprintf(jbuf + jpos, MAX_JSON_LEN - jpos, "\"%s\":", names[col]);
-        if (col_is_null) {
-          jpos += snprintf(jbuf + jpos, MAX_JSON_LEN - jpos, "null");
-        } else {
-          switch (types[col]) {
-            case MYSQL_TYPE_TIMESTAMP:
-            case MYSQL_TYPE_DATE:
-            case MYSQL_TYPE_TIME:
-            case MYSQL_TYPE_DATETIME:
-            case MYSQL_TYPE_VARCHAR:
-            case MYSQL_TYPE_TIMESTAMP2:
-            case MYSQL_TYPE_DATETIME2:
-            case MYSQL_TYPE_TIME2:
-            case MYSQL_TYPE_JSON:
-            case MYSQL_TYPE_ENUM:
-            case MYSQL_TYPE_SET:
-            case MYSQL_TYPE_TINY_BLOB:
-            case MYSQL_TYPE_MEDIUM_BLOB:
-            case MYSQL_TYPE_LONG_BLOB:
-            case MYSQL_TYPE_BLOB:
-            case MYSQL_TYPE_VAR_STRING:
-            case MYSQL_TYPE_STRING:
-            case MYSQL_TYPE_GEOMETRY:
-              jpos += snprintf(jbuf + jpos, MAX_JSON_LEN - jpos, "\"%s\"", row[col]);
-              break;
-            default:
-              jpos += snprintf(jbuf + jpos, MAX_JSON_LEN - jpos, "%s", row[col]);
-              break;
+    uint64_t plan = encoder_fingerprint(encoder);
+    char** row = bound.values;
+    unsigned long* lengths = bound.lengths;
+    int fetched = 0;
+    while ((fetched = mysql_row_fetch(stmt, &bound)) > 0) {
+      unsigned frame = (unsigned)-1;
+      if (stage->fingerprint) {
+        uint64_t fingerprint = plan;
+        for (unsigned col = 0; col < num_fields; col++) {
+          const char* value = types[col] == MYSQL_TYPE_NULL ? 0 : row[col];
+          fingerprint = fingerprint_add(fingerprint, 0, value, (unsigned) lengths[col]);
+        }
+        int key_pos = index_pos[0];
+        frame = reuse_row(table, stage, key_pos < 0 ? 0 : row[key_pos],
+                          key_pos < 0 ? 0 : (unsigned) lengths[key_pos], fingerprint);
+        if (!frame) {
+          ++bad;
+          break;
+        }
+      }
+      if (frame == (unsigned)-1) {
+        encoder_begin(encoder, stage->arena);
+        for (unsigned col = 0; col < num_fields; col++) {
+          if (!row[col] || types[col] == MYSQL_TYPE_NULL) {
+            encoder_add_null(encoder, col);
+          } else {
+            encoder_add_value(encoder, col, row[col], (unsigned) lengths[col]);
           }
         }
-        ++cols;
+        frame = encoder_end(encoder);
       }
-      jpos += snprintf(jbuf + jpos, MAX_JSON_LEN - jpos, "}");
       ++rows;
-      LOG_DEBUG("Fetched row %u: %p %u [%.*s]", rows, row, jpos, jpos, jbuf);
 
-      unsigned frame = arena_store_framed(slot->arena, (uint8_t*)jbuf, jpos);
-      LOG_DEBUG("Stored frame %p", frame);
+      LOG_DEBUG("Stored row %u at frame %u", rows, frame);
       if (frame == (unsigned)-1) {
         LOG_WARN("Could not store framed JSON for SELECT query for table %s", table_name(table));
+        ++bad;
+        break;
+      }
+      if (!table_stage_row(stage, frame)) {
+        ++bad;
         break;
       }
 
@@ -468,13 +852,11 @@ static unsigned db_mysql_query_into_hash(DB* db, Table* table, struct TableSlot*
       for (unsigned idx = 0; idx < table->index_count; ++idx) {
         int col_pos = index_pos[idx];
         if (col_pos < 0) continue;
-        if (!slot->indexes[idx]) continue;
         const char* value = row[col_pos];
         if (!value) continue;
         if (table->indexes[idx].type == CONFIG_INDEX_TYPE_INT) {
           unsigned key_int = (unsigned) atoi(value);
-          if (!hash_insert(slot->indexes[idx], &key_int, sizeof(unsigned),
-                           frame, jpos + sizeof(unsigned))) {
+          if (!table_stage_key(stage, idx, &key_int, sizeof(unsigned), frame)) {
             LOG_WARN("Could not insert row for table %s key %u index %u",
                      table_name(table), key_int, idx);
             insert_error = 1;
@@ -487,7 +869,7 @@ static unsigned db_mysql_query_into_hash(DB* db, Table* table, struct TableSlot*
         } else {
           unsigned hlen = strlen(value);
           if (!hlen) continue;
-          if (!hash_insert(slot->indexes[idx], value, hlen, frame, jpos + sizeof(unsigned))) {
+          if (!table_stage_key(stage, idx, value, hlen, frame)) {
             LOG_WARN("Could not insert row for table %s key %.*s index %u",
                      table_name(table), hlen, value, idx);
             insert_error = 1;
@@ -495,15 +877,66 @@ static unsigned db_mysql_query_into_hash(DB* db, Table* table, struct TableSlot*
           }
         }
       }
-      if (insert_error) break;
+      if (insert_error) {
+        ++bad;
+        break;
+      }
+    }
+    // The rows also end when the connection fails.
+    if (!bad && fetched < 0) {
+      LOG_WARN("Error fetching rows from table %s: %s", table_name(table), mysql_stmt_error(stmt));
+      ++bad;
     }
+    if (bad) break;
     double t1 = now_sec();
     unsigned long elapsed = (t1 - t0) * 1000000;
     LOG_INFO("Fetched %u rows from table %s in %lu us", rows, table_name(table), elapsed);
+    ok = 1;
   } while (0);
 
+  // The statement is kept prepared for the next load; freeing its result
+  // also reads whatever rows were left.
+  if (stmt) mysql_stmt_free_result(stmt);
   if (result) mysql_free_result(result);
-  return rows;
+  mysql_row_free(&bound);
+  if (encoder) encoder_destroy(encoder);
+  return ok ? rows : (unsigned)-1;
+}
+
+static unsigned db_mysql_probe(DB* db, Table* table, unsigned partition, const char* sql,
+                               char* value, unsigned len) {
+  if (!db->mysql) return 0;
+  MYSQL_STMT* stmt = db_mysql_prepare(db, table, partition, sql);
+  if (!stmt) return 0;
+  unsigned ok = 0;
+  MYSQL_RES* result = 0;
+  MySQLRow bound = {0};
+  do {
+    if (mysql_stmt_execute(stmt)) {
+      LOG_WARN("Cannot run probe [%s] for table %s: %s", sql, table_name(table), mysql_stmt_error(stmt));
+      break;
+    }
+    result = mysql_stmt_result_metadata(stmt);
+    unsigned num_fields = result ? mysql_num_fields(result) : 0;
+    if (!result || num_fields > MAX_FIELDS || !mysql_row_bind(stmt, &bound, num_fields)) {
+      LOG_WARN("Cannot get result of probe for table %s", table_name(table));
+      break;
+    }
+    int fetched = mysql_row_fetch(stmt, &bound);
+    if (fetched < 0) {
+      LOG_WARN("Cannot run probe [%s] for table %s: %s", sql, table_name(table), mysql_stmt_error(stmt));
+      break;
+    }
+    unsigned pos = 0;
+    for (unsigned col = 0; fetched && col < num_fields; ++col) {
+      pos = probe_append(value, len, pos, col, bound.values[col]);
+    }
+    ok = 1;
+  } while (0);
+  mysql_stmt_free_result(stmt);
+  if (result) mysql_free_result(result);
+  mysql_row_free(&bound);
+  return ok;
 }
 
 #endif  // HAVE_MYSQL
@@ -556,34 +989,12 @@ static void db_sqlite_disconnect(DB* db) {
   db->sqlite = NULL;
 }
 
-static unsigned db_sqlite_get_table_size(DB* db, Table* table) {
-  unsigned count = 0;
-  sqlite3_stmt* stmt = NULL;
-  do {
-    if (!db->sqlite) {
-      LOG_WARN("Cannot get table size for %s, SQLite database not open", table_name(table));
-      break;
-    }
-    char sql[MAX_SQL_LEN];
-    snprintf(sql, MAX_SQL_LEN, "SELECT COUNT(*) FROM (%s) AS melian_sub", table_select_sql(table));
-    if (sqlite3_prepare_v2(db->sqlite, sql, -1, &stmt, NULL) != SQLITE_OK) {
-      LOG_WARN("Cannot run query [%s] for table %s: %s", sql, table_name(table), sqlite3_errmsg(db->sqlite));
-      break;
-    }
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-      count = (unsigned) sqlite3_column_int64(stmt, 0);
-    } else {
-      LOG_WARN("COUNT query for table %s returned no rows", table_name(table));
-    }
-  } while (0);
-  if (stmt) sqlite3_finalize(stmt);
-  return count;
-}
-
-static unsigned db_sqlite_query_into_hash(DB* db, Table* table, struct TableSlot* slot,
+static unsigned db_sqlite_query_into_hash(DB* db, Table* table, TableStage* stage,
                                           unsigned* min_id, unsigned* max_id) {
   unsigned rows = 0;
+  unsigned ok = 0;
   sqlite3_stmt* stmt = NULL;
+  Encoder* encoder = 0;
   do {
     if (!db->sqlite) {
       LOG_WARN("Cannot query table data for %s, SQLite database not open", table_name(table));
@@ -591,11 +1002,20 @@ static unsigned db_sqlite_query_into_hash(DB* db, Table* table, struct TableSlot
     }
 
     double t0 = now_sec();
-    const char* query = table_select_sql(table);
-    if (sqlite3_prepare_v2(db->sqlite, query, -1, &stmt, NULL) != SQLITE_OK) {
-      LOG_WARN("Cannot run query [%s] for table %s: %s", query, table_name(table), sqlite3_errmsg(db->sqlite));
-      break;
+    char sql[MELIAN_MAX_SELECT_LEN + 2 * MAX_SQL_LEN];
+    const char* query = table_select_sql(db, table, stage, sql, sizeof(sql));
+    DBStatement* statement = db_statement(db, table, stage->watermark ? DELTA_PARTITION : stage->partition, query);
+    if (!statement) break;
+    if (!statement->prepared) {
+      sqlite3_stmt* handle = NULL;
+      if (sqlite3_prepare_v2(db->sqlite, query, -1, &handle, NULL) != SQLITE_OK) {
+        LOG_WARN("Cannot run query [%s] for table %s: %s", query, table_name(table), sqlite3_errmsg(db->sqlite));
+        break;
+      }
+      statement->handle = handle;
+      statement->prepared = 1;
     }
+    stmt = (sqlite3_stmt*) statement->handle;
 
     int num_fields = sqlite3_column_count(stmt);
     if (num_fields > MAX_FIELDS) {
@@ -604,51 +1024,80 @@ static unsigned db_sqlite_query_into_hash(DB* db, Table* table, struct TableSlot
       break;
     }
 
-    char names[MAX_FIELDS][MAX_FIELD_NAME_LEN];
+    encoder = encoder_build(num_fields, db->config->table.strip_null);
+    if (!encoder) break;
+
+    // SQLite types values rather than columns, so the encoding of each value
+    // is picked as it is read.
     int index_pos[MELIAN_MAX_INDEXES];
     for (unsigned idx = 0; idx < MELIAN_MAX_INDEXES; ++idx) index_pos[idx] = -1;
+    unsigned bad = 0;
     for (int col = 0; col < num_fields; ++col) {
       const char* name = sqlite3_column_name(stmt, col);
-      snprintf(names[col], MAX_FIELD_NAME_LEN, "%s", name ? name : "");
+      if (!name) name = "";
+      if (!encoder_add_column(encoder, name, ENCODER_TYPE_STRING)) {
+        ++bad;
+        break;
+      }
       for (unsigned idx = 0; idx < table->index_count; ++idx) {
-        if (strcmp(names[col], table->indexes[idx].column) == 0) {
+        if (strcmp(name, table->indexes[idx].column) == 0) {
           index_pos[idx] = col;
         }
       }
     }
+    if (bad) break;
 
     *min_id = (unsigned)-1;
     *max_id = 0;
+    uint64_t plan = encoder_fingerprint(encoder);
     int rc = SQLITE_OK;
     while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-      char jbuf[MAX_JSON_LEN];
-      unsigned jpos = 0;
-      jpos += snprintf(jbuf + jpos, MAX_JSON_LEN - jpos, "{");
-      unsigned cols = 0;
-      for (int col = 0; col < num_fields; ++col) {
-        int col_type = sqlite3_column_type(stmt, col);
-        int col_is_null = (col_type == SQLITE_NULL);
-        if (db->config->table.strip_null && col_is_null) continue;
-
-        if (cols > 0) jpos += snprintf(jbuf + jpos, MAX_JSON_LEN - jpos, ",");
-        jpos += snprintf(jbuf + jpos, MAX_JSON_LEN - jpos, "\"%s\":", names[col]);
-        if (col_is_null) {
-          jpos += snprintf(jbuf + jpos, MAX_JSON_LEN - jpos, "null");
-        } else if (col_type == SQLITE_INTEGER || col_type == SQLITE_FLOAT) {
-          const unsigned char* text = sqlite3_column_text(stmt, col);
-          jpos += snprintf(jbuf + jpos, MAX_JSON_LEN - jpos, "%s", text ? (const char*)text : "0");
-        } else {
-          const unsigned char* text = sqlite3_column_text(stmt, col);
-          jpos += snprintf(jbuf + jpos, MAX_JSON_LEN - jpos, "\"%s\"", text ? (const char*)text : "");
+      // Types are read before any value is converted to text.
+      int col_types[MAX_FIELDS];
+      for (int col = 0; col < num_fields; ++col) col_types[col] = sqlite3_column_type(stmt, col);
+      unsigned frame = (unsigned)-1;
+      if (stage->fingerprint) {
+        // Values are encoded by their storage class, which is part of their fingerprint.
+        uint64_t fingerprint = plan;
+        for (int col = 0; col < num_fields; ++col) {
+          int col_type = col_types[col];
+          const char* text = col_type == SQLITE_NULL ? 0 : (const char*) sqlite3_column_text(stmt, col);
+          unsigned len = text ? (unsigned) sqlite3_column_bytes(stmt, col) : 0;
+          fingerprint = fingerprint_add(fingerprint, (unsigned) col_type, text, len);
+        }
+        int key_pos = index_pos[0];
+        const char* key = key_pos < 0 ? 0 : (const char*) sqlite3_column_text(stmt, key_pos);
+        frame = reuse_row(table, stage, key, key ? (unsigned) sqlite3_column_bytes(stmt, key_pos) : 0, fingerprint);
+        if (!frame) {
+          ++bad;
+          break;
+        }
+      }
+      if (frame == (unsigned)-1) {
+        encoder_begin(encoder, stage->arena);
+        for (int col = 0; col < num_fields; ++col) {
+          int col_type = col_types[col];
+          if (col_type == SQLITE_NULL) {
+            encoder_add_null(encoder, col);
+            continue;
+          }
+          const char* text = (const char*) sqlite3_column_text(stmt, col);
+          unsigned len = text ? (unsigned) sqlite3_column_bytes(stmt, col) : 0;
+          EncoderType type = (col_type == SQLITE_INTEGER || col_type == SQLITE_FLOAT)
+                           ? ENCODER_TYPE_NUMBER : ENCODER_TYPE_STRING;
+          encoder_add_typed(encoder, col, type, text ? text : "", len);
         }
-        ++cols;
+        frame = encoder_end(encoder);
       }
-      jpos += snprintf(jbuf + jpos, MAX_JSON_LEN - jpos, "}");
       ++rows;
 
-      unsigned frame = arena_store_framed(slot->arena, (uint8_t*)jbuf, jpos);
       if (frame == (unsigned)-1) {
         LOG_WARN("Could not store framed JSON for SELECT query for table %s", table_name(table));
+        ++bad;
+        break;
+      }
+      if (!table_stage_row(stage, frame)) {
+        ++bad;
         break;
       }
 
@@ -656,10 +1105,10 @@ static unsigned db_sqlite_query_into_hash(DB* db, Table* table, struct TableSlot
       for (unsigned idx = 0; idx < table->index_count; ++idx) {
         int col_pos = index_pos[idx];
         if (col_pos < 0) continue;
-        if (!slot->indexes[idx]) continue;
         if (table->indexes[idx].type == CONFIG_INDEX_TYPE_INT) {
+          if (sqlite3_column_type(stmt, col_pos) == SQLITE_NULL) continue;
           unsigned key_int = (unsigned) sqlite3_column_int64(stmt, col_pos);
-          if (!hash_insert(slot->indexes[idx], &key_int, sizeof(unsigned), frame, jpos + sizeof(unsigned))) {
+          if (!table_stage_key(stage, idx, &key_int, sizeof(unsigned), frame)) {
             LOG_WARN("Could not insert row for table %s key %u index %u",
                      table_name(table), key_int, idx);
             insert_error = 1;
@@ -673,7 +1122,7 @@ static unsigned db_sqlite_query_into_hash(DB* db, Table* table, struct TableSlot
           const unsigned char* value = sqlite3_column_text(stmt, col_pos);
           unsigned hlen = (unsigned) sqlite3_column_bytes(stmt, col_pos);
           if (!value || !hlen) continue;
-          if (!hash_insert(slot->indexes[idx], value, hlen, frame, jpos + sizeof(unsigned))) {
+          if (!table_stage_key(stage, idx, value, hlen, frame)) {
             LOG_WARN("Could not insert row for table %s key %.*s index %u",
                      table_name(table), hlen, value, idx);
             insert_error = 1;
@@ -681,18 +1130,58 @@ static unsigned db_sqlite_query_into_hash(DB* db, Table* table, struct TableSlot
           }
         }
       }
-      if (insert_error) break;
+      if (insert_error) {
+        ++bad;
+        break;
+      }
     }
-    if (rc != SQLITE_DONE) {
+    if (!bad && rc != SQLITE_DONE) {
       LOG_WARN("Error fetching rows from table %s: %s", table_name(table), sqlite3_errmsg(db->sqlite));
+      ++bad;
     }
+    if (bad) break;
     double t1 = now_sec();
     unsigned long elapsed = (t1 - t0) * 1000000;
     LOG_INFO("Fetched %u rows from table %s in %lu us", rows, table_name(table), elapsed);
+    ok = 1;
   } while (0);
 
-  if (stmt) sqlite3_finalize(stmt);
-  return rows;
+  // The statement is kept prepared for the next load.
+  if (stmt) sqlite3_reset(stmt);
+  if (encoder) encoder_destroy(encoder);
+  return ok ? rows : (unsigned)-1;
+}
+
+static unsigned db_sqlite_probe(DB* db, Table* table, unsigned partition, const char* sql,
+                                char* value, unsigned len) {
+  if (!db->sqlite) return 0;
+  DBStatement* statement = db_statement(db, table, partition, sql);
+  if (!statement) return 0;
+  if (!statement->prepared) {
+    sqlite3_stmt* handle = NULL;
+    if (sqlite3_prepare_v2(db->sqlite, sql, -1, &handle, NULL) != SQLITE_OK) {
+      LOG_WARN("Cannot run probe [%s] for table %s: %s", sql, table_name(table), sqlite3_errmsg(db->sqlite));
+      return 0;
+    }
+    statement->handle = handle;
+    statement->prepared = 1;
+  }
+
+  sqlite3_stmt* stmt = (sqlite3_stmt*) statement->handle;
+  unsigned ok = 1;
+  int rc = sqlite3_step(stmt);
+  if (rc == SQLITE_ROW) {
+    unsigned pos = 0;
+    int num_fields = sqlite3_column_count(stmt);
+    for (int col = 0; col < num_fields; ++col) {
+      pos = probe_append(value, len, pos, col, (const char*) sqlite3_column_text(stmt, col));
+    }
+  } else if (rc != SQLITE_DONE) {
+    LOG_WARN("Cannot run probe [%s] for table %s: %s", sql, table_name(table), sqlite3_errmsg(db->sqlite));
+    ok = 0;
+  }
+  sqlite3_reset(stmt);
+  return ok;
 }
 
 #endif  // HAVE_SQLITE3
@@ -767,149 +1256,218 @@ static void db_postgresql_disconnect(DB* db) {
   LOG_INFO("Disconnected from PostgreSQL server at %s:%u", host, port);
 }
 
-static unsigned db_postgresql_get_table_size(DB* db, Table* table) {
-  unsigned count = 0;
-  if (!db->postgres) {
-    LOG_WARN("Cannot get table size for %s, PostgreSQL connection not established", table_name(table));
-    return 0;
-  }
-  char sql[MAX_SQL_LEN];
-  snprintf(sql, MAX_SQL_LEN, "SELECT COUNT(*) FROM (%s) AS melian_sub", table_select_sql(table));
-  PGresult* res = PQexec(db->postgres, sql);
-  if (!res) {
-    LOG_WARN("Cannot run query [%s] for table %s: %s", sql, table_name(table), PQerrorMessage(db->postgres));
-    return 0;
-  }
-  if (PQresultStatus(res) != PGRES_TUPLES_OK) {
-    LOG_WARN("Cannot run query [%s] for table %s: %s", sql, table_name(table), PQerrorMessage(db->postgres));
-    PQclear(res);
-    return 0;
-  }
-  if (PQntuples(res) >= 1) {
-    const char* value = PQgetvalue(res, 0, 0);
-    count = (unsigned) strtoul(value ? value : "0", 0, 10);
+// Columns of these types (int8, int2, int4, float4, float8, numeric) are
+// encoded as numbers, all others as strings.
+static EncoderType postgres_encoder_type(Oid type) {
+  switch (type) {
+    case 20:
+    case 21:
+    case 23:
+    case 700:
+    case 701:
+    case 1700:
+      return ENCODER_TYPE_NUMBER;
+    default:
+      return ENCODER_TYPE_STRING;
   }
-  PQclear(res);
-  return count;
 }
 
-static unsigned db_postgresql_query_into_hash(DB* db, Table* table, struct TableSlot* slot,
+static unsigned db_postgresql_query_into_hash(DB* db, Table* table, TableStage* stage,
                                               unsigned* min_id, unsigned* max_id) {
   unsigned rows = 0;
   if (!db->postgres) {
     LOG_WARN("Cannot query table data for %s, PostgreSQL connection not established", table_name(table));
-    return 0;
+    return (unsigned)-1;
   }
-  const char* query = table_select_sql(table);
-  PGresult* res = PQexec(db->postgres, query);
-  if (!res) {
-    LOG_WARN("Cannot run query [%s] for table %s: %s", query, table_name(table), PQerrorMessage(db->postgres));
-    return 0;
+  char sql[MELIAN_MAX_SELECT_LEN + 2 * MAX_SQL_LEN];
+  const char* query = table_select_sql(db, table, stage, sql, sizeof(sql));
+  DBStatement* statement = db_statement(db, table, stage->watermark ? DELTA_PARTITION : stage->partition, query);
+  if (!statement) return (unsigned)-1;
+  char name[MAX_SQL_LEN];
+  postgres_statement_name(statement, name, sizeof(name));
+  if (!statement->prepared) {
+    PGresult* prepared = PQprepare(db->postgres, name, query, 0, NULL);
+    ExecStatusType status = PQresultStatus(prepared);
+    PQclear(prepared);
+    if (status != PGRES_COMMAND_OK) {
+      LOG_WARN("Cannot prepare query [%s] for table %s: %s", query, table_name(table), PQerrorMessage(db->postgres));
+      return (unsigned)-1;
+    }
+    statement->prepared = 1;
   }
-  if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+  if (!PQsendQueryPrepared(db->postgres, name, 0, NULL, NULL, NULL, 0)) {
     LOG_WARN("Cannot run query [%s] for table %s: %s", query, table_name(table), PQerrorMessage(db->postgres));
-    PQclear(res);
-    return 0;
+    return (unsigned)-1;
   }
-  int num_fields = PQnfields(res);
-  if (num_fields > MAX_FIELDS) {
-    LOG_WARN("Expected at most %u number of fields for SELECT query for table %s, got %d",
-             MAX_FIELDS, table_name(table), num_fields);
-    PQclear(res);
-    return 0;
+  // Get one result per row as they arrive, instead of buffering the whole
+  // result set in libpq; if that fails, all rows come in a single result.
+  if (!PQsetSingleRowMode(db->postgres)) {
+    LOG_WARN("Could not use single-row mode for table %s", table_name(table));
   }
-  char names[MAX_FIELDS][MAX_FIELD_NAME_LEN];
+
+  Encoder* encoder = 0;
   int index_pos[MELIAN_MAX_INDEXES];
   for (unsigned idx = 0; idx < MELIAN_MAX_INDEXES; ++idx) index_pos[idx] = -1;
-  for (int col = 0; col < num_fields; ++col) {
-    const char* fname = PQfname(res, col);
-    snprintf(names[col], MAX_FIELD_NAME_LEN, "%s", fname ? fname : "");
-    for (unsigned idx = 0; idx < table->index_count; ++idx) {
-      if (strcmp(names[col], table->indexes[idx].column) == 0) {
-        index_pos[idx] = col;
-      }
-    }
-  }
+  int num_fields = -1;
+  unsigned bad = 0;
   *min_id = (unsigned)-1;
   *max_id = 0;
   double t0 = now_sec();
-  int num_rows = PQntuples(res);
-  for (int row = 0; row < num_rows; ++row) {
-    char jbuf[MAX_JSON_LEN];
-    unsigned jpos = 0;
-    jpos += snprintf(jbuf + jpos, MAX_JSON_LEN - jpos, "{");
-    unsigned cols = 0;
-    for (int col = 0; col < num_fields; ++col) {
-      int col_is_null = PQgetisnull(res, row, col);
-      if (db->config->table.strip_null && col_is_null) continue;
-      if (cols > 0) jpos += snprintf(jbuf + jpos, MAX_JSON_LEN - jpos, ",");
-      jpos += snprintf(jbuf + jpos, MAX_JSON_LEN - jpos, "\"%s\":", names[col]);
-      if (col_is_null) {
-        jpos += snprintf(jbuf + jpos, MAX_JSON_LEN - jpos, "null");
-      } else {
-        const char* value = PQgetvalue(res, row, col);
-        if (!value) value = "";
-        switch (PQftype(res, col)) {
-          case 20:
-          case 21:
-          case 23:
-          case 700:
-          case 701:
-          case 1700:
-            jpos += snprintf(jbuf + jpos, MAX_JSON_LEN - jpos, "%s", value);
-            break;
-          default:
-            jpos += snprintf(jbuf + jpos, MAX_JSON_LEN - jpos, "\"%s\"", value);
-            break;
+  PGresult* res = 0;
+  ExecStatusType last = PGRES_EMPTY_QUERY;
+  // Results must be read until there are none left, even after an error.
+  while ((res = PQgetResult(db->postgres))) {
+    ExecStatusType status = PQresultStatus(res);
+    last = status;
+    if (!bad && status != PGRES_SINGLE_TUPLE && status != PGRES_TUPLES_OK) {
+      LOG_WARN("Cannot run query [%s] for table %s: %s", query, table_name(table), PQerrorMessage(db->postgres));
+      ++bad;
+    }
+    if (!bad && num_fields < 0) {
+      num_fields = PQnfields(res);
+      if (num_fields > MAX_FIELDS) {
+        LOG_WARN("Expected at most %u number of fields for SELECT query for table %s, got %d",
+                 MAX_FIELDS, table_name(table), num_fields);
+        ++bad;
+      }
+      if (!bad) {
+        encoder = encoder_build(num_fields, db->config->table.strip_null);
+        if (!encoder) ++bad;
+      }
+      for (int col = 0; col < num_fields && !bad; ++col) {
+        const char* fname = PQfname(res, col);
+        if (!fname) fname = "";
+        if (!encoder_add_column(encoder, fname, postgres_encoder_type(PQftype(res, col)))) {
+          ++bad;
+          break;
+        }
+        for (unsigned idx = 0; idx < table->index_count; ++idx) {
+          if (strcmp(fname, table->indexes[idx].column) == 0) {
+            index_pos[idx] = col;
+          }
         }
       }
-      ++cols;
     }
-    jpos += snprintf(jbuf + jpos, MAX_JSON_LEN - jpos, "}");
-    ++rows;
-    unsigned frame = arena_store_framed(slot->arena, (uint8_t*)jbuf, jpos);
-    if (frame == (unsigned)-1) {
-      LOG_WARN("Could not store framed JSON for SELECT query for table %s", table_name(table));
-      break;
-    }
-    int insert_error = 0;
-    for (unsigned idx = 0; idx < table->index_count; ++idx) {
-      int col_pos = index_pos[idx];
-      if (col_pos < 0) continue;
-      if (!slot->indexes[idx]) continue;
-      if (table->indexes[idx].type == CONFIG_INDEX_TYPE_INT) {
-        const char* value = PQgetvalue(res, row, col_pos);
-        unsigned key_int = (unsigned) strtoul(value ? value : "0", 0, 10);
-        if (!hash_insert(slot->indexes[idx], &key_int, sizeof(unsigned),
-                         frame, jpos + sizeof(unsigned))) {
-          LOG_WARN("Could not insert row for table %s key %u index %u",
-                   table_name(table), key_int, idx);
-          insert_error = 1;
+    int num_rows = bad ? 0 : PQntuples(res);
+    uint64_t plan = num_rows ? encoder_fingerprint(encoder) : 0;
+    for (int row = 0; row < num_rows; ++row) {
+      unsigned frame = (unsigned)-1;
+      if (stage->fingerprint) {
+        uint64_t fingerprint = plan;
+        for (int col = 0; col < num_fields; ++col) {
+          const char* value = PQgetisnull(res, row, col) ? 0 : PQgetvalue(res, row, col);
+          fingerprint = fingerprint_add(fingerprint, 0, value, (unsigned) PQgetlength(res, row, col));
+        }
+        int key_pos = index_pos[0];
+        frame = reuse_row(table, stage, key_pos < 0 ? 0 : PQgetvalue(res, row, key_pos),
+                          key_pos < 0 ? 0 : (unsigned) PQgetlength(res, row, key_pos), fingerprint);
+        if (!frame) {
+          ++bad;
           break;
         }
-        if (idx == 0) {
-          if (*min_id > key_int) *min_id = key_int;
-          if (*max_id < key_int) *max_id = key_int;
+      }
+      if (frame == (unsigned)-1) {
+        encoder_begin(encoder, stage->arena);
+        for (int col = 0; col < num_fields; ++col) {
+          if (PQgetisnull(res, row, col)) {
+            encoder_add_null(encoder, col);
+          } else {
+            encoder_add_value(encoder, col, PQgetvalue(res, row, col), (unsigned) PQgetlength(res, row, col));
+          }
         }
-      } else {
-        const char* value = PQgetvalue(res, row, col_pos);
-        int hlen = PQgetlength(res, row, col_pos);
-        if (!value || !hlen) continue;
-        if (!hash_insert(slot->indexes[idx], value, (unsigned) hlen, frame, jpos + sizeof(unsigned))) {
-          LOG_WARN("Could not insert row for table %s key %.*s index %u",
-                   table_name(table), hlen, value, idx);
-          insert_error = 1;
-          break;
+        frame = encoder_end(encoder);
+      }
+      ++rows;
+      if (frame == (unsigned)-1) {
+        LOG_WARN("Could not store framed JSON for SELECT query for table %s", table_name(table));
+        ++bad;
+        break;
+      }
+      if (!table_stage_row(stage, frame)) {
+        ++bad;
+        break;
+      }
+      for (unsigned idx = 0; idx < table->index_count; ++idx) {
+        int col_pos = index_pos[idx];
+        if (col_pos < 0) continue;
+        if (table->indexes[idx].type == CONFIG_INDEX_TYPE_INT) {
+          if (PQgetisnull(res, row, col_pos)) continue;
+          const char* value = PQgetvalue(res, row, col_pos);
+          unsigned key_int = (unsigned) strtoul(value ? value : "0", 0, 10);
+          if (!table_stage_key(stage, idx, &key_int, sizeof(unsigned), frame)) {
+            LOG_WARN("Could not insert row for table %s key %u index %u",
+                     table_name(table), key_int, idx);
+            ++bad;
+            break;
+          }
+          if (idx == 0) {
+            if (*min_id > key_int) *min_id = key_int;
+            if (*max_id < key_int) *max_id = key_int;
+          }
+        } else {
+          const char* value = PQgetvalue(res, row, col_pos);
+          int hlen = PQgetlength(res, row, col_pos);
+          if (!value || !hlen) continue;
+          if (!table_stage_key(stage, idx, value, (unsigned) hlen, frame)) {
+            LOG_WARN("Could not insert row for table %s key %.*s index %u",
+                     table_name(table), hlen, value, idx);
+            ++bad;
+            break;
+          }
         }
       }
+      if (bad) break;
     }
-    if (insert_error) break;
+    PQclear(res);
   }
+  if (encoder) encoder_destroy(encoder);
+  // In single-row mode, only a final result with no rows tells all were read.
+  if (!bad && last != PGRES_TUPLES_OK) {
+    LOG_WARN("Error fetching rows from table %s: %s", table_name(table), PQerrorMessage(db->postgres));
+    ++bad;
+  }
+  if (bad) return (unsigned)-1;
   double t1 = now_sec();
   unsigned long elapsed = (t1 - t0) * 1000000;
   LOG_INFO("Fetched %u rows from table %s in %lu us", rows, table_name(table), elapsed);
-  PQclear(res);
   return rows;
 }
 
+static unsigned db_postgresql_probe(DB* db, Table* table, unsigned partition, const char* sql,
+                                    char* value, unsigned len) {
+  if (!db->postgres) return 0;
+  DBStatement* statement = db_statement(db, table, partition, sql);
+  if (!statement) return 0;
+  char name[MAX_SQL_LEN];
+  postgres_statement_name(statement, name, sizeof(name));
+  if (!statement->prepared) {
+    PGresult* prepared = PQprepare(db->postgres, name, sql, 0, NULL);
+    ExecStatusType status = PQresultStatus(prepared);
+    PQclear(prepared);
+    if (status != PGRES_COMMAND_OK) {
+      LOG_WARN("Cannot prepare probe [%s] for table %s: %s", sql, table_name(table), PQerrorMessage(db->postgres));
+      return 0;
+    }
+    statement->prepared = 1;
+  }
+
+  PGresult* res = PQexecPrepared(db->postgres, name, 0, NULL, NULL, NULL, 0);
+  if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+    LOG_WARN("Cannot run probe [%s] for table %s: %s", sql, table_name(table), PQerrorMessage(db->postgres));
+    PQclear(res);
+    return 0;
+  }
+  unsigned pos = 0;
+  int num_fields = PQntuples(res) > 0 ? PQnfields(res) : 0;
+  for (int col = 0; col < num_fields; ++col) {
+    pos = probe_append(value, len, pos, col, PQgetisnull(res, 0, col) ? "" : PQgetvalue(res, 0, col));
+  }
+  PQclear(res);
+  return 1;
+}
+
+static void postgres_statement_name(const DBStatement* statement, char* name, unsigned len) {
+  snprintf(name, len, "melian_%u_%u", statement->table_id, statement->partition);
+}
+
 #endif  // HAVE_POSTGRESQL
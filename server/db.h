@@ -1,18 +1,23 @@
 #pragma once
 
 // A Db knows how to query the configured database to load all data for a table.
+// Its connection stays open from one load to the next: it is checked before each
+// batch of loads and reopened if it was lost, backing off after failed attempts.
+// The SELECT of each table is prepared once per connection, and kept for as
+// long as the statement does not change.
 
 // TODO: make these limits dynamic? Arena?
 enum {
   MAX_VERSION_LEN = 1024,
 };
 
+#include <stdatomic.h>
 #include "config.h"
 
 struct Arena;
 struct Hash;
 struct Table;
-struct TableSlot;
+struct TableStage;
 
 #ifdef HAVE_MYSQL
 struct MYSQL;
@@ -25,6 +30,24 @@ struct pg_conn;
 typedef struct pg_conn PGconn;
 #endif
 
+// Connection counters, shared by a DB and all its clones.
+typedef struct DBStats {
+  atomic_uint connects;         // connections opened
+  atomic_uint failures;         // attempts to connect that failed
+  atomic_uint lost;             // open connections found dead before a load
+  atomic_ullong connect_us;     // total time spent opening connections
+  atomic_uint last_connect_us;  // time spent opening the last connection
+} DBStats;
+
+// The SELECT for one part of a table, prepared on the connection.
+typedef struct DBStatement {
+  unsigned table_id;
+  unsigned partition;
+  char* sql;              // text the statement was prepared from
+  void* handle;           // driver handle, if the driver has one
+  unsigned prepared;
+} DBStatement;
+
 typedef struct DB {
   Config *config;
 #ifdef HAVE_MYSQL
@@ -39,13 +62,39 @@ typedef struct DB {
 #endif
   char client_version[MAX_VERSION_LEN];
   char server_version[MAX_VERSION_LEN];
+  unsigned backoff;       // seconds to wait after the next failure to connect
+  unsigned retry_at;      // earliest time for the next attempt to connect
+  DBStatement* statements;
+  unsigned statement_count;
+  unsigned statement_cap;
+  DBStats* stats;         // points to own_stats, or those of the DB it was cloned from
+  DBStats own_stats;
+  struct DB* parts[MELIAN_MAX_PARTITIONS];  // connections for all parts but the first, see db_part
 } DB;
 
 DB* db_build(struct Config* config);
+// Build another DB for the same database, sharing the stats of db, which must outlive it.
+DB* db_clone(DB* db);
+// Return the connection to read a part of a table with, next to db, which
+// reads the first part: a clone of db built on first use and kept with it,
+// so that a loader uses the same connections for all the tables it loads.
+DB* db_part(DB* db, unsigned part);
+// Free what the client library keeps for the calling thread, before it exits.
+void db_thread_end(void);
 void db_destroy(DB* db);
 
 void db_connect(DB* db);
 void db_disconnect(DB* db);
-unsigned db_get_table_size(DB* db, struct Table* table);
-unsigned db_query_into_hash(DB* db, struct Table* table, struct TableSlot* slot,
+// Make sure the connection is open and alive, opening it again if needed;
+// return whether it can be used.
+unsigned db_ensure_connected(DB* db);
+// Run the change probe of a table and store its first row in value, with
+// columns separated by '|'; return 0 if it could not be run.
+unsigned db_probe(DB* db, struct Table* table, char* value, unsigned len);
+// Store in value the highest value of the watermark column of a table, which
+// is empty if the table has no rows; return 0 if it could not be read.
+unsigned db_watermark(DB* db, struct Table* table, char* value, unsigned len);
+// Read the rows of a table into a stage; return how many were read, or
+// (unsigned)-1 if they could not all be read.
+unsigned db_query_into_hash(DB* db, struct Table* table, struct TableStage* stage,
                             unsigned* min_id, unsigned* max_id);
@@ -0,0 +1,75 @@
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "arena.h"
+#include "dense.h"
+
+Dense* dense_build(unsigned min_key, unsigned max_key, struct Arena* arena) {
+  Dense* dense = 0;
+  unsigned bad = 0;
+  do {
+    if (!arena || max_key < min_key) {
+      LOG_WARN("Cannot create a Dense object without a valid Arena and key range");
+      break;
+    }
+
+    dense = calloc(1, sizeof(Dense));
+    if (!dense) {
+      LOG_WARN("Could not allocate a Dense object");
+      break;
+    }
+
+    dense->count = max_key - min_key + 1;
+    dense->frames = malloc((size_t)dense->count * sizeof(unsigned));
+    if (!dense->frames) {
+      LOG_WARN("Could not allocate Dense array for %u keys", dense->count);
+      ++bad;
+      break;
+    }
+    memset(dense->frames, 0xff, (size_t)dense->count * sizeof(unsigned));
+    dense->min_key = min_key;
+    dense->arena = arena;
+  } while (0);
+  if (bad) {
+    dense_destroy(dense);
+    dense = 0;
+  }
+  return dense;
+}
+
+void dense_destroy(Dense* dense) {
+  if (!dense) return;
+  if (dense->frames) free(dense->frames);
+  free(dense);
+}
+
+unsigned dense_insert(Dense* dense, unsigned key, unsigned frame) {
+  unsigned pos = key - dense->min_key;
+  if (key < dense->min_key || pos >= dense->count) return 0;
+  if (dense->frames[pos] == (unsigned)-1) {
+    ++dense->used;
+    dense->frames[pos] = frame;
+  } else if (frame < dense->frames[pos]) {
+    dense->frames[pos] = frame;
+  }
+  return 1;
+}
+
+unsigned dense_get(Dense* dense, const void *key, uint32_t key_len, uint32_t* frame_len) {
+  hash_stats_queries(&dense->stats, 1);
+  hash_stats_probes(&dense->stats, 1);
+  return dense_peek(dense, key, key_len, frame_len);
+}
+
+unsigned dense_peek(const Dense* dense, const void *key, uint32_t key_len, uint32_t* frame_len) {
+  if (key_len != sizeof(unsigned)) return (unsigned)-1;
+  unsigned k = 0;
+  memcpy(&k, key, sizeof(unsigned));
+  unsigned pos = k - dense->min_key;
+  if (k < dense->min_key || pos >= dense->count) return (unsigned)-1;
+  unsigned frame = dense->frames[pos];
+  if (frame == (unsigned)-1) return frame;
+
+  *frame_len = arena_get_frame_len(dense->arena, frame);
+  return frame;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+// A Dense keeps an index for integer keys that are (almost) contiguous, as a flat
+// array with one entry per key between the smallest and largest key.  Each entry
+// holds the arena index of the preframed value, so a lookup is a bounds check plus
+// one load, without hashing, probing or comparing keys.
+
+#include <stdint.h>
+#include "hash.h"
+
+typedef struct Dense {
+  unsigned min_key;       // smallest key, stored at position 0
+  unsigned count;         // number of positions, = max_key - min_key + 1
+  unsigned used;          // number of keys stored
+  unsigned *frames;       // arena index of preframed value per key, or -1
+  struct Arena* arena;    // pointer to common arena
+  struct HashStats stats;
+} Dense;
+
+Dense* dense_build(unsigned min_key, unsigned max_key, struct Arena* arena);
+void dense_destroy(Dense* dense);
+
+// Store the frame for a key; when a key is inserted twice, the earliest frame wins.
+unsigned dense_insert(Dense* dense, unsigned key, unsigned frame);
+
+// Return the arena index of the preframed value for a key, or (unsigned)-1.
+unsigned dense_get(Dense* dense, const void *key, uint32_t key_len, uint32_t* frame_len);
+// Same as dense_get, without counting the lookup in the stats.
+unsigned dense_peek(const Dense* dense, const void *key, uint32_t key_len, uint32_t* frame_len);
@@ -0,0 +1,264 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "log.h"
+#include "arena.h"
+#include "xxhash.h"
+#include "encoder.h"
+
+enum {
+  ENCODER_NAME_BYTES = 16,      // expected length of a column prefix, to size the plan
+  ENCODER_ESCAPE_BYTES = 6,     // longest escape for one byte, \u00XX
+};
+
+// Longest row, whose length and that of its 4-byte header fit in an unsigned.
+#define ENCODER_MAX_ROW ((size_t) UINT32_MAX - sizeof(unsigned))
+
+static const char encoder_hex[] = "0123456789abcdef";
+
+// Number of leading bytes of src that can be copied to a JSON string as they are.
+static inline unsigned encoder_plain_run(const uint8_t* src, unsigned len) {
+  unsigned pos = 0;
+#if defined(__SSE2__)
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i control = _mm_set1_epi8(0x1f);
+  for (; pos + 16 <= len; pos += 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i*)(src + pos));
+    __m128i special = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash));
+    special = _mm_or_si128(special, _mm_cmpeq_epi8(_mm_min_epu8(chunk, control), chunk));
+    unsigned mask = (unsigned)_mm_movemask_epi8(special);
+    if (mask) return pos + __builtin_ctz(mask);
+  }
+#endif
+  while (pos < len && src[pos] != '"' && src[pos] != '\\' && src[pos] >= 0x20) ++pos;
+  return pos;
+}
+
+// Copy src to dst escaped for a JSON string, and return the end of what was
+// written; dst must have room for ENCODER_ESCAPE_BYTES per byte of src.
+static uint8_t* encoder_escape(uint8_t* dst, const uint8_t* src, unsigned len) {
+  unsigned pos = 0;
+  while (1) {
+    unsigned run = encoder_plain_run(src + pos, len - pos);
+    memcpy(dst, src + pos, run);
+    dst += run;
+    pos += run;
+    if (pos >= len) break;
+
+    uint8_t c = src[pos++];
+    *dst++ = '\\';
+    switch (c) {
+      case '"':  *dst++ = '"';  break;
+      case '\\': *dst++ = '\\'; break;
+      case '\n': *dst++ = 'n';  break;
+      case '\r': *dst++ = 'r';  break;
+      case '\t': *dst++ = 't';  break;
+      case '\b': *dst++ = 'b';  break;
+      case '\f': *dst++ = 'f';  break;
+      default:
+        *dst++ = 'u';
+        *dst++ = '0';
+        *dst++ = '0';
+        *dst++ = encoder_hex[c >> 4];
+        *dst++ = encoder_hex[c & 0xf];
+        break;
+    }
+  }
+  return dst;
+}
+
+static inline unsigned encoder_digits(const char* value, unsigned len, unsigned pos) {
+  while (pos < len && value[pos] >= '0' && value[pos] <= '9') ++pos;
+  return pos;
+}
+
+// Whether value is spelled as a JSON number; databases also return things
+// such as NaN, Infinity or zero-filled integers for numeric columns.
+static unsigned encoder_is_number(const char* value, unsigned len) {
+  unsigned pos = 0;
+  if (pos < len && value[pos] == '-') ++pos;
+  if (pos >= len) return 0;
+  if (value[pos] == '0') {
+    ++pos;
+  } else {
+    unsigned beg = pos;
+    pos = encoder_digits(value, len, pos);
+    if (pos == beg) return 0;
+  }
+  if (pos < len && value[pos] == '.') {
+    unsigned beg = ++pos;
+    pos = encoder_digits(value, len, pos);
+    if (pos == beg) return 0;
+  }
+  if (pos < len && (value[pos] == 'e' || value[pos] == 'E')) {
+    ++pos;
+    if (pos < len && (value[pos] == '+' || value[pos] == '-')) ++pos;
+    unsigned beg = pos;
+    pos = encoder_digits(value, len, pos);
+    if (pos == beg) return 0;
+  }
+  return pos == len;
+}
+
+Encoder* encoder_build(unsigned columns, unsigned strip_null) {
+  Encoder* encoder = 0;
+  unsigned bad = 0;
+  do {
+    encoder = calloc(1, sizeof(Encoder));
+    if (!encoder) {
+      LOG_WARN("Could not allocate Encoder object");
+      break;
+    }
+    encoder->strip_null = strip_null;
+
+    encoder->columns = calloc(columns ? columns : 1, sizeof(EncoderColumn));
+    encoder->names_cap = (columns ? columns : 1) * ENCODER_NAME_BYTES;
+    encoder->names = malloc(encoder->names_cap);
+    if (!encoder->columns || !encoder->names) {
+      LOG_WARN("Could not allocate Encoder plan for %u columns", columns);
+      ++bad;
+      break;
+    }
+  } while (0);
+  if (bad) {
+    encoder_destroy(encoder);
+    encoder = 0;
+  }
+  return encoder;
+}
+
+void encoder_destroy(Encoder* encoder) {
+  if (!encoder) return;
+  if (encoder->columns) free(encoder->columns);
+  if (encoder->names) free(encoder->names);
+  free(encoder);
+}
+
+unsigned encoder_add_column(Encoder* encoder, const char* name, EncoderType type) {
+  size_t len = strlen(name);
+  size_t need = encoder->names_used + 4 + len * ENCODER_ESCAPE_BYTES;
+  if (len > UINT32_MAX / 2 / ENCODER_ESCAPE_BYTES || need > UINT32_MAX / 2) {
+    LOG_WARN("Could not add column with a name of %zu bytes to Encoder plan", len);
+    return 0;
+  }
+  if (need > encoder->names_cap) {
+    unsigned cap = encoder->names_cap;
+    while (need > cap) cap *= 2;
+    uint8_t* names = realloc(encoder->names, cap);
+    if (!names) {
+      LOG_WARN("Could not grow Encoder plan to %u bytes", cap);
+      return 0;
+    }
+    encoder->names = names;
+    encoder->names_cap = cap;
+  }
+
+  // Every prefix starts with a comma, which the first field of a row skips.
+  uint8_t* beg = encoder->names + encoder->names_used;
+  uint8_t* end = beg;
+  *end++ = ',';
+  *end++ = '"';
+  end = encoder_escape(end, (const uint8_t*) name, len);
+  *end++ = '"';
+  *end++ = ':';
+
+  EncoderColumn* column = &encoder->columns[encoder->count++];
+  column->type = type;
+  column->name_off = encoder->names_used;
+  column->name_len = end - beg;
+  encoder->names_used += column->name_len;
+  return 1;
+}
+
+uint64_t encoder_fingerprint(const Encoder* encoder) {
+  uint64_t fingerprint = XXH3_64bits(encoder->names, encoder->names_used, encoder->strip_null);
+  for (unsigned col = 0; col < encoder->count; ++col) {
+    fingerprint = XXH3_64bits(&encoder->columns[col].type, sizeof(EncoderType), fingerprint);
+  }
+  return fingerprint;
+}
+
+void encoder_begin(Encoder* encoder, Arena* arena) {
+  encoder->arena = arena;
+  encoder->fields = 0;
+  encoder->bad = 0;
+  encoder->frame = arena_begin(arena, sizeof(unsigned) + 1);
+  if (encoder->frame == (unsigned)-1) {
+    encoder->bad = 1;
+    return;
+  }
+  // The frame length is filled in by encoder_end.
+  arena->buffer[arena->used + sizeof(unsigned)] = '{';
+  arena->used += sizeof(unsigned) + 1;
+}
+
+// Write the prefix of a field, with room for len more bytes after it; a row that
+// would outgrow the length in its header cannot be stored.
+static uint8_t* encoder_field(Encoder* encoder, unsigned col, size_t len) {
+  if (encoder->bad) return 0;
+  const EncoderColumn* column = &encoder->columns[col];
+  unsigned skip = encoder->fields ? 0 : 1;
+  // The row already holds its header, and needs a byte for its closing brace.
+  size_t row = encoder->arena->used - (size_t) encoder->frame * ARENA_ALIGN + column->name_len + 1;
+  if (row > ENCODER_MAX_ROW || len > ENCODER_MAX_ROW - row) {
+    encoder->bad = 1;
+    return 0;
+  }
+  uint8_t* out = arena_reserve(encoder->arena, column->name_len + len);
+  if (!out) {
+    encoder->bad = 1;
+    return 0;
+  }
+  memcpy(out, encoder->names + column->name_off + skip, column->name_len - skip);
+  ++encoder->fields;
+  return out + column->name_len - skip;
+}
+
+void encoder_add_null(Encoder* encoder, unsigned col) {
+  if (encoder->strip_null) return;
+  uint8_t* out = encoder_field(encoder, col, 4);
+  if (!out) return;
+  memcpy(out, "null", 4);
+  encoder->arena->used = out + 4 - encoder->arena->buffer;
+}
+
+void encoder_add_typed(Encoder* encoder, unsigned col, EncoderType type, const char* value, unsigned len) {
+  if (type == ENCODER_TYPE_NUMBER && encoder_is_number(value, len)) {
+    uint8_t* out = encoder_field(encoder, col, len);
+    if (!out) return;
+    memcpy(out, value, len);
+    encoder->arena->used = out + len - encoder->arena->buffer;
+    return;
+  }
+
+  uint8_t* out = encoder_field(encoder, col, 2 + (size_t) len * ENCODER_ESCAPE_BYTES);
+  if (!out) return;
+  *out++ = '"';
+  out = encoder_escape(out, (const uint8_t*) value, len);
+  *out++ = '"';
+  encoder->arena->used = out - encoder->arena->buffer;
+}
+
+unsigned encoder_end(Encoder* encoder) {
+  Arena* arena = encoder->arena;
+  uint8_t* out = encoder->bad ? 0 : arena_reserve(arena, 1);
+  if (!out) {
+    // Drop whatever was written for the row.
+    if (encoder->frame != (unsigned)-1) arena->used = (size_t) encoder->frame * ARENA_ALIGN;
+    return -1;
+  }
+  *out = '}';
+  ++arena->used;
+
+  uint8_t* hdr = arena_get_ptr(arena, encoder->frame);
+  unsigned len = arena->buffer + arena->used - hdr - sizeof(unsigned);
+  hdr[0] = (uint8_t)((len >> 24) & 0xFF);
+  hdr[1] = (uint8_t)((len >> 16) & 0xFF);
+  hdr[2] = (uint8_t)((len >> 8)  & 0xFF);
+  hdr[3] = (uint8_t)( len        & 0xFF);
+  return encoder->frame;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+// An Encoder turns the rows of a query into JSON objects, written straight into
+// an Arena as preframed values.  The plan for each column is compiled once per
+// load: the escaped `"name":` bytes that prefix its values, and how to encode
+// them.  Strings are escaped by scanning 16 bytes at a time (with SSE2 when
+// available), and the arena grows as needed, so rows are never truncated.
+
+#include <stdint.h>
+
+struct Arena;
+
+typedef enum EncoderType {
+  ENCODER_TYPE_STRING,    // quoted and escaped
+  ENCODER_TYPE_NUMBER,    // as is, if it is a valid JSON number, else as a string
+} EncoderType;
+
+typedef struct EncoderColumn {
+  EncoderType type;
+  unsigned name_off;      // offset of the `,"name":` bytes in names
+  unsigned name_len;
+} EncoderColumn;
+
+typedef struct Encoder {
+  unsigned strip_null;    // whether to skip null values
+  unsigned count;         // number of columns
+  EncoderColumn* columns;
+  uint8_t* names;         // prefix bytes of all columns
+  unsigned names_used;
+  unsigned names_cap;
+  struct Arena* arena;    // where rows are written
+  unsigned frame;         // arena index of the row being written
+  unsigned fields;        // fields written so far for the row
+  unsigned bad;           // set if the row could not be written
+} Encoder;
+
+// Build an encoder for rows with the given number of columns.
+Encoder* encoder_build(unsigned columns, unsigned strip_null);
+void encoder_destroy(Encoder* encoder);
+
+// Add the next column to the plan.
+unsigned encoder_add_column(Encoder* encoder, const char* name, EncoderType type);
+
+// Fingerprint of the plan, which rows with the same values encode the same way
+// under; it seeds the fingerprint of the values of each row.
+uint64_t encoder_fingerprint(const Encoder* encoder);
+
+// Start a row in the arena; then add its fields, and end it to get the arena
+// index of its preframed value, or -1 if it could not be stored.
+void encoder_begin(Encoder* encoder, struct Arena* arena);
+void encoder_add_null(Encoder* encoder, unsigned col);
+void encoder_add_typed(Encoder* encoder, unsigned col, EncoderType type, const char* value, unsigned len);
+unsigned encoder_end(Encoder* encoder);
+
+static inline void encoder_add_value(Encoder* encoder, unsigned col, const char* value, unsigned len) {
+  encoder_add_typed(encoder, col, encoder->columns[col].type, value, len);
+}
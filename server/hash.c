@@ -37,7 +37,7 @@ Hash* hash_build(unsigned cap_pow2, struct Arena* arena) {
       break;
     }
 
-    hash->tab = calloc(cap_pow2, sizeof(Bucket));
+    hash->tab = arena_table_alloc(arena, (size_t) cap_pow2 * sizeof(Bucket), &hash->mapped);
     if (!hash->tab) {
       LOG_WARN("Could not allocate a Hash table object");
       ++bad;
@@ -55,29 +55,58 @@ Hash* hash_build(unsigned cap_pow2, struct Arena* arena) {
 
 void hash_destroy(Hash* hash) {
   if (!hash) return;
-  if (hash->tab) free(hash->tab);
+  if (hash->tab) arena_table_free(hash->tab, hash->mapped);
   free(hash);
 }
 
+unsigned hash_resize(Hash* hash, unsigned cap_pow2) {
+  if (cap_pow2 <= hash->used) return 0;
+  size_t mapped = 0;
+  Bucket *tab = arena_table_alloc(hash->arena, (size_t) cap_pow2 * sizeof(Bucket), &mapped);
+  if (!tab) {
+    LOG_WARN("Could not allocate a Hash table with %u buckets", cap_pow2);
+    return 0;
+  }
+  // Buckets keep their hash, so keys don't need to be hashed again.
+  uint32_t mask = cap_pow2 - 1;
+  for (unsigned b = 0; b < hash->cap; ++b) {
+    const Bucket *bucket = &hash->tab[b];
+    if (bucket->key_len == 0) continue;
+    uint32_t idx = bucket->hash & mask;
+    while (tab[idx].key_len != 0) {
+      idx = (idx + 1) & mask;
+    }
+    tab[idx] = *bucket;
+  }
+  arena_table_free(hash->tab, hash->mapped);
+  hash->tab = tab;
+  hash->mapped = mapped;
+  hash->cap = cap_pow2;
+  return 1;
+}
+
 // Insert preframed value
-unsigned hash_insert(Hash *hash, const void *key, uint32_t key_len, unsigned frame, uint32_t frame_len) {
-  uint64_t h = HASH_FUNC(key, key_len);
-  uint8_t tag = (uint8_t)(h >> 56);
-  uint64_t mask = hash->cap - 1;
-  uint64_t idx = h & mask;
+unsigned hash_insert(Hash *hash, const void *key, uint32_t key_len, unsigned frame) {
+  uint32_t h = (uint32_t)HASH_FUNC(key, key_len);
+  uint32_t mask = hash->cap - 1;
+  uint32_t idx = h & mask;
   while (1) {
-    if (hash->tab[idx].key_len == 0) {
-      // Store key in arena
-      unsigned kindex = arena_store(hash->arena, key, key_len);
-      if (kindex == (unsigned)-1) return 0;
+    Bucket *bucket = &hash->tab[idx];
+    if (bucket->key_len == 0) {
+      if (key_len <= HASH_KEY_INLINE) {
+        memcpy(bucket->key.bytes, key, key_len);
+      } else {
+        // Store the bytes beyond the prefix in arena
+        unsigned kindex = arena_store(hash->arena, (const uint8_t*)key + HASH_KEY_PREFIX, key_len - HASH_KEY_PREFIX);
+        if (kindex == (unsigned)-1) return 0;
+        memcpy(bucket->key.ext.prefix, key, HASH_KEY_PREFIX);
+        bucket->key.ext.rest_idx = kindex;
+      }
 
       // Assume frame value was already stored in arena
-      hash->tab[idx].hash = h;
-      hash->tab[idx].tag = tag;
-      hash->tab[idx].key_len = key_len;
-      hash->tab[idx].key_idx = kindex;
-      hash->tab[idx].frame_len = frame_len;
-      hash->tab[idx].frame_idx = frame;
+      bucket->hash = h;
+      bucket->key_len = key_len;
+      bucket->frame_idx = frame;
       hash->used++;
       return 1;
     }
@@ -85,14 +114,27 @@ unsigned hash_insert(Hash *hash, const void *key, uint32_t key_len, unsigned fra
   }
 }
 
-// Lookup by key
-const Bucket* hash_get(Hash *hash, const void *key, uint32_t key_len) {
-  ++hash->stats.queries;
-  uint64_t h = HASH_FUNC(key, key_len);
-  uint8_t tag = (uint8_t)(h >> 56);
-  LOG_DEBUG("Looking up %u bytes, [%.*s], hash %llu", key_len, key_len, key, h);
-  uint64_t mask = hash->cap - 1;
-  uint64_t idx = h & mask;
+// Compare a key against a bucket whose hash and length already matched
+static inline unsigned hash_key_equal(Hash *hash, const Bucket *bucket, const void *key, uint32_t key_len) {
+  if (key_len <= HASH_KEY_INLINE) return memcmp(bucket->key.bytes, key, key_len) == 0;
+  if (memcmp(bucket->key.ext.prefix, key, HASH_KEY_PREFIX) != 0) return 0;
+  uint8_t* rest_ptr = arena_get_ptr(hash->arena, bucket->key.ext.rest_idx);
+  return memcmp(rest_ptr, (const uint8_t*)key + HASH_KEY_PREFIX, key_len - HASH_KEY_PREFIX) == 0;
+}
+
+static inline void hash_record_probes(struct HashStats *stats, unsigned probes) {
+  if (!stats) return;
+  if (probes < MAX_PROBE_COUNT) {
+    hash_stats_probes(stats, probes);
+  } else {
+    LOG_WARN("Discarding probe count %u -- higher than maximum: %u", probes, MAX_PROBE_COUNT);
+  }
+}
+
+// Probe starting at the home bucket for an already hashed key, counting the probes in stats if set
+static inline const Bucket* hash_probe(Hash *hash, uint32_t h, const void *key, uint32_t key_len, struct HashStats *stats) {
+  uint32_t mask = hash->cap - 1;
+  uint32_t idx = h & mask;
   unsigned probes = 0;
   const Bucket *bucket = 0;
   while (1) {
@@ -103,21 +145,51 @@ const Bucket* hash_get(Hash *hash, const void *key, uint32_t key_len) {
       bucket = 0;
       break;
     }
-    if (bucket->tag == tag && bucket->hash == h && bucket->key_len == key_len) {
-      uint8_t* key_ptr = arena_get_ptr(hash->arena, bucket->key_idx);
-      if (memcmp(key_ptr, key, key_len) == 0) break;
-    }
+    if (bucket->hash == h && bucket->key_len == key_len && hash_key_equal(hash, bucket, key, key_len)) break;
     idx = (idx + 1) & mask;
   }
-  if (probes < MAX_PROBE_COUNT) {
-    ++hash->stats.probes[probes];
-  } else {
-    LOG_WARN("Discarding probe count %u -- higher than maximum: %u", probes, MAX_PROBE_COUNT);
-  }
-  LOG_DEBUG("Returning %u bytes: [%.*s]", bucket->frame_len, bucket->frame_len, arena_get_ptr(hash->arena, bucket->key_idx));
+  hash_record_probes(stats, probes);
   return bucket;
 }
 
+// Lookup by key
+const Bucket* hash_get(Hash *hash, const void *key, uint32_t key_len) {
+  hash_stats_queries(&hash->stats, 1);
+  uint32_t h = (uint32_t)HASH_FUNC(key, key_len);
+  LOG_DEBUG("Looking up %u bytes, [%.*s], hash %u", key_len, key_len, key, h);
+  return hash_probe(hash, h, key, key_len, &hash->stats);
+}
+
+const Bucket* hash_peek(Hash *hash, const void *key, uint32_t key_len) {
+  return hash_probe(hash, (uint32_t)HASH_FUNC(key, key_len), key, key_len, 0);
+}
+
+// Lookup a batch of keys, interleaving their memory accesses in groups:
+// hash every key and prefetch its home bucket, then prefetch the arena key bytes
+// of every candidate bucket holding a long key, and only then resolve them one by one.  This way the
+// cache misses of all lookups in a group overlap instead of being serialized.
+void hash_get_batch(Hash *hash, unsigned count, const void* const* keys, const uint32_t* key_lens, const Bucket** out) {
+  uint32_t mask = hash->cap - 1;
+  for (unsigned beg = 0; beg < count; beg += HASH_BATCH_GROUP) {
+    unsigned end = beg + HASH_BATCH_GROUP < count ? beg + HASH_BATCH_GROUP : count;
+    uint32_t h[HASH_BATCH_GROUP];
+    for (unsigned j = beg; j < end; ++j) {
+      h[j - beg] = (uint32_t)HASH_FUNC(keys[j], key_lens[j]);
+      __builtin_prefetch(&hash->tab[h[j - beg] & mask], 0, 3);
+    }
+    for (unsigned j = beg; j < end; ++j) {
+      const Bucket* bucket = &hash->tab[h[j - beg] & mask];
+      if (bucket->key_len == key_lens[j] && bucket->key_len > HASH_KEY_INLINE && bucket->hash == h[j - beg]) {
+        __builtin_prefetch(arena_get_ptr(hash->arena, bucket->key.ext.rest_idx), 0, 3);
+      }
+    }
+    for (unsigned j = beg; j < end; ++j) {
+      out[j] = hash_probe(hash, h[j - beg], keys[j], key_lens[j], &hash->stats);
+    }
+  }
+  hash_stats_queries(&hash->stats, count);
+}
+
 #if !USE_XXH3_32 && !USE_XXH3_64
 // Simple fast hash (xxhash64-like) for variable length binary keys
 static inline uint64_t fast_hash(const void *data, unsigned len) {
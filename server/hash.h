@@ -4,36 +4,64 @@
 // Keys are variable length byte arrays.
 // Values are variable length byte arrays.
 
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdint.h>
 
 enum {
   MAX_PROBE_COUNT = 1024,
+  HASH_BATCH_GROUP = 16,  // lookups whose memory accesses are overlapped in hash_get_batch
+  HASH_KEY_INLINE = 12,   // keys up to this length are stored whole in the bucket
+  HASH_KEY_PREFIX = 8,    // longer keys keep this many leading bytes in the bucket
 };
 
+// Stats of an index are counted by every worker serving it, and only read by
+// the status action, so they are atomic but updated with relaxed ordering.
 struct HashStats {
-  unsigned queries;       // total number of queries
-  unsigned probes[MAX_PROBE_COUNT];  // histogram with number of probes
+  atomic_uint queries;    // total number of queries
+  atomic_uint probes[MAX_PROBE_COUNT];  // histogram with number of probes
 };
 
+static inline void hash_stats_queries(struct HashStats* stats, unsigned count) {
+  atomic_fetch_add_explicit(&stats->queries, count, memory_order_relaxed);
+}
+
+static inline void hash_stats_probes(struct HashStats* stats, unsigned probes) {
+  if (probes < MAX_PROBE_COUNT) atomic_fetch_add_explicit(&stats->probes[probes], 1, memory_order_relaxed);
+}
+
 // Preframed value: [4-byte BE length][binary value]
+// The value length is read from the frame itself, see arena_get_frame_len.
+// Short keys (including all int keys) live inside the bucket, so a lookup
+// only touches the arena for long keys whose hash and prefix both match.
 typedef struct Bucket {
-  uint64_t hash;          // hash of the key for quick reject
-  uint8_t  tag;           // top 8 bits of hash as a tiny fingerprint
-  uint32_t key_len;       // length of key in bytes
-  unsigned key_idx;       // index into arena memory for key bytes
+  uint32_t hash;          // hash of the key for quick reject
+  uint32_t key_len;       // length of key in bytes, 0 for an empty bucket
   unsigned frame_idx;     // index into arena memory for preframed value
-  uint32_t frame_len;     // = 4 + value_len
+  union {
+    uint8_t bytes[HASH_KEY_INLINE];     // whole key, if key_len <= HASH_KEY_INLINE
+    struct {
+      uint8_t prefix[HASH_KEY_PREFIX];  // leading key bytes
+      unsigned rest_idx;                // index into arena memory for the remaining key bytes
+    } ext;
+  } key;
 } Bucket;
 
 typedef struct Hash {
   unsigned cap;           // power-of-two capacity
   unsigned used;          // number of items stored
   Bucket *tab;            // array of buckets
+  size_t mapped;          // bytes mapped for tab, or 0 if it was calloc'ed
   struct Arena* arena;    // pointer to common arena
   struct HashStats stats;
 } Hash;
 
 Hash* hash_build(unsigned cap_pow2, struct Arena* arena);
 void hash_destroy(Hash* hash);
-unsigned hash_insert(Hash *hash, const void *key, uint32_t key_len, unsigned frame, uint32_t frame_len);
+// Move all buckets to a new table with the given power-of-two capacity.
+unsigned hash_resize(Hash* hash, unsigned cap_pow2);
+unsigned hash_insert(Hash *hash, const void *key, uint32_t key_len, unsigned frame);
 const Bucket* hash_get(Hash *hash, const void *key, uint32_t key_len);
+// Same as hash_get, without counting the lookup in the stats.
+const Bucket* hash_peek(Hash *hash, const void *key, uint32_t key_len);
+void hash_get_batch(Hash *hash, unsigned count, const void* const* keys, const uint32_t* key_lens, const Bucket** out);
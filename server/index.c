@@ -0,0 +1,470 @@
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "util.h"
+#include "arena.h"
+#include "hash.h"
+#include "swiss.h"
+#include "mph.h"
+#include "dense.h"
+#include "ordered.h"
+#include "postings.h"
+#include "bitmap.h"
+#include "index.h"
+
+Index* index_build(ConfigIndexEngine engine, ConfigIndexType type, unsigned rows, struct Arena* arena) {
+  Index* index = 0;
+  unsigned bad = 0;
+  do {
+    index = calloc(1, sizeof(Index));
+    if (!index) {
+      LOG_WARN("Could not allocate an Index object");
+      break;
+    }
+    index->engine = engine;
+
+    switch (engine) {
+      case CONFIG_INDEX_ENGINE_SWISS:
+        index->u.swiss = swiss_build(rows, arena);
+        if (!index->u.swiss) ++bad;
+        break;
+
+      case CONFIG_INDEX_ENGINE_MPH:
+        index->u.mph = mph_build(rows, arena);
+        if (!index->u.mph) ++bad;
+        break;
+
+      case CONFIG_INDEX_ENGINE_ORDERED:
+        index->u.ordered = ordered_build(type, rows, arena);
+        if (!index->u.ordered) ++bad;
+        break;
+
+      case CONFIG_INDEX_ENGINE_POSTINGS:
+        index->u.postings = postings_build(rows, arena);
+        if (!index->u.postings) ++bad;
+        break;
+
+      case CONFIG_INDEX_ENGINE_BITMAP:
+        index->u.bitmap = bitmap_build(rows, arena);
+        if (!index->u.bitmap) ++bad;
+        break;
+
+      case CONFIG_INDEX_ENGINE_HASH:
+      default:
+        index->u.hash = hash_build(2 * next_power_of_two(rows, 1), arena);
+        if (!index->u.hash) ++bad;
+        break;
+    }
+  } while (0);
+  if (bad) {
+    index_destroy(index);
+    index = 0;
+  }
+  return index;
+}
+
+void index_destroy(Index* index) {
+  if (!index) return;
+  switch (index->engine) {
+    case CONFIG_INDEX_ENGINE_SWISS:
+      swiss_destroy(index->u.swiss);
+      break;
+    case CONFIG_INDEX_ENGINE_MPH:
+      mph_destroy(index->u.mph);
+      break;
+    case CONFIG_INDEX_ENGINE_ORDERED:
+      ordered_destroy(index->u.ordered);
+      break;
+    case CONFIG_INDEX_ENGINE_POSTINGS:
+      postings_destroy(index->u.postings);
+      break;
+    case CONFIG_INDEX_ENGINE_BITMAP:
+      bitmap_destroy(index->u.bitmap);
+      break;
+    case CONFIG_INDEX_ENGINE_DENSE:
+      dense_destroy(index->u.dense);
+      break;
+    case CONFIG_INDEX_ENGINE_HASH:
+    default:
+      hash_destroy(index->u.hash);
+      break;
+  }
+  free(index);
+}
+
+unsigned index_insert(Index* index, const void *key, uint32_t key_len, unsigned frame, uint32_t frame_len) {
+  switch (index->engine) {
+    case CONFIG_INDEX_ENGINE_SWISS:
+      return swiss_insert(index->u.swiss, key, key_len, frame, frame_len);
+    case CONFIG_INDEX_ENGINE_MPH:
+      UNUSED(frame_len);
+      return mph_insert(index->u.mph, key, key_len, frame);
+    case CONFIG_INDEX_ENGINE_ORDERED:
+      UNUSED(frame_len);
+      return ordered_insert(index->u.ordered, key, key_len, frame);
+    case CONFIG_INDEX_ENGINE_POSTINGS:
+      UNUSED(frame_len);
+      return postings_insert(index->u.postings, key, key_len, frame);
+    case CONFIG_INDEX_ENGINE_BITMAP:
+      UNUSED(frame_len);
+      return bitmap_insert(index->u.bitmap, key, key_len, frame);
+    case CONFIG_INDEX_ENGINE_DENSE: {
+      unsigned k = 0;
+      if (key_len != sizeof(unsigned)) return 0;
+      memcpy(&k, key, sizeof(unsigned));
+      UNUSED(frame_len);
+      return dense_insert(index->u.dense, k, frame);
+    }
+    case CONFIG_INDEX_ENGINE_HASH:
+    default:
+      UNUSED(frame_len);
+      return hash_insert(index->u.hash, key, key_len, frame);
+  }
+}
+
+unsigned index_finalize(Index* index, const unsigned* rows, unsigned row_count) {
+  if (index->engine == CONFIG_INDEX_ENGINE_ORDERED) return ordered_finalize(index->u.ordered);
+  if (index->engine == CONFIG_INDEX_ENGINE_POSTINGS) return postings_finalize(index->u.postings);
+  if (index->engine == CONFIG_INDEX_ENGINE_BITMAP) return bitmap_finalize(index->u.bitmap, rows, row_count);
+  if (index->engine != CONFIG_INDEX_ENGINE_MPH) return 1;
+
+  Mph* mph = index->u.mph;
+  if (mph_finalize(mph)) return 1;
+
+  // Fall back to a hash table with the staged keys; this should be really rare.
+  LOG_WARN("Falling back to hash engine for %u keys", mph->staged_used);
+  Hash* hash = hash_build(2 * next_power_of_two(mph->staged_used, 1), mph->arena);
+  if (!hash) return 0;
+  unsigned bad = 0;
+  for (unsigned j = 0; j < mph->staged_used; ++j) {
+    const MphEntry* entry = &mph->staged[j];
+    uint32_t key_len = 0;
+    const uint8_t* key_ptr = mph_entry_key(mph, entry, &key_len);
+    // Copy the key out, since storing it again may grow the arena.
+    uint8_t* key = malloc(key_len + 1);
+    if (!key) {
+      ++bad;
+      break;
+    }
+    memcpy(key, key_ptr, key_len);
+    if (!hash_insert(hash, key, key_len, entry->frame_idx)) ++bad;
+    free(key);
+  }
+  mph_destroy(mph);
+  index->engine = CONFIG_INDEX_ENGINE_HASH;
+  index->u.hash = hash;
+  return bad == 0;
+}
+
+unsigned index_densify(Index* index, unsigned factor) {
+  if (index->engine != CONFIG_INDEX_ENGINE_HASH || !factor) return 0;
+  Hash* hash = index->u.hash;
+  if (!hash->used) return 0;
+
+  unsigned min_key = (unsigned)-1;
+  unsigned max_key = 0;
+  for (unsigned b = 0; b < hash->cap; ++b) {
+    const Bucket* bucket = &hash->tab[b];
+    if (!bucket->key_len) continue;
+    if (bucket->key_len != sizeof(unsigned)) return 0;
+    unsigned key = 0;
+    memcpy(&key, bucket->key.bytes, sizeof(unsigned));
+    if (min_key > key) min_key = key;
+    if (max_key < key) max_key = key;
+  }
+  uint64_t range = (uint64_t)max_key - min_key + 1;
+  if (range > (uint64_t)factor * hash->used) {
+    LOG_DEBUG("Keys too sparse for a dense index: range %llu, keys %u", (unsigned long long)range, hash->used);
+    return 0;
+  }
+
+  Dense* dense = dense_build(min_key, max_key, hash->arena);
+  if (!dense) return 0;
+  for (unsigned b = 0; b < hash->cap; ++b) {
+    const Bucket* bucket = &hash->tab[b];
+    if (!bucket->key_len) continue;
+    unsigned key = 0;
+    memcpy(&key, bucket->key.bytes, sizeof(unsigned));
+    dense_insert(dense, key, bucket->frame_idx);
+  }
+  hash_destroy(hash);
+  index->engine = CONFIG_INDEX_ENGINE_DENSE;
+  index->u.dense = dense;
+  return 1;
+}
+
+unsigned index_get(Index* index, const void *key, uint32_t key_len, uint32_t* frame_len) {
+  switch (index->engine) {
+    case CONFIG_INDEX_ENGINE_SWISS: {
+      const SwissSlot* slot = swiss_get(index->u.swiss, key, key_len);
+      if (!slot) return (unsigned)-1;
+      *frame_len = slot->frame_len;
+      return slot->frame_idx;
+    }
+    case CONFIG_INDEX_ENGINE_MPH: {
+      const MphEntry* entry = mph_get(index->u.mph, key, key_len);
+      if (!entry) return (unsigned)-1;
+      *frame_len = arena_get_frame_len(index->u.mph->arena, entry->frame_idx);
+      return entry->frame_idx;
+    }
+    case CONFIG_INDEX_ENGINE_DENSE:
+      return dense_get(index->u.dense, key, key_len, frame_len);
+    case CONFIG_INDEX_ENGINE_ORDERED: {
+      unsigned frame = ordered_get(index->u.ordered, key, key_len);
+      if (frame == (unsigned)-1) return frame;
+      *frame_len = arena_get_frame_len(index->u.ordered->arena, frame);
+      return frame;
+    }
+    case CONFIG_INDEX_ENGINE_POSTINGS: {
+      const unsigned* frames = 0;
+      unsigned bytes = 0;
+      if (!postings_get(index->u.postings, key, key_len, &frames, &bytes)) return (unsigned)-1;
+      *frame_len = arena_get_frame_len(index->u.postings->arena, frames[0]);
+      return frames[0];
+    }
+    case CONFIG_INDEX_ENGINE_BITMAP:
+      return (unsigned)-1;
+    case CONFIG_INDEX_ENGINE_HASH:
+    default: {
+      const Bucket* bucket = hash_get(index->u.hash, key, key_len);
+      if (!bucket) return (unsigned)-1;
+      *frame_len = arena_get_frame_len(index->u.hash->arena, bucket->frame_idx);
+      return bucket->frame_idx;
+    }
+  }
+}
+
+unsigned index_peek(Index* index, const void *key, uint32_t key_len, uint32_t* frame_len) {
+  switch (index->engine) {
+    case CONFIG_INDEX_ENGINE_SWISS: {
+      const SwissSlot* slot = swiss_peek(index->u.swiss, key, key_len);
+      if (!slot) return (unsigned)-1;
+      *frame_len = slot->frame_len;
+      return slot->frame_idx;
+    }
+    case CONFIG_INDEX_ENGINE_MPH: {
+      const MphEntry* entry = mph_peek(index->u.mph, key, key_len);
+      if (!entry) return (unsigned)-1;
+      *frame_len = arena_get_frame_len(index->u.mph->arena, entry->frame_idx);
+      return entry->frame_idx;
+    }
+    case CONFIG_INDEX_ENGINE_DENSE:
+      return dense_peek(index->u.dense, key, key_len, frame_len);
+    case CONFIG_INDEX_ENGINE_ORDERED: {
+      unsigned frame = ordered_peek(index->u.ordered, key, key_len);
+      if (frame == (unsigned)-1) return frame;
+      *frame_len = arena_get_frame_len(index->u.ordered->arena, frame);
+      return frame;
+    }
+    case CONFIG_INDEX_ENGINE_POSTINGS: {
+      Postings* postings = index->u.postings;
+      const Bucket* bucket = hash_peek(postings->keys, key, key_len);
+      if (!bucket) return (unsigned)-1;
+      unsigned frame = postings->frames[postings->offsets[bucket->frame_idx]];
+      *frame_len = arena_get_frame_len(postings->arena, frame);
+      return frame;
+    }
+    case CONFIG_INDEX_ENGINE_BITMAP:
+      return (unsigned)-1;
+    case CONFIG_INDEX_ENGINE_HASH:
+    default: {
+      const Bucket* bucket = hash_peek(index->u.hash, key, key_len);
+      if (!bucket) return (unsigned)-1;
+      *frame_len = arena_get_frame_len(index->u.hash->arena, bucket->frame_idx);
+      return bucket->frame_idx;
+    }
+  }
+}
+
+void index_get_batch(Index* index, unsigned count, const void* const* keys, const uint32_t* key_lens,
+                     unsigned* frames, uint32_t* frame_lens) {
+  for (unsigned beg = 0; beg < count; beg += HASH_BATCH_GROUP) {
+    unsigned n = count - beg < HASH_BATCH_GROUP ? count - beg : HASH_BATCH_GROUP;
+    switch (index->engine) {
+      case CONFIG_INDEX_ENGINE_SWISS: {
+        const SwissSlot* slots[HASH_BATCH_GROUP];
+        swiss_get_batch(index->u.swiss, n, keys + beg, key_lens + beg, slots);
+        for (unsigned j = 0; j < n; ++j) {
+          frames[beg + j] = slots[j] ? slots[j]->frame_idx : (unsigned)-1;
+          frame_lens[beg + j] = slots[j] ? slots[j]->frame_len : 0;
+        }
+        break;
+      }
+      case CONFIG_INDEX_ENGINE_MPH: {
+        const MphEntry* entries[HASH_BATCH_GROUP];
+        mph_get_batch(index->u.mph, n, keys + beg, key_lens + beg, entries);
+        for (unsigned j = 0; j < n; ++j) {
+          frames[beg + j] = entries[j] ? entries[j]->frame_idx : (unsigned)-1;
+          frame_lens[beg + j] = entries[j] ? arena_get_frame_len(index->u.mph->arena, entries[j]->frame_idx) : 0;
+        }
+        break;
+      }
+      case CONFIG_INDEX_ENGINE_DENSE:
+        for (unsigned j = beg; j < beg + n; ++j) {
+          frames[j] = dense_get(index->u.dense, keys[j], key_lens[j], &frame_lens[j]);
+          if (frames[j] == (unsigned)-1) frame_lens[j] = 0;
+        }
+        break;
+      case CONFIG_INDEX_ENGINE_ORDERED:
+        for (unsigned j = beg; j < beg + n; ++j) {
+          frames[j] = ordered_get(index->u.ordered, keys[j], key_lens[j]);
+          frame_lens[j] = frames[j] == (unsigned)-1 ? 0 : arena_get_frame_len(index->u.ordered->arena, frames[j]);
+        }
+        break;
+      case CONFIG_INDEX_ENGINE_POSTINGS:
+      case CONFIG_INDEX_ENGINE_BITMAP:
+        for (unsigned j = beg; j < beg + n; ++j) {
+          frames[j] = index_get(index, keys[j], key_lens[j], &frame_lens[j]);
+          if (frames[j] == (unsigned)-1) frame_lens[j] = 0;
+        }
+        break;
+      case CONFIG_INDEX_ENGINE_HASH:
+      default: {
+        const Bucket* buckets[HASH_BATCH_GROUP];
+        hash_get_batch(index->u.hash, n, keys + beg, key_lens + beg, buckets);
+        for (unsigned j = 0; j < n; ++j) {
+          frames[beg + j] = buckets[j] ? buckets[j]->frame_idx : (unsigned)-1;
+          frame_lens[beg + j] = buckets[j] ? arena_get_frame_len(index->u.hash->arena, buckets[j]->frame_idx) : 0;
+        }
+        break;
+      }
+    }
+  }
+}
+
+// Collect the frames of count consecutive keys of an ordered index, plus the cursor key.
+static void index_scan_frames(Ordered* ordered, unsigned count, unsigned first, unsigned after,
+                              const uint8_t** frames, uint32_t* frame_lens,
+                              const void** next, uint32_t* next_len) {
+  if (count == (unsigned)-1) return;
+  for (unsigned j = 0; j < count; ++j) {
+    unsigned frame = ordered->frames[first + j];
+    frames[j] = arena_get_ptr(ordered->arena, frame);
+    frame_lens[j] = arena_get_frame_len(ordered->arena, frame);
+  }
+  if (after != (unsigned)-1) *next = ordered_key(ordered, after, next_len);
+}
+
+unsigned index_range(Index* index, const void *from, uint32_t from_len, const void *to, uint32_t to_len,
+                     unsigned limit, const uint8_t** frames, uint32_t* frame_lens,
+                     const void** next, uint32_t* next_len) {
+  *next = 0;
+  *next_len = 0;
+  if (index->engine != CONFIG_INDEX_ENGINE_ORDERED) return (unsigned)-1;
+
+  Ordered* ordered = index->u.ordered;
+  unsigned first = 0;
+  unsigned after = 0;
+  unsigned count = ordered_range(ordered, from, from_len, to, to_len, limit, &first, &after);
+  index_scan_frames(ordered, count, first, after, frames, frame_lens, next, next_len);
+  return count;
+}
+
+unsigned index_prefix(Index* index, const void *prefix, uint32_t prefix_len, const void *from, uint32_t from_len,
+                      unsigned limit, const uint8_t** frames, uint32_t* frame_lens,
+                      const void** next, uint32_t* next_len) {
+  *next = 0;
+  *next_len = 0;
+  if (index->engine != CONFIG_INDEX_ENGINE_ORDERED) return (unsigned)-1;
+
+  Ordered* ordered = index->u.ordered;
+  unsigned first = 0;
+  unsigned after = 0;
+  unsigned count = ordered_prefix(ordered, prefix, prefix_len, from, from_len, limit, &first, &after);
+  index_scan_frames(ordered, count, first, after, frames, frame_lens, next, next_len);
+  return count;
+}
+
+unsigned index_get_all(Index* index, const void *key, uint32_t key_len, const unsigned** frames, unsigned* bytes) {
+  *frames = 0;
+  *bytes = 0;
+  if (index->engine != CONFIG_INDEX_ENGINE_POSTINGS) return (unsigned)-1;
+  return postings_get(index->u.postings, key, key_len, frames, bytes);
+}
+
+unsigned index_get_bitmap(Index* index, const void *key, uint32_t key_len, const struct Roaring** map) {
+  *map = 0;
+  if (index->engine != CONFIG_INDEX_ENGINE_BITMAP) return 0;
+  *map = bitmap_get(index->u.bitmap, key, key_len);
+  return 1;
+}
+
+unsigned index_capacity(const Index* index) {
+  switch (index->engine) {
+    case CONFIG_INDEX_ENGINE_SWISS:
+      return index->u.swiss->cap;
+    case CONFIG_INDEX_ENGINE_MPH:
+      return index->u.mph->m;
+    case CONFIG_INDEX_ENGINE_DENSE:
+      return index->u.dense->count;
+    case CONFIG_INDEX_ENGINE_ORDERED:
+      return index->u.ordered->used;
+    case CONFIG_INDEX_ENGINE_POSTINGS:
+      return index->u.postings->keys->cap;
+    case CONFIG_INDEX_ENGINE_BITMAP:
+      return index->u.bitmap->keys->cap;
+    case CONFIG_INDEX_ENGINE_HASH:
+    default:
+      return index->u.hash->cap;
+  }
+}
+
+unsigned index_used(const Index* index) {
+  switch (index->engine) {
+    case CONFIG_INDEX_ENGINE_SWISS:
+      return index->u.swiss->used;
+    case CONFIG_INDEX_ENGINE_MPH:
+      return index->u.mph->n;
+    case CONFIG_INDEX_ENGINE_DENSE:
+      return index->u.dense->used;
+    case CONFIG_INDEX_ENGINE_ORDERED:
+      return index->u.ordered->used;
+    case CONFIG_INDEX_ENGINE_POSTINGS:
+      return index->u.postings->lists;
+    case CONFIG_INDEX_ENGINE_BITMAP:
+      return index->u.bitmap->count;
+    case CONFIG_INDEX_ENGINE_HASH:
+    default:
+      return index->u.hash->used;
+  }
+}
+
+const struct HashStats* index_stats(const Index* index) {
+  switch (index->engine) {
+    case CONFIG_INDEX_ENGINE_SWISS:
+      return &index->u.swiss->stats;
+    case CONFIG_INDEX_ENGINE_MPH:
+      return &index->u.mph->stats;
+    case CONFIG_INDEX_ENGINE_DENSE:
+      return &index->u.dense->stats;
+    case CONFIG_INDEX_ENGINE_ORDERED:
+      return &index->u.ordered->stats;
+    case CONFIG_INDEX_ENGINE_POSTINGS:
+      return &index->u.postings->keys->stats;
+    case CONFIG_INDEX_ENGINE_BITMAP:
+      return &index->u.bitmap->keys->stats;
+    case CONFIG_INDEX_ENGINE_HASH:
+    default:
+      return &index->u.hash->stats;
+  }
+}
+
+const char* index_engine_name(ConfigIndexEngine engine) {
+  switch (engine) {
+    case CONFIG_INDEX_ENGINE_SWISS:
+      return "swiss";
+    case CONFIG_INDEX_ENGINE_MPH:
+      return "mph";
+    case CONFIG_INDEX_ENGINE_DENSE:
+      return "dense";
+    case CONFIG_INDEX_ENGINE_ORDERED:
+      return "ordered";
+    case CONFIG_INDEX_ENGINE_POSTINGS:
+      return "postings";
+    case CONFIG_INDEX_ENGINE_BITMAP:
+      return "bitmap";
+    case CONFIG_INDEX_ENGINE_HASH:
+    default:
+      return "hash";
+  }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+// An Index maps keys to preframed values stored in the Arena of a table slot.
+// Each index of a table is served by one of several engines, selected in the
+// table configuration; all of them are used through this common interface.
+
+#include <stdint.h>
+#include "config.h"
+
+struct Arena;
+struct HashStats;
+struct Roaring;
+
+typedef struct Index {
+  ConfigIndexEngine engine;
+  union {
+    struct Hash* hash;
+    struct Swiss* swiss;
+    struct Mph* mph;
+    struct Dense* dense;
+    struct Ordered* ordered;
+    struct Postings* postings;
+    struct Bitmap* bitmap;
+  } u;
+} Index;
+
+// Build an empty index sized for the given number of rows.
+Index* index_build(ConfigIndexEngine engine, ConfigIndexType type, unsigned rows, struct Arena* arena);
+void index_destroy(Index* index);
+unsigned index_insert(Index* index, const void *key, uint32_t key_len, unsigned frame, uint32_t frame_len);
+
+// Complete the index once all keys have been inserted, before serving lookups;
+// rows holds the arena index of the preframed value of every row in load order.
+unsigned index_finalize(Index* index, const unsigned* rows, unsigned row_count);
+
+// Replace a hash index over int keys with a direct-addressed array, when the
+// key range is at most factor times the number of keys; return 1 if replaced.
+unsigned index_densify(Index* index, unsigned factor);
+
+// Return the arena index of the preframed value for a key, or (unsigned)-1.
+// For a postings index, this is the first row with that key; a bitmap index
+// only answers index_get_bitmap.
+unsigned index_get(Index* index, const void *key, uint32_t key_len, uint32_t* frame_len);
+// Same as index_get, without counting the lookup in the index stats, for the
+// loader to look up rows of the live slot while workers are serving it.
+unsigned index_peek(Index* index, const void *key, uint32_t key_len, uint32_t* frame_len);
+void index_get_batch(Index* index, unsigned count, const void* const* keys, const uint32_t* key_lens,
+                     unsigned* frames, uint32_t* frame_lens);
+
+// Point frames to up to limit preframed values in the arena whose keys lie in
+// [from, to], in key order; an empty from or to leaves that end open.  If more
+// keys match, point next to the first one not returned, else set next_len to 0.
+// Return the number of frames, or (unsigned)-1 if the index cannot do range
+// scans or the bounds are invalid.
+unsigned index_range(Index* index, const void *from, uint32_t from_len, const void *to, uint32_t to_len,
+                     unsigned limit, const uint8_t** frames, uint32_t* frame_lens,
+                     const void** next, uint32_t* next_len);
+
+// Same as index_range, for the keys of a string index that start with prefix
+// and are not less than from; an empty from starts at the first such key.
+unsigned index_prefix(Index* index, const void *prefix, uint32_t prefix_len, const void *from, uint32_t from_len,
+                      unsigned limit, const uint8_t** frames, uint32_t* frame_lens,
+                      const void** next, uint32_t* next_len);
+
+// Return the number of rows for a key of a postings index, pointing frames to
+// the arena indexes of their preframed values and setting bytes to their total
+// length.  Return (unsigned)-1 if the index is not a postings index.
+unsigned index_get_all(Index* index, const void *key, uint32_t key_len, const unsigned** frames, unsigned* bytes);
+
+// Point map to the bitmap of row numbers for a key of a bitmap index, or to
+// NULL if no row has that key.  Return 0 if the index is not a bitmap index.
+unsigned index_get_bitmap(Index* index, const void *key, uint32_t key_len, const struct Roaring** map);
+
+unsigned index_capacity(const Index* index);
+unsigned index_used(const Index* index);
+const struct HashStats* index_stats(const Index* index);
+const char* index_engine_name(ConfigIndexEngine engine);
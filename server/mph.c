@@ -0,0 +1,357 @@
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "arena.h"
+#include "xxhash.h"
+#include "mph.h"
+
+enum {
+  MPH_BUCKET_KEYS = 4,      // average number of keys per bucket
+  MPH_MAX_PILOT = 65535,    // pilots are stored in 16 bits
+  MPH_MAX_ATTEMPTS = 8,     // seeds to try before giving up
+};
+
+// 60% of the keys go to the first 30% of the buckets, so that there are some
+// large buckets, which are placed first, while most positions are still free.
+#define MPH_SKEW_THRESHOLD ((uint32_t)(0.6 * 4294967296.0))
+
+static unsigned mph_dedupe(Mph* mph);
+static unsigned mph_try_build(Mph* mph);
+
+static inline unsigned mph_bucket(const Mph* mph, uint64_t h) {
+  uint32_t hi = (uint32_t)(h >> 32);
+  unsigned dense = mph->buckets * 3 / 10;
+  if (hi < MPH_SKEW_THRESHOLD) return dense ? hi % dense : 0;
+  return dense + hi % (mph->buckets - dense);
+}
+
+static inline unsigned mph_position(const Mph* mph, uint64_t h, unsigned pilot) {
+  uint64_t x = h ^ (pilot * 0x9E3779B97F4A7C15ull);
+  x ^= x >> 32;
+  return (unsigned)(x % mph->m);
+}
+
+Mph* mph_build(unsigned rows, struct Arena* arena) {
+  Mph* mph = 0;
+  unsigned bad = 0;
+  do {
+    if (!arena) {
+      LOG_WARN("Cannot create a Mph object without a valid Arena");
+      break;
+    }
+
+    mph = calloc(1, sizeof(Mph));
+    if (!mph) {
+      LOG_WARN("Could not allocate a Mph object");
+      break;
+    }
+
+    mph->staged_cap = rows ? rows : 1;
+    mph->staged = malloc(mph->staged_cap * sizeof(MphEntry));
+    if (!mph->staged) {
+      LOG_WARN("Could not allocate Mph staging area for %u rows", mph->staged_cap);
+      ++bad;
+      break;
+    }
+    mph->arena = arena;
+  } while (0);
+  if (bad) {
+    mph_destroy(mph);
+    mph = 0;
+  }
+  return mph;
+}
+
+void mph_destroy(Mph* mph) {
+  if (!mph) return;
+  if (mph->pilots) free(mph->pilots);
+  if (mph->remap) free(mph->remap);
+  if (mph->entries) free(mph->entries);
+  if (mph->staged) free(mph->staged);
+  free(mph);
+}
+
+unsigned mph_insert(Mph* mph, const void *key, uint32_t key_len, unsigned frame) {
+  if (mph->staged_used >= mph->staged_cap) {
+    unsigned cap = mph->staged_cap * 2;
+    MphEntry* staged = realloc(mph->staged, cap * sizeof(MphEntry));
+    if (!staged) {
+      LOG_WARN("Could not grow Mph staging area to %u rows", cap);
+      return 0;
+    }
+    mph->staged = staged;
+    mph->staged_cap = cap;
+  }
+  unsigned kindex = arena_store_framed(mph->arena, key, key_len);
+  if (kindex == (unsigned)-1) return 0;
+
+  MphEntry* entry = &mph->staged[mph->staged_used++];
+  entry->key_idx = kindex;
+  entry->frame_idx = frame;
+  return 1;
+}
+
+const uint8_t* mph_entry_key(const Mph* mph, const MphEntry* entry, uint32_t* key_len) {
+  *key_len = arena_get_frame_len(mph->arena, entry->key_idx) - sizeof(unsigned);
+  return arena_get_ptr(mph->arena, entry->key_idx) + sizeof(unsigned);
+}
+
+unsigned mph_finalize(Mph* mph) {
+  mph->n = mph_dedupe(mph);
+  unsigned built = 0;
+  for (unsigned attempt = 0; attempt < MPH_MAX_ATTEMPTS && !built; ++attempt) {
+    mph->seed = attempt;
+    built = mph_try_build(mph);
+    if (!built) LOG_INFO("Could not build perfect hash for %u keys with seed %u, retrying", mph->n, attempt);
+  }
+  if (!built) {
+    LOG_WARN("Could not build perfect hash for %u keys", mph->n);
+    return 0;
+  }
+  LOG_DEBUG("Built perfect hash for %u keys, %u positions, %u buckets, seed %llu",
+            mph->n, mph->m, mph->buckets, (unsigned long long)mph->seed);
+  free(mph->staged);
+  mph->staged = 0;
+  mph->staged_used = mph->staged_cap = 0;
+  return 1;
+}
+
+static inline const MphEntry* mph_probe(Mph* mph, uint64_t h, const void *key, uint32_t key_len, struct HashStats* stats) {
+  if (stats) hash_stats_probes(stats, 1);
+  if (!mph->n) return 0;
+  unsigned pos = mph_position(mph, h, mph->pilots[mph_bucket(mph, h)]);
+  if (pos >= mph->n) pos = mph->remap[pos - mph->n];
+  const MphEntry* entry = &mph->entries[pos];
+  uint32_t entry_len = 0;
+  const uint8_t* entry_key = mph_entry_key(mph, entry, &entry_len);
+  if (entry_len != key_len || memcmp(entry_key, key, key_len) != 0) return 0;
+  return entry;
+}
+
+const MphEntry* mph_get(Mph* mph, const void *key, uint32_t key_len) {
+  hash_stats_queries(&mph->stats, 1);
+  uint64_t h = XXH3_64bits(key, key_len, mph->seed);
+  return mph_probe(mph, h, key, key_len, &mph->stats);
+}
+
+const MphEntry* mph_peek(Mph* mph, const void *key, uint32_t key_len) {
+  return mph_probe(mph, XXH3_64bits(key, key_len, mph->seed), key, key_len, 0);
+}
+
+// Lookup a batch of keys: hash them all and prefetch their pilots, then compute
+// their positions and prefetch the entries, and only then resolve them.
+void mph_get_batch(Mph* mph, unsigned count, const void* const* keys, const uint32_t* key_lens, const MphEntry** out) {
+  for (unsigned beg = 0; beg < count; beg += HASH_BATCH_GROUP) {
+    unsigned end = beg + HASH_BATCH_GROUP < count ? beg + HASH_BATCH_GROUP : count;
+    uint64_t h[HASH_BATCH_GROUP];
+    for (unsigned j = beg; j < end; ++j) {
+      h[j - beg] = XXH3_64bits(keys[j], key_lens[j], mph->seed);
+      if (mph->n) __builtin_prefetch(&mph->pilots[mph_bucket(mph, h[j - beg])], 0, 3);
+    }
+    for (unsigned j = beg; mph->n && j < end; ++j) {
+      unsigned pos = mph_position(mph, h[j - beg], mph->pilots[mph_bucket(mph, h[j - beg])]);
+      if (pos >= mph->n) pos = mph->remap[pos - mph->n];
+      __builtin_prefetch(&mph->entries[pos], 0, 3);
+    }
+    for (unsigned j = beg; j < end; ++j) {
+      out[j] = mph_probe(mph, h[j - beg], keys[j], key_lens[j], &mph->stats);
+    }
+  }
+  hash_stats_queries(&mph->stats, count);
+}
+
+struct MphSortKey {
+  uint64_t hash;
+  unsigned pos;
+};
+
+static int mph_cmp_sort_key(const void* lv, const void* rv) {
+  const struct MphSortKey* l = lv;
+  const struct MphSortKey* r = rv;
+  if (l->hash != r->hash) return l->hash < r->hash ? -1 : 1;
+  return l->pos < r->pos ? -1 : l->pos > r->pos;
+}
+
+// A perfect hash needs distinct keys; as with the other engines, the first row
+// inserted for a key wins.  Return the number of distinct staged keys.
+static unsigned mph_dedupe(Mph* mph) {
+  unsigned count = mph->staged_used;
+  if (count < 2) return count;
+  struct MphSortKey* sorted = malloc(count * sizeof(struct MphSortKey));
+  uint8_t* drop = calloc(count, 1);
+  if (!sorted || !drop) {
+    LOG_WARN("Could not allocate memory to check %u keys for duplicates", count);
+    free(sorted);
+    free(drop);
+    return count;
+  }
+  for (unsigned j = 0; j < count; ++j) {
+    uint32_t key_len = 0;
+    const uint8_t* key = mph_entry_key(mph, &mph->staged[j], &key_len);
+    sorted[j].hash = XXH3_64bits(key, key_len, 0);
+    sorted[j].pos = j;
+  }
+  qsort(sorted, count, sizeof(struct MphSortKey), mph_cmp_sort_key);
+  unsigned dups = 0;
+  for (unsigned j = 1; j < count; ++j) {
+    uint32_t entry_len = 0;
+    const uint8_t* entry_key = mph_entry_key(mph, &mph->staged[sorted[j].pos], &entry_len);
+    for (unsigned k = j; k > 0 && sorted[k - 1].hash == sorted[j].hash; --k) {
+      if (drop[sorted[k - 1].pos]) continue;
+      uint32_t other_len = 0;
+      const uint8_t* other_key = mph_entry_key(mph, &mph->staged[sorted[k - 1].pos], &other_len);
+      if (other_len != entry_len || memcmp(other_key, entry_key, entry_len) != 0) continue;
+      drop[sorted[j].pos] = 1;
+      ++dups;
+      break;
+    }
+  }
+  if (dups) {
+    LOG_INFO("Ignoring %u duplicate keys out of %u for perfect hash", dups, count);
+    unsigned kept = 0;
+    for (unsigned j = 0; j < count; ++j) {
+      if (!drop[j]) mph->staged[kept++] = mph->staged[j];
+    }
+    mph->staged_used = kept;
+  }
+  free(sorted);
+  free(drop);
+  return mph->staged_used;
+}
+
+// Try to build the function with the current seed.
+static unsigned mph_try_build(Mph* mph) {
+  unsigned n = mph->n;
+  unsigned ok = 0;
+  uint64_t* hashes = 0;
+  unsigned* key_bucket = 0;
+  unsigned* bucket_start = 0;
+  unsigned* bucket_keys = 0;
+  unsigned* order = 0;
+  unsigned* positions = 0;
+  uint64_t* taken = 0;
+
+  if (mph->pilots) free(mph->pilots);
+  if (mph->remap) free(mph->remap);
+  if (mph->entries) free(mph->entries);
+  mph->pilots = 0;
+  mph->remap = 0;
+  mph->entries = 0;
+
+  mph->m = n + n / 99 + 1;  // load factor of about 0.99
+  mph->buckets = n / MPH_BUCKET_KEYS + 1;
+  unsigned buckets = mph->buckets;
+  do {
+    hashes = malloc((n + 1) * sizeof(uint64_t));
+    key_bucket = malloc((n + 1) * sizeof(unsigned));
+    bucket_start = calloc(buckets + 1, sizeof(unsigned));
+    bucket_keys = malloc((n + 1) * sizeof(unsigned));
+    order = malloc(buckets * sizeof(unsigned));
+    positions = malloc((n + 1) * sizeof(unsigned));
+    taken = calloc(mph->m / 64 + 1, sizeof(uint64_t));
+    mph->pilots = calloc(buckets, sizeof(uint16_t));
+    mph->remap = calloc(mph->m - n, sizeof(unsigned));
+    mph->entries = calloc(n + 1, sizeof(MphEntry));
+    if (!hashes || !key_bucket || !bucket_start || !bucket_keys || !order ||
+        !positions || !taken || !mph->pilots || !mph->remap || !mph->entries) {
+      LOG_WARN("Could not allocate memory to build perfect hash for %u keys", n);
+      break;
+    }
+
+    // Hash all keys and group them by bucket (counting sort).
+    for (unsigned j = 0; j < n; ++j) {
+      uint32_t key_len = 0;
+      const uint8_t* key = mph_entry_key(mph, &mph->staged[j], &key_len);
+      hashes[j] = XXH3_64bits(key, key_len, mph->seed);
+      key_bucket[j] = mph_bucket(mph, hashes[j]);
+      ++bucket_start[key_bucket[j] + 1];
+    }
+    unsigned max_size = 0;
+    for (unsigned b = 0; b < buckets; ++b) {
+      if (max_size < bucket_start[b + 1]) max_size = bucket_start[b + 1];
+      bucket_start[b + 1] += bucket_start[b];
+    }
+    for (unsigned j = 0; j < n; ++j) {
+      bucket_keys[bucket_start[key_bucket[j]]++] = j;
+    }
+    for (unsigned b = buckets; b > 0; --b) {
+      bucket_start[b] = bucket_start[b - 1];
+    }
+    bucket_start[0] = 0;
+
+    // Order buckets by decreasing size (counting sort again).
+    unsigned* size_start = calloc(max_size + 2, sizeof(unsigned));
+    if (!size_start) {
+      LOG_WARN("Could not allocate memory to sort %u buckets", buckets);
+      break;
+    }
+    for (unsigned b = 0; b < buckets; ++b) {
+      unsigned size = bucket_start[b + 1] - bucket_start[b];
+      ++size_start[max_size - size + 1];
+    }
+    for (unsigned s = 0; s <= max_size; ++s) {
+      size_start[s + 1] += size_start[s];
+    }
+    for (unsigned b = 0; b < buckets; ++b) {
+      unsigned size = bucket_start[b + 1] - bucket_start[b];
+      order[size_start[max_size - size]++] = b;
+    }
+    free(size_start);
+
+    // Find a pilot for each bucket, largest buckets first.
+    unsigned failed = 0;
+    for (unsigned o = 0; o < buckets && !failed; ++o) {
+      unsigned b = order[o];
+      unsigned beg = bucket_start[b];
+      unsigned end = bucket_start[b + 1];
+      if (beg == end) break;  // all remaining buckets are empty
+      unsigned pilot = 0;
+      for (; pilot <= MPH_MAX_PILOT; ++pilot) {
+        unsigned j = beg;
+        for (; j < end; ++j) {
+          unsigned pos = mph_position(mph, hashes[bucket_keys[j]], pilot);
+          if (taken[pos / 64] & (1ull << (pos % 64))) break;
+          unsigned k = beg;
+          while (k < j && positions[bucket_keys[k]] != pos) ++k;
+          if (k < j) break;
+          positions[bucket_keys[j]] = pos;
+        }
+        if (j == end) break;
+      }
+      if (pilot > MPH_MAX_PILOT) {
+        failed = 1;
+        break;
+      }
+      mph->pilots[b] = (uint16_t)pilot;
+      for (unsigned j = beg; j < end; ++j) {
+        unsigned pos = positions[bucket_keys[j]];
+        taken[pos / 64] |= 1ull << (pos % 64);
+      }
+    }
+    if (failed) break;
+
+    // Positions at or above n are remapped to the free positions below n.
+    unsigned free_pos = 0;
+    for (unsigned pos = n; pos < mph->m; ++pos) {
+      if (!(taken[pos / 64] & (1ull << (pos % 64)))) continue;
+      while (taken[free_pos / 64] & (1ull << (free_pos % 64))) ++free_pos;
+      mph->remap[pos - n] = free_pos++;
+    }
+
+    for (unsigned j = 0; j < n; ++j) {
+      unsigned pos = positions[j];
+      if (pos >= n) pos = mph->remap[pos - n];
+      mph->entries[pos] = mph->staged[j];
+    }
+    ok = 1;
+  } while (0);
+
+  free(hashes);
+  free(key_bucket);
+  free(bucket_start);
+  free(bucket_keys);
+  free(order);
+  free(positions);
+  free(taken);
+  return ok;
+}
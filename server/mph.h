@@ -0,0 +1,51 @@
+#pragma once
+
+// A Mph keeps an index for data stored in an Arena, using a minimal perfect hash
+// function built PTHash-style: keys are spread into small buckets, and for each
+// bucket (largest first) we search for a 16-bit pilot value that sends all its keys
+// to free positions.  A lookup then costs a single probe, plus a key comparison to
+// reject keys that were not in the set; the function itself takes a few bits per key.
+//
+// Since the function depends on the whole key set, keys are staged by mph_insert
+// and the function is only built by mph_finalize, once all keys are known.
+
+#include <stdint.h>
+#include "hash.h"
+
+// An entry only holds arena indexes: the key is stored framed, so its length is
+// read next to its bytes when comparing it, and the length of the value comes
+// from the header of its frame, which is read to send it anyway.
+typedef struct MphEntry {
+  unsigned key_idx;       // index into arena memory for framed key
+  unsigned frame_idx;     // index into arena memory for preframed value
+} MphEntry;
+
+typedef struct Mph {
+  unsigned n;             // number of distinct keys
+  unsigned m;             // number of positions, slightly above n
+  unsigned buckets;       // number of buckets / pilots
+  uint64_t seed;          // seed used to hash keys
+  uint16_t *pilots;       // one pilot per bucket
+  unsigned *remap;        // for positions in [n, m), the free position in [0, n) they use
+  MphEntry *entries;      // n entries, indexed by position
+  MphEntry *staged;       // keys inserted but not yet finalized
+  unsigned staged_used;
+  unsigned staged_cap;
+  struct Arena* arena;    // pointer to common arena
+  struct HashStats stats;
+} Mph;
+
+// Build an empty function, with room to stage the given number of rows.
+Mph* mph_build(unsigned rows, struct Arena* arena);
+void mph_destroy(Mph* mph);
+unsigned mph_insert(Mph* mph, const void *key, uint32_t key_len, unsigned frame);
+
+// Build the function for all staged keys; return 0 if no function could be found.
+unsigned mph_finalize(Mph* mph);
+
+const MphEntry* mph_get(Mph* mph, const void *key, uint32_t key_len);
+// Same as mph_get, without counting the lookup in the stats.
+const MphEntry* mph_peek(Mph* mph, const void *key, uint32_t key_len);
+void mph_get_batch(Mph* mph, unsigned count, const void* const* keys, const uint32_t* key_lens, const MphEntry** out);
+// Return the key of an entry, setting key_len to its length.
+const uint8_t* mph_entry_key(const Mph* mph, const MphEntry* entry, uint32_t* key_len);
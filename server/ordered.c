@@ -0,0 +1,319 @@
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "arena.h"
+#include "ordered.h"
+
+// A key being looked up, in the same form as the stored ones.
+typedef struct OrderedProbe {
+  uint64_t head;          // int key, or first 8 bytes of string key
+  uint32_t key_len;
+  const uint8_t *key;
+} OrderedProbe;
+
+static inline uint64_t ordered_head(const void *key, uint32_t key_len) {
+  uint8_t bytes[8] = {0};
+  memcpy(bytes, key, key_len < sizeof(bytes) ? key_len : sizeof(bytes));
+  uint64_t head = 0;
+  for (unsigned j = 0; j < sizeof(bytes); ++j) {
+    head = (head << 8) | bytes[j];
+  }
+  return head;
+}
+
+// Compare two string keys whose first bytes are given as heads; the bytes beyond
+// the head are only compared when the heads are equal.
+static inline int ordered_string_cmp(uint64_t lhead, uint32_t llen, const uint8_t* lkey,
+                                     uint64_t rhead, uint32_t rlen, const uint8_t* rkey) {
+  if (lhead != rhead) return lhead < rhead ? -1 : 1;
+  uint32_t len = llen < rlen ? llen : rlen;
+  if (len > sizeof(uint64_t)) {
+    int cmp = memcmp(lkey + sizeof(uint64_t), rkey + sizeof(uint64_t), len - sizeof(uint64_t));
+    if (cmp) return cmp;
+  }
+  return (llen > rlen) - (llen < rlen);
+}
+
+static int ordered_entry_cmp(const Ordered* ordered, const OrderedEntry* l, const OrderedEntry* r) {
+  if (ordered->type == CONFIG_INDEX_TYPE_INT) {
+    return (l->key.head > r->key.head) - (l->key.head < r->key.head);
+  }
+  uint8_t* lkey = arena_get_ptr(ordered->arena, l->key.key_idx);
+  uint8_t* rkey = arena_get_ptr(ordered->arena, r->key.key_idx);
+  return ordered_string_cmp(l->key.head, l->key.key_len, lkey, r->key.head, r->key.key_len, rkey);
+}
+
+// Compare the key stored at a position with a probe.
+static inline int ordered_cmp(const Ordered* ordered, unsigned pos, const OrderedProbe* probe) {
+  if (ordered->type == CONFIG_INDEX_TYPE_INT) {
+    uint32_t key = (uint32_t)probe->head;
+    return (ordered->keys[pos] > key) - (ordered->keys[pos] < key);
+  }
+  const OrderedString* s = &ordered->strings[pos];
+  uint8_t* key = arena_get_ptr(ordered->arena, s->key_idx);
+  return ordered_string_cmp(s->head, s->key_len, key, probe->head, probe->key_len, probe->key);
+}
+
+static unsigned ordered_make_probe(const Ordered* ordered, const void *key, uint32_t key_len, OrderedProbe* probe) {
+  if (ordered->type == CONFIG_INDEX_TYPE_INT) {
+    if (key_len != sizeof(uint32_t)) return 0;
+    uint32_t k = 0;
+    memcpy(&k, key, sizeof(uint32_t));
+    probe->head = k;
+  } else {
+    probe->head = ordered_head(key, key_len);
+  }
+  probe->key_len = key_len;
+  probe->key = key;
+  return 1;
+}
+
+// Stable bottom-up merge sort of the staged entries, so that equal keys keep
+// the order in which they were inserted.
+static unsigned ordered_sort(Ordered* ordered) {
+  unsigned count = ordered->staged_used;
+  OrderedEntry* tmp = malloc((count ? count : 1) * sizeof(OrderedEntry));
+  if (!tmp) {
+    LOG_WARN("Could not allocate Ordered sort buffer for %u keys", count);
+    return 0;
+  }
+  OrderedEntry* src = ordered->staged;
+  OrderedEntry* dst = tmp;
+  for (unsigned width = 1; width < count; width *= 2) {
+    for (unsigned lo = 0; lo < count; lo += 2 * width) {
+      unsigned mid = count - lo > width ? lo + width : count;
+      unsigned hi = count - mid > width ? mid + width : count;
+      unsigned l = lo;
+      unsigned r = mid;
+      unsigned d = lo;
+      while (l < mid && r < hi) {
+        dst[d++] = ordered_entry_cmp(ordered, &src[r], &src[l]) < 0 ? src[r++] : src[l++];
+      }
+      while (l < mid) dst[d++] = src[l++];
+      while (r < hi) dst[d++] = src[r++];
+    }
+    OrderedEntry* swap = src;
+    src = dst;
+    dst = swap;
+  }
+  if (src != ordered->staged) memcpy(ordered->staged, src, count * sizeof(OrderedEntry));
+  free(tmp);
+  return 1;
+}
+
+Ordered* ordered_build(ConfigIndexType type, unsigned rows, struct Arena* arena) {
+  Ordered* ordered = 0;
+  unsigned bad = 0;
+  do {
+    if (!arena) {
+      LOG_WARN("Cannot create an Ordered object without a valid Arena");
+      break;
+    }
+
+    ordered = calloc(1, sizeof(Ordered));
+    if (!ordered) {
+      LOG_WARN("Could not allocate an Ordered object");
+      break;
+    }
+
+    ordered->type = type;
+    ordered->staged_cap = rows ? rows : 1;
+    ordered->staged = malloc(ordered->staged_cap * sizeof(OrderedEntry));
+    if (!ordered->staged) {
+      LOG_WARN("Could not allocate Ordered staging area for %u rows", ordered->staged_cap);
+      ++bad;
+      break;
+    }
+    ordered->arena = arena;
+  } while (0);
+  if (bad) {
+    ordered_destroy(ordered);
+    ordered = 0;
+  }
+  return ordered;
+}
+
+void ordered_destroy(Ordered* ordered) {
+  if (!ordered) return;
+  if (ordered->keys) free(ordered->keys);
+  if (ordered->strings) free(ordered->strings);
+  if (ordered->frames) free(ordered->frames);
+  if (ordered->staged) free(ordered->staged);
+  free(ordered);
+}
+
+unsigned ordered_insert(Ordered* ordered, const void *key, uint32_t key_len, unsigned frame) {
+  if (ordered->type == CONFIG_INDEX_TYPE_INT && key_len != sizeof(uint32_t)) return 0;
+  if (ordered->staged_used >= ordered->staged_cap) {
+    unsigned cap = ordered->staged_cap * 2;
+    OrderedEntry* staged = realloc(ordered->staged, cap * sizeof(OrderedEntry));
+    if (!staged) {
+      LOG_WARN("Could not grow Ordered staging area to %u rows", cap);
+      return 0;
+    }
+    ordered->staged = staged;
+    ordered->staged_cap = cap;
+  }
+  OrderedEntry entry = {0};
+  if (ordered->type == CONFIG_INDEX_TYPE_INT) {
+    uint32_t k = 0;
+    memcpy(&k, key, sizeof(uint32_t));
+    entry.key.head = k;
+  } else {
+    unsigned kindex = arena_store(ordered->arena, key, key_len);
+    if (kindex == (unsigned)-1) return 0;
+    entry.key.head = ordered_head(key, key_len);
+    entry.key.key_idx = kindex;
+  }
+  entry.key.key_len = key_len;
+  entry.frame_idx = frame;
+  ordered->staged[ordered->staged_used++] = entry;
+  return 1;
+}
+
+unsigned ordered_finalize(Ordered* ordered) {
+  unsigned count = ordered->staged_used;
+  if (!ordered_sort(ordered)) return 0;
+  if (ordered->type == CONFIG_INDEX_TYPE_INT) {
+    ordered->keys = malloc((count ? count : 1) * sizeof(uint32_t));
+  } else {
+    ordered->strings = malloc((count ? count : 1) * sizeof(OrderedString));
+  }
+  ordered->frames = malloc((count ? count : 1) * sizeof(unsigned));
+  if ((!ordered->keys && !ordered->strings) || !ordered->frames) {
+    LOG_WARN("Could not allocate Ordered arrays for %u keys", count);
+    return 0;
+  }
+  unsigned used = 0;
+  for (unsigned j = 0; j < count; ++j) {
+    const OrderedEntry* entry = &ordered->staged[j];
+    if (j && ordered_entry_cmp(ordered, &ordered->staged[j - 1], entry) == 0) continue;
+    if (ordered->keys) {
+      ordered->keys[used] = (uint32_t)entry->key.head;
+    } else {
+      ordered->strings[used] = entry->key;
+    }
+    ordered->frames[used] = entry->frame_idx;
+    ++used;
+  }
+  if (used < count) {
+    LOG_INFO("Ignored %u duplicate keys out of %u", count - used, count);
+  }
+  ordered->used = used;
+  free(ordered->staged);
+  ordered->staged = 0;
+  ordered->staged_used = ordered->staged_cap = 0;
+  return 1;
+}
+
+// Position of the first key not less than the probe, or used if there is none.
+static inline unsigned ordered_lower_bound(Ordered* ordered, const OrderedProbe* probe, struct HashStats* stats) {
+  if (!ordered->used) return 0;
+  unsigned base = 0;
+  unsigned probes = 0;
+  if (ordered->type == CONFIG_INDEX_TYPE_INT) {
+    uint32_t key = (uint32_t)probe->head;
+    for (unsigned n = ordered->used; n > 1; ++probes) {
+      unsigned half = n / 2;
+      base = ordered->keys[base + half] < key ? base + half : base;
+      n -= half;
+    }
+  } else {
+    for (unsigned n = ordered->used; n > 1; ++probes) {
+      unsigned half = n / 2;
+      base = ordered_cmp(ordered, base + half, probe) < 0 ? base + half : base;
+      n -= half;
+    }
+  }
+  if (stats) hash_stats_probes(stats, probes);
+  return base + (ordered_cmp(ordered, base, probe) < 0);
+}
+
+// Find the frame of a key, counting the search in stats if set.
+static unsigned ordered_find(Ordered* ordered, const void *key, uint32_t key_len, struct HashStats* stats) {
+  OrderedProbe probe;
+  if (!ordered_make_probe(ordered, key, key_len, &probe)) return (unsigned)-1;
+  unsigned pos = ordered_lower_bound(ordered, &probe, stats);
+  if (pos >= ordered->used || ordered_cmp(ordered, pos, &probe) != 0) return (unsigned)-1;
+  return ordered->frames[pos];
+}
+
+unsigned ordered_get(Ordered* ordered, const void *key, uint32_t key_len) {
+  hash_stats_queries(&ordered->stats, 1);
+  return ordered_find(ordered, key, key_len, &ordered->stats);
+}
+
+unsigned ordered_peek(Ordered* ordered, const void *key, uint32_t key_len) {
+  return ordered_find(ordered, key, key_len, 0);
+}
+
+unsigned ordered_range(Ordered* ordered, const void *from, uint32_t from_len, const void *to, uint32_t to_len,
+                       unsigned limit, unsigned* first, unsigned* next) {
+  hash_stats_queries(&ordered->stats, 1);
+  *next = (unsigned)-1;
+  OrderedProbe lo = {0};
+  OrderedProbe hi = {0};
+  if (from_len && !ordered_make_probe(ordered, from, from_len, &lo)) return (unsigned)-1;
+  if (to_len && !ordered_make_probe(ordered, to, to_len, &hi)) return (unsigned)-1;
+
+  unsigned pos = from_len ? ordered_lower_bound(ordered, &lo, &ordered->stats) : 0;
+  *first = pos;
+  unsigned count = 0;
+  for (; pos < ordered->used && (!to_len || ordered_cmp(ordered, pos, &hi) <= 0); ++pos) {
+    if (count >= limit) {
+      *next = pos;
+      break;
+    }
+    ++count;
+  }
+  return count;
+}
+
+// Check whether the string key stored at a position starts with a prefix;
+// short prefixes are checked against the head alone.
+static inline unsigned ordered_has_prefix(const Ordered* ordered, unsigned pos, const OrderedProbe* prefix) {
+  const OrderedString* s = &ordered->strings[pos];
+  if (s->key_len < prefix->key_len) return 0;
+  if (prefix->key_len < sizeof(uint64_t)) {
+    uint64_t mask = prefix->key_len ? ~(uint64_t)0 << (64 - 8 * prefix->key_len) : 0;
+    return (s->head & mask) == prefix->head;
+  }
+  if (s->head != prefix->head) return 0;
+  uint8_t* key = arena_get_ptr(ordered->arena, s->key_idx);
+  return memcmp(key + sizeof(uint64_t), prefix->key + sizeof(uint64_t), prefix->key_len - sizeof(uint64_t)) == 0;
+}
+
+unsigned ordered_prefix(Ordered* ordered, const void *prefix, uint32_t prefix_len, const void *from, uint32_t from_len,
+                        unsigned limit, unsigned* first, unsigned* next) {
+  *next = (unsigned)-1;
+  if (ordered->type != CONFIG_INDEX_TYPE_STRING) return (unsigned)-1;
+  hash_stats_queries(&ordered->stats, 1);
+  OrderedProbe p;
+  ordered_make_probe(ordered, prefix, prefix_len, &p);
+  unsigned pos = ordered_lower_bound(ordered, &p, &ordered->stats);
+  if (from_len) {
+    OrderedProbe f;
+    ordered_make_probe(ordered, from, from_len, &f);
+    unsigned after = ordered_lower_bound(ordered, &f, &ordered->stats);
+    if (pos < after) pos = after;
+  }
+  *first = pos;
+  unsigned count = 0;
+  for (; pos < ordered->used && ordered_has_prefix(ordered, pos, &p); ++pos) {
+    if (count >= limit) {
+      *next = pos;
+      break;
+    }
+    ++count;
+  }
+  return count;
+}
+
+const void* ordered_key(const Ordered* ordered, unsigned pos, uint32_t* key_len) {
+  if (ordered->type == CONFIG_INDEX_TYPE_INT) {
+    *key_len = sizeof(uint32_t);
+    return &ordered->keys[pos];
+  }
+  *key_len = ordered->strings[pos].key_len;
+  return arena_get_ptr(ordered->arena, ordered->strings[pos].key_idx);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+// An Ordered keeps an index for data stored in an Arena as an array of keys sorted
+// in ascending order, next to a parallel array with the arena index of each frame.
+// Besides exact lookups, this can answer range and prefix scans, returning frames
+// in key order.  Int keys are compared as unsigned numbers and take 4 bytes each.
+// String keys are compared bytewise and take 16 bytes each: their first 8 bytes,
+// packed as a big-endian number, plus a reference to the whole key in the arena,
+// which is only read when two keys share those first 8 bytes.  Lookups are binary
+// searches over these arrays, and do not allocate.
+//
+// Since the keys have to be sorted, they are staged by ordered_insert and the arrays
+// are only built by ordered_finalize, once all keys are known.
+
+#include <stdint.h>
+#include "config.h"
+#include "hash.h"
+
+typedef struct OrderedString {
+  uint64_t head;          // first 8 key bytes as a big-endian number, zero padded
+  uint32_t key_len;       // length of key in bytes
+  unsigned key_idx;       // index into arena memory for key bytes
+} OrderedString;
+
+typedef struct OrderedEntry {
+  OrderedString key;      // for int keys, head holds the key itself
+  unsigned frame_idx;     // index into arena memory for preframed value
+} OrderedEntry;
+
+typedef struct Ordered {
+  ConfigIndexType type;
+  unsigned used;          // number of distinct keys
+  uint32_t *keys;         // sorted keys, for int indexes
+  OrderedString *strings; // sorted keys, for string indexes
+  unsigned *frames;       // arena index of preframed value for each key
+  OrderedEntry *staged;   // keys inserted but not yet finalized
+  unsigned staged_used;
+  unsigned staged_cap;
+  struct Arena* arena;    // pointer to common arena
+  struct HashStats stats; // probes count binary search steps
+} Ordered;
+
+// Build an empty index, with room to stage the given number of rows.
+Ordered* ordered_build(ConfigIndexType type, unsigned rows, struct Arena* arena);
+void ordered_destroy(Ordered* ordered);
+unsigned ordered_insert(Ordered* ordered, const void *key, uint32_t key_len, unsigned frame);
+
+// Sort all staged keys; when a key was inserted several times, the first one wins.
+unsigned ordered_finalize(Ordered* ordered);
+
+// Return the arena index of the preframed value for a key, or (unsigned)-1.
+unsigned ordered_get(Ordered* ordered, const void *key, uint32_t key_len);
+// Same as ordered_get, without counting the lookup in the stats.
+unsigned ordered_peek(Ordered* ordered, const void *key, uint32_t key_len);
+
+// Find the keys that lie in [from, to]; an empty from or to leaves that end open.
+// Set *first to the position of the first one; return how many of them, up to
+// limit, follow it, or (unsigned)-1 if from or to are not valid keys.  Set *next
+// to the position of the first matching key beyond the limit, or (unsigned)-1.
+unsigned ordered_range(Ordered* ordered, const void *from, uint32_t from_len, const void *to, uint32_t to_len,
+                       unsigned limit, unsigned* first, unsigned* next);
+
+// Same as ordered_range, for the keys of a string index that start with prefix
+// and are not less than from.
+unsigned ordered_prefix(Ordered* ordered, const void *prefix, uint32_t prefix_len, const void *from, uint32_t from_len,
+                        unsigned limit, unsigned* first, unsigned* next);
+
+// Return a pointer to the key stored at a position, and its length.
+const void* ordered_key(const Ordered* ordered, unsigned pos, uint32_t* key_len);
@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "arena.h"
+#include "postings.h"
+
+enum {
+  POSTINGS_INITIAL_KEYS = 16,   // initial capacity of the key table, grown as needed
+};
+
+Postings* postings_build(unsigned rows, struct Arena* arena) {
+  Postings* postings = 0;
+  unsigned bad = 0;
+  do {
+    if (!arena) {
+      LOG_WARN("Cannot create a Postings object without a valid Arena");
+      break;
+    }
+
+    postings = calloc(1, sizeof(Postings));
+    if (!postings) {
+      LOG_WARN("Could not allocate a Postings object");
+      break;
+    }
+
+    // The number of distinct keys is not known in advance, and is often tiny.
+    postings->keys = hash_build(POSTINGS_INITIAL_KEYS, arena);
+    postings->staged_cap = rows ? rows : 1;
+    postings->staged = malloc(postings->staged_cap * sizeof(PostingsEntry));
+    postings->offsets = calloc(POSTINGS_INITIAL_KEYS + 1, sizeof(unsigned));
+    if (!postings->keys || !postings->staged || !postings->offsets) {
+      LOG_WARN("Could not allocate Postings staging area for %u rows", postings->staged_cap);
+      ++bad;
+      break;
+    }
+    postings->arena = arena;
+  } while (0);
+  if (bad) {
+    postings_destroy(postings);
+    postings = 0;
+  }
+  return postings;
+}
+
+void postings_destroy(Postings* postings) {
+  if (!postings) return;
+  if (postings->keys) hash_destroy(postings->keys);
+  if (postings->offsets) free(postings->offsets);
+  if (postings->bytes) free(postings->bytes);
+  if (postings->frames) free(postings->frames);
+  if (postings->staged) free(postings->staged);
+  free(postings);
+}
+
+unsigned postings_insert(Postings* postings, const void *key, uint32_t key_len, unsigned frame) {
+  if (postings->staged_used >= postings->staged_cap) {
+    unsigned cap = postings->staged_cap * 2;
+    PostingsEntry* staged = realloc(postings->staged, cap * sizeof(PostingsEntry));
+    if (!staged) {
+      LOG_WARN("Could not grow Postings staging area to %u rows", cap);
+      return 0;
+    }
+    postings->staged = staged;
+    postings->staged_cap = cap;
+  }
+
+  // While staging, offsets[j] counts the rows for list j.
+  Hash* keys = postings->keys;
+  const Bucket* bucket = hash_get(keys, key, key_len);
+  unsigned list = 0;
+  if (bucket) {
+    list = bucket->frame_idx;
+  } else {
+    if (2 * (keys->used + 1) > keys->cap) {
+      unsigned cap = keys->cap * 2;
+      unsigned* offsets = realloc(postings->offsets, (cap + 1) * sizeof(unsigned));
+      if (!offsets) {
+        LOG_WARN("Could not grow Postings offsets to %u keys", cap);
+        return 0;
+      }
+      postings->offsets = offsets;
+      memset(offsets + keys->cap + 1, 0, (cap - keys->cap) * sizeof(unsigned));
+      if (!hash_resize(keys, cap)) return 0;
+    }
+    list = postings->lists;
+    if (!hash_insert(keys, key, key_len, list)) return 0;
+    ++postings->lists;
+  }
+  ++postings->offsets[list];
+
+  PostingsEntry* entry = &postings->staged[postings->staged_used++];
+  entry->list = list;
+  entry->frame_idx = frame;
+  return 1;
+}
+
+unsigned postings_finalize(Postings* postings) {
+  unsigned lists = postings->lists;
+  unsigned count = postings->staged_used;
+  postings->frames = malloc((count ? count : 1) * sizeof(unsigned));
+  postings->bytes = calloc(lists ? lists : 1, sizeof(unsigned));
+  if (!postings->frames || !postings->bytes) {
+    LOG_WARN("Could not allocate Postings lists for %u rows", count);
+    return 0;
+  }
+
+  // Turn the counts into start offsets, then place every row in its list; this
+  // moves each offset to the start of the next list, so shift them back after.
+  unsigned start = 0;
+  for (unsigned j = 0; j <= lists; ++j) {
+    unsigned rows = postings->offsets[j];
+    postings->offsets[j] = start;
+    start += rows;
+  }
+  for (unsigned j = 0; j < count; ++j) {
+    const PostingsEntry* entry = &postings->staged[j];
+    postings->frames[postings->offsets[entry->list]++] = entry->frame_idx;
+    postings->bytes[entry->list] += arena_get_frame_len(postings->arena, entry->frame_idx);
+  }
+  for (unsigned j = lists; j > 0; --j) {
+    postings->offsets[j] = postings->offsets[j - 1];
+  }
+  postings->offsets[0] = 0;
+  postings->used = count;
+
+  // Lookups done while staging should not count as queries.
+  memset(&postings->keys->stats, 0, sizeof(postings->keys->stats));
+  free(postings->staged);
+  postings->staged = 0;
+  postings->staged_used = postings->staged_cap = 0;
+  return 1;
+}
+
+unsigned postings_get(Postings* postings, const void *key, uint32_t key_len,
+                      const unsigned** frames, unsigned* bytes) {
+  const Bucket* bucket = hash_get(postings->keys, key, key_len);
+  if (!bucket) return 0;
+  unsigned list = bucket->frame_idx;
+  *frames = postings->frames + postings->offsets[list];
+  *bytes = postings->bytes[list];
+  return postings->offsets[list + 1] - postings->offsets[list];
+}
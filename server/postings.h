@@ -0,0 +1,42 @@
+#pragma once
+
+// A Postings keeps a non-unique index for data stored in an Arena: each distinct
+// key maps to the list of all frames whose row has that key, in row order.
+// Distinct keys live in a Hash, whose buckets hold the number of their list
+// instead of a frame; the lists themselves are stored back to back in a single
+// array of arena indexes, with an array of offsets marking where each one starts.
+//
+// Since the lists can only be laid out once their sizes are known, rows are staged
+// by postings_insert and the lists are only built by postings_finalize.
+
+#include <stdint.h>
+#include "hash.h"
+
+typedef struct PostingsEntry {
+  unsigned list;          // number of the list for the key of this row
+  unsigned frame_idx;     // index into arena memory for preframed value
+} PostingsEntry;
+
+typedef struct Postings {
+  struct Hash* keys;      // distinct keys, mapped to their list number
+  unsigned lists;         // number of distinct keys
+  unsigned used;          // number of frames in all lists
+  unsigned *offsets;      // lists + 1 positions in frames; list j is [offsets[j], offsets[j+1])
+  unsigned *bytes;        // total length of the frames in each list
+  unsigned *frames;       // arena index of preframed values, grouped by list
+  PostingsEntry *staged;  // rows inserted but not yet finalized
+  unsigned staged_used;
+  unsigned staged_cap;
+  struct Arena* arena;    // pointer to common arena
+} Postings;
+
+// Build an empty index, with room to stage the given number of rows.
+Postings* postings_build(unsigned rows, struct Arena* arena);
+void postings_destroy(Postings* postings);
+unsigned postings_insert(Postings* postings, const void *key, uint32_t key_len, unsigned frame);
+unsigned postings_finalize(Postings* postings);
+
+// Return the number of frames for a key, pointing frames to their arena indexes
+// and setting bytes to their total length; return 0 if the key is not present.
+unsigned postings_get(Postings* postings, const void *key, uint32_t key_len,
+                      const unsigned** frames, unsigned* bytes);
@@ -0,0 +1,376 @@
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "roaring.h"
+
+static void container_free(RoaringContainer* c) {
+  if (c->bitset) {
+    free(c->u.bits);
+  } else {
+    free(c->u.array);
+  }
+  c->u.array = 0;
+}
+
+static unsigned container_to_bitset(RoaringContainer* c) {
+  uint64_t* bits = calloc(ROARING_BITSET_WORDS, sizeof(uint64_t));
+  if (!bits) {
+    LOG_WARN("Could not allocate Roaring bitset container");
+    return 0;
+  }
+  for (unsigned j = 0; j < c->card; ++j) {
+    bits[c->u.array[j] >> 6] |= (uint64_t)1 << (c->u.array[j] & 63);
+  }
+  free(c->u.array);
+  c->u.bits = bits;
+  c->bitset = 1;
+  c->cap = 0;
+  return 1;
+}
+
+// Only called for bitsets with at most ROARING_ARRAY_MAX values.
+static unsigned container_to_array(RoaringContainer* c) {
+  uint16_t* array = malloc((c->card ? c->card : 1) * sizeof(uint16_t));
+  if (!array) {
+    LOG_WARN("Could not allocate Roaring array container");
+    return 0;
+  }
+  unsigned n = 0;
+  for (unsigned w = 0; w < ROARING_BITSET_WORDS; ++w) {
+    for (uint64_t word = c->u.bits[w]; word; word &= word - 1) {
+      array[n++] = (uint16_t)(w * 64 + __builtin_ctzll(word));
+    }
+  }
+  free(c->u.bits);
+  c->u.array = array;
+  c->bitset = 0;
+  c->cap = c->card;
+  return 1;
+}
+
+static unsigned container_copy(const RoaringContainer* src, RoaringContainer* dst) {
+  *dst = *src;
+  if (src->bitset) {
+    dst->u.bits = malloc(ROARING_BITSET_WORDS * sizeof(uint64_t));
+    if (!dst->u.bits) return 0;
+    memcpy(dst->u.bits, src->u.bits, ROARING_BITSET_WORDS * sizeof(uint64_t));
+  } else {
+    dst->cap = src->card;
+    dst->u.array = malloc((src->card ? src->card : 1) * sizeof(uint16_t));
+    if (!dst->u.array) return 0;
+    memcpy(dst->u.array, src->u.array, src->card * sizeof(uint16_t));
+  }
+  return 1;
+}
+
+static unsigned container_add(RoaringContainer* c, uint16_t low) {
+  if (!c->bitset) {
+    unsigned pos = c->card;
+    if (c->card && c->u.array[c->card - 1] >= low) {
+      unsigned lo = 0;
+      unsigned hi = c->card;
+      while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if (c->u.array[mid] < low) {
+          lo = mid + 1;
+        } else {
+          hi = mid;
+        }
+      }
+      if (c->u.array[lo] == low) return 1;
+      pos = lo;
+    }
+    if (c->card < ROARING_ARRAY_MAX) {
+      if (c->card == c->cap) {
+        unsigned cap = c->cap ? 2 * c->cap : 4;
+        if (cap > ROARING_ARRAY_MAX) cap = ROARING_ARRAY_MAX;
+        uint16_t* array = realloc(c->u.array, cap * sizeof(uint16_t));
+        if (!array) {
+          LOG_WARN("Could not grow Roaring array container to %u values", cap);
+          return 0;
+        }
+        c->u.array = array;
+        c->cap = cap;
+      }
+      memmove(c->u.array + pos + 1, c->u.array + pos, (c->card - pos) * sizeof(uint16_t));
+      c->u.array[pos] = low;
+      ++c->card;
+      return 1;
+    }
+    if (!container_to_bitset(c)) return 0;
+  }
+  uint64_t mask = (uint64_t)1 << (low & 63);
+  if (!(c->u.bits[low >> 6] & mask)) {
+    c->u.bits[low >> 6] |= mask;
+    ++c->card;
+  }
+  return 1;
+}
+
+// Intersection of two containers into dst, whose key is already set.
+static unsigned container_and(const RoaringContainer* a, const RoaringContainer* b, RoaringContainer* dst) {
+  if (a->bitset && b->bitset) {
+    dst->u.bits = malloc(ROARING_BITSET_WORDS * sizeof(uint64_t));
+    if (!dst->u.bits) return 0;
+    dst->bitset = 1;
+    unsigned card = 0;
+    for (unsigned w = 0; w < ROARING_BITSET_WORDS; ++w) {
+      dst->u.bits[w] = a->u.bits[w] & b->u.bits[w];
+      card += __builtin_popcountll(dst->u.bits[w]);
+    }
+    dst->card = card;
+    return card > ROARING_ARRAY_MAX || container_to_array(dst);
+  }
+
+  if (a->bitset) {
+    const RoaringContainer* t = a;
+    a = b;
+    b = t;
+  }
+  // a is now an array, and the result is no larger than it.
+  dst->u.array = malloc((a->card ? a->card : 1) * sizeof(uint16_t));
+  if (!dst->u.array) return 0;
+  dst->cap = a->card;
+  unsigned n = 0;
+  if (b->bitset) {
+    for (unsigned j = 0; j < a->card; ++j) {
+      uint16_t v = a->u.array[j];
+      if (b->u.bits[v >> 6] & ((uint64_t)1 << (v & 63))) dst->u.array[n++] = v;
+    }
+  } else {
+    unsigned i = 0;
+    unsigned j = 0;
+    while (i < a->card && j < b->card) {
+      uint16_t va = a->u.array[i];
+      uint16_t vb = b->u.array[j];
+      if (va < vb) {
+        ++i;
+      } else if (vb < va) {
+        ++j;
+      } else {
+        dst->u.array[n++] = va;
+        ++i;
+        ++j;
+      }
+    }
+  }
+  dst->card = n;
+  return 1;
+}
+
+static void bitset_or_container(uint64_t* bits, const RoaringContainer* c) {
+  if (c->bitset) {
+    for (unsigned w = 0; w < ROARING_BITSET_WORDS; ++w) {
+      bits[w] |= c->u.bits[w];
+    }
+  } else {
+    for (unsigned j = 0; j < c->card; ++j) {
+      bits[c->u.array[j] >> 6] |= (uint64_t)1 << (c->u.array[j] & 63);
+    }
+  }
+}
+
+// Union of two containers into dst, whose key is already set.
+static unsigned container_or(const RoaringContainer* a, const RoaringContainer* b, RoaringContainer* dst) {
+  if (!a->bitset && !b->bitset && a->card + b->card <= ROARING_ARRAY_MAX) {
+    dst->u.array = malloc((a->card + b->card) * sizeof(uint16_t));
+    if (!dst->u.array) return 0;
+    dst->cap = a->card + b->card;
+    unsigned i = 0;
+    unsigned j = 0;
+    unsigned n = 0;
+    while (i < a->card || j < b->card) {
+      if (j >= b->card || (i < a->card && a->u.array[i] < b->u.array[j])) {
+        dst->u.array[n++] = a->u.array[i++];
+      } else if (i >= a->card || b->u.array[j] < a->u.array[i]) {
+        dst->u.array[n++] = b->u.array[j++];
+      } else {
+        dst->u.array[n++] = a->u.array[i++];
+        ++j;
+      }
+    }
+    dst->card = n;
+    return 1;
+  }
+
+  dst->u.bits = calloc(ROARING_BITSET_WORDS, sizeof(uint64_t));
+  if (!dst->u.bits) return 0;
+  dst->bitset = 1;
+  bitset_or_container(dst->u.bits, a);
+  bitset_or_container(dst->u.bits, b);
+  unsigned card = 0;
+  for (unsigned w = 0; w < ROARING_BITSET_WORDS; ++w) {
+    card += __builtin_popcountll(dst->u.bits[w]);
+  }
+  dst->card = card;
+  return card > ROARING_ARRAY_MAX || container_to_array(dst);
+}
+
+// Append a new empty container, which must have the largest key so far.
+static RoaringContainer* roaring_append(Roaring* roaring, uint16_t key) {
+  if (roaring->count >= roaring->cap) {
+    unsigned cap = roaring->cap ? 2 * roaring->cap : 4;
+    RoaringContainer* containers = realloc(roaring->containers, cap * sizeof(RoaringContainer));
+    if (!containers) {
+      LOG_WARN("Could not grow Roaring bitmap to %u containers", cap);
+      return 0;
+    }
+    roaring->containers = containers;
+    roaring->cap = cap;
+  }
+  RoaringContainer* c = &roaring->containers[roaring->count++];
+  memset(c, 0, sizeof(RoaringContainer));
+  c->key = key;
+  return c;
+}
+
+static RoaringContainer* roaring_container(Roaring* roaring, uint16_t key) {
+  unsigned count = roaring->count;
+  if (!count || roaring->containers[count - 1].key < key) return roaring_append(roaring, key);
+  unsigned lo = 0;
+  unsigned hi = count;
+  while (lo < hi) {
+    unsigned mid = (lo + hi) / 2;
+    if (roaring->containers[mid].key < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (roaring->containers[lo].key == key) return &roaring->containers[lo];
+
+  // Insert in the middle: append, then move the new container into place.
+  if (!roaring_append(roaring, key)) return 0;
+  RoaringContainer c = roaring->containers[count];
+  memmove(roaring->containers + lo + 1, roaring->containers + lo, (count - lo) * sizeof(RoaringContainer));
+  roaring->containers[lo] = c;
+  return &roaring->containers[lo];
+}
+
+Roaring* roaring_build(void) {
+  Roaring* roaring = calloc(1, sizeof(Roaring));
+  if (!roaring) {
+    LOG_WARN("Could not allocate a Roaring object");
+  }
+  return roaring;
+}
+
+void roaring_destroy(Roaring* roaring) {
+  if (!roaring) return;
+  for (unsigned j = 0; j < roaring->count; ++j) {
+    container_free(&roaring->containers[j]);
+  }
+  if (roaring->containers) free(roaring->containers);
+  free(roaring);
+}
+
+unsigned roaring_add(Roaring* roaring, uint32_t value) {
+  RoaringContainer* c = roaring_container(roaring, (uint16_t)(value >> 16));
+  if (!c) return 0;
+  return container_add(c, (uint16_t)value);
+}
+
+Roaring* roaring_and(const Roaring* lhs, const Roaring* rhs) {
+  Roaring* out = roaring_build();
+  if (!out) return 0;
+  unsigned i = 0;
+  unsigned j = 0;
+  while (i < lhs->count && j < rhs->count) {
+    const RoaringContainer* a = &lhs->containers[i];
+    const RoaringContainer* b = &rhs->containers[j];
+    if (a->key < b->key) {
+      ++i;
+    } else if (b->key < a->key) {
+      ++j;
+    } else {
+      // On failure, a partially built container is still freed by roaring_destroy.
+      RoaringContainer* c = roaring_append(out, a->key);
+      if (!c || !container_and(a, b, c)) {
+        roaring_destroy(out);
+        return 0;
+      }
+      if (!c->card) {
+        container_free(c);
+        --out->count;
+      }
+      ++i;
+      ++j;
+    }
+  }
+  return out;
+}
+
+Roaring* roaring_or(const Roaring* lhs, const Roaring* rhs) {
+  Roaring* out = roaring_build();
+  if (!out) return 0;
+  unsigned i = 0;
+  unsigned j = 0;
+  while (i < lhs->count || j < rhs->count) {
+    const RoaringContainer* a = i < lhs->count ? &lhs->containers[i] : 0;
+    const RoaringContainer* b = j < rhs->count ? &rhs->containers[j] : 0;
+    unsigned ok = 0;
+    RoaringContainer* c = 0;
+    if (a && (!b || a->key < b->key)) {
+      c = roaring_append(out, a->key);
+      ok = c && container_copy(a, c);
+      ++i;
+    } else if (b && (!a || b->key < a->key)) {
+      c = roaring_append(out, b->key);
+      ok = c && container_copy(b, c);
+      ++j;
+    } else {
+      c = roaring_append(out, a->key);
+      ok = c && container_or(a, b, c);
+      ++i;
+      ++j;
+    }
+    if (!ok) {
+      roaring_destroy(out);
+      return 0;
+    }
+  }
+  return out;
+}
+
+unsigned roaring_cardinality(const Roaring* roaring) {
+  unsigned card = 0;
+  for (unsigned j = 0; j < roaring->count; ++j) {
+    card += roaring->containers[j].card;
+  }
+  return card;
+}
+
+unsigned roaring_select(const Roaring* roaring, unsigned offset, unsigned limit, uint32_t* values) {
+  unsigned n = 0;
+  for (unsigned j = 0; j < roaring->count && n < limit; ++j) {
+    const RoaringContainer* c = &roaring->containers[j];
+    if (offset >= c->card) {
+      offset -= c->card;
+      continue;
+    }
+    uint32_t high = (uint32_t)c->key << 16;
+    if (!c->bitset) {
+      for (unsigned k = offset; k < c->card && n < limit; ++k) {
+        values[n++] = high | c->u.array[k];
+      }
+    } else {
+      for (unsigned w = 0; w < ROARING_BITSET_WORDS && n < limit; ++w) {
+        uint64_t word = c->u.bits[w];
+        unsigned bits = __builtin_popcountll(word);
+        if (offset >= bits) {
+          offset -= bits;
+          continue;
+        }
+        for (; word && n < limit; word &= word - 1) {
+          if (offset) {
+            --offset;
+            continue;
+          }
+          values[n++] = high | (w * 64 + __builtin_ctzll(word));
+        }
+      }
+    }
+    offset = 0;
+  }
+  return n;
+}
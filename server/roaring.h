@@ -0,0 +1,48 @@
+#pragma once
+
+// A Roaring is a compressed bitmap of 32-bit values, following the layout of
+// Roaring bitmaps: values are split by their high 16 bits into containers, each
+// one holding the low 16 bits either as a sorted array, when it has at most 4096
+// values, or as a bitset of 65536 bits otherwise.  Run containers are not used.
+// Intersections and unions work container by container; bitsets are combined
+// one 64-bit word at a time, in loops the compiler turns into SIMD code.
+
+#include <stdint.h>
+
+enum {
+  ROARING_ARRAY_MAX = 4096,     // containers with more values use a bitset
+  ROARING_BITSET_WORDS = 1024,  // 64-bit words in a bitset container
+};
+
+typedef struct RoaringContainer {
+  uint16_t key;           // high 16 bits of all values in the container
+  uint8_t bitset;         // 1 if values are in bits, 0 if they are in array
+  uint32_t card;          // number of values
+  uint32_t cap;           // allocated entries in array
+  union {
+    uint16_t *array;      // sorted low 16 bits of the values
+    uint64_t *bits;       // ROARING_BITSET_WORDS words
+  } u;
+} RoaringContainer;
+
+typedef struct Roaring {
+  unsigned count;         // number of containers
+  unsigned cap;           // allocated containers
+  RoaringContainer *containers;  // sorted by key
+} Roaring;
+
+Roaring* roaring_build(void);
+void roaring_destroy(Roaring* roaring);
+
+// Add a value; this is fastest when values are added in increasing order.
+unsigned roaring_add(Roaring* roaring, uint32_t value);
+
+// Return a new bitmap with the intersection / union of two bitmaps.
+Roaring* roaring_and(const Roaring* lhs, const Roaring* rhs);
+Roaring* roaring_or(const Roaring* lhs, const Roaring* rhs);
+
+unsigned roaring_cardinality(const Roaring* roaring);
+
+// Store in values up to limit values of the bitmap in increasing order, skipping
+// the first offset ones; return the number of values stored.
+unsigned roaring_select(const Roaring* roaring, unsigned offset, unsigned limit, uint32_t* values);
@@ -1,4 +1,6 @@
 #include <assert.h>
+#include <errno.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -11,6 +13,7 @@
 #include <event2/listener.h>
 #include <event2/bufferevent.h>
 #include <event2/buffer.h>
+#include <event2/thread.h>
 #include "util.h"
 #include "log.h"
 #include "arena.h"
@@ -25,6 +28,11 @@
 
 enum {
   MELIAN_MAX_KEY_LEN = 256, // max key length in bytes
+  MELIAN_MAX_MULTI_LEN = MELIAN_MAX_MULTI_KEYS * (4 + MELIAN_MAX_KEY_LEN), // max FETCH_MULTI payload
+  MELIAN_MAX_RANGE_LEN = 4 + 2 * (4 + MELIAN_MAX_KEY_LEN), // max FETCH_RANGE / FETCH_PREFIX payload
+  MELIAN_MAX_FILTER_LEN = 8 + MELIAN_MAX_FILTER_TERMS * (6 + MELIAN_MAX_KEY_LEN), // max FILTER payload
+  MELIAN_PIPELINE_MAX = 64,         // max pipelined FETCH requests resolved in one batch
+  MELIAN_PIPELINE_WINDOW = 16*1024, // max input bytes made contiguous for pipelined requests
 };
 
 // Bufferevent options: always close fd on free, and defer callbacks so libevent
@@ -33,7 +41,7 @@ enum {
 
 // State for each client connection
 struct conn_state_t {
-  Server* server;
+  ServerWorker* worker;
   MelianRequestHeader hdr;
   uint32_t hdr_have;
   uint8_t action;
@@ -48,11 +56,29 @@ struct conn_state_t {
 };
 
 static void on_read(struct bufferevent *bev, void *ctx);
+static void on_sent(const void *data, size_t len, void *extra);
+static void add_pinned(struct evbuffer *out, const void *data, size_t len, struct TableSlot* pin);
 static void on_event(struct bufferevent *bev, short events, void *ctx);
 static void on_accept(struct evconnlistener *lev, evutil_socket_t fd,
                       struct sockaddr *addr, int socklen, void *ctx);
+static void on_accept_unix(struct evconnlistener *lev, evutil_socket_t fd,
+                           struct sockaddr *addr, int socklen, void *ctx);
+static void on_handoff(evutil_socket_t fd, short what, void *ctx);
 static void on_quit(evutil_socket_t fd, short what, void *ctx);
+static unsigned fetch_multi(Server* server, struct evbuffer *out, unsigned table_id, unsigned index_id,
+                            const uint8_t* payload, unsigned len);
+static unsigned fetch_pipelined(Server* server, struct evbuffer *in, struct evbuffer *out);
+static unsigned fetch_all(Server* server, struct evbuffer *out, unsigned table_id, unsigned index_id,
+                          const uint8_t* key, unsigned len);
+static unsigned fetch_range(Server* server, struct evbuffer *out, unsigned action, unsigned table_id, unsigned index_id,
+                            const uint8_t* payload, unsigned len);
+static unsigned fetch_filter(Server* server, struct evbuffer *out, unsigned table_id,
+                             const uint8_t* payload, unsigned len);
 static void on_signal(int signal, short events, void *ctx);
+static unsigned worker_init(ServerWorker* worker, Server* server, unsigned id);
+static void worker_fini(ServerWorker* worker);
+static void worker_add_conn(ServerWorker* worker, evutil_socket_t fd);
+static void* worker_main(void *arg);
 
 Server* server_build(void) {
   Server* server = 0;
@@ -63,6 +89,12 @@ Server* server_build(void) {
       LOG_WARN("Could not allocate a Server object");
       break;
     }
+    // Workers add events to each other's loops (hand-offs, quit), so enable locking.
+    if (evthread_use_pthreads() != 0) {
+      LOG_WARN("Could not enable libevent thread support");
+      ++bad;
+      break;
+    }
     server->base = event_base_new();
     if (!server->base) {
       LOG_WARN("Could not allocate a Server event_base object");
@@ -91,6 +123,33 @@ Server* server_build(void) {
       break;
     }
 
+    unsigned num_workers = server->config->server.workers;
+    if (!num_workers) {
+      long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+      num_workers = cpus > 0 ? (unsigned) cpus : 1;
+    }
+    if (num_workers > MELIAN_MAX_WORKERS) {
+      LOG_WARN("Limiting %u requested workers to %u", num_workers, MELIAN_MAX_WORKERS);
+      num_workers = MELIAN_MAX_WORKERS;
+    }
+    server->workers = calloc(num_workers, sizeof(ServerWorker));
+    if (!server->workers) {
+      LOG_WARN("Could not allocate %u Server workers", num_workers);
+      ++bad;
+      break;
+    }
+    for (unsigned w = 0; w < num_workers; ++w) {
+      ++server->num_workers;
+      if (!worker_init(&server->workers[w], server, w)) {
+        ++bad;
+        break;
+      }
+    }
+    if (bad) {
+      break;
+    }
+    LOG_INFO("Serving requests with %u worker(s)", server->num_workers);
+
     server->status = status_build(server->base, server->db);
     if (!server->status) {
       ++bad;
@@ -100,6 +159,7 @@ Server* server_build(void) {
 
     server->sev = evsignal_new(server->base, SIGINT, on_signal, server);
     event_add(server->sev, NULL);
+    server->tev = evtimer_new(server->base, on_quit, server);
   } while (0);
   if (bad) {
     server_destroy(server);
@@ -112,20 +172,13 @@ void server_destroy(Server* server) {
   if (!server) return;
   server_stop(server);
 
-  unsigned size = 0;
-  for (struct conn_state_t* p = server->conn_free; p; ) {
-    ++size;
-    struct conn_state_t* q = p;
-    p = p->next;
-    bufferevent_free(q->bev);
-    free(q);
-  }
-  if (size) {
-    LOG_INFO("Cleared conn free list with %u elements", size);
+  for (unsigned w = 0; w < server->num_workers; ++w) {
+    worker_fini(&server->workers[w]);
   }
+  if (server->workers) free(server->workers);
 
   if (server->listeners) {
-    for (size_t i = 0; i < server->num_listeners; i++) {
+    for (unsigned i = 0; i < server->num_listeners; i++) {
       evconnlistener_free(server->listeners[i]);
     }
     free(server->listeners);
@@ -142,7 +195,7 @@ void server_destroy(Server* server) {
 }
 
 unsigned server_initial_load(Server* server) {
-  unsigned total_rows = data_load_all_tables_from_db(server->data, server->db);
+  unsigned total_rows = cron_load_all(server->cron);
   return total_rows > 0;
 }
 
@@ -153,23 +206,44 @@ unsigned server_listen(Server* server) {
     return 0;
   }
 
-  size_t num_sockets = 0;
-  for(ConfigSocket* socket = sockets[num_sockets++]; socket; socket = sockets[num_sockets++]);
+  unsigned num_sockets = 0;
+  while (sockets[num_sockets]) ++num_sockets;
   server->listeners = calloc(num_sockets, sizeof(struct evconnlistener*));
+  if (!server->listeners) {
+    LOG_WARN("Could not allocate %u Server listeners", num_sockets);
+    return 0;
+  }
+  for (unsigned w = 0; w < server->num_workers; ++w) {
+    ServerWorker* worker = &server->workers[w];
+    worker->listeners = calloc(num_sockets, sizeof(struct evconnlistener*));
+    if (!worker->listeners) {
+      LOG_WARN("Could not allocate %u listeners for worker %u", num_sockets, w);
+      return 0;
+    }
+  }
 
-  size_t i = 0;
-  for(ConfigSocket* socket = sockets[i++]; socket; socket = sockets[i++]) {
+  unsigned bad = 0;
+  for (unsigned s = 0; s < num_sockets; ++s) {
+    ConfigSocket* socket = sockets[s];
     const char* path = socket->path;
     if (path && path[0]) {
+      // The kernel does not balance UNIX sockets across listeners, so these
+      // are accepted on the main thread and handed off to the workers.
       unlink(path);
       struct sockaddr_un sun;
       memset(&sun, 0, sizeof(sun));
       sun.sun_family = AF_UNIX;
       /* TODO: Check for truncation: if (... >= (int)sizeof(sun.sun_path)) {...} */
       snprintf(sun.sun_path, sizeof(sun.sun_path), "%s", path);
-      server->listeners[i] = evconnlistener_new_bind(server->base, on_accept, server,
-                                                 LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE, -1,
-                                                 (struct sockaddr*)&sun, sizeof(sun));
+      struct evconnlistener* lev = evconnlistener_new_bind(server->base, on_accept_unix, server,
+                                                           LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE, -1,
+                                                           (struct sockaddr*)&sun, sizeof(sun));
+      if (!lev) {
+        LOG_WARN("Could not listen on UNIX socket [%s]", path);
+        ++bad;
+        continue;
+      }
+      server->listeners[server->num_listeners++] = lev;
       mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP; // 0660
       chmod(path, mode);
       LOG_INFO("Listening on UNIX socket [%s]", path);
@@ -178,23 +252,30 @@ unsigned server_listen(Server* server) {
     const char* host = socket->host;
     unsigned port = socket->port;
     if (host && host[0] && port) {
+      // Each worker binds its own listener to the same port; with SO_REUSEPORT
+      // the kernel spreads incoming connections across them.
       struct sockaddr_in sin;
       memset(&sin, 0, sizeof(sin));
       sin.sin_family = AF_INET;
       sin.sin_port = htons(port);
       inet_pton(AF_INET, host, &sin.sin_addr);
       unsigned flags = LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE | LEV_OPT_REUSEABLE_PORT;
-      server->listeners[i] = evconnlistener_new_bind(server->base, on_accept, server, flags, -1,
-                                                 (struct sockaddr*)&sin, sizeof(sin));
+      for (unsigned w = 0; w < server->num_workers; ++w) {
+        ServerWorker* worker = &server->workers[w];
+        struct evconnlistener* lev = evconnlistener_new_bind(worker->base, on_accept, worker, flags, -1,
+                                                             (struct sockaddr*)&sin, sizeof(sin));
+        if (!lev) {
+          LOG_WARN("Could not listen on TCP socket [%s:%u] for worker %u", host, port, w);
+          ++bad;
+          break;
+        }
+        worker->listeners[worker->num_listeners++] = lev;
+      }
       LOG_INFO("Listening on TCP socket [%s:%u]", host, port);
     }
   }
 
-  if (num_sockets == i) {
-    return 1;
-  }
-
-  return 0;
+  return bad == 0;
 }
 
 unsigned server_run(Server* server) {
@@ -202,6 +283,15 @@ unsigned server_run(Server* server) {
     if (server->running) break;
     server->running = 1;
 
+    for (unsigned w = 1; w < server->num_workers; ++w) {
+      ServerWorker* worker = &server->workers[w];
+      if (pthread_create(&worker->thread, 0, worker_main, worker) != 0) {
+        LOG_WARN("Could not start thread for worker %u", w);
+        continue;
+      }
+      worker->started = 1;
+    }
+
     cron_run(server->cron);
     LOG_INFO("Running event loop");
     event_base_dispatch(server->base);
@@ -216,18 +306,91 @@ unsigned server_stop(Server* server) {
 
     cron_stop(server->cron);
     LOG_INFO("Stopping event loop");
+    for (unsigned w = 1; w < server->num_workers; ++w) {
+      ServerWorker* worker = &server->workers[w];
+      if (!worker->started) continue;
+      event_base_loopexit(worker->base, 0);
+      pthread_join(worker->thread, 0);
+      LOG_DEBUG("Joined thread for worker %u", w);
+      worker->started = 0;
+    }
     event_base_loopexit(server->base, 0);
   } while (0);
   return 0;
 }
 
+static unsigned worker_init(ServerWorker* worker, Server* server, unsigned id) {
+  worker->server = server;
+  worker->id = id;
+  worker->pair[0] = worker->pair[1] = -1;
+  if (id == 0) {
+    // The first worker runs on the main thread, sharing its event loop.
+    worker->base = server->base;
+    return 1;
+  }
+
+  worker->base = event_base_new();
+  if (!worker->base) {
+    LOG_WARN("Could not allocate event_base object for worker %u", id);
+    return 0;
+  }
+  if (pipe(worker->pair) != 0) {
+    LOG_WARN("Could not create hand-off pipe for worker %u: %s", id, strerror(errno));
+    return 0;
+  }
+  evutil_make_socket_nonblocking(worker->pair[0]);
+  worker->handoff = event_new(worker->base, worker->pair[0], EV_READ | EV_PERSIST, on_handoff, worker);
+  if (!worker->handoff) {
+    LOG_WARN("Could not allocate hand-off event for worker %u", id);
+    return 0;
+  }
+  event_add(worker->handoff, NULL);
+  return 1;
+}
+
+static void worker_fini(ServerWorker* worker) {
+  unsigned size = 0;
+  for (struct conn_state_t* p = worker->conn_free; p; ) {
+    ++size;
+    struct conn_state_t* q = p;
+    p = p->next;
+    bufferevent_free(q->bev);
+    free(q);
+  }
+  if (size) {
+    LOG_INFO("Cleared conn free list for worker %u with %u elements", worker->id, size);
+  }
+
+  if (worker->listeners) {
+    for (unsigned i = 0; i < worker->num_listeners; i++) {
+      evconnlistener_free(worker->listeners[i]);
+    }
+    free(worker->listeners);
+  }
+  if (worker->handoff) event_free(worker->handoff);
+  if (worker->pair[0] >= 0) close(worker->pair[0]);
+  if (worker->pair[1] >= 0) close(worker->pair[1]);
+  if (worker->base && worker->base != worker->server->base) event_base_free(worker->base);
+}
+
+static void* worker_main(void *arg) {
+  ServerWorker* worker = arg;
+  LOG_INFO("THREAD: running worker %u", worker->id);
+  event_base_loop(worker->base, EVLOOP_NO_EXIT_ON_EMPTY);
+  LOG_INFO("THREAD: stopping worker %u", worker->id);
+  return 0;
+}
+
 // Read callback: parse requests, send replies
 static void on_read(struct bufferevent *bev, void *ctx) {
   struct conn_state_t *state = ctx;
-  Server* server = state->server;
+  Server* server = state->worker->server;
   struct evbuffer *in = bufferevent_get_input(bev);
   struct evbuffer *out = bufferevent_get_output(bev);
   while (1) {
+    // Fast path: a run of complete FETCH requests is served with one batched lookup
+    if (state->hdr_have == 0 && fetch_pipelined(server, in, out)) continue;
+
     // Step 1 (zero-copy): ensure full header is available, then parse in place
     if (state->hdr_have < sizeof(state->hdr)) {
       if (evbuffer_get_length(in) < sizeof(MelianRequestHeader)) return; // need more bytes
@@ -241,7 +404,13 @@ static void on_read(struct bufferevent *bev, void *ctx) {
       state->key_len = ntohl(H->data.length);
       evbuffer_drain(in, sizeof(MelianRequestHeader)); // consume header
       state->hdr_have = sizeof(MelianRequestHeader);
-      state->discarding = (state->key_len > MELIAN_MAX_KEY_LEN);
+      unsigned max_len = MELIAN_MAX_KEY_LEN;
+      if (state->action == MELIAN_ACTION_FETCH_MULTI) max_len = MELIAN_MAX_MULTI_LEN;
+      if (state->action == MELIAN_ACTION_FETCH_RANGE || state->action == MELIAN_ACTION_FETCH_PREFIX) {
+        max_len = MELIAN_MAX_RANGE_LEN;
+      }
+      if (state->action == MELIAN_ACTION_FILTER) max_len = MELIAN_MAX_FILTER_LEN;
+      state->discarding = (state->key_len > max_len);
       state->key_have = 0;
     }
 
@@ -264,6 +433,8 @@ static void on_read(struct bufferevent *bev, void *ctx) {
     const uint8_t* rptr = 0;
     unsigned rlen = 0;
     unsigned rfmt = 0;
+    struct TableSlot* pin = 0;
+    unsigned replied = 0;
     unsigned tab = -1;
     if (!state->discarding) {
       switch (state->action) {
@@ -278,9 +449,17 @@ static void on_read(struct bufferevent *bev, void *ctx) {
         }
 
         case MELIAN_ACTION_GET_STATISTICS: {
-          status_json(server->status, server->config, server->data);
-          rptr =  (uint8_t*)server->status->json.jbuf;
-          rlen = server->status->json.jlen;
+          // The status buffer is shared by all workers, so reply with a copy.
+          Status* status = server->status;
+          pthread_mutex_lock(&status->lock);
+          status_json(status, server->config, server->data);
+          if (status->json.jlen) {
+            uint32_t l = htonl(status->json.jlen);
+            evbuffer_add(out, &l, sizeof(l));
+            evbuffer_add(out, status->json.jbuf, status->json.jlen);
+            replied = 1;
+          }
+          pthread_mutex_unlock(&status->lock);
           break;
         }
 
@@ -290,30 +469,42 @@ static void on_read(struct bufferevent *bev, void *ctx) {
           rlen = strlen(bye);
 
           const struct timeval one_sec = { 1, 0 }; // sec, usec
-          server->tev = evtimer_new(server->base, on_quit, server);
           evtimer_add(server->tev, &one_sec);
           break;
         }
 
         case MELIAN_ACTION_FETCH:
+          if (!data_index_unique(server->data, state->table_id, state->index_id)) {
+            replied = fetch_all(server, out, state->table_id, state->index_id, key_ptr, state->key_len);
+            if (replied) break;
+          }
           tab = state->table_id;
           break;
 
+        case MELIAN_ACTION_FETCH_MULTI:
+          replied = fetch_multi(server, out, state->table_id, state->index_id, key_ptr, state->key_len);
+          break;
+
+        case MELIAN_ACTION_FETCH_RANGE:
+        case MELIAN_ACTION_FETCH_PREFIX:
+          replied = fetch_range(server, out, state->action, state->table_id, state->index_id, key_ptr, state->key_len);
+          break;
+
+        case MELIAN_ACTION_FILTER:
+          replied = fetch_filter(server, out, state->table_id, key_ptr, state->key_len);
+          break;
+
         default:
           break;
       }
     }
     if (tab != (unsigned)-1) {
-      const Bucket* bucket = data_fetch(server->data, tab, state->index_id, key_ptr, state->key_len);
-      if (bucket) {
-        const Table* table = server->data->lookup[tab];
-        const Arena* arena = table->slots[table->current_slot].arena;
-        rptr = arena_get_ptr(arena, bucket->frame_idx);
-        rlen = bucket->frame_len;
-        rfmt = 1;
-      }
+      rptr = data_fetch(server->data, tab, state->index_id, key_ptr, state->key_len, &rlen, &pin);
+      if (rptr) rfmt = 1;
     }
-    if (rptr && rlen) {
+    if (replied) {
+      LOG_DEBUG("Response already written");
+    } else if (rptr && rlen) {
       LOG_DEBUG("Writing response with %u bytes", rlen);
       if (!rfmt) {
         uint32_t l = htonl(rlen);
@@ -321,7 +512,7 @@ static void on_read(struct bufferevent *bev, void *ctx) {
         evbuffer_add(out, &l, sizeof(l));
       }
       // Zero-copy send of arena-backed frame (or static buffer)
-      evbuffer_add_reference(out, rptr, rlen, NULL, NULL);
+      add_pinned(out, rptr, rlen, pin);
     } else {
       switch (state->action) {
         case MELIAN_ACTION_FETCH: {
@@ -354,6 +545,261 @@ static void on_read(struct bufferevent *bev, void *ctx) {
   }
 }
 
+// Drop the pin on the slot a response was read from, once libevent is done
+// with the last reference into its arena.
+static void on_sent(const void *data, size_t len, void *extra) {
+  UNUSED(data);
+  UNUSED(len);
+  data_unpin(extra);
+}
+
+// Add a reference into an arena; the pin, if any, goes with it.  References
+// are released in the order they were added, so a response only needs its
+// pin on the last one.
+static void add_pinned(struct evbuffer *out, const void *data, size_t len, struct TableSlot* pin) {
+  if (evbuffer_add_reference(out, data, len, pin ? on_sent : NULL, pin) != 0) data_unpin(pin);
+}
+
+static void add_frames(struct evbuffer *out, unsigned count, const uint8_t** frames, const unsigned* frame_lens,
+                       struct TableSlot* pin) {
+  static const uint8_t zero_hdr[4] = {0};
+  unsigned last = count;
+  for (unsigned f = 0; f < count; ++f) {
+    if (frames[f]) last = f;
+  }
+  for (unsigned f = 0; f < count; ++f) {
+    if (f == last) {
+      add_pinned(out, frames[f], frame_lens[f], pin);
+    } else if (frames[f]) {
+      evbuffer_add_reference(out, frames[f], frame_lens[f], NULL, NULL);
+    } else {
+      evbuffer_add_reference(out, zero_hdr, sizeof(zero_hdr), NULL, NULL);
+    }
+  }
+}
+
+// Write all rows for a key of a postings index as a single response; runs of
+// frames that are adjacent in the arena are added with a single reference.
+static unsigned fetch_all(Server* server, struct evbuffer *out, unsigned table_id, unsigned index_id,
+                          const uint8_t* key, unsigned len) {
+  const struct Arena* arena = 0;
+  const unsigned* frames = 0;
+  unsigned bytes = 0;
+  struct TableSlot* pin = 0;
+  unsigned count = data_fetch_all(server->data, table_id, index_id, key, len, &arena, &frames, &bytes, &pin);
+  if (count == (unsigned)-1 || count == 0) return 0;
+
+  LOG_DEBUG("Writing %u rows, %u bytes", count, bytes);
+  uint32_t hdr[2] = { htonl(sizeof(uint32_t) + bytes), htonl(count) };
+  evbuffer_add(out, hdr, sizeof(hdr));
+  const uint8_t* run = arena_get_ptr(arena, frames[0]);
+  unsigned run_len = 0;
+  for (unsigned f = 0; f < count; ++f) {
+    const uint8_t* frame = arena_get_ptr(arena, frames[f]);
+    if (frame != run + run_len) {
+      evbuffer_add_reference(out, run, run_len, NULL, NULL);
+      run = frame;
+      run_len = 0;
+    }
+    run_len += arena_get_frame_len(arena, frames[f]);
+  }
+  add_pinned(out, run, run_len, pin);
+  return 1;
+}
+
+// Read a 4-byte BE length and that many bytes from a payload, advancing pos.
+static unsigned read_key(const uint8_t* payload, unsigned len, unsigned* pos, const uint8_t** key, uint32_t* key_len) {
+  uint32_t l = 0;
+  if (len - *pos < sizeof(l)) return 0;
+  memcpy(&l, payload + *pos, sizeof(l));
+  l = ntohl(l);
+  *pos += sizeof(l);
+  if (l > MELIAN_MAX_KEY_LEN || len - *pos < l) return 0;
+  *key = payload + *pos;
+  *key_len = l;
+  *pos += l;
+  return 1;
+}
+
+// Look up every key in a FETCH_MULTI payload and write all frames as a single
+// response; the frames themselves are added by reference, straight from the arena.
+static unsigned fetch_multi(Server* server, struct evbuffer *out, unsigned table_id, unsigned index_id,
+                            const uint8_t* payload, unsigned len) {
+  const void* keys[MELIAN_MAX_MULTI_KEYS];
+  uint32_t key_lens[MELIAN_MAX_MULTI_KEYS];
+  unsigned count = 0;
+  unsigned pos = 0;
+  while (pos < len) {
+    const uint8_t* key = 0;
+    if (count >= MELIAN_MAX_MULTI_KEYS || !read_key(payload, len, &pos, &key, &key_lens[count])) return 0;
+    keys[count++] = key;
+  }
+  if (!count) return 0;
+
+  const uint8_t* frames[MELIAN_MAX_MULTI_KEYS];
+  unsigned frame_lens[MELIAN_MAX_MULTI_KEYS];
+  struct TableSlot* pin = 0;
+  data_fetch_batch(server->data, table_id, index_id, count, keys, key_lens, frames, frame_lens, &pin);
+  uint32_t total = 0;
+  for (unsigned f = 0; f < count; ++f) {
+    total += frames[f] ? frame_lens[f] : 4;
+  }
+
+  LOG_DEBUG("Writing multi response with %u frames, %u bytes", count, total);
+  uint32_t l = htonl(total);
+  evbuffer_add(out, &l, sizeof(l));
+  add_frames(out, count, frames, frame_lens, pin);
+  return 1;
+}
+
+// Scan an ordered index for a FETCH_RANGE or FETCH_PREFIX request; the frames
+// are added by reference, straight from the arena, and the cursor key is copied.
+static unsigned fetch_range(Server* server, struct evbuffer *out, unsigned action, unsigned table_id, unsigned index_id,
+                            const uint8_t* payload, unsigned len) {
+  uint32_t limit = 0;
+  if (len < sizeof(limit)) return 0;
+  memcpy(&limit, payload, sizeof(limit));
+  limit = ntohl(limit);
+  if (limit == 0 || limit > MELIAN_MAX_RANGE_ROWS) limit = MELIAN_MAX_RANGE_ROWS;
+
+  unsigned pos = sizeof(limit);
+  const uint8_t* first = 0;
+  const uint8_t* second = 0;
+  uint32_t first_len = 0;
+  uint32_t second_len = 0;
+  if (!read_key(payload, len, &pos, &first, &first_len)) return 0;
+  if (!read_key(payload, len, &pos, &second, &second_len)) return 0;
+  if (pos != len) return 0;
+
+  const uint8_t* frames[MELIAN_MAX_RANGE_ROWS];
+  unsigned frame_lens[MELIAN_MAX_RANGE_ROWS];
+  const void* next = 0;
+  unsigned next_len = 0;
+  unsigned count = 0;
+  struct TableSlot* pin = 0;
+  if (action == MELIAN_ACTION_FETCH_PREFIX) {
+    // first is the prefix, second the key to continue from
+    count = data_prefix(server->data, table_id, index_id, first, first_len, second, second_len, limit,
+                        frames, frame_lens, &next, &next_len, &pin);
+  } else {
+    // first and second are the bounds of the range
+    count = data_range(server->data, table_id, index_id, first, first_len, second, second_len, limit,
+                       frames, frame_lens, &next, &next_len, &pin);
+  }
+  if (count == (unsigned)-1) return 0;
+
+  uint32_t total = 2 * sizeof(uint32_t) + next_len;
+  for (unsigned f = 0; f < count; ++f) {
+    total += frame_lens[f];
+  }
+  LOG_DEBUG("Writing range response with %u frames, %u bytes", count, total);
+  uint32_t hdr[3] = { htonl(total), htonl(count), htonl(next_len) };
+  evbuffer_add(out, hdr, sizeof(hdr));
+  if (next_len) evbuffer_add(out, next, next_len);
+  add_frames(out, count, frames, frame_lens, pin);
+  return 1;
+}
+
+// Run the program in a FILTER payload over the bitmap indexes of a table; the
+// frames of the matching rows are added by reference, straight from the arena.
+static unsigned fetch_filter(Server* server, struct evbuffer *out, unsigned table_id,
+                             const uint8_t* payload, unsigned len) {
+  uint32_t offset = 0;
+  uint32_t limit = 0;
+  if (len < sizeof(offset) + sizeof(limit)) return 0;
+  memcpy(&offset, payload, sizeof(offset));
+  memcpy(&limit, payload + sizeof(offset), sizeof(limit));
+  offset = ntohl(offset);
+  limit = ntohl(limit);
+  if (limit > MELIAN_MAX_RANGE_ROWS) limit = MELIAN_MAX_RANGE_ROWS;
+
+  DataFilterTerm terms[MELIAN_MAX_FILTER_TERMS];
+  unsigned count = 0;
+  unsigned pos = sizeof(offset) + sizeof(limit);
+  while (pos < len) {
+    if (count >= MELIAN_MAX_FILTER_TERMS) return 0;
+    DataFilterTerm* term = &terms[count++];
+    memset(term, 0, sizeof(*term));
+    term->op = payload[pos++];
+    if (term->op != MELIAN_FILTER_EQ) continue;
+    const uint8_t* key = 0;
+    if (pos >= len) return 0;
+    term->index_id = payload[pos++];
+    if (!read_key(payload, len, &pos, &key, &term->key_len)) return 0;
+    term->key = key;
+  }
+
+  const uint8_t* frames[MELIAN_MAX_RANGE_ROWS];
+  unsigned frame_lens[MELIAN_MAX_RANGE_ROWS];
+  unsigned matches = 0;
+  struct TableSlot* pin = 0;
+  unsigned n = data_filter(server->data, table_id, terms, count, offset, limit, frames, frame_lens, &matches, &pin);
+  if (n == (unsigned)-1) return 0;
+
+  uint32_t total = 2 * sizeof(uint32_t);
+  for (unsigned f = 0; f < n; ++f) {
+    total += frame_lens[f];
+  }
+  LOG_DEBUG("Writing filter response with %u of %u rows, %u bytes", n, matches, total);
+  uint32_t hdr[3] = { htonl(total), htonl(matches), htonl(n) };
+  evbuffer_add(out, hdr, sizeof(hdr));
+  add_frames(out, n, frames, frame_lens, pin);
+  return 1;
+}
+
+// Serve a run of pipelined FETCH requests for the same table / index that are
+// already complete in the input buffer, with a single batched lookup.
+// Return the number of requests served; anything else is left to on_read.
+// Headers are copied out where they lie, and the requests are only made
+// contiguous once at least two of them can be served together.
+static unsigned fetch_pipelined(Server* server, struct evbuffer *in, struct evbuffer *out) {
+  size_t avail = evbuffer_get_length(in);
+  if (avail < 2 * sizeof(MelianRequestHeader)) return 0;
+  if (avail > MELIAN_PIPELINE_WINDOW) avail = MELIAN_PIPELINE_WINDOW;
+
+  const void* keys[MELIAN_PIPELINE_MAX];
+  unsigned key_offs[MELIAN_PIPELINE_MAX];
+  uint32_t key_lens[MELIAN_PIPELINE_MAX];
+  unsigned table_id = 0;
+  unsigned index_id = 0;
+  unsigned count = 0;
+  size_t pos = 0;
+  struct evbuffer_ptr ptr;
+  evbuffer_ptr_set(in, &ptr, 0, EVBUFFER_PTR_SET);
+  while (count < MELIAN_PIPELINE_MAX && avail - pos >= sizeof(MelianRequestHeader)) {
+    MelianRequestHeader H;
+    if (evbuffer_copyout_from(in, &ptr, &H, sizeof(H)) != (ev_ssize_t) sizeof(H)) break;
+    uint32_t key_len = ntohl(H.data.length);
+    if (H.data.version != MELIAN_HEADER_VERSION || H.data.action != MELIAN_ACTION_FETCH) break;
+    if (key_len > MELIAN_MAX_KEY_LEN || avail - pos - sizeof(H) < key_len) break;
+    if (count == 0) {
+      table_id = H.data.table_id;
+      index_id = H.data.index_id;
+      if (!data_index_unique(server->data, table_id, index_id)) break;
+    } else if (H.data.table_id != table_id || H.data.index_id != index_id) {
+      break;
+    }
+    key_offs[count] = pos + sizeof(H);
+    key_lens[count] = key_len;
+    ++count;
+    pos += sizeof(H) + key_len;
+    if (evbuffer_ptr_set(in, &ptr, sizeof(H) + key_len, EVBUFFER_PTR_ADD) < 0) break;
+  }
+  if (count < 2) return 0;
+  const uint8_t* buf = evbuffer_pullup(in, pos);
+  if (!buf) return 0;
+  for (unsigned j = 0; j < count; ++j) keys[j] = buf + key_offs[j];
+
+  const uint8_t* frames[MELIAN_PIPELINE_MAX];
+  unsigned frame_lens[MELIAN_PIPELINE_MAX];
+  struct TableSlot* pin = 0;
+  data_fetch_batch(server->data, table_id, index_id, count, keys, key_lens, frames, frame_lens, &pin);
+  LOG_DEBUG("Writing %u pipelined responses", count);
+  add_frames(out, count, frames, frame_lens, pin);
+  evbuffer_drain(in, pos);
+  return count;
+}
+
 // Event callback: handle disconnects and errors
 static void on_event(struct bufferevent *bev, short events, void *ctx) {
   UNUSED(bev);
@@ -361,35 +807,83 @@ static void on_event(struct bufferevent *bev, short events, void *ctx) {
   if (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR)) {
     LOG_DEBUG("Reusing state and bufferevent");
     bufferevent_setfd(state->bev, -1);
-    Server* server = state->server;
-    state->next = server->conn_free;
-    server->conn_free = state;
+    // Whatever was not sent is dropped, releasing the slots it pinned.
+    struct evbuffer *out = bufferevent_get_output(state->bev);
+    evbuffer_drain(out, evbuffer_get_length(out));
+    struct evbuffer *in = bufferevent_get_input(state->bev);
+    evbuffer_drain(in, evbuffer_get_length(in));
+    state->hdr_have = 0;
+    state->key_have = 0;
+    state->discarding = 0;
+    ServerWorker* worker = state->worker;
+    state->next = worker->conn_free;
+    worker->conn_free = state;
   }
 }
 
-// Accept callback: create bufferevent for new client
+// Accept callback for TCP listeners: each worker accepts on its own listener
 static void on_accept(struct evconnlistener *lev, evutil_socket_t fd,
                       struct sockaddr *addr, int socklen, void *ctx) {
   UNUSED(lev);
   UNUSED(addr);
   UNUSED(socklen);
+  ServerWorker* worker = ctx;
+  worker_add_conn(worker, fd);
+}
+
+// Accept callback for UNIX listeners: pick a worker round-robin and hand off the fd
+static void on_accept_unix(struct evconnlistener *lev, evutil_socket_t fd,
+                           struct sockaddr *addr, int socklen, void *ctx) {
+  UNUSED(lev);
+  UNUSED(addr);
+  UNUSED(socklen);
+  Server* server = ctx;
+  ServerWorker* worker = &server->workers[server->next_worker];
+  server->next_worker = (server->next_worker + 1) % server->num_workers;
+  if (worker->base == server->base) {
+    worker_add_conn(worker, fd);
+    return;
+  }
+
+  ssize_t wrote = 0;
+  do {
+    wrote = write(worker->pair[1], &fd, sizeof(fd));
+  } while (wrote < 0 && errno == EINTR);
+  if (wrote != sizeof(fd)) {
+    LOG_ERROR("Failed to hand off connection to worker %u: %s", worker->id, strerror(errno));
+    evutil_closesocket(fd);
+  }
+}
+
+// Hand-off callback: adopt connections accepted by the main thread
+static void on_handoff(evutil_socket_t fd, short what, void *ctx) {
+  UNUSED(what);
+  ServerWorker* worker = ctx;
+  while (1) {
+    evutil_socket_t conn = -1;
+    ssize_t nread = read(fd, &conn, sizeof(conn));
+    if (nread != sizeof(conn)) break;
+    worker_add_conn(worker, conn);
+  }
+}
+
+// Create (or reuse) a bufferevent for a new client
+static void worker_add_conn(ServerWorker* worker, evutil_socket_t fd) {
 #if __APPLE__
   int one = 1;
   setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
 #endif
-  Server* server = ctx;
-  struct event_base *base = server->base;
   struct conn_state_t *state = 0;
-  if (server->conn_free) {
-    state = server->conn_free;
-    server->conn_free = server->conn_free->next;
+  if (worker->conn_free) {
+    state = worker->conn_free;
+    worker->conn_free = worker->conn_free->next;
     state->next = 0;
     bufferevent_setfd(state->bev, fd);
     LOG_DEBUG("REUSED conn and bev");
   } else {
     state = calloc(1, sizeof(struct conn_state_t));
-    state->server = server;
-    state->bev = bufferevent_socket_new(base, fd, MELIAN_BEV_OPTS);
+    state->worker = worker;
+    state->bev = bufferevent_socket_new(worker->base, fd, MELIAN_BEV_OPTS);
     LOG_DEBUG("CREATED conn and bev");
   }
   bufferevent_setcb(state->bev, on_read, NULL, on_event, state);
@@ -1,14 +1,36 @@
 #pragma once
 
 // A Server embodies the Melian server.
+// Requests are served by one or more workers, each running its own event loop.
+// Worker 0 runs on the main thread, which also handles signals and the cron tick.
+
+#include <pthread.h>
 
 struct conn_state_t;
+struct Server;
+
+// A worker owns an event loop, its TCP listeners and its own free list of connections.
+typedef struct ServerWorker {
+  struct Server* server;
+  unsigned id;
+  struct event_base *base;
+  struct evconnlistener **listeners;   // TCP listeners, bound with SO_REUSEPORT
+  unsigned num_listeners;
+  int pair[2];                         // receives fds handed off by the UNIX acceptor
+  struct event *handoff;
+  struct conn_state_t* conn_free;
+  pthread_t thread;
+  unsigned started;                    // whether thread is running
+} ServerWorker;
 
 // A running server.
 typedef struct Server {
   struct event_base *base;
-  struct evconnlistener **listeners;
+  struct evconnlistener **listeners;   // UNIX listeners, accepted on the main thread
   unsigned num_listeners;
+  ServerWorker* workers;
+  unsigned num_workers;
+  unsigned next_worker;
   struct event *tev;
   struct event *sev;
   struct Config* config;
@@ -16,7 +38,6 @@ typedef struct Server {
   struct Data* data;
   struct DB* db;
   struct Cron* cron;
-  struct conn_state_t* conn_free;
   unsigned running;
 } Server;
 
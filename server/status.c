@@ -9,6 +9,7 @@
 #include "log.h"
 #include "arena.h"
 #include "hash.h"
+#include "index.h"
 #include "config.h"
 #include "data.h"
 #include "db.h"
@@ -24,7 +25,9 @@ static json_t* json_process_info(Status* status);
 static json_t* json_table(Table* table);
 static json_t* json_table_arena(Arena* arena, unsigned rows);
 static json_t* json_table_hashes(Table* table, struct TableSlot* slot);
-static json_t* json_table_hash(const char* tname, Hash* hash, const char* iname);
+static json_t* json_table_huge_pages(Table* table, struct TableSlot* slot);
+static json_t* json_table_slots(Table* table, struct TableSlot* slot);
+static json_t* json_table_hash(const char* tname, Index* index, const char* iname);
 
 Status* status_build(struct event_base *base, DB* db) {
   Status* status = 0;
@@ -35,6 +38,7 @@ Status* status_build(struct event_base *base, DB* db) {
       break;
     }
     status->db = db;
+    pthread_mutex_init(&status->lock, 0);
 
     status->process.pid = getpid();
     status->process.birth = time(0);
@@ -55,6 +59,8 @@ Status* status_build(struct event_base *base, DB* db) {
 
 void status_destroy(Status* status) {
   if (!status) return;
+  if (status->json.jbuf) free(status->json.jbuf);
+  pthread_mutex_destroy(&status->lock);
   free(status);
 }
 
@@ -92,8 +98,9 @@ void status_json(Status* status, Config* config, Data* data) {
   unsigned success = 0;
   const char* driver_key = config_db_driver_name(config->db.driver);
 
+  if (status->json.jbuf) free(status->json.jbuf);
+  status->json.jbuf = NULL;
   status->json.jlen = 0;
-  status->json.jbuf[0] = '\0';
 
   server_obj = json_server_info(status);
   software_obj = json_software_info(status, driver_key);
@@ -130,15 +137,10 @@ void status_json(Status* status, Config* config, Data* data) {
     goto done;
   }
 
-  size_t dump_len = strlen(dump);
-  if (dump_len >= sizeof(status->json.jbuf)) {
-    LOG_WARN("Status JSON truncated from %zu bytes to %zu", dump_len,
-             sizeof(status->json.jbuf) - 1);
-    dump_len = sizeof(status->json.jbuf) - 1;
-  }
-  memcpy(status->json.jbuf, dump, dump_len);
-  status->json.jbuf[dump_len] = '\0';
-  status->json.jlen = (unsigned)dump_len;
+  // The dump is sent as is, however many tables it covers.
+  status->json.jbuf = dump;
+  status->json.jlen = (unsigned)strlen(dump);
+  dump = NULL;
   success = 1;
 
 done:
@@ -151,7 +153,6 @@ done:
   if (process_obj) json_decref(process_obj);
   if (!success) {
     status->json.jlen = 0;
-    status->json.jbuf[0] = '\0';
     LOG_WARN("Building status JSON failed");
   }
 }
@@ -164,44 +165,55 @@ static unsigned get_uptime(Status* status) {
 }
 
 static json_t* json_table(Table* table) {
-  struct TableSlot* slot = &table->slots[table->current_slot];
+  // The slot is pinned so that no loader rebuilds or releases it meanwhile.
+  struct TableSlot* slot = table_pin(table);
   json_t* last_loaded = json_epoch_object(table->stats.last_loaded);
   json_t* arena = json_table_arena(slot->arena, table->stats.rows);
   json_t* hashes = json_table_hashes(table, slot);
-  if (!last_loaded || !arena || !hashes) {
+  json_t* huge_pages = json_table_huge_pages(table, slot);
+  json_t* slots = json_table_slots(table, slot);
+  data_unpin(slot);
+  if (!last_loaded || !arena || !hashes || !huge_pages || !slots) {
     if (last_loaded) json_decref(last_loaded);
     if (arena) json_decref(arena);
     if (hashes) json_decref(hashes);
+    if (huge_pages) json_decref(huge_pages);
+    if (slots) json_decref(slots);
     return NULL;
   }
-  json_t* obj = json_pack("{s:s,s:i,s:i,s:i,s:i,s:i,s:O,s:O,s:O}",
+  json_t* obj = json_pack("{s:s,s:i,s:i,s:i,s:i,s:i,s:i,s:i,s:i,s:O,s:O,s:O,s:O,s:O}",
                           "name", table_name(table),
                           "id", (int)table->table_id,
                           "period", (int)table->period,
                           "rows", (int)table->stats.rows,
+                          "skipped_reloads", (int)table->stats.skipped,
+                          "delta_reloads", (int)table->stats.deltas,
+                          "reused_rows", (int)table->stats.reused,
                           "min_id", (int)table->stats.min_id,
                           "max_id", (int)table->stats.max_id,
                           "last_loaded", last_loaded,
                           "arena", arena,
-                          "hashes", hashes);
-  if (!obj) {
-    json_decref(last_loaded);
-    json_decref(arena);
-    json_decref(hashes);
-  }
+                          "hashes", hashes,
+                          "huge_pages", huge_pages,
+                          "slots", slots);
+  json_decref(last_loaded);
+  json_decref(arena);
+  json_decref(hashes);
+  json_decref(huge_pages);
+  json_decref(slots);
   return obj;
 }
 
 static json_t* json_table_arena(Arena* arena, unsigned rows) {
-  unsigned arena_cap = arena->capacity;
-  unsigned arena_used = arena->used;
-  unsigned arena_free = arena_cap - arena_used;
+  unsigned long long arena_cap = arena->capacity;
+  unsigned long long arena_used = arena->used;
+  unsigned long long arena_free = arena_cap - arena_used;
   double arena_bpr_avg = 0;
   if (rows) arena_bpr_avg = (double)arena->used / (double)rows;
-  return json_pack("{s:i,s:i,s:i,s:f}",
-                   "capacity_bytes", (int)arena_cap,
-                   "used_bytes", (int)arena_used,
-                   "free_bytes", (int)arena_free,
+  return json_pack("{s:I,s:I,s:I,s:f}",
+                   "capacity_bytes", (json_int_t)arena_cap,
+                   "used_bytes", (json_int_t)arena_used,
+                   "free_bytes", (json_int_t)arena_free,
                    "row_avg_size_bytes", arena_bpr_avg);
 }
 
@@ -209,9 +221,9 @@ static json_t* json_table_hashes(Table* table, struct TableSlot* slot) {
   json_t* obj = json_object();
   if (!obj) return NULL;
   for (unsigned idx = 0; idx < table->index_count; ++idx) {
-    Hash* hash = slot->indexes[idx];
-    if (!hash) continue;
-    json_t* hash_obj = json_table_hash(table_name(table), hash, table->indexes[idx].column);
+    Index* index = slot->indexes[idx];
+    if (!index) continue;
+    json_t* hash_obj = json_table_hash(table_name(table), index, table->indexes[idx].column);
     if (!hash_obj) {
       json_decref(obj);
       return NULL;
@@ -225,6 +237,53 @@ static json_t* json_table_hashes(Table* table, struct TableSlot* slot) {
   return obj;
 }
 
+// How much of the arena and hash tables of a slot is backed by huge pages, as
+// counted when it was loaded.
+static json_t* json_table_huge_pages(Table* table, struct TableSlot* slot) {
+  unsigned long long total = slot->arena->capacity;
+  unsigned long long huge = slot->huge_bytes;
+  for (unsigned idx = 0; idx < table->index_count; ++idx) {
+    Index* index = slot->indexes[idx];
+    if (!index || index->engine != CONFIG_INDEX_ENGINE_HASH) continue;
+    total += (size_t) index->u.hash->cap * sizeof(Bucket);
+  }
+  if (huge > total) huge = total;
+  double coverage = total ? (double)huge / (double)total : 0;
+  return json_pack("{s:b,s:I,s:I,s:f}",
+                   "enabled", slot->arena->huge ? 1 : 0,
+                   "huge_bytes", (json_int_t)huge,
+                   "total_bytes", (json_int_t)total,
+                   "coverage_perc", coverage * 100);
+}
+
+// Memory held by the arena of each slot: the address space it reserves, what
+// of it is usable, and what is actually in memory; and the responses still
+// being sent from it.  Only counters are read for the slot that is not pinned,
+// which a loader may be rebuilding or releasing; mincore reads no memory.  The
+// pin taken for this is not counted.
+static json_t* json_table_slots(Table* table, struct TableSlot* slot) {
+  json_t* arr = json_array();
+  if (!arr) return NULL;
+  for (unsigned b = 0; b < 2; ++b) {
+    unsigned current = &table->slots[b] == slot;
+    Arena* arena = table->slots[b].arena;
+    unsigned long long capacity = arena->capacity;
+    unsigned long long reserved = arena->reserved ? arena->reserved : capacity;
+    json_t* slot_obj = json_pack("{s:b,s:b,s:I,s:I,s:I,s:I}",
+                                 "current", current,
+                                 "released", !current && table->standby_released ? 1 : 0,
+                                 "reserved_bytes", (json_int_t)reserved,
+                                 "capacity_bytes", (json_int_t)capacity,
+                                 "resident_bytes", (json_int_t)arena_resident_bytes(arena->buffer, capacity),
+                                 "pins", (json_int_t)(atomic_load(&table->slots[b].pins) - current));
+    if (!slot_obj || json_array_append_new(arr, slot_obj) < 0) {
+      json_decref(arr);
+      return NULL;
+    }
+  }
+  return arr;
+}
+
 struct Percentile {
   unsigned needed;
   unsigned pos;
@@ -238,14 +297,17 @@ enum PercentileRange {
   PERC_LAST,
 };
 
-static json_t* json_table_hash(const char* tname, Hash* hash, const char* iname) {
-  unsigned free = hash->cap - hash->used;
-  double fill_factor = hash->cap ? (double)hash->used / (double)hash->cap : 0;
+static json_t* json_table_hash(const char* tname, Index* index, const char* iname) {
+  unsigned cap = index_capacity(index);
+  unsigned used = index_used(index);
+  const struct HashStats* hstats = index_stats(index);
+  unsigned free = cap - used;
+  double fill_factor = cap ? (double)used / (double)cap : 0;
   unsigned probe_cnt = 0;
   unsigned probe_min = (unsigned)-1;
   unsigned probe_max = 0;
   for (unsigned h = 0; h < MAX_PROBE_COUNT; ++h) {
-    unsigned val = h * hash->stats.probes[h];
+    unsigned val = h * hstats->probes[h];
     if (!val) continue;
     if (probe_min > h) probe_min = h;
     if (probe_max < h) probe_max = h;
@@ -259,16 +321,16 @@ static json_t* json_table_hash(const char* tname, Hash* hash, const char* iname)
   }
   double ppq = 0;
   if (probe_cnt) {
-    ppq = (double)probe_cnt / (double)hash->stats.queries;
+    ppq = (double)probe_cnt / (double)hstats->queries;
     LOG_INFO("For table %s index %s: queries %u, probes %u (from %u to %u)",
-             tname, iname, hash->stats.queries, probe_cnt, probe_min, probe_max);
+             tname, iname, hstats->queries, probe_cnt, probe_min, probe_max);
     LOG_INFO("  Mean is %.1f probes/query", ppq);
     for (unsigned s = 0; s < PERC_LAST; ++s) {
       LOG_INFO("  P%02u needs %8u probes  - shown as %s", levels[s], stats[s].needed, symbols[s]);
     }
     unsigned sum_all = 0;
     for (unsigned h = probe_min; h <= probe_max; ++h) {
-      unsigned val = h * hash->stats.probes[h];
+      unsigned val = h * hstats->probes[h];
       sum_all += val;
       for (unsigned s = 0; s < PERC_LAST; ++s) {
         if (stats[s].found) continue;
@@ -291,12 +353,13 @@ static json_t* json_table_hash(const char* tname, Hash* hash, const char* iname)
     }
   }
 
-  return json_pack("{s:i,s:i,s:i,s:f,s:i,s:i,s:f,s:i,s:i,s:i}",
-                   "total_slots", (int)hash->cap,
-                   "used_slots", (int)hash->used,
+  return json_pack("{s:s,s:i,s:i,s:i,s:f,s:i,s:i,s:f,s:i,s:i,s:i}",
+                   "engine", index_engine_name(index->engine),
+                   "total_slots", (int)cap,
+                   "used_slots", (int)used,
                    "free_slots", (int)free,
                    "fill_factor_perc", fill_factor * 100,
-                   "queries", (int)hash->stats.queries,
+                   "queries", (int)hstats->queries,
                    "probes", (int)probe_cnt,
                    "probes_per_query_avg", ppq,
                    "probes_p50", (int)stats[PERC_50].pos,
@@ -332,7 +395,25 @@ static json_t* json_software_info(Status* status, const char* driver_key) {
     json_decref(client);
     return NULL;
   }
-  json_t* driver = json_pack("{s:O,s:O}", "client", client, "server", server);
+  // Counters for the connections of all loaders, which share them.
+  const DBStats* dstats = status->db->stats;
+  unsigned connects = atomic_load(&dstats->connects);
+  unsigned long long connect_us = atomic_load(&dstats->connect_us);
+  json_t* connections = json_pack("{s:i,s:i,s:i,s:f,s:i}",
+                                  "connects", (int)connects,
+                                  "failures", (int)atomic_load(&dstats->failures),
+                                  "lost", (int)atomic_load(&dstats->lost),
+                                  "connect_us_avg", connects ? (double)connect_us / connects : 0.0,
+                                  "connect_us_last", (int)atomic_load(&dstats->last_connect_us));
+  if (!connections) {
+    json_decref(libevent);
+    json_decref(client);
+    json_decref(server);
+    return NULL;
+  }
+  json_t* driver = json_pack("{s:O,s:O,s:O}", "client", client, "server", server, "connections", connections);
+  // The pack took its own reference to connections.
+  json_decref(connections);
   if (!driver) {
     json_decref(libevent);
     json_decref(client);
@@ -378,8 +459,11 @@ static json_t* json_config_info(Config* config, const char* driver_key) {
     return NULL;
   }
 
-  json_t* table_cfg = json_pack("{s:i,s:s,s:b}",
+  json_t* table_cfg = json_pack("{s:i,s:i,s:b,s:b,s:s,s:b}",
                                 "period", (int)config->table.period,
+                                "dense_factor", (int)config->table.dense_factor,
+                                "huge_pages", config->table.huge_pages ? 1 : 0,
+                                "release_standby", config->table.release_standby ? 1 : 0,
                                 "schema", safe_string(config->table.schema),
                                 "strip_null", config->table.strip_null ? 1 : 0);
   if (!table_cfg) {
@@ -388,7 +472,10 @@ static json_t* json_config_info(Config* config, const char* driver_key) {
     return NULL;
   }
 
-  json_t* server_cfg = json_pack("{s:b}", "show_msgs", config->server.show_msgs ? 1 : 0);
+  json_t* server_cfg = json_pack("{s:b,s:i,s:i}",
+                                 "show_msgs", config->server.show_msgs ? 1 : 0,
+                                 "workers", (int)config->server.workers,
+                                 "loaders", (int)config->server.loaders);
   if (!server_cfg) {
     json_decref(driver_cfg);
     json_decref(sockets_cfg);
@@ -3,9 +3,10 @@
 // A Status gathers data about the server status.
 // It can either log this data or format it as JSON.
 
+#include <pthread.h>
+
 // TODO: make these limits dynamic? Arena?
 enum {
-  MAX_JSON_LEN = 10240,
   MAX_STR_LEN = 1024,
 };
 
@@ -32,11 +33,12 @@ typedef struct StatusProcess {
 } StatusProcess;
 
 typedef struct StatusJson {
-  char jbuf[MAX_JSON_LEN];
+  char* jbuf;             // as returned by json_dumps, kept until the next one
   unsigned jlen;
 } StatusJson;
 
 typedef struct Status {
+  pthread_mutex_t lock;   // serializes status_json() across workers
   struct DB* db;
   StatusProcess process;
   StatusServer server;
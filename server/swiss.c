@@ -0,0 +1,160 @@
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "log.h"
+#include "util.h"
+#include "arena.h"
+#include "xxhash.h"
+#include "swiss.h"
+
+// Control byte for an empty slot; full slots store the low 7 bits of the hash.
+#define SWISS_EMPTY 0x80
+
+#define SWISS_H1(h) ((h) >> 7)
+#define SWISS_H2(h) ((uint8_t)((h) & 0x7f))
+
+// Bitmask of the bytes in the group at ctrl that are equal to value.
+static inline unsigned swiss_match(const uint8_t* ctrl, uint8_t value) {
+#if defined(__SSE2__)
+  __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+  return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)value)));
+#else
+  unsigned mask = 0;
+  for (unsigned j = 0; j < SWISS_GROUP_WIDTH; ++j) {
+    mask |= (unsigned)(ctrl[j] == value) << j;
+  }
+  return mask;
+#endif
+}
+
+Swiss* swiss_build(unsigned rows, struct Arena* arena) {
+  Swiss* swiss = 0;
+  unsigned bad = 0;
+  do {
+    if (!arena) {
+      LOG_WARN("Cannot create a Swiss object without a valid Arena");
+      break;
+    }
+
+    swiss = calloc(1, sizeof(Swiss));
+    if (!swiss) {
+      LOG_WARN("Could not allocate a Swiss object");
+      break;
+    }
+
+    // Keep the load factor at or below 7/8.
+    unsigned cap = next_power_of_two(rows + rows / 7 + 1, SWISS_GROUP_WIDTH);
+    swiss->ctrl = malloc(cap);
+    swiss->slots = calloc(cap, sizeof(SwissSlot));
+    if (!swiss->ctrl || !swiss->slots) {
+      LOG_WARN("Could not allocate Swiss table with %u slots", cap);
+      ++bad;
+      break;
+    }
+    memset(swiss->ctrl, SWISS_EMPTY, cap);
+    swiss->cap = cap;
+    swiss->arena = arena;
+  } while (0);
+  if (bad) {
+    swiss_destroy(swiss);
+    swiss = 0;
+  }
+  return swiss;
+}
+
+void swiss_destroy(Swiss* swiss) {
+  if (!swiss) return;
+  if (swiss->ctrl) free(swiss->ctrl);
+  if (swiss->slots) free(swiss->slots);
+  free(swiss);
+}
+
+unsigned swiss_insert(Swiss* swiss, const void *key, uint32_t key_len, unsigned frame, uint32_t frame_len) {
+  if (swiss->used >= swiss->cap - swiss->cap / 8) {
+    LOG_WARN("Swiss table full with %u slots, cannot insert", swiss->cap);
+    return 0;
+  }
+  uint64_t h = XXH3_64bits(key, key_len, 0);
+  unsigned gmask = swiss->cap / SWISS_GROUP_WIDTH - 1;
+  unsigned group = SWISS_H1(h) & gmask;
+  for (unsigned stride = 1; ; ++stride) {
+    uint8_t* ctrl = swiss->ctrl + group * SWISS_GROUP_WIDTH;
+    unsigned empty = swiss_match(ctrl, SWISS_EMPTY);
+    if (empty) {
+      unsigned pos = group * SWISS_GROUP_WIDTH + __builtin_ctz(empty);
+      unsigned kindex = arena_store(swiss->arena, key, key_len);
+      if (kindex == (unsigned)-1) return 0;
+
+      swiss->ctrl[pos] = SWISS_H2(h);
+      swiss->slots[pos].key_len = key_len;
+      swiss->slots[pos].key_idx = kindex;
+      swiss->slots[pos].frame_idx = frame;
+      swiss->slots[pos].frame_len = frame_len;
+      swiss->used++;
+      return 1;
+    }
+    group = (group + stride) & gmask;
+  }
+}
+
+// Probe groups for an already hashed key; stop at the first group with an empty slot.
+static inline const SwissSlot* swiss_probe(Swiss* swiss, uint64_t h, const void *key, uint32_t key_len, struct HashStats* stats) {
+  unsigned gmask = swiss->cap / SWISS_GROUP_WIDTH - 1;
+  unsigned group = SWISS_H1(h) & gmask;
+  uint8_t h2 = SWISS_H2(h);
+  unsigned probes = 0;
+  const SwissSlot* found = 0;
+  for (unsigned stride = 1; ; ++stride) {
+    ++probes;
+    const uint8_t* ctrl = swiss->ctrl + group * SWISS_GROUP_WIDTH;
+    for (unsigned match = swiss_match(ctrl, h2); match; match &= match - 1) {
+      const SwissSlot* slot = &swiss->slots[group * SWISS_GROUP_WIDTH + __builtin_ctz(match)];
+      if (slot->key_len != key_len) continue;
+      uint8_t* key_ptr = arena_get_ptr(swiss->arena, slot->key_idx);
+      if (memcmp(key_ptr, key, key_len) == 0) {
+        found = slot;
+        break;
+      }
+    }
+    if (found || swiss_match(ctrl, SWISS_EMPTY) || probes > gmask) break;
+    group = (group + stride) & gmask;
+  }
+  if (stats) hash_stats_probes(stats, probes);
+  return found;
+}
+
+const SwissSlot* swiss_get(Swiss* swiss, const void *key, uint32_t key_len) {
+  hash_stats_queries(&swiss->stats, 1);
+  uint64_t h = XXH3_64bits(key, key_len, 0);
+  return swiss_probe(swiss, h, key, key_len, &swiss->stats);
+}
+
+const SwissSlot* swiss_peek(Swiss* swiss, const void *key, uint32_t key_len) {
+  return swiss_probe(swiss, XXH3_64bits(key, key_len, 0), key, key_len, 0);
+}
+
+// Lookup a batch of keys: hash them all and prefetch their first control group,
+// then prefetch the first matching slot of each, and only then resolve them.
+void swiss_get_batch(Swiss* swiss, unsigned count, const void* const* keys, const uint32_t* key_lens, const SwissSlot** out) {
+  unsigned gmask = swiss->cap / SWISS_GROUP_WIDTH - 1;
+  for (unsigned beg = 0; beg < count; beg += HASH_BATCH_GROUP) {
+    unsigned end = beg + HASH_BATCH_GROUP < count ? beg + HASH_BATCH_GROUP : count;
+    uint64_t h[HASH_BATCH_GROUP];
+    for (unsigned j = beg; j < end; ++j) {
+      h[j - beg] = XXH3_64bits(keys[j], key_lens[j], 0);
+      unsigned group = SWISS_H1(h[j - beg]) & gmask;
+      __builtin_prefetch(swiss->ctrl + group * SWISS_GROUP_WIDTH, 0, 3);
+    }
+    for (unsigned j = beg; j < end; ++j) {
+      unsigned group = SWISS_H1(h[j - beg]) & gmask;
+      unsigned match = swiss_match(swiss->ctrl + group * SWISS_GROUP_WIDTH, SWISS_H2(h[j - beg]));
+      if (match) __builtin_prefetch(swiss->slots + group * SWISS_GROUP_WIDTH + __builtin_ctz(match), 0, 3);
+    }
+    for (unsigned j = beg; j < end; ++j) {
+      out[j] = swiss_probe(swiss, h[j - beg], keys[j], key_lens[j], &swiss->stats);
+    }
+  }
+  hash_stats_queries(&swiss->stats, count);
+}
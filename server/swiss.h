@@ -0,0 +1,40 @@
+#pragma once
+
+// A Swiss keeps an index for data stored in an Arena, using a "Swiss table" layout.
+// There is a separate array of control bytes, one per slot, holding either an empty
+// marker or 7 bits of the key's hash; slots only hold compact references to the arena.
+// Slots are grouped 16 at a time: a lookup loads the 16 control bytes of a group and
+// compares them all at once (with SSE2 when available), and only touches the slots
+// whose control byte matched.
+
+#include <stdint.h>
+#include "hash.h"
+
+enum {
+  SWISS_GROUP_WIDTH = 16,
+};
+
+typedef struct SwissSlot {
+  uint32_t key_len;       // length of key in bytes
+  unsigned key_idx;       // index into arena memory for key bytes
+  unsigned frame_idx;     // index into arena memory for preframed value
+  uint32_t frame_len;     // = 4 + value_len
+} SwissSlot;
+
+typedef struct Swiss {
+  unsigned cap;           // power-of-two number of slots, at least one group
+  unsigned used;          // number of items stored
+  uint8_t *ctrl;          // control bytes, one per slot
+  SwissSlot *slots;       // array of slots
+  struct Arena* arena;    // pointer to common arena
+  struct HashStats stats; // probes count groups visited
+} Swiss;
+
+// Build a table sized for the given number of rows.
+Swiss* swiss_build(unsigned rows, struct Arena* arena);
+void swiss_destroy(Swiss* swiss);
+unsigned swiss_insert(Swiss* swiss, const void *key, uint32_t key_len, unsigned frame, uint32_t frame_len);
+const SwissSlot* swiss_get(Swiss* swiss, const void *key, uint32_t key_len);
+// Same as swiss_get, without counting the lookup in the stats.
+const SwissSlot* swiss_peek(Swiss* swiss, const void *key, uint32_t key_len);
+void swiss_get_batch(Swiss* swiss, unsigned count, const void* const* keys, const uint32_t* key_lens, const SwissSlot** out);
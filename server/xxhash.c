@@ -55,9 +55,9 @@ uint64_t XXH3_64bits(const void* input, uint32_t length, uint64_t seed) {
     if (length >= 9) {
       uint64_t input_lo = read64(data);
       uint64_t input_hi = read64(data + length - 8);
-      uint64_t bitflip = read64(XXH3_kSecret + 24) ^ read64(XXH3_kSecret + 32);
+      uint64_t bitflip = (read64(XXH3_kSecret + 24) ^ read64(XXH3_kSecret + 32)) + seed;
       uint64_t keyed = input_lo ^ input_hi ^ bitflip;
-      return avalanche(rol64(keyed, 37) * XXH_PRIME64_1);
+      return avalanche(rol64(keyed, 37) * XXH_PRIME64_1 + length);
     }
     if (length >= 4) {
       uint32_t input1, input2;
@@ -65,25 +65,27 @@ uint64_t XXH3_64bits(const void* input, uint32_t length, uint64_t seed) {
       memcpy(&input2, data + length - 4, 4);
       uint64_t combined = ((uint64_t)input1 << 32) | input2;
       uint64_t keyed = combined ^ (read64(XXH3_kSecret + 8) + seed);
-      return avalanche(rol64(keyed, 11) * XXH_PRIME64_1);
+      return avalanche(rol64(keyed, 11) * XXH_PRIME64_1 + length);
     }
     if (length > 0) {
       uint8_t c1 = data[0];
       uint8_t c2 = data[length >> 1];
       uint8_t c3 = data[length - 1];
-      uint32_t combined = ((uint32_t)c1 << 16) | ((uint32_t)c2 << 8) | c3;
+      uint32_t combined = ((uint32_t)length << 24) | ((uint32_t)c1 << 16) | ((uint32_t)c2 << 8) | c3;
       uint64_t keyed = combined ^ (read64(XXH3_kSecret) + seed);
       return avalanche(keyed * XXH_PRIME64_1);
     }
-    return avalanche(read64(XXH3_kSecret + 56) ^ read64(XXH3_kSecret + 64));
+    return avalanche(seed ^ read64(XXH3_kSecret + 56) ^ read64(XXH3_kSecret + 64));
   }
 
   if (length <= 128) {
     uint64_t acc = length * XXH_PRIME64_1;
     size_t i;
-    for (i = 0; i < length; i += 16) {
+    for (i = 0; i + 16 <= length; i += 16) {
       acc += mix16B(data + i, XXH3_kSecret + i, seed);
     }
+    // The last bytes are read as the last 16 of the input, never past its end.
+    if (i < length) acc += mix16B(data + length - 16, XXH3_kSecret + i, seed);
     return avalanche(acc);
   }
 
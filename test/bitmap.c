@@ -0,0 +1,118 @@
+#include "test.h"
+#include "bitmap.h"
+#include "roaring.h"
+
+enum {
+  BITMAP_ROWS = 70000,    // enough for a second container, past row 65535
+};
+
+static Arena* arena;
+static unsigned frames[BITMAP_ROWS];
+
+// Build a bitmap index where row n has the key of number key(n).
+static Index* test_bitmap_build(ConfigIndexType type, unsigned (*key)(unsigned)) {
+  Index* index = index_build(CONFIG_INDEX_ENGINE_BITMAP, type, BITMAP_ROWS, arena);
+  CHECK(index != 0);
+  if (!index) return 0;
+  char buf[64];
+  for (unsigned n = 0; n < BITMAP_ROWS; ++n) {
+    uint32_t len = test_key(type, key(n), buf);
+    CHECK(index_insert(index, buf, len, frames[n], arena_get_frame_len(arena, frames[n])));
+  }
+  CHECK(index_finalize(index, frames, BITMAP_ROWS));
+  return index;
+}
+
+// Keys of each index, and the rows expected in bitmaps.
+static unsigned test_parity(unsigned n) { return n % 2; }
+static unsigned test_fifth(unsigned n) { return n % 5 ? 1 : 0; }
+static unsigned test_rare(unsigned n) { return n % 1000 ? 1 : 0; }
+static unsigned test_even(unsigned n) { return n % 2 == 0; }
+static unsigned test_tenth(unsigned n) { return n % 10 == 0; }
+static unsigned test_odd_or_rare(unsigned n) { return n % 2 == 1 || n % 1000 == 0; }
+static unsigned test_rare_row(unsigned n) { return n % 1000 == 0; }
+
+static const Roaring* test_bitmap_get(Index* index, ConfigIndexType type, unsigned number) {
+  char buf[64];
+  uint32_t len = test_key(type, number, buf);
+  const Roaring* map = 0;
+  CHECK(index_get_bitmap(index, buf, len, &map));
+  return map;
+}
+
+// Check that a bitmap holds exactly the rows for which keep is true.
+static void test_bitmap_rows(const Roaring* map, unsigned (*keep)(unsigned)) {
+  static uint32_t rows[BITMAP_ROWS];
+  unsigned count = 0;
+  for (unsigned n = 0; n < BITMAP_ROWS; ++n) count += keep(n);
+  CHECK(map && roaring_cardinality(map) == count);
+  if (!map) return;
+  CHECK(roaring_select(map, 0, BITMAP_ROWS, rows) == count);
+  unsigned pos = 0;
+  for (unsigned n = 0; n < BITMAP_ROWS && pos < count; ++n) {
+    if (!keep(n)) continue;
+    CHECK(rows[pos] == n);
+    ++pos;
+  }
+}
+
+int main(void) {
+  arena = arena_build(1024);
+  for (unsigned n = 0; n < BITMAP_ROWS; ++n) frames[n] = test_frame(arena, n);
+  Index* parity = test_bitmap_build(CONFIG_INDEX_TYPE_INT, test_parity);
+  Index* fifth = test_bitmap_build(CONFIG_INDEX_TYPE_STRING, test_fifth);
+  Index* rare = test_bitmap_build(CONFIG_INDEX_TYPE_STRING, test_rare);
+  if (!parity || !fifth || !rare) return test_result("bitmap");
+  CHECK(index_used(parity) == 2);
+
+  // Bitset containers for the frequent keys, arrays for the rare one.
+  const Roaring* even = test_bitmap_get(parity, CONFIG_INDEX_TYPE_INT, 0);
+  const Roaring* odd = test_bitmap_get(parity, CONFIG_INDEX_TYPE_INT, 1);
+  const Roaring* tenth = test_bitmap_get(fifth, CONFIG_INDEX_TYPE_STRING, 0);
+  const Roaring* thousandth = test_bitmap_get(rare, CONFIG_INDEX_TYPE_STRING, 0);
+  test_bitmap_rows(even, test_even);
+  test_bitmap_rows(thousandth, test_rare_row);
+  CHECK(even && even->count == 2 && even->containers[0].bitset && !even->containers[1].bitset);
+  CHECK(thousandth && !thousandth->containers[0].bitset);
+
+  // Intersections and unions across container kinds.
+  if (even && odd && tenth && thousandth) {
+    Roaring* map = roaring_and(even, tenth);
+    test_bitmap_rows(map, test_tenth);
+    roaring_destroy(map);
+    map = roaring_or(odd, thousandth);
+    test_bitmap_rows(map, test_odd_or_rare);
+    roaring_destroy(map);
+    map = roaring_and(odd, thousandth);
+    CHECK(map && roaring_cardinality(map) == 0);
+    roaring_destroy(map);
+    map = roaring_and(even, thousandth);
+    test_bitmap_rows(map, test_rare_row);
+    roaring_destroy(map);
+  }
+
+  // Pages of rows, and offsets past the end.
+  uint32_t rows[4];
+  CHECK(even && roaring_select(even, 5, 3, rows) == 3);
+  CHECK(rows[0] == 10 && rows[1] == 12 && rows[2] == 14);
+  CHECK(even && roaring_select(even, 34999, 4, rows) == 1 && rows[0] == 69998);
+  CHECK(even && roaring_select(even, 35000, 4, rows) == 0);
+  CHECK(even && roaring_select(even, 0, 0, rows) == 0);
+
+  // Keys no row has, and lookups the index does not answer.
+  CHECK(test_bitmap_get(parity, CONFIG_INDEX_TYPE_INT, 2) == 0);
+  CHECK(test_bitmap_get(fifth, CONFIG_INDEX_TYPE_STRING, 2) == 0);
+  const Roaring* map = 0;
+  CHECK(index_get_bitmap(fifth, "", 0, &map) && !map);
+  uint32_t frame_len = 0;
+  CHECK(index_get(parity, "\0\0\0\0", 4, &frame_len) == (unsigned)-1);
+  Index* hash = index_build(CONFIG_INDEX_ENGINE_HASH, CONFIG_INDEX_TYPE_INT, 1, arena);
+  CHECK(hash && !index_get_bitmap(hash, "\0\0\0\0", 4, &map) && !map);
+
+  index_destroy(hash);
+  index_destroy(parity);
+  index_destroy(fifth);
+  index_destroy(rare);
+  arena_destroy(arena);
+  return test_result("bitmap");
+}
@@ -0,0 +1,78 @@
+#include "test.h"
+#include "dense.h"
+
+// Build a hash index over the given int keys, each for its own row, and try to
+// make it dense.
+static Index* test_dense_build(Arena* arena, const unsigned* keys, unsigned count, unsigned factor,
+                               unsigned* frames) {
+  Index* index = index_build(CONFIG_INDEX_ENGINE_HASH, CONFIG_INDEX_TYPE_INT, count, arena);
+  CHECK(index != 0);
+  if (!index) return 0;
+  for (unsigned j = 0; j < count; ++j) {
+    frames[j] = test_frame(arena, j);
+    CHECK(index_insert(index, &keys[j], sizeof(unsigned), frames[j], arena_get_frame_len(arena, frames[j])));
+  }
+  CHECK(index_finalize(index, frames, count));
+  index_densify(index, factor);
+  return index;
+}
+
+// Keys at the ends of the range, and next to them, outside of it.
+static void test_dense_bounds(void) {
+  Arena* arena = arena_build(1024);
+  unsigned keys[] = { 100, 101, 105, 110 };
+  unsigned frames[ALEN(keys)];
+  Index* index = test_dense_build(arena, keys, ALEN(keys), 4, frames);
+  CHECK(index && index->engine == CONFIG_INDEX_ENGINE_DENSE);
+  if (!index) return;
+  CHECK(index_used(index) == ALEN(keys));
+  CHECK(index_capacity(index) == 11);
+  uint32_t frame_len = 0;
+  for (unsigned j = 0; j < ALEN(keys); ++j) {
+    CHECK(index_get(index, &keys[j], sizeof(unsigned), &frame_len) == frames[j]);
+    CHECK(frame_len == arena_get_frame_len(arena, frames[j]));
+  }
+  unsigned misses[] = { 0, 99, 102, 109, 111, (unsigned)-1 };
+  for (unsigned j = 0; j < ALEN(misses); ++j) {
+    CHECK(index_get(index, &misses[j], sizeof(unsigned), &frame_len) == (unsigned)-1);
+  }
+  // Keys of any other length are not int keys.
+  CHECK(index_get(index, "\x64\0\0\0\0", 5, &frame_len) == (unsigned)-1);
+  CHECK(index_get(index, "\x64", 1, &frame_len) == (unsigned)-1);
+  CHECK(index_get(index, "", 0, &frame_len) == (unsigned)-1);
+  index_destroy(index);
+  arena_destroy(arena);
+}
+
+// Keys spread over more than factor times their number keep the hash index.
+static void test_dense_sparse(void) {
+  Arena* arena = arena_build(1024);
+  unsigned keys[] = { 1, 2, 3, 1000 };
+  unsigned frames[ALEN(keys)];
+  Index* index = test_dense_build(arena, keys, ALEN(keys), 2, frames);
+  CHECK(index && index->engine == CONFIG_INDEX_ENGINE_HASH);
+  if (!index) return;
+  uint32_t frame_len = 0;
+  CHECK(index_get(index, &keys[3], sizeof(unsigned), &frame_len) == frames[3]);
+  CHECK(!index_densify(index, 0));
+  index_destroy(index);
+
+  // String keys are never made dense.
+  index = index_build(CONFIG_INDEX_ENGINE_HASH, CONFIG_INDEX_TYPE_STRING, 1, arena);
+  CHECK(index != 0);
+  if (!index) return;
+  unsigned frame = test_frame(arena, 0);
+  CHECK(index_insert(index, "ab", 2, frame, arena_get_frame_len(arena, frame)));
+  CHECK(!index_densify(index, 1000));
+  CHECK(index->engine == CONFIG_INDEX_ENGINE_HASH);
+  index_destroy(index);
+  arena_destroy(arena);
+}
+
+int main(void) {
+  test_unique_index(CONFIG_INDEX_ENGINE_HASH, CONFIG_INDEX_TYPE_INT, 1000, 3);
+  test_unique_index(CONFIG_INDEX_ENGINE_HASH, CONFIG_INDEX_TYPE_INT, 1, 1);
+  test_dense_bounds();
+  test_dense_sparse();
+  return test_result("dense");
+}
@@ -0,0 +1,851 @@
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <jansson.h>
+#include "test.h"
+#include "protocol.h"
+
+// Requests sent to a running server, started by live.sh, over the tables:
+//   0 items: id 1..1000 (hash); name item-NNNN (ordered); category id % 10
+//            (postings); color red / green / blue by id % 3 (bitmap); size
+//            id % 4 (bitmap).  It is reloaded every second.
+//   1 nums:  id 2, 4, ..., 1000 (ordered); code cN (mph); alias alias-N (swiss).
+
+enum {
+  LIVE_ITEMS = 0,
+  LIVE_NUMS = 1,
+  LIVE_MAX_RESPONSE = 1 << 20,
+  LIVE_MAX_REQUEST = 1 << 20,
+};
+
+static const char* live_path;
+static uint8_t response[LIVE_MAX_RESPONSE];
+static uint8_t request[LIVE_MAX_REQUEST];
+
+static int live_connect(void) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", live_path);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static unsigned live_send(int fd, const void* data, size_t len) {
+  const uint8_t* p = data;
+  while (len) {
+    ssize_t n = write(fd, p, len);
+    if (n <= 0) return 0;
+    p += n;
+    len -= n;
+  }
+  return 1;
+}
+
+static unsigned live_recv(int fd, void* data, size_t len) {
+  uint8_t* p = data;
+  while (len) {
+    ssize_t n = read(fd, p, len);
+    if (n <= 0) return 0;
+    p += n;
+    len -= n;
+  }
+  return 1;
+}
+
+static unsigned live_put_u32(uint8_t* buf, uint32_t value) {
+  value = htonl(value);
+  memcpy(buf, &value, sizeof(value));
+  return sizeof(value);
+}
+
+static uint32_t live_get_u32(const uint8_t* buf) {
+  uint32_t value = 0;
+  memcpy(&value, buf, sizeof(value));
+  return ntohl(value);
+}
+
+// Write a key as a 4-byte BE length followed by its bytes.
+static unsigned live_put_key(uint8_t* buf, const void* key, uint32_t len) {
+  unsigned pos = live_put_u32(buf, len);
+  memcpy(buf + pos, key, len);
+  return pos + len;
+}
+
+static unsigned live_put_header(uint8_t* buf, unsigned action, unsigned table_id, unsigned index_id, uint32_t len) {
+  MelianRequestHeader hdr;
+  hdr.data.version = MELIAN_HEADER_VERSION;
+  hdr.data.action = action;
+  hdr.data.table_id = table_id;
+  hdr.data.index_id = index_id;
+  hdr.data.length = htonl(len);
+  memcpy(buf, hdr.bytes, sizeof(hdr));
+  return sizeof(hdr);
+}
+
+// Read one response into response, and return its length, or -1 on errors.
+static uint32_t live_response(int fd) {
+  uint8_t hdr[4];
+  if (!live_recv(fd, hdr, sizeof(hdr))) return -1;
+  uint32_t len = live_get_u32(hdr);
+  if (len > sizeof(response) || !live_recv(fd, response, len)) return -1;
+  return len;
+}
+
+// Send one request and read its response.
+static uint32_t live_request(int fd, unsigned action, unsigned table_id, unsigned index_id,
+                             const void* payload, uint32_t len) {
+  uint8_t hdr[sizeof(MelianRequestHeader)];
+  live_put_header(hdr, action, table_id, index_id, len);
+  if (!live_send(fd, hdr, sizeof(hdr)) || !live_send(fd, payload, len)) return -1;
+  return live_response(fd);
+}
+
+// Return the id of a row from its JSON value, or -1 if it is not one.
+static unsigned live_id(const uint8_t* value, uint32_t len) {
+  static const char prefix[] = "{\"id\":";
+  if (len <= sizeof(prefix) - 1 || memcmp(value, prefix, sizeof(prefix) - 1) != 0) return -1;
+  unsigned id = 0;
+  for (unsigned pos = sizeof(prefix) - 1; pos < len && value[pos] >= '0' && value[pos] <= '9'; ++pos) {
+    id = id * 10 + (value[pos] - '0');
+  }
+  return id;
+}
+
+// FETCH a key, and return the id of the row found, 0 for an empty response,
+// or -1 if the response was not a row.
+static unsigned live_fetch(int fd, unsigned table_id, unsigned index_id, const void* key, uint32_t len) {
+  uint32_t got = live_request(fd, MELIAN_ACTION_FETCH, table_id, index_id, key, len);
+  if (got == 0) return 0;
+  if (got == (uint32_t)-1) return -1;
+  return live_id(response, got);
+}
+
+static unsigned live_fetch_int(int fd, unsigned table_id, unsigned index_id, unsigned key) {
+  return live_fetch(fd, table_id, index_id, &key, sizeof(key));
+}
+
+static unsigned live_fetch_str(int fd, unsigned table_id, unsigned index_id, const char* key) {
+  return live_fetch(fd, table_id, index_id, key, strlen(key));
+}
+
+// Check the frames of a response against the expected ids, 0 meaning a miss.
+static void live_check_frames(const uint8_t* frames, uint32_t len, const unsigned* ids, unsigned count) {
+  uint32_t pos = 0;
+  for (unsigned j = 0; j < count; ++j) {
+    CHECK(len - pos >= 4);
+    if (len - pos < 4) return;
+    uint32_t frame_len = live_get_u32(frames + pos);
+    pos += 4;
+    CHECK(frame_len <= len - pos);
+    if (frame_len > len - pos) return;
+    CHECK((ids[j] ? live_id(frames + pos, frame_len) : 0) == ids[j]);
+    CHECK(ids[j] || frame_len == 0);
+    pos += frame_len;
+  }
+  CHECK(pos == len);
+}
+
+static void test_fetch(int fd) {
+  CHECK(live_fetch_int(fd, LIVE_ITEMS, 0, 5) == 5);
+  CHECK(live_fetch_int(fd, LIVE_ITEMS, 0, 1000) == 1000);
+  CHECK(live_fetch_int(fd, LIVE_ITEMS, 0, 0) == 0);
+  CHECK(live_fetch_int(fd, LIVE_ITEMS, 0, 1001) == 0);
+  CHECK(live_fetch(fd, LIVE_ITEMS, 0, "\5\0\0", 3) == 0);
+  CHECK(live_fetch(fd, LIVE_ITEMS, 0, "", 0) == 0);
+  CHECK(live_fetch_str(fd, LIVE_ITEMS, 1, "item-0042") == 42);
+  CHECK(live_fetch_str(fd, LIVE_ITEMS, 1, "item-42") == 0);
+  CHECK(live_fetch_str(fd, LIVE_NUMS, 1, "c10") == 10);
+  CHECK(live_fetch_str(fd, LIVE_NUMS, 1, "c11") == 0);
+  CHECK(live_fetch_str(fd, LIVE_NUMS, 1, "") == 0);
+  CHECK(live_fetch_str(fd, LIVE_NUMS, 2, "alias-1000") == 1000);
+  CHECK(live_fetch_str(fd, LIVE_NUMS, 2, "alias-1001") == 0);
+  CHECK(live_fetch_int(fd, LIVE_NUMS, 0, 500) == 500);
+  CHECK(live_fetch_int(fd, LIVE_NUMS, 0, 501) == 0);
+  // Unknown tables and indexes.
+  CHECK(live_fetch_int(fd, 9, 0, 5) == 0);
+  CHECK(live_fetch_int(fd, LIVE_ITEMS, 9, 5) == 0);
+  // A key longer than any key is read and dropped, and the connection goes on.
+  memset(request, 'x', 300);
+  CHECK(live_fetch(fd, LIVE_NUMS, 1, request, 300) == 0);
+  CHECK(live_fetch_int(fd, LIVE_ITEMS, 0, 7) == 7);
+}
+
+// Send a FETCH_MULTI for int keys, and check the ids of the frames returned.
+static void live_multi_ints(int fd, unsigned table_id, const unsigned* keys, const unsigned* ids, unsigned count) {
+  uint32_t len = 0;
+  for (unsigned j = 0; j < count; ++j) len += live_put_key(request + len, &keys[j], sizeof(unsigned));
+  uint32_t got = live_request(fd, MELIAN_ACTION_FETCH_MULTI, table_id, 0, request, len);
+  CHECK(got != (uint32_t)-1);
+  if (got != (uint32_t)-1) live_check_frames(response, got, ids, count);
+}
+
+static void test_fetch_multi(int fd) {
+  // Hits, misses and the same key twice, in request order.
+  unsigned keys[] = { 1, 5000, 2, 2, 0, 1000 };
+  unsigned ids[] = { 1, 0, 2, 2, 0, 1000 };
+  live_multi_ints(fd, LIVE_ITEMS, keys, ids, ALEN(keys));
+
+  // As many keys as a request can carry.
+  static unsigned many_keys[MELIAN_MAX_MULTI_KEYS];
+  static unsigned many_ids[MELIAN_MAX_MULTI_KEYS];
+  for (unsigned j = 0; j < MELIAN_MAX_MULTI_KEYS; ++j) {
+    many_keys[j] = MELIAN_MAX_MULTI_KEYS - j;
+    many_ids[j] = many_keys[j] <= 1000 ? many_keys[j] : 0;
+  }
+  live_multi_ints(fd, LIVE_ITEMS, many_keys, many_ids, MELIAN_MAX_MULTI_KEYS);
+
+  // String keys on the mph and swiss indexes.
+  const char* codes[] = { "c2", "c3", "c1000", "" };
+  unsigned code_ids[] = { 2, 0, 1000, 0 };
+  for (unsigned index_id = 1; index_id <= 2; ++index_id) {
+    uint32_t len = 0;
+    for (unsigned j = 0; j < ALEN(codes); ++j) {
+      char key[32];
+      int key_len = index_id == 1 || !codes[j][0] ? sprintf(key, "%s", codes[j])
+                                                  : sprintf(key, "alias-%s", codes[j] + 1);
+      len += live_put_key(request + len, key, key_len);
+    }
+    uint32_t got = live_request(fd, MELIAN_ACTION_FETCH_MULTI, LIVE_NUMS, index_id, request, len);
+    CHECK(got != (uint32_t)-1);
+    if (got != (uint32_t)-1) live_check_frames(response, got, code_ids, ALEN(codes));
+  }
+
+  // Every key of an unknown table misses.
+  unsigned misses[] = { 0, 0, 0, 0, 0, 0 };
+  live_multi_ints(fd, 9, keys, misses, ALEN(keys));
+
+  // Malformed payloads get an empty response: no keys, too many keys, a length
+  // cut short, a key running past the payload, and a key longer than any key.
+  CHECK(live_request(fd, MELIAN_ACTION_FETCH_MULTI, LIVE_ITEMS, 0, request, 0) == 0);
+  uint32_t len = 0;
+  for (unsigned j = 0; j <= MELIAN_MAX_MULTI_KEYS; ++j) len += live_put_key(request + len, &j, sizeof(unsigned));
+  CHECK(live_request(fd, MELIAN_ACTION_FETCH_MULTI, LIVE_ITEMS, 0, request, len) == 0);
+  len = live_put_key(request, &keys[0], sizeof(unsigned));
+  CHECK(live_request(fd, MELIAN_ACTION_FETCH_MULTI, LIVE_ITEMS, 0, request, len + 3) == 0);
+  live_put_u32(request + len, 5);
+  CHECK(live_request(fd, MELIAN_ACTION_FETCH_MULTI, LIVE_ITEMS, 0, request, len + 8) == 0);
+  len = live_put_u32(request, 300);
+  memset(request + len, 'x', 300);
+  CHECK(live_request(fd, MELIAN_ACTION_FETCH_MULTI, LIVE_ITEMS, 1, request, len + 300) == 0);
+  CHECK(live_fetch_int(fd, LIVE_ITEMS, 0, 3) == 3);
+}
+
+// Append a request to a buffer, and return its length.
+static unsigned live_put_request(uint8_t* buf, unsigned action, unsigned table_id, unsigned index_id,
+                                 const void* payload, uint32_t len) {
+  unsigned pos = live_put_header(buf, action, table_id, index_id, len);
+  memcpy(buf + pos, payload, len);
+  return pos + len;
+}
+
+static void live_pause(void) {
+  struct timespec ts = { 0, 20 * 1000 * 1000 };
+  nanosleep(&ts, 0);
+}
+
+static void test_pipelined(int fd) {
+  // Runs of FETCHes on one index are served together; they are broken by other
+  // tables and indexes, keys of the wrong size or too long, and other actions.
+  enum { PIPELINED = 300 };
+  static unsigned expected[PIPELINED];
+  static unsigned multi[PIPELINED];
+  uint32_t len = 0;
+  for (unsigned j = 0; j < PIPELINED; ++j) {
+    char key[512];
+    uint32_t key_len = 0;
+    unsigned table_id = LIVE_ITEMS;
+    unsigned index_id = 0;
+    unsigned action = MELIAN_ACTION_FETCH;
+    unsigned number = j * 7 % 1100;
+    if (j == 120) {
+      memset(key, 'x', 300);
+      key_len = 300;
+      number = 0;
+    } else if (j == 130) {
+      memcpy(key, &number, 3);
+      key_len = 3;
+      number = 0;
+    } else if (j == 160 || j == 161) {
+      action = MELIAN_ACTION_FETCH_MULTI;
+      key_len = live_put_key((uint8_t*) key, &number, sizeof(number));
+      if (number > 1000) number = 0;
+    } else if (j >= 100 && j < 200) {
+      // Names on the mph index, then alternating with aliases on the swiss one.
+      table_id = LIVE_NUMS;
+      index_id = j < 150 || j % 2 ? 1 : 2;
+      key_len = sprintf(key, index_id == 1 ? "c%u" : "alias-%u", number);
+      if (number % 2 || number > 1000) number = 0;
+    } else {
+      memcpy(key, &number, sizeof(number));
+      key_len = sizeof(number);
+      if (number > 1000) number = 0;
+    }
+    expected[j] = number;
+    multi[j] = action == MELIAN_ACTION_FETCH_MULTI;
+    len += live_put_request(request + len, action, table_id, index_id, key, key_len);
+  }
+  CHECK(live_send(fd, request, len));
+  for (unsigned j = 0; j < PIPELINED; ++j) {
+    uint32_t got = live_response(fd);
+    CHECK(got != (uint32_t)-1);
+    if (got == (uint32_t)-1) return;
+    if (multi[j]) {
+      live_check_frames(response, got, &expected[j], 1);
+    } else {
+      CHECK((got ? live_id(response, got) : 0) == expected[j]);
+    }
+  }
+
+  // A run longer than the input window made contiguous at once.
+  enum { LONG_RUN = 2000 };
+  len = 0;
+  for (unsigned j = 0; j < LONG_RUN; ++j) {
+    unsigned number = j % 1000 + 1;
+    len += live_put_request(request + len, MELIAN_ACTION_FETCH, LIVE_ITEMS, 0, &number, sizeof(number));
+  }
+  CHECK(live_send(fd, request, len));
+  for (unsigned j = 0; j < LONG_RUN; ++j) {
+    uint32_t got = live_response(fd);
+    CHECK(got != (uint32_t)-1);
+    if (got == (uint32_t)-1) return;
+    CHECK(live_id(response, got) == j % 1000 + 1);
+  }
+
+  // Requests split across writes: within a header, within a key, and a whole
+  // request followed by part of the next one.
+  unsigned first = 11;
+  unsigned second = 12;
+  len = live_put_request(request, MELIAN_ACTION_FETCH, LIVE_ITEMS, 0, &first, sizeof(first));
+  len += live_put_request(request + len, MELIAN_ACTION_FETCH, LIVE_ITEMS, 0, &second, sizeof(second));
+  uint32_t cuts[] = { 0, 5, 10, 17, len };
+  for (unsigned j = 1; j < ALEN(cuts); ++j) {
+    CHECK(live_send(fd, request + cuts[j - 1], cuts[j] - cuts[j - 1]));
+    live_pause();
+  }
+  uint32_t got = live_response(fd);
+  CHECK(got != (uint32_t)-1 && live_id(response, got) == first);
+  got = live_response(fd);
+  CHECK(got != (uint32_t)-1 && live_id(response, got) == second);
+}
+
+// FETCH every row with a category, and check they come in load order.
+static void live_check_category(int fd, unsigned category) {
+  uint32_t got = live_request(fd, MELIAN_ACTION_FETCH, LIVE_ITEMS, 2, &category, sizeof(category));
+  CHECK(got != (uint32_t)-1 && got >= 4);
+  if (got == (uint32_t)-1 || got < 4) return;
+  unsigned count = live_get_u32(response);
+  CHECK(count == 100);
+  unsigned ids[100];
+  // Category 0 is ids 10, 20, ..., 1000, and the others start at their own id.
+  for (unsigned j = 0; j < ALEN(ids); ++j) ids[j] = category ? j * 10 + category : (j + 1) * 10;
+  if (count == ALEN(ids)) live_check_frames(response + 4, got - 4, ids, count);
+}
+
+static void test_postings(int fd) {
+  live_check_category(fd, 3);
+  live_check_category(fd, 0);
+  unsigned category = 10;
+  CHECK(live_request(fd, MELIAN_ACTION_FETCH, LIVE_ITEMS, 2, &category, sizeof(category)) == 0);
+  CHECK(live_request(fd, MELIAN_ACTION_FETCH, LIVE_ITEMS, 2, &category, 3) == 0);
+
+  // FETCH_MULTI returns the first row of each key.
+  uint32_t len = 0;
+  unsigned keys[] = { 3, 0, 10, 3 };
+  unsigned ids[] = { 3, 10, 0, 3 };
+  for (unsigned j = 0; j < ALEN(keys); ++j) len += live_put_key(request + len, &keys[j], sizeof(unsigned));
+  uint32_t got = live_request(fd, MELIAN_ACTION_FETCH_MULTI, LIVE_ITEMS, 2, request, len);
+  CHECK(got != (uint32_t)-1);
+  if (got != (uint32_t)-1) live_check_frames(response, got, ids, ALEN(keys));
+}
+
+// A page of a FETCH_RANGE or FETCH_PREFIX response.
+typedef struct LivePage {
+  unsigned count;
+  unsigned ids[MELIAN_MAX_RANGE_ROWS];
+  uint32_t cursor_len;
+  uint8_t cursor[256];
+} LivePage;
+
+// Send a FETCH_RANGE or FETCH_PREFIX request and read its page; return 0 if
+// the response was empty, or could not be read.
+static unsigned live_page(int fd, unsigned action, unsigned table_id, unsigned index_id, unsigned limit,
+                          const void* first, uint32_t first_len, const void* second, uint32_t second_len,
+                          LivePage* page) {
+  uint32_t len = live_put_u32(request, limit);
+  len += live_put_key(request + len, first, first_len);
+  len += live_put_key(request + len, second, second_len);
+  uint32_t got = live_request(fd, action, table_id, index_id, request, len);
+  if (got == (uint32_t)-1 || got < 8) return 0;
+  page->count = live_get_u32(response);
+  page->cursor_len = live_get_u32(response + 4);
+  CHECK(page->count <= MELIAN_MAX_RANGE_ROWS && page->cursor_len <= sizeof(page->cursor));
+  if (page->count > MELIAN_MAX_RANGE_ROWS || page->cursor_len > sizeof(page->cursor)) return 0;
+  CHECK(8 + page->cursor_len <= got);
+  if (8 + page->cursor_len > got) return 0;
+  memcpy(page->cursor, response + 8, page->cursor_len);
+  uint32_t pos = 8 + page->cursor_len;
+  for (unsigned j = 0; j < page->count; ++j) {
+    CHECK(got - pos >= 4);
+    if (got - pos < 4) return 0;
+    uint32_t frame_len = live_get_u32(response + pos);
+    pos += 4;
+    CHECK(frame_len <= got - pos);
+    if (frame_len > got - pos) return 0;
+    page->ids[j] = live_id(response + pos, frame_len);
+    pos += frame_len;
+  }
+  CHECK(pos == got);
+  return 1;
+}
+
+// Check a page holds the ids from, from + step, ..., up to count of them.
+static void live_check_page(const LivePage* page, unsigned count, unsigned from, unsigned step) {
+  CHECK(page->count == count);
+  for (unsigned j = 0; j < page->count && j < count; ++j) CHECK(page->ids[j] == from + j * step);
+}
+
+static LivePage page;
+
+static unsigned live_range(int fd, unsigned limit, unsigned from, unsigned to) {
+  return live_page(fd, MELIAN_ACTION_FETCH_RANGE, LIVE_NUMS, 0, limit,
+                   &from, from ? sizeof(from) : 0, &to, to ? sizeof(to) : 0, &page);
+}
+
+static void test_range(int fd) {
+  // Closed ranges, with bounds on and between keys.
+  CHECK(live_range(fd, 0, 100, 120));
+  live_check_page(&page, 11, 100, 2);
+  CHECK(page.cursor_len == 0);
+  CHECK(live_range(fd, 0, 99, 121));
+  live_check_page(&page, 11, 100, 2);
+
+  // Open ends.
+  CHECK(live_range(fd, 0, 0, 10));
+  live_check_page(&page, 5, 2, 2);
+  CHECK(live_range(fd, 0, 995, 0));
+  live_check_page(&page, 3, 996, 2);
+  CHECK(live_range(fd, 0, 0, 0));
+  live_check_page(&page, 500, 2, 2);
+
+  // Paging: each cursor is sent back as from, until it comes back empty.
+  unsigned from = 1;
+  unsigned seen = 0;
+  for (unsigned pages = 0; pages < 10; ++pages) {
+    CHECK(live_range(fd, 64, from, 1000));
+    live_check_page(&page, seen + 64 <= 500 ? 64 : 500 - seen, 2 + 2 * seen, 2);
+    seen += page.count;
+    if (!page.cursor_len) break;
+    CHECK(page.cursor_len == sizeof(from));
+    memcpy(&from, page.cursor, sizeof(from));
+    CHECK(from == 2 + 2 * seen);
+  }
+  CHECK(seen == 500 && page.cursor_len == 0);
+
+  // Empty ranges: between two keys, reversed, and past the last key.
+  CHECK(live_range(fd, 0, 101, 101));
+  live_check_page(&page, 0, 0, 0);
+  CHECK(page.cursor_len == 0);
+  CHECK(live_range(fd, 0, 200, 100));
+  live_check_page(&page, 0, 0, 0);
+  CHECK(live_range(fd, 0, 2000, 3000));
+  live_check_page(&page, 0, 0, 0);
+
+  // String ranges on an ordered string index.
+  CHECK(live_page(fd, MELIAN_ACTION_FETCH_RANGE, LIVE_ITEMS, 1, 0, "item-0010", 9, "item-0012", 9, &page));
+  live_check_page(&page, 3, 10, 1);
+
+  // Bounds that are not keys of the index, an index that is not ordered, an
+  // unknown table, and malformed payloads get an empty response.
+  CHECK(!live_page(fd, MELIAN_ACTION_FETCH_RANGE, LIVE_NUMS, 0, 0, "\2\0\0", 3, "", 0, &page));
+  CHECK(!live_page(fd, MELIAN_ACTION_FETCH_RANGE, LIVE_NUMS, 1, 0, "c2", 2, "c4", 2, &page));
+  CHECK(!live_page(fd, MELIAN_ACTION_FETCH_RANGE, 9, 0, 0, "", 0, "", 0, &page));
+  uint32_t len = live_put_u32(request, 0);
+  CHECK(live_request(fd, MELIAN_ACTION_FETCH_RANGE, LIVE_NUMS, 0, request, 2) == 0);
+  CHECK(live_request(fd, MELIAN_ACTION_FETCH_RANGE, LIVE_NUMS, 0, request, len) == 0);
+  len += live_put_key(request + len, &from, sizeof(from));
+  CHECK(live_request(fd, MELIAN_ACTION_FETCH_RANGE, LIVE_NUMS, 0, request, len) == 0);
+  len += live_put_u32(request + len, 8);
+  CHECK(live_request(fd, MELIAN_ACTION_FETCH_RANGE, LIVE_NUMS, 0, request, len + 4) == 0);
+  CHECK(live_fetch_int(fd, LIVE_NUMS, 0, 2) == 2);
+}
+
+static unsigned live_prefix(int fd, unsigned limit, const char* prefix, const void* from, uint32_t from_len) {
+  return live_page(fd, MELIAN_ACTION_FETCH_PREFIX, LIVE_ITEMS, 1, limit, prefix, strlen(prefix), from, from_len, &page);
+}
+
+static void test_prefix(int fd) {
+  CHECK(live_prefix(fd, 0, "item-00", "", 0));
+  live_check_page(&page, 99, 1, 1);
+  CHECK(page.cursor_len == 0);
+  CHECK(live_prefix(fd, 0, "item-1", "", 0));
+  live_check_page(&page, 1, 1000, 1);
+  CHECK(live_prefix(fd, 0, "item-0042", "", 0));
+  live_check_page(&page, 1, 42, 1);
+  // An empty prefix matches every key.
+  CHECK(live_prefix(fd, 0, "", "", 0));
+  live_check_page(&page, 1000, 1, 1);
+  // Starting from a key.
+  CHECK(live_prefix(fd, 0, "item-00", "item-0050", 9));
+  live_check_page(&page, 50, 50, 1);
+  CHECK(live_prefix(fd, 0, "item-00", "item-5", 6));
+  live_check_page(&page, 0, 0, 0);
+
+  // Paging: each cursor is sent back as from, until it comes back empty.
+  uint8_t from[256];
+  uint32_t from_len = 0;
+  unsigned seen = 0;
+  for (unsigned pages = 0; pages < 10; ++pages) {
+    CHECK(live_prefix(fd, 40, "item-05", from, from_len));
+    live_check_page(&page, seen + 40 <= 100 ? 40 : 100 - seen, 500 + seen, 1);
+    seen += page.count;
+    if (!page.cursor_len) break;
+    from_len = page.cursor_len;
+    memcpy(from, page.cursor, from_len);
+    CHECK(from_len == 9 && live_fetch(fd, LIVE_ITEMS, 1, from, from_len) == 500 + seen);
+  }
+  CHECK(seen == 100 && page.cursor_len == 0);
+
+  // No match.
+  CHECK(live_prefix(fd, 0, "zzz", "", 0));
+  live_check_page(&page, 0, 0, 0);
+  CHECK(live_prefix(fd, 0, "item-0000", "", 0));
+  live_check_page(&page, 0, 0, 0);
+
+  // Indexes that are not ordered string ones, and malformed payloads, get an
+  // empty response.
+  CHECK(!live_page(fd, MELIAN_ACTION_FETCH_PREFIX, LIVE_NUMS, 0, 0, "\2\0\0\0", 4, "", 0, &page));
+  CHECK(!live_page(fd, MELIAN_ACTION_FETCH_PREFIX, LIVE_NUMS, 1, 0, "c", 1, "", 0, &page));
+  uint32_t len = live_put_u32(request, 0);
+  len += live_put_key(request + len, "item", 4);
+  CHECK(live_request(fd, MELIAN_ACTION_FETCH_PREFIX, LIVE_ITEMS, 1, request, len) == 0);
+  len += live_put_key(request + len, "", 0);
+  CHECK(live_request(fd, MELIAN_ACTION_FETCH_PREFIX, LIVE_ITEMS, 1, request, len + 1) == 0);
+  CHECK(live_fetch_int(fd, LIVE_ITEMS, 0, 4) == 4);
+}
+
+// Append a term pushing the rows with a key of a bitmap index to a program.
+static unsigned live_put_eq(uint8_t* buf, unsigned index_id, const void* key, uint32_t len) {
+  buf[0] = MELIAN_FILTER_EQ;
+  buf[1] = index_id;
+  return 2 + live_put_key(buf + 2, key, len);
+}
+
+static unsigned live_put_color(uint8_t* buf, const char* color) {
+  return live_put_eq(buf, 3, color, strlen(color));
+}
+
+static unsigned live_put_size(uint8_t* buf, unsigned size) {
+  return live_put_eq(buf, 4, &size, sizeof(size));
+}
+
+// Send a FILTER request and read the ids of the rows returned
+// into page; return 0 if the response was empty, or could not be read.
+static unsigned live_filter(int fd, unsigned table_id, unsigned offset, unsigned limit,
+                            const uint8_t* program, uint32_t program_len, unsigned* matches) {
+  uint32_t len = live_put_u32(request, offset);
+  len += live_put_u32(request + len, limit);
+  memcpy(request + len, program, program_len);
+  uint32_t got = live_request(fd, MELIAN_ACTION_FILTER, table_id, 0, request, len + program_len);
+  if (got == (uint32_t)-1 || got < 8) return 0;
+  *matches = live_get_u32(response);
+  page.count = live_get_u32(response + 4);
+  page.cursor_len = 0;
+  CHECK(page.count <= MELIAN_MAX_RANGE_ROWS);
+  if (page.count > MELIAN_MAX_RANGE_ROWS) return 0;
+  uint32_t pos = 8;
+  for (unsigned j = 0; j < page.count; ++j) {
+    CHECK(got - pos >= 4);
+    if (got - pos < 4) return 0;
+    uint32_t frame_len = live_get_u32(response + pos);
+    pos += 4;
+    CHECK(frame_len <= got - pos);
+    if (frame_len > got - pos) return 0;
+    page.ids[j] = live_id(response + pos, frame_len);
+    pos += frame_len;
+  }
+  CHECK(pos == got);
+  return 1;
+}
+
+static void test_filter(int fd) {
+  uint8_t program[2048];
+  unsigned matches = 0;
+
+  // One key: the red items are the multiples of 3, in load order.
+  uint32_t len = live_put_color(program, "red");
+  CHECK(live_filter(fd, LIVE_ITEMS, 0, 1024, program, len, &matches));
+  CHECK(matches == 333);
+  live_check_page(&page, 333, 3, 3);
+  // Offset and limit, a limit of 0 for just the count, and an offset past the end.
+  CHECK(live_filter(fd, LIVE_ITEMS, 10, 5, program, len, &matches));
+  CHECK(matches == 333);
+  live_check_page(&page, 5, 33, 3);
+  CHECK(live_filter(fd, LIVE_ITEMS, 0, 0, program, len, &matches));
+  CHECK(matches == 333);
+  live_check_page(&page, 0, 0, 0);
+  CHECK(live_filter(fd, LIVE_ITEMS, 400, 10, program, len, &matches));
+  CHECK(matches == 333);
+  live_check_page(&page, 0, 0, 0);
+  // A key missing from the index matches nothing.
+  len = live_put_color(program, "purple");
+  CHECK(live_filter(fd, LIVE_ITEMS, 0, 10, program, len, &matches));
+  CHECK(matches == 0);
+  live_check_page(&page, 0, 0, 0);
+
+  // AND: red items of size 0 are the multiples of 12.
+  len = live_put_color(program, "red");
+  len += live_put_size(program + len, 0);
+  program[len++] = MELIAN_FILTER_AND;
+  CHECK(live_filter(fd, LIVE_ITEMS, 0, 1024, program, len, &matches));
+  CHECK(matches == 83);
+  live_check_page(&page, 83, 12, 12);
+
+  // OR: red or green items are the ones not 2 modulo 3, in load order.
+  len = live_put_color(program, "red");
+  len += live_put_color(program + len, "green");
+  program[len++] = MELIAN_FILTER_OR;
+  CHECK(live_filter(fd, LIVE_ITEMS, 0, 1024, program, len, &matches));
+  CHECK(matches == 667);
+  CHECK(page.count == 667);
+  for (unsigned j = 0; j < page.count; ++j) {
+    CHECK(page.ids[j] % 3 != 2);
+    CHECK(j == 0 || page.ids[j] > page.ids[j - 1]);
+  }
+
+  // Nested: (red AND size 0) OR (green AND size 1), ids 0 or 1 modulo 12.
+  len = live_put_color(program, "red");
+  len += live_put_size(program + len, 0);
+  program[len++] = MELIAN_FILTER_AND;
+  len += live_put_color(program + len, "green");
+  len += live_put_size(program + len, 1);
+  program[len++] = MELIAN_FILTER_AND;
+  program[len++] = MELIAN_FILTER_OR;
+  CHECK(live_filter(fd, LIVE_ITEMS, 0, 1024, program, len, &matches));
+  CHECK(matches == 83 + 84);
+  CHECK(page.count == 83 + 84);
+  for (unsigned j = 0; j < page.count; ++j) CHECK(page.ids[j] % 12 <= 1);
+
+  // Invalid programs get an empty response: none at all, an operator without
+  // two sets, two sets left, an unknown operator, an index that is not a bitmap
+  // or does not exist, a key cut short, and too many terms.
+  CHECK(!live_filter(fd, LIVE_ITEMS, 0, 10, program, 0, &matches));
+  program[0] = MELIAN_FILTER_AND;
+  CHECK(!live_filter(fd, LIVE_ITEMS, 0, 10, program, 1, &matches));
+  len = live_put_color(program, "red");
+  program[len++] = MELIAN_FILTER_OR;
+  CHECK(!live_filter(fd, LIVE_ITEMS, 0, 10, program, len, &matches));
+  len = live_put_color(program, "red");
+  len += live_put_color(program + len, "blue");
+  CHECK(!live_filter(fd, LIVE_ITEMS, 0, 10, program, len, &matches));
+  program[len++] = 'x';
+  CHECK(!live_filter(fd, LIVE_ITEMS, 0, 10, program, len, &matches));
+  unsigned id = 5;
+  len = live_put_eq(program, 0, &id, sizeof(id));
+  CHECK(!live_filter(fd, LIVE_ITEMS, 0, 10, program, len, &matches));
+  len = live_put_eq(program, 9, &id, sizeof(id));
+  CHECK(!live_filter(fd, LIVE_ITEMS, 0, 10, program, len, &matches));
+  len = live_put_color(program, "red");
+  CHECK(!live_filter(fd, LIVE_ITEMS, 0, 10, program, len - 1, &matches));
+  len = live_put_color(program, "red");
+  for (unsigned j = 0; j < MELIAN_MAX_FILTER_TERMS; ++j) {
+    len += live_put_color(program + len, "red");
+    program[len++] = MELIAN_FILTER_OR;
+  }
+  CHECK(!live_filter(fd, LIVE_ITEMS, 0, 10, program, len, &matches));
+  len = live_put_color(program, "red");
+  CHECK(!live_filter(fd, 9, 0, 10, program, len, &matches));
+  CHECK(live_request(fd, MELIAN_ACTION_FILTER, LIVE_ITEMS, 0, request, 7) == 0);
+  CHECK(live_fetch_int(fd, LIVE_ITEMS, 0, 6) == 6);
+}
+
+// Request the STATUS of the server, and return it parsed, or NULL.
+static json_t* live_status(int fd) {
+  uint32_t got = live_request(fd, MELIAN_ACTION_GET_STATISTICS, 0, 0, "", 0);
+  if (got == (uint32_t)-1 || got == 0) return NULL;
+  return json_loadb((const char*) response, got, 0, NULL);
+}
+
+// Check an index of a table was sized for the rows loaded: used slots holds
+// the number of keys, and total slots is at least that, and less than slack
+// times it.
+static void live_check_index(json_t* status, const char* table, const char* column, const char* engine,
+                             json_int_t used, json_int_t slack) {
+  const char* got_engine = "";
+  json_int_t total_slots = 0;
+  json_int_t used_slots = 0;
+  CHECK(json_unpack(status, "{s:{s:{s:{s:{s:s,s:I,s:I}}}}}", "tables", table, "hashes", column,
+                    "engine", &got_engine, "total_slots", &total_slots, "used_slots", &used_slots) == 0);
+  CHECK(strcmp(got_engine, engine) == 0);
+  CHECK(used_slots == used);
+  CHECK(total_slots >= used && total_slots < slack * used);
+}
+
+static void test_status(int fd) {
+  json_t* status = live_status(fd);
+  CHECK(status);
+  if (!status) return;
+  json_int_t rows = 0;
+  json_int_t min_id = 0;
+  json_int_t max_id = 0;
+  CHECK(json_unpack(status, "{s:{s:{s:I,s:I,s:I}}}", "tables", "items",
+                    "rows", &rows, "min_id", &min_id, "max_id", &max_id) == 0);
+  CHECK(rows == 1000 && min_id == 1 && max_id == 1000);
+  CHECK(json_unpack(status, "{s:{s:{s:I,s:I,s:I}}}", "tables", "nums",
+                    "rows", &rows, "min_id", &min_id, "max_id", &max_id) == 0);
+  CHECK(rows == 500 && min_id == 2 && max_id == 1000);
+
+  // The ids of the items are dense enough for a direct-addressed index.
+  live_check_index(status, "items", "id", "dense", 1000, 2);
+  live_check_index(status, "items", "name", "ordered", 1000, 2);
+  live_check_index(status, "items", "category", "postings", 10, 4);
+  live_check_index(status, "items", "color", "bitmap", 3, 8);
+  live_check_index(status, "items", "size", "bitmap", 4, 8);
+  live_check_index(status, "nums", "id", "ordered", 500, 2);
+  live_check_index(status, "nums", "code", "mph", 500, 2);
+  live_check_index(status, "nums", "alias", "swiss", 500, 4);
+
+  // Lookups on nums, which is not reloaded while the test runs, are counted.
+  json_int_t queries = 0;
+  CHECK(json_unpack(status, "{s:{s:{s:{s:{s:I}}}}}", "tables", "nums", "hashes", "code",
+                    "queries", &queries) == 0);
+  CHECK(queries > 0);
+  json_decref(status);
+}
+
+// Return the pins on both slots of a table, from its STATUS.
+static json_int_t live_pins(json_t* status, const char* table) {
+  json_t* slots = 0;
+  CHECK(json_unpack(status, "{s:{s:{s:o}}}", "tables", table, "slots", &slots) == 0);
+  json_int_t pins = 0;
+  for (size_t j = 0; slots && j < json_array_size(slots); ++j) {
+    json_int_t slot_pins = 0;
+    CHECK(json_unpack(json_array_get(slots, j), "{s:I}", "pins", &slot_pins) == 0);
+    pins += slot_pins;
+  }
+  return pins;
+}
+
+static json_int_t live_loaded(json_t* status, const char* table) {
+  json_int_t epoch = 0;
+  CHECK(json_unpack(status, "{s:{s:{s:{s:I}}}}", "tables", table, "last_loaded", "epoch", &epoch) == 0);
+  return epoch;
+}
+
+// Poll STATUS until the pins on both tables are, or not, zero, for a few
+// seconds; return the last STATUS, or NULL.
+static json_t* live_wait_pins(int fd, unsigned pinned) {
+  json_t* status = 0;
+  for (unsigned tries = 0; tries < 250; ++tries) {
+    json_decref(status);
+    status = live_status(fd);
+    CHECK(status);
+    if (!status) return NULL;
+    unsigned items = live_pins(status, "items") != 0;
+    unsigned nums = live_pins(status, "nums") != 0;
+    if (items == pinned && nums == pinned) break;
+    live_pause();
+  }
+  return status;
+}
+
+static void test_pins(int fd) {
+  // Every slot pinned by a response is released once it has been sent.
+  int other = live_connect();
+  CHECK(other >= 0);
+  if (other < 0) return;
+  unsigned key = 17;
+  uint32_t len = live_put_request(request, MELIAN_ACTION_FETCH, LIVE_ITEMS, 0, &key, sizeof(key));
+  uint8_t program[64];
+  uint32_t program_len = live_put_u32(program, 0);
+  program_len += live_put_u32(program + program_len, 1024);
+  program_len += live_put_color(program + program_len, "red");
+  uint8_t range[16];
+  uint32_t range_len = live_put_u32(range, 0);
+  range_len += live_put_key(range + range_len, "", 0);
+  range_len += live_put_key(range + range_len, "", 0);
+  uint8_t multi[16];
+  uint32_t multi_len = live_put_key(multi, "c4", 2);
+  len += live_put_request(request + len, MELIAN_ACTION_FILTER, LIVE_ITEMS, 0, program, program_len);
+  unsigned category = 7;
+  len += live_put_request(request + len, MELIAN_ACTION_FETCH, LIVE_ITEMS, 2, &category, sizeof(category));
+  len += live_put_request(request + len, MELIAN_ACTION_FETCH_RANGE, LIVE_NUMS, 0, range, range_len);
+  len += live_put_request(request + len, MELIAN_ACTION_FETCH_MULTI, LIVE_NUMS, 1, multi, multi_len);
+  CHECK(live_send(other, request, len));
+  for (unsigned j = 0; j < 5; ++j) {
+    uint32_t got = live_response(other);
+    CHECK(got != (uint32_t)-1 && got > 0);
+  }
+  json_t* status = live_wait_pins(fd, 0);
+  CHECK(status && live_pins(status, "items") == 0 && live_pins(status, "nums") == 0);
+  json_decref(status);
+
+  // A client that does not read its responses keeps their slots pinned, some
+  // megabytes of them, while other clients are served.
+  len = 0;
+  for (unsigned j = 0; j < 200; ++j) {
+    len += live_put_request(request + len, MELIAN_ACTION_FILTER, LIVE_ITEMS, 0, program, program_len);
+    len += live_put_request(request + len, MELIAN_ACTION_FETCH_RANGE, LIVE_NUMS, 0, range, range_len);
+  }
+  CHECK(live_send(other, request, len));
+  status = live_wait_pins(fd, 1);
+  CHECK(status && live_pins(status, "items") > 0 && live_pins(status, "nums") > 0);
+  json_decref(status);
+  CHECK(live_fetch_int(fd, LIVE_ITEMS, 0, 8) == 8);
+
+  // The items are due every second, but are not loaded again into a pinned slot.
+  for (unsigned j = 0; j < 100; ++j) live_pause();
+  status = live_status(fd);
+  CHECK(status);
+  json_int_t loaded = status ? live_loaded(status, "items") : 0;
+  json_decref(status);
+  for (unsigned j = 0; j < 100; ++j) live_pause();
+  status = live_status(fd);
+  CHECK(status && live_loaded(status, "items") == loaded && live_pins(status, "items") > 0);
+  json_decref(status);
+
+  // Disconnecting drops what was not sent, with its pins, and reloads go on.
+  close(other);
+  status = live_wait_pins(fd, 0);
+  CHECK(status && live_pins(status, "items") == 0 && live_pins(status, "nums") == 0);
+  for (unsigned tries = 0; status && live_loaded(status, "items") == loaded && tries < 250; ++tries) {
+    json_decref(status);
+    live_pause();
+    status = live_status(fd);
+  }
+  CHECK(status && live_loaded(status, "items") > loaded);
+  json_decref(status);
+  CHECK(live_fetch_int(fd, LIVE_ITEMS, 0, 9) == 9);
+}
+
+int main(int argc, char* argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s socket\n", argv[0]);
+    return 2;
+  }
+  live_path = argv[1];
+  int fd = live_connect();
+  CHECK(fd >= 0);
+  if (fd < 0) return test_result("live");
+
+  test_fetch(fd);
+  test_fetch_multi(fd);
+  test_pipelined(fd);
+  test_postings(fd);
+  test_range(fd);
+  test_prefix(fd);
+  test_filter(fd);
+  test_status(fd);
+  test_pins(fd);
+
+  close(fd);
+  return test_result("live");
+}
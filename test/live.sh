@@ -0,0 +1,52 @@
+#!/bin/sh
+# Run test/live against a melian-server serving a SQLite database built here.
+# Skipped (exit 77, as automake expects) when sqlite3 is not available.
+
+command -v sqlite3 >/dev/null 2>&1 || { echo "sqlite3 not found, skipping"; exit 77; }
+
+dir=$(mktemp -d "${TMPDIR:-/tmp}/melian-test.XXXXXX") || exit 1
+pid=
+cleanup() {
+  [ -n "$pid" ] && kill "$pid" 2>/dev/null && wait "$pid" 2>/dev/null
+  rm -rf "$dir"
+}
+trap cleanup EXIT
+
+sqlite3 "$dir/melian.db" <<'SQL' || exit 1
+CREATE TABLE items (id INTEGER, name TEXT, category INTEGER, color TEXT, size INTEGER);
+WITH RECURSIVE n(id) AS (SELECT 1 UNION ALL SELECT id + 1 FROM n WHERE id < 1000)
+INSERT INTO items
+SELECT id, printf('item-%04d', id), id % 10,
+       CASE id % 3 WHEN 0 THEN 'red' WHEN 1 THEN 'green' ELSE 'blue' END, id % 4
+FROM n;
+CREATE TABLE nums (id INTEGER, code TEXT, alias TEXT);
+WITH RECURSIVE n(k) AS (SELECT 1 UNION ALL SELECT k + 1 FROM n WHERE k < 500)
+INSERT INTO nums SELECT 2 * k, 'c' || (2 * k), 'alias-' || (2 * k) FROM n;
+SQL
+
+# An empty config file, so that no /etc/melian.json on the host is read.
+echo '{}' > "$dir/melian.json" || exit 1
+
+MELIAN_CONFIG_FILE="$dir/melian.json" \
+MELIAN_DB_DRIVER=sqlite \
+MELIAN_SQLITE_FILENAME="$dir/melian.db" \
+MELIAN_LISTENERS="unix://$dir/melian.sock" \
+MELIAN_TABLE_TABLES='items#0|1|id#0:int;name#1:string:ordered;category#2:int:postings;color#3:string:bitmap;size#4:int:bitmap,nums#1|60|id#0:int:ordered;code#1:string:mph;alias#2:string:swiss' \
+  ./melian-server > "$dir/server.log" 2>&1 &
+pid=$!
+
+tries=0
+until [ -S "$dir/melian.sock" ]; do
+  tries=$((tries + 1))
+  if [ $tries -gt 100 ] || ! kill -0 "$pid" 2>/dev/null; then
+    cat "$dir/server.log"
+    grep -q "not available in this build" "$dir/server.log" && exit 77
+    exit 1
+  fi
+  sleep 0.1
+done
+
+./test/live "$dir/melian.sock"
+rc=$?
+[ $rc -eq 0 ] || cat "$dir/server.log"
+exit $rc
@@ -0,0 +1,57 @@
+#include "test.h"
+#include "mph.h"
+
+// An empty key set builds a function that misses every key.
+static void test_mph_empty(void) {
+  Arena* arena = arena_build(1024);
+  Index* index = index_build(CONFIG_INDEX_ENGINE_MPH, CONFIG_INDEX_TYPE_STRING, 0, arena);
+  CHECK(index && index_finalize(index, 0, 0));
+  if (!index) return;
+  uint32_t frame_len = 0;
+  CHECK(index_get(index, "row", 3, &frame_len) == (unsigned)-1);
+  CHECK(index_get(index, "", 0, &frame_len) == (unsigned)-1);
+  index_destroy(index);
+  arena_destroy(arena);
+}
+
+// Every key gets its own position, and all positions are in use.
+static void test_mph_positions(unsigned count) {
+  Arena* arena = arena_build(1024);
+  Mph* mph = mph_build(count, arena);
+  CHECK(mph != 0);
+  if (!mph) return;
+  char key[64];
+  for (unsigned n = 0; n < count; ++n) {
+    uint32_t len = test_key(CONFIG_INDEX_TYPE_STRING, n, key);
+    CHECK(mph_insert(mph, key, len, test_frame(arena, n)));
+  }
+  CHECK(mph_finalize(mph));
+  CHECK(mph->n == count && mph->m >= count);
+  unsigned char* seen = calloc(count, 1);
+  for (unsigned n = 0; n < count; ++n) {
+    uint32_t len = test_key(CONFIG_INDEX_TYPE_STRING, n, key);
+    const MphEntry* entry = mph_get(mph, key, len);
+    CHECK(entry != 0);
+    if (!entry) continue;
+    unsigned pos = entry - mph->entries;
+    CHECK(pos < count && !seen[pos]);
+    if (pos < count) seen[pos] = 1;
+    uint32_t entry_len = 0;
+    const uint8_t* entry_key = mph_entry_key(mph, entry, &entry_len);
+    CHECK(entry_len == len && memcmp(entry_key, key, len) == 0);
+  }
+  free(seen);
+  mph_destroy(mph);
+  arena_destroy(arena);
+}
+
+int main(void) {
+  // Entries only hold the arena indexes of a key and its row.
+  CHECK(sizeof(MphEntry) == 2 * sizeof(unsigned));
+  test_unique_index(CONFIG_INDEX_ENGINE_MPH, CONFIG_INDEX_TYPE_INT, 1000, 0);
+  test_unique_index(CONFIG_INDEX_ENGINE_MPH, CONFIG_INDEX_TYPE_STRING, 1000, 0);
+  test_unique_index(CONFIG_INDEX_ENGINE_MPH, CONFIG_INDEX_TYPE_INT, 1, 0);
+  test_mph_empty();
+  test_mph_positions(50000);
+  return test_result("mph");
+}
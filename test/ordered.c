@@ -0,0 +1,148 @@
+#include "test.h"
+#include "ordered.h"
+
+enum {
+  ORDERED_ROWS = 100,     // rows stored with keys 3n+1, from 1 to 298
+};
+
+static Arena* arena;
+static unsigned frames[ORDERED_ROWS];
+
+static Index* test_ordered_build(ConfigIndexType type) {
+  Index* index = index_build(CONFIG_INDEX_ENGINE_ORDERED, type, ORDERED_ROWS, arena);
+  CHECK(index != 0);
+  if (!index) return 0;
+  char key[64];
+  // Rows are inserted out of key order, as a query would return them.
+  for (unsigned j = 0; j < ORDERED_ROWS; ++j) {
+    unsigned n = (j * 37) % ORDERED_ROWS;
+    uint32_t len = test_key(type, 3 * n + 1, key);
+    CHECK(index_insert(index, key, len, frames[n], arena_get_frame_len(arena, frames[n])));
+  }
+  CHECK(index_finalize(index, frames, ORDERED_ROWS));
+  return index;
+}
+
+// Scan the keys from..to, with -1 for an open end, and check that count rows
+// starting at row first come back in order, followed by the key of row next
+// as the cursor, or by no cursor if next is -1.
+static void test_ordered_range(Index* index, ConfigIndexType type, unsigned from, unsigned to, unsigned limit,
+                               unsigned first, unsigned count, unsigned next) {
+  char from_key[64];
+  char to_key[64];
+  uint32_t from_len = from == (unsigned)-1 ? 0 : test_key(type, from, from_key);
+  uint32_t to_len = to == (unsigned)-1 ? 0 : test_key(type, to, to_key);
+  const uint8_t* found[ORDERED_ROWS];
+  uint32_t found_lens[ORDERED_ROWS];
+  const void* cursor = 0;
+  uint32_t cursor_len = 0;
+  unsigned got = index_range(index, from_key, from_len, to_key, to_len, limit, found, found_lens,
+                             &cursor, &cursor_len);
+  CHECK(got == count);
+  for (unsigned j = 0; j < count && j < got; ++j) {
+    CHECK(found[j] == arena_get_ptr(arena, frames[first + j]));
+    CHECK(found_lens[j] == arena_get_frame_len(arena, frames[first + j]));
+  }
+  if (next == (unsigned)-1) {
+    CHECK(cursor_len == 0);
+  } else {
+    char key[64];
+    uint32_t len = test_key(type, 3 * next + 1, key);
+    CHECK(cursor_len == len && cursor && memcmp(cursor, key, len) == 0);
+  }
+}
+
+static void test_ordered_ranges(ConfigIndexType type) {
+  Index* index = test_ordered_build(type);
+  if (!index) return;
+  unsigned none = (unsigned)-1;
+  test_ordered_range(index, type, 10, 20, 100, 3, 4, none);
+  test_ordered_range(index, type, 10, 19, 100, 3, 4, none);
+  test_ordered_range(index, type, 11, 18, 100, 4, 2, none);
+  // Pages follow the cursor of the previous one.
+  test_ordered_range(index, type, 10, 20, 2, 3, 2, 5);
+  test_ordered_range(index, type, 16, 20, 2, 5, 2, none);
+  test_ordered_range(index, type, 10, 20, 0, 3, 0, 3);
+  // Open ends.
+  test_ordered_range(index, type, none, 4, 100, 0, 2, none);
+  test_ordered_range(index, type, 295, none, 100, 98, 2, none);
+  test_ordered_range(index, type, none, none, 10, 0, 10, 10);
+  // Empty ranges: between keys, reversed, and past either end.
+  test_ordered_range(index, type, 2, 3, 100, 0, 0, none);
+  test_ordered_range(index, type, 20, 10, 100, 0, 0, none);
+  test_ordered_range(index, type, 299, 1000, 100, 0, 0, none);
+  test_ordered_range(index, type, none, 0, 100, 0, 0, none);
+  index_destroy(index);
+}
+
+// Scan the keys with a prefix from a key, and count them.
+static unsigned test_ordered_prefix(Index* index, const char* prefix, const char* from, unsigned limit,
+                                    const void** cursor, uint32_t* cursor_len) {
+  const uint8_t* found[ORDERED_ROWS];
+  uint32_t found_lens[ORDERED_ROWS];
+  return index_prefix(index, prefix, strlen(prefix), from, from ? strlen(from) : 0, limit,
+                      found, found_lens, cursor, cursor_len);
+}
+
+static void test_ordered_prefixes(void) {
+  Index* index = test_ordered_build(CONFIG_INDEX_TYPE_STRING);
+  if (!index) return;
+  const void* cursor = 0;
+  uint32_t len = 0;
+  CHECK(test_ordered_prefix(index, "row-0000001", 0, 100, &cursor, &len) == 4);
+  CHECK(len == 0);
+  CHECK(test_ordered_prefix(index, "row-0000001", 0, 3, &cursor, &len) == 3);
+  CHECK(len && memcmp(cursor, "row-00000019.example.com", len) == 0);
+  CHECK(test_ordered_prefix(index, "row-0000001", "row-00000019.example.com", 3, &cursor, &len) == 1);
+  CHECK(len == 0);
+  // Prefixes longer than the 8 bytes kept next to each key.
+  CHECK(test_ordered_prefix(index, "row-00000016.ex", 0, 100, &cursor, &len) == 1);
+  CHECK(test_ordered_prefix(index, "row-00000016.example.com", 0, 100, &cursor, &len) == 1);
+  CHECK(test_ordered_prefix(index, "row-00000016.example.com.", 0, 100, &cursor, &len) == 0);
+  CHECK(test_ordered_prefix(index, "row-00000017", 0, 100, &cursor, &len) == 0);
+  // Short and empty prefixes.
+  CHECK(test_ordered_prefix(index, "r", 0, 100, &cursor, &len) == 100);
+  CHECK(test_ordered_prefix(index, "", 0, 10, &cursor, &len) == 10);
+  CHECK(len != 0);
+  CHECK(test_ordered_prefix(index, "s", 0, 100, &cursor, &len) == 0);
+  CHECK(test_ordered_prefix(index, "a", 0, 100, &cursor, &len) == 0);
+  // A from key past all the keys with the prefix.
+  CHECK(test_ordered_prefix(index, "row-0000001", "row-00000020", 100, &cursor, &len) == 0);
+  index_destroy(index);
+}
+
+// Bounds that are not keys of the index, and indexes that cannot scan.
+static void test_ordered_invalid(void) {
+  const uint8_t* found[1];
+  uint32_t found_lens[1];
+  const void* cursor = 0;
+  uint32_t len = 0;
+  Index* index = test_ordered_build(CONFIG_INDEX_TYPE_INT);
+  if (!index) return;
+  CHECK(index_range(index, "abc", 3, 0, 0, 1, found, found_lens, &cursor, &len) == (unsigned)-1);
+  CHECK(index_range(index, 0, 0, "abcde", 5, 1, found, found_lens, &cursor, &len) == (unsigned)-1);
+  CHECK(index_prefix(index, "a", 1, 0, 0, 1, found, found_lens, &cursor, &len) == (unsigned)-1);
+  index_destroy(index);
+
+  index = index_build(CONFIG_INDEX_ENGINE_HASH, CONFIG_INDEX_TYPE_STRING, 1, arena);
+  CHECK(index != 0);
+  if (!index) return;
+  CHECK(index_range(index, 0, 0, 0, 0, 1, found, found_lens, &cursor, &len) == (unsigned)-1);
+  CHECK(index_prefix(index, "a", 1, 0, 0, 1, found, found_lens, &cursor, &len) == (unsigned)-1);
+  index_destroy(index);
+}
+
+int main(void) {
+  test_unique_index(CONFIG_INDEX_ENGINE_ORDERED, CONFIG_INDEX_TYPE_INT, 1000, 0);
+  test_unique_index(CONFIG_INDEX_ENGINE_ORDERED, CONFIG_INDEX_TYPE_STRING, 1000, 0);
+  test_unique_index(CONFIG_INDEX_ENGINE_ORDERED, CONFIG_INDEX_TYPE_STRING, 1, 0);
+
+  arena = arena_build(1024);
+  for (unsigned n = 0; n < ORDERED_ROWS; ++n) frames[n] = test_frame(arena, n);
+  test_ordered_ranges(CONFIG_INDEX_TYPE_INT);
+  test_ordered_ranges(CONFIG_INDEX_TYPE_STRING);
+  test_ordered_prefixes();
+  test_ordered_invalid();
+  arena_destroy(arena);
+  return test_result("ordered");
+}
@@ -0,0 +1,87 @@
+#include "test.h"
+#include "postings.h"
+
+enum {
+  POSTINGS_ROWS = 300,
+  POSTINGS_KEYS = 7,      // row n has key n % 7, plus one key for row 0 alone
+};
+
+// Every key maps to all its rows in row order, and the first of them is what
+// a plain lookup returns.
+static void test_postings(ConfigIndexType type) {
+  Arena* arena = arena_build(1024);
+  Index* index = index_build(CONFIG_INDEX_ENGINE_POSTINGS, type, POSTINGS_ROWS, arena);
+  CHECK(index != 0);
+  if (!index) return;
+  unsigned frames[POSTINGS_ROWS];
+  char key[64];
+  for (unsigned n = 0; n < POSTINGS_ROWS; ++n) {
+    frames[n] = test_frame(arena, n);
+    uint32_t len = test_key(type, n % POSTINGS_KEYS, key);
+    CHECK(index_insert(index, key, len, frames[n], arena_get_frame_len(arena, frames[n])));
+  }
+  uint32_t alone_len = test_key(type, 1000, key);
+  CHECK(index_insert(index, key, alone_len, frames[0], arena_get_frame_len(arena, frames[0])));
+  CHECK(index_finalize(index, frames, POSTINGS_ROWS));
+  CHECK(index_used(index) == POSTINGS_KEYS + 1);
+
+  for (unsigned k = 0; k < POSTINGS_KEYS; ++k) {
+    uint32_t len = test_key(type, k, key);
+    const unsigned* found = 0;
+    unsigned bytes = 0;
+    unsigned count = index_get_all(index, key, len, &found, &bytes);
+    CHECK(count == (POSTINGS_ROWS - k + POSTINGS_KEYS - 1) / POSTINGS_KEYS);
+    unsigned total = 0;
+    for (unsigned j = 0; j < count; ++j) {
+      CHECK(found[j] == frames[k + j * POSTINGS_KEYS]);
+      total += arena_get_frame_len(arena, found[j]);
+    }
+    CHECK(bytes == total);
+    uint32_t frame_len = 0;
+    CHECK(index_get(index, key, len, &frame_len) == frames[k]);
+    CHECK(frame_len == arena_get_frame_len(arena, frames[k]));
+  }
+
+  const unsigned* found = 0;
+  unsigned bytes = 0;
+  alone_len = test_key(type, 1000, key);
+  CHECK(index_get_all(index, key, alone_len, &found, &bytes) == 1);
+  CHECK(found && found[0] == frames[0]);
+  CHECK(bytes == arena_get_frame_len(arena, frames[0]));
+
+  // Keys no row has.
+  uint32_t frame_len = 0;
+  uint32_t len = test_key(type, POSTINGS_KEYS, key);
+  CHECK(index_get_all(index, key, len, &found, &bytes) == 0);
+  CHECK(bytes == 0);
+  CHECK(index_get(index, key, len, &frame_len) == (unsigned)-1);
+  CHECK(index_get_all(index, "", 0, &found, &bytes) == 0);
+
+  // A batch returns the first row of each key.
+  char keys[POSTINGS_KEYS + 1][64];
+  const void* key_ptrs[POSTINGS_KEYS + 1];
+  uint32_t key_lens[POSTINGS_KEYS + 1];
+  unsigned firsts[POSTINGS_KEYS + 1];
+  uint32_t first_lens[POSTINGS_KEYS + 1];
+  for (unsigned k = 0; k <= POSTINGS_KEYS; ++k) {
+    key_ptrs[k] = keys[k];
+    key_lens[k] = test_key(type, k, keys[k]);
+  }
+  index_get_batch(index, POSTINGS_KEYS + 1, key_ptrs, key_lens, firsts, first_lens);
+  for (unsigned k = 0; k < POSTINGS_KEYS; ++k) CHECK(firsts[k] == frames[k]);
+  CHECK(firsts[POSTINGS_KEYS] == (unsigned)-1 && first_lens[POSTINGS_KEYS] == 0);
+
+  index_destroy(index);
+
+  // Other indexes do not list rows.
+  index = index_build(CONFIG_INDEX_ENGINE_HASH, type, 1, arena);
+  CHECK(index && index_get_all(index, key, len, &found, &bytes) == (unsigned)-1);
+  index_destroy(index);
+  arena_destroy(arena);
+}
+
+int main(void) {
+  test_postings(CONFIG_INDEX_TYPE_INT);
+  test_postings(CONFIG_INDEX_TYPE_STRING);
+  return test_result("postings");
+}
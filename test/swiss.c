@@ -0,0 +1,36 @@
+#include "test.h"
+#include "swiss.h"
+
+// A table filled up to its limit still resolves every key, and refuses more.
+static void test_swiss_groups(void) {
+  Arena* arena = arena_build(1024);
+  Swiss* swiss = swiss_build(SWISS_GROUP_WIDTH / 2, arena);
+  CHECK(swiss && swiss->cap >= SWISS_GROUP_WIDTH);
+  if (!swiss) return;
+  unsigned frames[SWISS_GROUP_WIDTH];
+  char key[64];
+  unsigned stored = 0;
+  while (stored < SWISS_GROUP_WIDTH && swiss->used < swiss->cap - swiss->cap / 8) {
+    frames[stored] = test_frame(arena, stored);
+    uint32_t len = test_key(CONFIG_INDEX_TYPE_STRING, stored, key);
+    CHECK(swiss_insert(swiss, key, len, frames[stored], arena_get_frame_len(arena, frames[stored])));
+    ++stored;
+  }
+  uint32_t len = test_key(CONFIG_INDEX_TYPE_STRING, stored, key);
+  CHECK(!swiss_insert(swiss, key, len, 0, 0));
+  for (unsigned n = 0; n < stored; ++n) {
+    len = test_key(CONFIG_INDEX_TYPE_STRING, n, key);
+    const SwissSlot* slot = swiss_get(swiss, key, len);
+    CHECK(slot && slot->frame_idx == frames[n]);
+  }
+  swiss_destroy(swiss);
+  arena_destroy(arena);
+}
+
+int main(void) {
+  test_unique_index(CONFIG_INDEX_ENGINE_SWISS, CONFIG_INDEX_TYPE_INT, 1000, 0);
+  test_unique_index(CONFIG_INDEX_ENGINE_SWISS, CONFIG_INDEX_TYPE_STRING, 1000, 0);
+  test_unique_index(CONFIG_INDEX_ENGINE_SWISS, CONFIG_INDEX_TYPE_STRING, 1, 0);
+  test_swiss_groups();
+  return test_result("swiss");
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+// Helpers shared by the tests run by `make check`.  Each test program runs its
+// checks, printing the ones that fail, and exits with a non-zero status if any
+// of them did.  Index tests store their rows as preframed values in an Arena,
+// the way a table slot does, and look them up by keys built from a row number.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "arena.h"
+#include "hash.h"
+#include "index.h"
+
+static unsigned test_failures;
+
+#define CHECK(cond) \
+  do { \
+    if (!(cond)) { \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      ++test_failures; \
+    } \
+  } while (0)
+
+static inline int test_result(const char* name) {
+  printf("%s: %s\n", name, test_failures ? "FAILED" : "OK");
+  return test_failures ? 1 : 0;
+}
+
+// Store the value of a row, {"n":<number>}, and return its arena index.
+static inline unsigned test_frame(Arena* arena, unsigned number) {
+  char value[64];
+  int len = snprintf(value, sizeof(value), "{\"n\":%u}", number);
+  return arena_store_framed(arena, (const uint8_t*) value, (unsigned) len);
+}
+
+// Write the key of a row number into buf and return its length: the number
+// itself for int indexes, or a string long enough not to fit in a bucket.
+static inline uint32_t test_key(ConfigIndexType type, unsigned number, char* buf) {
+  if (type == CONFIG_INDEX_TYPE_INT) {
+    memcpy(buf, &number, sizeof(unsigned));
+    return sizeof(unsigned);
+  }
+  return (uint32_t) sprintf(buf, "row-%08u.example.com", number);
+}
+
+// Check an engine over unique keys: count rows are stored with keys 3n+1, and
+// all of them are found, while the numbers around them are not.  A key inserted
+// a second time keeps the row it was first inserted with.  With a factor, the
+// index is then made dense, as the loader does for int keys, and must be.
+static inline void test_unique_index(ConfigIndexEngine engine, ConfigIndexType type, unsigned count,
+                                     unsigned factor) {
+  Arena* arena = arena_build(1024);
+  Index* index = index_build(engine, type, count, arena);
+  CHECK(arena && index);
+  if (!arena || !index) return;
+
+  unsigned* frames = calloc(count + 1, sizeof(unsigned));
+  char key[64];
+  for (unsigned n = 0; n < count; ++n) {
+    frames[n] = test_frame(arena, n);
+    uint32_t len = test_key(type, 3 * n + 1, key);
+    CHECK(index_insert(index, key, len, frames[n], arena_get_frame_len(arena, frames[n])));
+  }
+  frames[count] = test_frame(arena, count);
+  uint32_t dup_len = test_key(type, 1, key);
+  CHECK(index_insert(index, key, dup_len, frames[count], arena_get_frame_len(arena, frames[count])));
+  CHECK(index_finalize(index, frames, count + 1));
+  if (factor) {
+    CHECK(index_densify(index, factor));
+    CHECK(index->engine == CONFIG_INDEX_ENGINE_DENSE);
+  }
+  CHECK(index_used(index) >= count);
+
+  for (unsigned n = 0; n < count; ++n) {
+    uint32_t frame_len = 0;
+    uint32_t len = test_key(type, 3 * n + 1, key);
+    CHECK(index_get(index, key, len, &frame_len) == frames[n]);
+    CHECK(frame_len == arena_get_frame_len(arena, frames[n]));
+    CHECK(index_peek(index, key, len, &frame_len) == frames[n]);
+    len = test_key(type, 3 * n + 2, key);
+    CHECK(index_get(index, key, len, &frame_len) == (unsigned)-1);
+    len = test_key(type, 3 * n + 3, key);
+    CHECK(index_peek(index, key, len, &frame_len) == (unsigned)-1);
+  }
+  uint32_t frame_len = 0;
+  CHECK(index_get(index, "", 0, &frame_len) == (unsigned)-1);
+  CHECK(index_get(index, "row-", 4, &frame_len) == (unsigned)-1);
+
+  // Lookups are counted once per get, and not at all by peeks.
+  const struct HashStats* stats = index_stats(index);
+  CHECK(!stats || stats->queries == 2 * count + 2);
+
+  // A batch returns hits and misses in request order.
+  enum { BATCH = 3 * HASH_BATCH_GROUP + 5 };
+  char keys[BATCH][64];
+  const void* key_ptrs[BATCH];
+  uint32_t key_lens[BATCH];
+  unsigned found[BATCH];
+  uint32_t found_lens[BATCH];
+  for (unsigned j = 0; j < BATCH; ++j) {
+    key_ptrs[j] = keys[j];
+    key_lens[j] = test_key(type, j * 7 % (3 * count), keys[j]);
+  }
+  index_get_batch(index, BATCH, key_ptrs, key_lens, found, found_lens);
+  for (unsigned j = 0; j < BATCH; ++j) {
+    unsigned number = j * 7 % (3 * count);
+    unsigned expected = number % 3 == 1 ? frames[number / 3] : (unsigned)-1;
+    CHECK(found[j] == expected);
+    CHECK(found_lens[j] == (expected == (unsigned)-1 ? 0 : arena_get_frame_len(arena, expected)));
+  }
+
+  free(frames);
+  index_destroy(index);
+  arena_destroy(arena);
+}